@@ -12,6 +12,8 @@
 #include <cpsw_api_builder.h>
 #include <cpsw_mmio_dev.h>
 
+#include <string.h>
+
 #define CPSW_TRY_CATCH(X)       try {   \
         (X);                            \
     } catch (CPSWError &e) {            \
@@ -48,6 +50,78 @@ if(_type == bsss) { printf("(%s:%d %s) is only for BLD\n", __FILE__, __LINE__, _
 
 using namespace AcqService;
 
+static uint32_t destSel(uint32_t mode, uint32_t dest_mask)
+{
+    return (mode<<DEST_MODE_BITLOC) | (DEST_MASK & dest_mask);
+}
+
+static uint32_t fixedRateSel(uint32_t rate)
+{
+    return (RATE_FIXED<<RATE_MODE_BITLOC)
+           | (RATE_FIXED_MASK & rate);
+}
+
+static uint32_t acRateSel(uint32_t ts_mask, uint32_t rate)
+{
+    return (RATE_AC<<RATE_MODE_BITLOC)
+           | (RATE_AC_TS_MASK & ts_mask) << RATE_AC_TS_BITLOC
+           | (RATE_AC_MASK & rate);
+}
+
+static uint32_t seqRateSel(uint32_t seq_num, uint32_t seq_bit)
+{
+    return (RATE_SEQ<<RATE_MODE_BITLOC)
+           | (RATE_SEQ_NUM_MASK & seq_num) << RATE_SEQ_NUM_BITLOC
+           | (RATE_SEQ_MASK & seq_bit);
+}
+
+AcqServiceConfig::AcqServiceConfig()
+{
+    for(int i = 0; i < MAX_EDEFS; i++) {
+        edefEnable[i]    = 0;
+        edefRateLimit[i] = 0;
+        edefRateSel[i]   = fixedRateSel(0);
+        edefDestSel[i]   = destSel(DEST_DISABLE, 0);
+    }
+    channelMask = 0;
+    channelSevr = 0;
+    packetSize  = 0;
+    enable      = 0;
+}
+
+void AcqServiceConfig::setDestInclusion(int chn, uint32_t dest_mask) { edefDestSel[chn] = destSel(DEST_INCLUSION, dest_mask); }
+void AcqServiceConfig::setDestExclusion(int chn, uint32_t dest_mask) { edefDestSel[chn] = destSel(DEST_EXCLUSION, dest_mask); }
+void AcqServiceConfig::setDestDisable(int chn)                       { edefDestSel[chn] = destSel(DEST_DISABLE, 0); }
+void AcqServiceConfig::setFixedRate(int chn, uint32_t rate)          { edefRateSel[chn] = fixedRateSel(rate); }
+void AcqServiceConfig::setACRate(int chn, uint32_t ts_mask, uint32_t rate)     { edefRateSel[chn] = acRateSel(ts_mask, rate); }
+void AcqServiceConfig::setSeqRate(int chn, uint32_t seq_num, uint32_t seq_bit) { edefRateSel[chn] = seqRateSel(seq_num, seq_bit); }
+void AcqServiceConfig::setRateLimit(int chn, uint32_t rate_limit)    { edefRateLimit[chn] = rate_limit; }
+void AcqServiceConfig::setRateLimit(uint32_t rate_limit)             { edefRateLimit[0] = rate_limit; }
+void AcqServiceConfig::setEdefEnable(int chn, uint32_t enable)       { edefEnable[chn] = enable? 1: 0; }
+
+void AcqServiceConfig::setChannelSevr(int chn, uint64_t sevr)
+{
+    channelSevr &= ~((uint64_t(0x3)) << (chn*2));
+    channelSevr |= ((uint64_t(0x3) & sevr) << (chn*2));
+}
+
+void AcqServiceConfig::setChannelSevr(uint64_t sevr)                 { channelSevr = sevr; }
+
+void AcqServiceConfig::setChannelMask(int chn, uint32_t enable)
+{
+    channelMask &= ~(0x1 << chn);
+    channelMask |= (enable?0x1:0x0) << chn;
+}
+
+void AcqServiceConfig::setChannelMask(uint32_t mask)                 { channelMask = mask; }
+void AcqServiceConfig::setPacketSize(uint32_t size)                  { packetSize = size; }
+void AcqServiceConfig::enablePacket(uint32_t enable)                 { this->enable = enable? 1: 0; }
+
+AcqServiceSnapshot::AcqServiceSnapshot()
+{
+    memset(this, 0, sizeof(*this));
+}
+
 AcqServiceYaml::AcqServiceYaml(Path AcqService_path, uint32_t edef_num, serviceType_t type)
 {
     // Make sure no overflow will occur
@@ -69,8 +143,15 @@ AcqServiceYaml::AcqServiceYaml(Path AcqService_path, uint32_t edef_num, serviceT
     _diagnStrobeRate = IScalVal_RO::create(_path->findByName("diagnStrobeRate"));
     _eventSel0Rate   = IScalVal_RO::create(_path->findByName("eventSel0Rate"));
 
-    _edef_num = edef_num;
-    _type     = type;
+    // severity filtering is not present in every firmware
+    try {
+        _channelSevr = IScalVal::create(_path->findByName("channelSevr"));
+    } catch (CPSWError &e) {
+    }
+
+    _edef_num    = edef_num;
+    _type        = type;
+    _shadowValid = false;
 
 }
 
@@ -124,26 +205,73 @@ void AcqServiceYaml::getEventSel0Rate(uint32_t *rate)
     CPSW_TRY_CATCH(_eventSel0Rate->getVal(rate));
 }
 
+//
+//  Events in a full packet: the first event carries the header
+//  (see BldStream.hh and BsssStream.hh for the packet formats)
+//
+static unsigned eventsPerPacket(serviceType_t type, const AcqServiceConfig& c)
+{
+    unsigned nchn  = __builtin_popcount(c.channelMask);
+    unsigned first = (type == bld) ? 7+nchn : 7+nchn+2;
+    unsigned next  = (type == bld) ? 3+nchn : 3+nchn+2;
+    return c.packetSize < first ? 0 : 1 + (c.packetSize-first)/next;
+}
+
+void AcqServiceYaml::snapshot(AcqServiceSnapshot *snapshot)
+{
+    AcqServiceSnapshot& s = *snapshot;
+
+    try {
+        _currPacketSize ->getVal(&s.currPacketSize);
+        _currPacketState->getVal(&s.currPacketState);
+        _currPulseIdL   ->getVal(&s.currPulseIdL);
+        _currTimeStampL ->getVal(&s.currTimeStampL);
+        _currDelta      ->getVal(&s.currDelta);
+        _packetCount    ->getVal(&s.packetCount);
+        _paused         ->getVal(&s.paused);
+        _diagnClockRate ->getVal(&s.diagnClockRate);
+        _diagnStrobeRate->getVal(&s.diagnStrobeRate);
+        _eventSel0Rate  ->getVal(&s.eventSel0Rate);
+    } catch (CPSWError &e) {
+        fprintf(stderr, "CPSW Error: %s at %s, line %d\n",
+                e.getInfo().c_str(), __FILE__, __LINE__);
+        throw e;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &s.time);
+
+    s.interval   = 0;
+    s.packetRate = 0;
+    s.eventRate  = 0;
+    if(_lastSnapshot.time.tv_sec || _lastSnapshot.time.tv_nsec) {
+        s.interval = double(s.time.tv_sec - _lastSnapshot.time.tv_sec) +
+                     1.e-9*(double(s.time.tv_nsec) - double(_lastSnapshot.time.tv_nsec));
+        if(s.interval > 0)   // counter difference is modulo 2^32
+            s.packetRate = double(uint32_t(s.packetCount - _lastSnapshot.packetCount)) / s.interval;
+        if(_shadowValid)
+            s.eventRate  = s.packetRate * double(eventsPerPacket(_type, _shadow));
+    }
+    _lastSnapshot = s;
+}
 
 void AcqServiceYaml::setDestInclusion(int chn, uint32_t dest_mask)
 {
     BLD_ONLY();
-    uint32_t destSel = (DEST_INCLUSION<<DEST_MODE_BITLOC) | (DEST_MASK & dest_mask);
-    CPSW_TRY_CATCH(_EdefDestSel[chn]->setVal(destSel));
+    _shadow.setDestInclusion(chn, dest_mask);
+    CPSW_TRY_CATCH(_EdefDestSel[chn]->setVal(_shadow.edefDestSel[chn]));
 }
 
 void AcqServiceYaml::setDestExclusion(int chn, uint32_t dest_mask)
 {
     BLD_ONLY();
-    uint32_t destSel = (DEST_EXCLUSION<<DEST_MODE_BITLOC) | (DEST_MASK & dest_mask);
-    CPSW_TRY_CATCH(_EdefDestSel[chn]->setVal(destSel));
+    _shadow.setDestExclusion(chn, dest_mask);
+    CPSW_TRY_CATCH(_EdefDestSel[chn]->setVal(_shadow.edefDestSel[chn]));
 }
 
 void AcqServiceYaml::setDestDisable(int chn)
 {
     BLD_ONLY();
-    uint32_t destSel = (DEST_DISABLE<<DEST_MODE_BITLOC);
-    CPSW_TRY_CATCH(_EdefDestSel[chn]->setVal(destSel));
+    _shadow.setDestDisable(chn);
+    CPSW_TRY_CATCH(_EdefDestSel[chn]->setVal(_shadow.edefDestSel[chn]));
 }
 
 
@@ -151,44 +279,42 @@ void AcqServiceYaml::setFixedRate(int chn, uint32_t rate)
 {
 
     BLD_ONLY();
-    uint32_t rateSel = (RATE_FIXED<<RATE_MODE_BITLOC)
-                       | (RATE_FIXED_MASK & rate);
-    CPSW_TRY_CATCH(_EdefRateSel[chn]->setVal(rateSel));
+    _shadow.setFixedRate(chn, rate);
+    CPSW_TRY_CATCH(_EdefRateSel[chn]->setVal(_shadow.edefRateSel[chn]));
 }
 
 void AcqServiceYaml::setACRate(int chn, uint32_t ts_mask, uint32_t rate)
 {
     BLD_ONLY();
-    uint32_t rateSel = (RATE_AC<<RATE_MODE_BITLOC)
-                       | (RATE_AC_TS_MASK & ts_mask) << RATE_AC_TS_BITLOC
-                       | (RATE_AC_MASK & rate);
-    CPSW_TRY_CATCH(_EdefRateSel[chn]->setVal(rateSel));
+    _shadow.setACRate(chn, ts_mask, rate);
+    CPSW_TRY_CATCH(_EdefRateSel[chn]->setVal(_shadow.edefRateSel[chn]));
 }
 
 void AcqServiceYaml::setSeqRate(int chn, uint32_t seq_num, uint32_t seq_bit)
 {
     BLD_ONLY();
-    uint32_t rateSel = (RATE_SEQ<<RATE_MODE_BITLOC)
-                       | (RATE_SEQ_NUM_MASK & seq_num) << RATE_SEQ_NUM_BITLOC
-                       | (RATE_SEQ_MASK & seq_bit);
-    CPSW_TRY_CATCH(_EdefRateSel[chn]->setVal(rateSel));
+    _shadow.setSeqRate(chn, seq_num, seq_bit);
+    CPSW_TRY_CATCH(_EdefRateSel[chn]->setVal(_shadow.edefRateSel[chn]));
 }
 
 void AcqServiceYaml::setRateLimit(int chn, uint32_t rate_limit)
 {
     BLD_ONLY();
+    _shadow.setRateLimit(chn, rate_limit);
     CPSW_TRY_CATCH(_EdefRateLimit[chn]->setVal(rate_limit));
 }
 
 void AcqServiceYaml::setRateLimit(uint32_t rate_limit)
 {
     BSSS_ONLY();
+    _shadow.setRateLimit(rate_limit);
     CPSW_TRY_CATCH(_EdefRateLimit[0]->setVal(rate_limit));
 }
 
 void AcqServiceYaml::setEdefEnable(int chn, uint32_t enable)
 {
     BLD_ONLY();
+    _shadow.setEdefEnable(chn, enable);
     CPSW_TRY_CATCH(_EdefEnable[chn]->setVal(enable?(uint32_t) 1: (uint32_t) 0));
 }
 
@@ -200,20 +326,24 @@ void AcqServiceYaml::setChannelMask(int chn, uint32_t enable)
     channelMask &= ~(0x1 << chn);                  /* clear mask */
     channelMask |= (0x1 & enable?0x1:0x0) << chn;  /* set mask */
     CPSW_TRY_CATCH(_channelMask->setVal(channelMask));
+    _shadow.channelMask = channelMask;
 }
 
 void AcqServiceYaml::setChannelMask(uint32_t mask)
 {
+    _shadow.setChannelMask(mask);
     CPSW_TRY_CATCH(_channelMask->setVal(mask));
 }
 
 void AcqServiceYaml::setPacketSize(uint32_t size)
 {
+    _shadow.setPacketSize(size);
     CPSW_TRY_CATCH(_packetSize->setVal(size));
 }
 
 void AcqServiceYaml::enablePacket(uint32_t enable)
 {
+    _shadow.enablePacket(enable);
     CPSW_TRY_CATCH(_enable->setVal(enable?(uint32_t) 1: (uint32_t) 0));
 }
 
@@ -222,5 +352,86 @@ uint32_t AcqServiceYaml::getEdefNum()
     return this->_edef_num;
 }
 
+#define CHANGED(field) (!_shadowValid || config.field != _shadow.field)
 
+unsigned AcqServiceYaml::apply(const AcqServiceConfig& config)
+{
+    unsigned nedef = (_type == bld) ? _edef_num : 0;
+    unsigned nwrites = 0;
+    bool     changed = CHANGED(channelMask) || CHANGED(packetSize) || CHANGED(edefRateLimit[0]);
+
+    if(_channelSevr && CHANGED(channelSevr)) changed = true;
+
+    for(unsigned i = 0; i < nedef && !changed; i++)
+        changed = CHANGED(edefEnable[i]) || CHANGED(edefRateLimit[i]) ||
+                  CHANGED(edefRateSel[i]) || CHANGED(edefDestSel[i]);
+
+    if(!changed) {
+        if(CHANGED(enable)) {
+            enablePacket(config.enable);
+            nwrites++;
+        }
+        return nwrites;
+    }
+
+    // hold off packets while the configuration is partially written
+    if(!_shadowValid || _shadow.enable) {
+        uint32_t disable = 0;
+        CPSW_TRY_CATCH(_enable->setVal(disable));
+        _shadow.enable = 0;
+        nwrites++;
+    }
+
+    bool valid   = _shadowValid;
+    _shadowValid = false;        // until all writes have succeeded
+
+    // write one register type at a time, in edef order
+    for(unsigned i = 0; i < nedef; i++)
+        if(!valid || config.edefRateSel[i] != _shadow.edefRateSel[i]) {
+            CPSW_TRY_CATCH(_EdefRateSel[i]->setVal(config.edefRateSel[i]));
+            nwrites++;
+        }
+    for(unsigned i = 0; i < nedef; i++)
+        if(!valid || config.edefDestSel[i] != _shadow.edefDestSel[i]) {
+            CPSW_TRY_CATCH(_EdefDestSel[i]->setVal(config.edefDestSel[i]));
+            nwrites++;
+        }
+    for(unsigned i = 0; i < nedef; i++)
+        if(!valid || config.edefRateLimit[i] != _shadow.edefRateLimit[i]) {
+            CPSW_TRY_CATCH(_EdefRateLimit[i]->setVal(config.edefRateLimit[i]));
+            nwrites++;
+        }
+    for(unsigned i = 0; i < nedef; i++)
+        if(!valid || config.edefEnable[i] != _shadow.edefEnable[i]) {
+            CPSW_TRY_CATCH(_EdefEnable[i]->setVal(config.edefEnable[i]? (uint32_t) 1: (uint32_t) 0));
+            nwrites++;
+        }
+
+    if(_type == bsss && (!valid || config.edefRateLimit[0] != _shadow.edefRateLimit[0])) {
+        CPSW_TRY_CATCH(_EdefRateLimit[0]->setVal(config.edefRateLimit[0]));
+        nwrites++;
+    }
+    if(!valid || config.channelMask != _shadow.channelMask) {
+        CPSW_TRY_CATCH(_channelMask->setVal(config.channelMask));
+        nwrites++;
+    }
+    if(_channelSevr && (!valid || config.channelSevr != _shadow.channelSevr)) {
+        CPSW_TRY_CATCH(_channelSevr->setVal(config.channelSevr));
+        nwrites++;
+    }
+    if(!valid || config.packetSize != _shadow.packetSize) {
+        CPSW_TRY_CATCH(_packetSize->setVal(config.packetSize));
+        nwrites++;
+    }
+
+    _shadow        = config;
+    _shadow.enable = 0;
+    _shadowValid   = true;
 
+    if(config.enable) {
+        enablePacket(config.enable);
+        nwrites++;
+    }
+
+    return nwrites;
+}
@@ -12,6 +12,7 @@
 
 #include <cpsw_api_builder.h>
 #include <stdint.h>
+#include <time.h>
 #include <vector>
 
 #define MAX_EDEFS 16
@@ -19,6 +20,68 @@
 namespace AcqService {
 typedef enum {bld = 0, bsss} serviceType_t;
 
+    // configuration of a whole BLD/BSSS service, applied with AcqServiceYaml::apply()
+    class AcqServiceConfig {
+        public:
+            AcqServiceConfig();
+
+            // channel number corresponds to the  BSSS EDEF, rate controls
+            void setDestInclusion(int chn, uint32_t dest_mask);
+            void setDestExclusion(int chn, uint32_t dest_mask);
+            void setDestDisable(int chn);
+            void setFixedRate(int chn, uint32_t rate);
+            void setACRate(int chn, uint32_t ts_mask, uint32_t rate);
+            void setSeqRate(int chn, uint32_t seq_num, uint32_t seq_bit);
+            void setRateLimit(int chn, uint32_t rate_limit);      // for BLD, per edef channel
+            void setRateLimit(uint32_t rate_limit);               // for BSSS, per module
+            void setEdefEnable(int chn, uint32_t enable);
+
+            // channel number correspnds to the BSSS data channels
+            void setChannelSevr(int chn, uint64_t sevr);
+            void setChannelSevr(uint64_t sevr);
+            void setChannelMask(int chn, uint32_t enable);
+            void setChannelMask(uint32_t enable);
+            void setPacketSize(uint32_t size);
+            void enablePacket(uint32_t enable);
+
+        public:
+            uint32_t edefEnable[MAX_EDEFS];
+            uint32_t edefRateLimit[MAX_EDEFS];       // BSSS uses the first entry for the module
+            uint32_t edefRateSel[MAX_EDEFS];
+            uint32_t edefDestSel[MAX_EDEFS];
+            uint32_t channelMask;
+            uint64_t channelSevr;
+            uint32_t packetSize;
+            uint32_t enable;
+    }; /* class AcqServiceConfig */
+
+    // diagnostics of a BLD/BSSS service, gathered with AcqServiceYaml::snapshot()
+    class AcqServiceSnapshot {
+        public:
+            AcqServiceSnapshot();
+
+        public:
+            timespec time;                           // host monotonic time when the registers were read
+            uint32_t currPacketSize;
+            uint32_t currPacketState;
+            uint32_t currPulseIdL;
+            uint32_t currTimeStampL;
+            uint32_t currDelta;
+            uint32_t packetCount;
+            uint32_t paused;
+            uint32_t diagnClockRate;
+            uint32_t diagnStrobeRate;
+            uint32_t eventSel0Rate;
+
+            // derived from the previous snapshot, zero for the first one
+            double   interval;                       // seconds since the previous snapshot
+            double   packetRate;                     // packets per second
+            // events per second if the packets are sent full (an upper bound
+            // when packets are closed early), from the applied configuration;
+            // zero if no configuration was applied
+            double   eventRate;
+    }; /* class AcqServiceSnapshot */
+
     class AcqServiceYaml {
         protected:
             AcqServiceYaml(Path path, uint32_t edefs, serviceType_t type);
@@ -56,6 +119,16 @@ typedef enum {bld = 0, bsss} serviceType_t;
             void enablePacket(uint32_t enable);
             uint32_t getEdefNum();
 
+            // write the registers which differ from the last applied configuration;
+            // packets are disabled while the changes are written.
+            // returns the number of register writes
+            unsigned apply(const AcqServiceConfig& config);
+            const AcqServiceConfig& applied() const { return _shadow; }
+
+            // read all diagnostics registers in one pass; each register is a
+            // separate field of the firmware's register map, so one transaction each
+            void snapshot(AcqServiceSnapshot *snapshot);
+
         protected:
             Path _path;
             uint32_t _edef_num;
@@ -84,6 +157,9 @@ typedef enum {bld = 0, bsss} serviceType_t;
 
         private:
            serviceType_t _type;
+           AcqServiceConfig _shadow;                 // last values written to the registers
+           bool _shadowValid;                        // all shadow values are known
+           AcqServiceSnapshot _lastSnapshot;         // previous snapshot for rate calculation
 
     }; /* class AcqServiceYaml */
 
@@ -17,20 +17,6 @@
 #include <TPG.hh>
 #include <TPGMini.hh>
 
-static uint64_t GET_U1(Path pre, unsigned nelms)
-{
-  uint64_t r=0;
-  ScalVal_RO s = IScalVal_RO::create( pre );
-  for(unsigned i=0; i<nelms; i++) {
-    IndexRange rng(i);
-    unsigned v;
-    s->getVal(&v,1,&rng);
-    if (v)
-      r |= 1ULL<<i;
-  }
-  return r;
-}
-
 static uint64_t GET_U1(ScalVal_RO s, unsigned nelms)
 {
   uint64_t r=0;
@@ -44,28 +30,26 @@ static uint64_t GET_U1(ScalVal_RO s, unsigned nelms)
   return r;
 }
 
-#define SET_REG(name,val) {                                             \
+#define SET_REG(id,val) {                                               \
     unsigned v(val);                                                    \
-    ScalVal s = IScalVal::create( _path->findByName(name) );     \
-    s->setVal(&v,1,&rng);                                               \
+    _regs.rw(id)->setVal(&v,1,&rng);                                    \
   }
 
-#define GET_REG(name,val) {                                             \
-    ScalVal s = IScalVal::create( _path->findByName(name) );     \
-    s->getVal(&val,1,&rng);                                             \
+#define GET_REG(id,val) {                                               \
+    _regs.ro(id)->getVal(&val,1,&rng);                                  \
   }
 
-#define SET_REGL(name,val) {                                            \
+#define SET_REGL(id,val) {                                              \
     uint64_t v(val);                                                    \
-    ScalVal s = IScalVal::create( _path->findByName(name) );     \
-    s->setVal(&v,1,&rng);                                               \
+    _regs.rw(id)->setVal(&v,1,&rng);                                    \
   }
 
-#define GET_REGL(name,val) {                                            \
-    ScalVal_RO s = IScalVal_RO::create( _path->findByName(name) ); \
-    s->getVal(&val,1,&rng);                                               \
+#define GET_REGL(id,val) {                                              \
+    _regs.ro(id)->getVal(&val,1,&rng);                                  \
   }
 
+static const char* ramPaths[] = { "mmio/control", "mmio/waveform0", "mmio/waveform1" };
+static const char* tpgPath    = "mmio/tpg";
 
 using namespace Bsa;
 
@@ -217,6 +201,7 @@ AmcCarrier::AmcCarrier(const char* ip, bool lTPG)
   _trAddr    = IScalVal_RO::create( _path->findByName("mmio/control/TriggerAddr") );
   _dram      = IScalVal_RO::create( _path->findByName("strm/dram") );
   _memEnd    = 0;
+  _regs.resolve(_path, ramPaths, tpgPath);
   //  pthread_t      thread_id;
   //  pthread_create(&thread_id, 0, poll_irq, (void*)this);
   printf("dram array is (%u,%llu)\n", _dram->getNelms(), _dram->getSizeBits());
@@ -246,6 +231,7 @@ AmcCarrier::AmcCarrier(Path path)
   _trAddr    = IScalVal_RO::create( _path->findByName("mmio/control/TriggerAddr") );
   _dram      = IScalVal_RO::create( _path->findByName("strm/dram") );
   _memEnd    = 0;
+  _regs.resolve(_path, ramPaths, tpgPath);
   printf("dram array is (%u,%llu)\n", _dram->getNelms(), _dram->getSizeBits());
 }
 
@@ -256,15 +242,15 @@ AmcCarrier::~AmcCarrier()
 unsigned AmcCarrier::nArrays   () const
 {
   unsigned v;
-  IScalVal_RO::create(_path->findByName("mmio/tpg/NArraysBsa"))->getVal(&v,1);
+  _regs.ro(TpgNArraysBsa)->getVal(&v,1);
   return v;
 }
 
 uint32_t AmcCarrier::doneRaw   () const
 {
   uint32_t done;
-  done  = (GET_U1(_path->findByName("mmio/waveform0/Done"),4)<<0)
-        | (GET_U1(_path->findByName("mmio/waveform1/Done"),4)<<4);
+  done  = (GET_U1(_regs.ro(Waveform0,Done),4)<<0)
+        | (GET_U1(_regs.ro(Waveform1,Done),4)<<4);
   return done;
 }
 
@@ -272,10 +258,10 @@ RingState AmcCarrier::ring     (unsigned array) const
 {
   RingState s;
   IndexRange rng(array);
-  Path path = _path->findByName(array<4 ? "mmio/waveform0" : "mmio/waveform1");
-  IScalVal_RO::create( path->findByName("StartAddr") )->getVal(&s.begAddr,1,&rng);
-  IScalVal_RO::create( path->findByName("EndAddr"  ) )->getVal(&s.endAddr,1,&rng);
-  IScalVal_RO::create( path->findByName("WrAddr"   ) )->getVal(&s.nxtAddr,1,&rng);
+  RamBlock b = waveform(array);
+  _regs.ro(b,StartAddr)->getVal(&s.begAddr,1,&rng);
+  _regs.ro(b,EndAddr  )->getVal(&s.endAddr,1,&rng);
+  _regs.ro(b,WrAddr   )->getVal(&s.nxtAddr,1,&rng);
   return s;
 }
 
@@ -285,7 +271,7 @@ void     AmcCarrier::initRaw   (unsigned index,
 {
   const uint64_t BlockMask = (0x1ULL<<12)-1;  // Buffers must be in blocks of 4kB
 
-  Path path = _path->findByName(index<4 ? "mmio/waveform0" : "mmio/waveform1");
+  RamBlock b = waveform(index);
     
   //  Setup the waveform memory
   uint64_t p = _memEnd;
@@ -293,23 +279,23 @@ void     AmcCarrier::initRaw   (unsigned index,
   uint32_t one(1), zero(0), mode(doneWhenFull ? 1:0);
   IndexRange rng(index%4);
   printf("Setup waveform memory %i %llx:%llx\n", index, p,pn);
-  IScalVal::create( path->findByName("StartAddr"))->setVal(&p   ,1,&rng);
-  IScalVal::create( path->findByName("EndAddr"  ))->setVal(&pn  ,1,&rng);
-  IScalVal::create( path->findByName("Enabled"  ))->setVal(&one ,1,&rng);
-  IScalVal::create( path->findByName("Mode"     ))->setVal(&mode,1,&rng);
-  IScalVal::create( path->findByName("Init"     ))->setVal(&one ,1,&rng);
-  IScalVal::create( path->findByName("Init"     ))->setVal(&zero,1,&rng);
+  _regs.rw(b,StartAddr)->setVal(&p   ,1,&rng);
+  _regs.rw(b,EndAddr  )->setVal(&pn  ,1,&rng);
+  _regs.rw(b,Enabled  )->setVal(&one ,1,&rng);
+  _regs.rw(b,Mode     )->setVal(&mode,1,&rng);
+  _regs.rw(b,Init     )->setVal(&one ,1,&rng);
+  _regs.rw(b,Init     )->setVal(&zero,1,&rng);
   _memEnd = pn;
 }
 
 void     AmcCarrier::rearm(unsigned index)
 {
   uint32_t one(1), zero(0), mode(1);
-  Path path = _path->findByName(index<4 ? "mmio/waveform0" : "mmio/waveform1");
+  RamBlock b = waveform(index);
   IndexRange rng(index%4);
-  IScalVal::create( path->findByName("Mode"     ))->setVal(&mode,1,&rng);
-  IScalVal::create( path->findByName("Init"     ))->setVal(&one ,1,&rng);
-  IScalVal::create( path->findByName("Init"     ))->setVal(&zero,1,&rng);
+  _regs.rw(b,Mode     )->setVal(&mode,1,&rng);
+  _regs.rw(b,Init     )->setVal(&one ,1,&rng);
+  _regs.rw(b,Init     )->setVal(&zero,1,&rng);
 }
 
 void     AmcCarrier::start     (unsigned array,
@@ -323,8 +309,8 @@ void     AmcCarrier::start     (unsigned array,
   _sCmpl->setVal(&cmpl,1);
   
   IndexRange rng(array);
-  SET_REG("mmio/tpg/BsaEventSel",(2<<29)|(rate&0xf));
-  SET_REG("mmio/tpg/BsaStatSel" ,(nacq<<16)|(naccum&0x1fff)|((sevr&0x3)<<14));
+  SET_REG(TpgBsaEventSel,(2<<29)|(rate&0xf));
+  SET_REG(TpgBsaStatSel ,(nacq<<16)|(naccum&0x1fff)|((sevr&0x3)<<14));
 }
 
 void     AmcCarrier::start     (unsigned   array,
@@ -339,8 +325,8 @@ void     AmcCarrier::start     (unsigned   array,
   _sCmpl->setVal(&cmpl,1);
   
   IndexRange rng(array);
-  SET_REG("mmio/tpg/BsaEventSel",(unsigned(beam)<<13) | (unsigned(rate)<<0));
-  SET_REG("mmio/tpg/BsaStatSel" ,(nacq<<16)|(naccum&0x1fff)|((sevr&0x3)<<14));
+  SET_REG(TpgBsaEventSel,(unsigned(beam)<<13) | (unsigned(rate)<<0));
+  SET_REG(TpgBsaStatSel ,(nacq<<16)|(naccum&0x1fff)|((sevr&0x3)<<14));
 }
 
 void     AmcCarrier::poll      (AmcCarrierCallback& cb)
@@ -364,8 +350,8 @@ void     AmcCarrier::poll      (AmcCarrierCallback& cb)
 void     AmcCarrier::clear     (unsigned array)
 {
   IndexRange rng(array);
-  SET_REG ("mmio/control/Init"     , 1);
-  SET_REG ("mmio/control/Init"     , 0);
+  SET_REG (regId(BsaBuffers,Init), 1);
+  SET_REG (regId(BsaBuffers,Init), 0);
 }
 
 void     AmcCarrier::dump      () const
@@ -397,26 +383,29 @@ void     AmcCarrier::dump      () const
   printf("\n");
 
   for(unsigned i=0; i<NArrays; i++) {
-    _printBuffer(_path->findByName("mmio/control"),
-                 _tstamp, i, done, full, empty, error);
+    _printBuffer(BsaBuffers, _tstamp, i, done, full, empty, error);
   }
 
-  done  = GET_U1(_path->findByName("mmio/waveform0/Done"),4);
-  full  = GET_U1(_path->findByName("mmio/waveform0/Full"),4);
-  empty = GET_U1(_path->findByName("mmio/waveform0/Empty"),4);
+  done  = GET_U1(_regs.ro(Waveform0,Done ),4);
+  full  = GET_U1(_regs.ro(Waveform0,Full ),4);
+  empty = GET_U1(_regs.ro(Waveform0,Empty),4);
 
   for(unsigned i=0; i<4; i++) {
-    _printBuffer(_path->findByName("mmio/waveform0"),i, done, full, empty, error);
+    _printBuffer(Waveform0,i, done, full, empty, error);
   }
 
-  done  = GET_U1(_path->findByName("mmio/waveform1/Done"),4);
-  full  = GET_U1(_path->findByName("mmio/waveform1/Full"),4);
-  empty = GET_U1(_path->findByName("mmio/waveform1/Empty"),4);
+  done  = GET_U1(_regs.ro(Waveform1,Done ),4);
+  full  = GET_U1(_regs.ro(Waveform1,Full ),4);
+  empty = GET_U1(_regs.ro(Waveform1,Empty),4);
 
   for(unsigned i=0; i<4; i++) {
-    _printBuffer(_path->findByName("mmio/waveform1"),i, done, full, empty, error);
+    _printBuffer(Waveform1,i, done, full, empty, error);
   }
 
+  printf("Register lookups %llu  cache hits %llu\n",
+         (unsigned long long)_regs.lookups(),
+         (unsigned long long)_regs.hits());
+
   _path->dump(stderr);
 }
 
@@ -40,9 +40,6 @@ namespace Bsa {
   public:
     //  BSA buffers
     unsigned nArrays   () const;
-    Record*  get       (unsigned array,
-                        uint64_t begin,
-                        uint64_t* next) const;
 
     void     dump      () const;
   public:
@@ -70,10 +67,6 @@ namespace Bsa {
     void     clear     (unsigned array);
   public:
     void     handleIrq ();
-  private:
-    void     _fill     (void*    dst,
-                        uint64_t begin,
-                        uint64_t end) const;
   private:
     ScalVal    _sCmpl;
     ScalVal_RO _sStat;
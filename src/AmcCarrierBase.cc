@@ -9,33 +9,19 @@
 //////////////////////////////////////////////////////////////////////////////
 #include "AmcCarrierBase.hh"
 #include "BsaDefs.hh"
+#include "BsaLog.hh"
+#include "BsaTrace.hh"
+#include "BsaCapture.hh"
+#include "DramLayout.hh"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <syslog.h>
+#include <time.h>
 
 using namespace Bsa;
 
-//#define BURSTSIZE 0x800
-//#define DBUG
-
-#ifdef DBUG
-static const uint64_t BSASIZE_U   = 1<<8;
-static const uint64_t BSASIZE_L   = 1ULL<<8;
-#else
-static const uint64_t BSASIZE_U   = 1<<15;
-static const uint64_t BSASIZE_L   = 1ULL<<15;
-#endif
-static const unsigned FAULTSIZE   = 1<<20;
-static const uint64_t FAULTSIZE_L = 1ULL<<20;
-
-static char* timestr() 
-{
-  time_t t = time(NULL);
-  char* v = asctime(localtime(&t));
-  *strchr(v,'\n')=0; // strip the carriage return
-  return v;
-}
-
 static uint64_t GET_U1(ScalVal_RO s, unsigned nelms)
 {
   uint64_t r=0;
@@ -49,79 +35,198 @@ static uint64_t GET_U1(ScalVal_RO s, unsigned nelms)
   return r;
 }
 
-AmcCarrierBase::AmcCarrierBase() : _state(HSTARRAYN), _record(FAULTSIZE)
+//
+//  Register accesses, recorded while the tracer is open
+//
+template <class S, class T>
+static inline void _get(TraceTarget t, const S& s, T* v, unsigned n, IndexRange* rng=0)
 {
+  TraceScope scope(t, rng ? rng->getFrom() : 0, n*sizeof(T));
+  s->getVal(v, n, rng);
+  scope.completed();
+  if (BsaCapture::enabled())
+    BsaCapture::regs(t, rng ? rng->getFrom() : 0, n, v);
 }
 
-void     AmcCarrierBase::initialize()
+template <class S, class T>
+static inline void _set(TraceTarget t, const S& s, T* v, unsigned n, IndexRange* rng=0)
 {
-  uint64_t p=0,pn=0,pe=0;
-  uint32_t uzro=0,uone=1;
+  TraceScope scope(t, rng ? rng->getFrom() : 0, n*sizeof(T), TraceWrite);
+  s->setVal(v, n, rng);
+  scope.completed();
+}
 
-  //  Setup the standard BSA arrays (32k entries)
-  //  Must be a multiple of bsaSize and burstSize(2kB)
-  const uint64_t bsaSize = 3ULL<<7;  // one entry
+AmcCarrierBase::AmcCarrierBase() : _state(HSTARRAYN), _record(DramLayout::FaultEntries)
+{
+  //  BSA_TRACE=<file>[,<records>] records the transactions
+  const char* trace = getenv("BSA_TRACE");
+  if (trace && !BsaTrace::enabled()) {
+    char path[256];
+    strncpy(path, trace, sizeof(path)-1);
+    path[sizeof(path)-1] = 0;
+    char* sep = strchr(path, ',');
+    if (sep) {
+      *sep = 0;
+      BsaTrace::open(path, strtoul(sep+1, NULL, 0));
+    }
+    else
+      BsaTrace::open(path);
+  }
+}
+
+//
+//  Take the array bounds from a plan
+//
+void     AmcCarrierBase::_layout(const DramLayout& plan)
+{
   _begin.resize(HSTARRAYN);
   _end  .resize(HSTARRAYN);
-  for(unsigned i=0; i<NBSAARRAYS; i++) {
-    pn = p+BSASIZE_L*bsaSize;
-    //    pe = pn - BURSTSIZE;
-    pe = pn;
-    _begin[i] = p;
-    _end  [i] = pe;
-    IndexRange rng(i);
-    _startAddr->setVal(&p   ,1,&rng);
-    _endAddr  ->setVal(&pe  ,1,&rng);
-    _sEnabled ->setVal(&uone,1,&rng);
-    _sMode    ->setVal(&uzro,1,&rng);
-    _sInit    ->setVal(&uone,1,&rng);
-    _sInit    ->setVal(&uzro,1,&rng);
-    syslog(LOG_DEBUG,"<D>  array %u  startAddr 0x%09llx  endAddr 0x%09llx",
-           i, p, pe);
-    p = pn;
+  for(unsigned i=0; i<HSTARRAYN; i++) {
+    _begin[i] = plan.begin(i);
+    _end  [i] = plan.end  (i);
   }
-  //  Setup the fault arrays to be LARGER (1M entries)
-  for(unsigned i=HSTARRAY0; i<HSTARRAYN; i++) {
-    pn = p+FAULTSIZE_L*bsaSize;
-    //    pe = pn - BURSTSIZE;
-    pe = pn;
-    _begin[i] = p;
-    _end  [i] = pe;
-    IndexRange rng(i);
-    _startAddr->setVal(&p   ,1,&rng);
-    _endAddr  ->setVal(&pe  ,1,&rng);
-    _sEnabled ->setVal(&uone,1,&rng);
-    _sMode    ->setVal(&uzro,1,&rng);
-    _sInit    ->setVal(&uone,1,&rng);
-    _sInit    ->setVal(&uzro,1,&rng);
-    syslog(LOG_DEBUG,"<D>  array %u  startAddr 0x%09llx  endAddr 0x%09llx",
-           i, p, pe);
-    p = pn;
+  _memEnd = plan.memEnd();
+  _reserve();
+}
+
+//
+//  A fetch must not reallocate the record (outside the prefault), so it
+//  holds the largest array in the layout
+//
+void     AmcCarrierBase::_reserve()
+{
+  uint64_t nmax = 0;
+  for(unsigned i=0; i<_begin.size(); i++)
+    if (_end[i] > _begin[i] && (_end[i]-_begin[i])/sizeof(Entry) > nmax)
+      nmax = (_end[i]-_begin[i])/sizeof(Entry);
+  _record.entries.reserve(nmax);
+}
+
+uint64_t AmcCarrierBase::_dramSize() const
+{
+  return _dram ? uint64_t(_dram->getNelms())*(_dram->getSizeBits()/8) : 0;
+}
+
+//
+//  Setup the standard BSA arrays (32k entries)
+//  and the fault arrays to be LARGER (1M entries)
+//
+void     AmcCarrierBase::_defaultLayout()
+{
+  _layout(DramLayout());
+}
+
+//
+//  BSA_LAYOUT=<arrays>=<entries>|<rate>hz,...[,hold=<seconds>]
+//  resizes arrays from the standard layout
+//
+void     AmcCarrierBase::initialize()
+{
+  DramLayout plan;
+  const char* spec = getenv("BSA_LAYOUT");
+  if (spec && !(plan.configure(spec) && plan.plan(0, _dramSize()))) {
+    syslog(LOG_ERR,"<E> AmcCarrierBase: BSA_LAYOUT %s rejected, using the standard layout", spec);
+    plan = DramLayout();
   }
+  initialize(plan);
+}
+
+void     AmcCarrierBase::initialize(const DramLayout& plan)
+{
+  timespec tv_begin;
+  clock_gettime(CLOCK_MONOTONIC,&tv_begin);
 
-  _memEnd = p;
+  //  Build the buffer tables in host memory and write them with ranged
+  //  array transactions rather than one register access per array
+  uint64_t startAddr[HSTARRAYN];
+  uint64_t endAddr  [HSTARRAYN];
+  uint32_t uzro     [HSTARRAYN];
+  uint32_t uone     [HSTARRAYN];
+
+  _layout(plan);
+  for(unsigned i=0; i<HSTARRAYN; i++) {
+    startAddr[i] = _begin[i];
+    endAddr  [i] = _end  [i];
+    uzro[i] = 0;
+    uone[i] = 1;
+    BsaLog::post(LogArrayLayout, i, _begin[i], _end[i]);
+  }
+
+  IndexRange rng(0,HSTARRAYN-1);
+  _set(TraceStartAddr, _startAddr, startAddr,HSTARRAYN,&rng);
+  _set(TraceEndAddr, _endAddr, endAddr  ,HSTARRAYN,&rng);
+  _set(TraceEnabled, _sEnabled, uone     ,HSTARRAYN,&rng);
+  _set(TraceMode, _sMode, uzro     ,HSTARRAYN,&rng);
+  //  Pulse init on all arrays at once
+  _set(TraceInit, _sInit, uone     ,HSTARRAYN,&rng);
+  _set(TraceInit, _sInit, uzro     ,HSTARRAYN,&rng);
+
+  if (BsaCapture::enabled())
+    BsaCapture::layout(_begin, _end);
+
+  timespec tv_end;
+  clock_gettime(CLOCK_MONOTONIC,&tv_end);
+  double dt = double(tv_end.tv_sec-tv_begin.tv_sec) +
+    1.e-9*(double(tv_end.tv_nsec)-double(tv_begin.tv_nsec));
+
+  //  Per-array initialization took 6 single-element writes per array;
+  //  time one (rewriting the mode of array 0) to estimate what they cost
+  IndexRange rng0(0);
+  clock_gettime(CLOCK_MONOTONIC,&tv_begin);
+  _set(TraceMode, _sMode, uzro, 1, &rng0);
+  clock_gettime(CLOCK_MONOTONIC,&tv_end);
+  double ds = double(tv_end.tv_sec-tv_begin.tv_sec) +
+    1.e-9*(double(tv_end.tv_nsec)-double(tv_begin.tv_nsec));
+
+  const unsigned nlegacy = 6*HSTARRAYN;
+  const unsigned nbatch  = 6;
+  BsaLog::post(LogInitialized, LogNoArray, nbatch, uint64_t(1.e6*dt),
+               uint64_t(1.e6*ds), nlegacy, uint64_t(1.e6*ds*nlegacy));
+}
+
+void     AmcCarrierBase::layout()
+{
+  uint64_t startAddr[HSTARRAYN];
+  uint64_t endAddr  [HSTARRAYN];
+  IndexRange rng(0,HSTARRAYN-1);
+  _get(TraceStartAddr, _startAddr, startAddr,HSTARRAYN,&rng);
+  _get(TraceEndAddr, _endAddr, endAddr  ,HSTARRAYN,&rng);
+
+  _begin.resize(HSTARRAYN);
+  _end  .resize(HSTARRAYN);
+  _memEnd = 0;
+  for(unsigned i=0; i<HSTARRAYN; i++) {
+    _begin[i] = startAddr[i];
+    _end  [i] = endAddr  [i];
+    if (_end[i] > _memEnd)
+      _memEnd = _end[i];
+  }
+  _reserve();
+
+  if (BsaCapture::enabled())
+    BsaCapture::layout(_begin, _end);
 }
 
 void     AmcCarrierBase::reset     (unsigned array)
 {
   IndexRange rng(array);
   uint32_t uzro=0,uone=1;
-  _sInit    ->setVal(&uone,1,&rng);
-  _sInit    ->setVal(&uzro,1,&rng);
+  _set(TraceInit, _sInit, &uone,1,&rng);
+  _set(TraceInit, _sInit, &uzro,1,&rng);
 }
 
 void     AmcCarrierBase::ackClear  (unsigned array)
 {
   uint32_t   uzro=0;
   IndexRange rng(array);
-  _sClear->setVal(&uzro,1,&rng);
+  _set(TraceClear, _sClear, &uzro,1,&rng);
 }
 
 uint64_t AmcCarrierBase::inprogress() const
 {
   uint64_t r=0;
   unsigned v[64];
-  _sEmpt->getVal(v,HSTARRAYN);
+  _get(TraceEmpty, _sEmpt, v,HSTARRAYN);
   for(unsigned i=0; i<HSTARRAYN; i++) {
     if (!v[i])
       r |= 1ULL<<i;
@@ -134,7 +239,7 @@ uint64_t AmcCarrierBase::done      () const
   uint64_t r=0;
   uint32_t v[HSTARRAYN];
   memset(v,0,HSTARRAYN*sizeof(uint32_t));
-  _sStatus->getVal(v,HSTARRAYN);
+  _get(TraceStatus, _sStatus, v,HSTARRAYN);
   for(unsigned i=0; i<HSTARRAYN; i++) {
     if (v[i]&4)
       r |= 1ULL<<i;
@@ -147,7 +252,7 @@ bool AmcCarrierBase::done      (unsigned array) const
 {
   IndexRange rng(array);
   unsigned v;
-  _sDone->getVal(&v,1,&rng);
+  _get(TraceDone, _sDone, &v,1,&rng);
 
   return v;
 }
@@ -156,7 +261,7 @@ uint32_t AmcCarrierBase::status    (unsigned array) const
 {
   uint32_t v;
   IndexRange rng(array);
-  _sDone->getVal(&v,1,&rng);
+  _get(TraceDone, _sDone, &v,1,&rng);
   return v;
 }
 
@@ -164,21 +269,25 @@ ArrayState AmcCarrierBase::state   (unsigned array) const
 {
   ArrayState s;
   IndexRange rng(array);
-  _tstamp->getVal(&s.timestamp,1,&rng);
-  _wrAddr->getVal(&s.wrAddr   ,1,&rng);
-  _sClear->getVal(&s.clear    ,1,&rng);
-  _sFull ->getVal(&s.wrap     ,1,&rng);
+  _get(TraceTimestamp, _tstamp, &s.timestamp,1,&rng);
+  _get(TraceWrAddr, _wrAddr, &s.wrAddr   ,1,&rng);
+  _get(TraceClear, _sClear, &s.clear    ,1,&rng);
+  _get(TraceFull, _sFull, &s.wrap     ,1,&rng);
   return s;
 }
 
 const std::vector<ArrayState>& AmcCarrierBase::state()
 {
+  //  Each poll of all arrays starts a round of the capture
+  if (BsaCapture::enabled())
+    BsaCapture::poll();
+
   uint64_t tstamp[HSTARRAYN];
   uint64_t wrAddr[HSTARRAYN];
   unsigned clear [HSTARRAYN];
-  _tstamp->getVal(tstamp,HSTARRAYN);
-  _sClear->getVal(clear ,HSTARRAYN);
-  _wrAddr->getVal(wrAddr,HSTARRAYN);
+  _get(TraceTimestamp, _tstamp, tstamp,HSTARRAYN);
+  _get(TraceClear, _sClear, clear ,HSTARRAYN);
+  _get(TraceWrAddr, _wrAddr, wrAddr,HSTARRAYN);
   for(unsigned i=0; i<HSTARRAYN; i++) {
     _state[i].timestamp = tstamp[i];
     _state[i].clear     = clear [i];
@@ -221,42 +330,64 @@ uint8_t*  AmcCarrierBase::getBuffer (uint64_t begin,
 Record*  AmcCarrierBase::get       (unsigned array,
                                     uint64_t begin,
                                     uint64_t* next) const
+{
+  Record*   record;
+  BsaStatus s = fetch(array, begin, next, &record);
+  if (s != BsaOk)
+    throw(statusText(s));
+  return record;
+}
+
+BsaStatus AmcCarrierBase::fetch     (unsigned  array,
+                                     uint64_t  begin,
+                                     uint64_t* next,
+                                     Record**  precord) const
+{
+  uint64_t   tstamp, wrAddr;
+  unsigned   wrap=0;
+  IndexRange rng(array);
+  _get(TraceTimestamp, _tstamp, &tstamp,1,&rng);
+  _get(TraceWrAddr   , _wrAddr, &wrAddr,1,&rng);
+  _get(TraceFull     , _sFull , &wrap  ,1,&rng);
+  return _fetch(array, begin, tstamp, wrAddr, wrap, next, precord);
+}
+
+//
+//  The fetch from the array's registers
+//
+BsaStatus AmcCarrierBase::_fetch    (unsigned  array,
+                                     uint64_t  begin,
+                                     uint64_t  tstamp,
+                                     uint64_t  wrAddr,
+                                     unsigned  wrap,
+                                     uint64_t* next,
+                                     Record**  precord) const
 {
   Record& record = _record;
   record.buffer = array;
 
   uint64_t start=_begin[array];
   uint64_t last =  _end[array];
-  uint64_t end;
-  unsigned wrap=0;
+  uint64_t end  = wrAddr;
+  //  The most entries the array was planned to hold
+  uint64_t capacity = (last-start)/sizeof(Entry);
   {
-    uint64_t v;
-    IndexRange rng(array);
-    _tstamp->getVal(&v,1,&rng);
-    
-    record.time_secs  = v>>32;
-    record.time_nsecs = v&0xffffffff;
+    record.time_secs  = tstamp>>32;
+    record.time_nsecs = tstamp&0xffffffff;
 
     if (begin < start || begin > last) { // This is an error
-      syslog(LOG_ERR,"<E> %s  %s:%-4d [Begin out of bounds]  begin 0x%09llx  startAddr 0x%09llx  endAddr 0x%09llx",
-             timestr(),__FILE__,__LINE__,begin,start,last);
-      throw("fetch begin out of bounds");
+      BsaLog::post(LogBeginOutOfBounds, array, begin, start, last);
+      return _status(BsaBeginOutOfBounds);
     }
 
-    _wrAddr->getVal(&end,1,&rng);
-
     if (end < start or end > last) {
-      syslog(LOG_ERR,"<E> %s  %s:%-4d [End out of bounds]  wrAddr 0x%09llx  startAddr 0x%09llx  endAddr 0x%09llx",
-             timestr(),__FILE__,__LINE__,end,start,last);
-      throw("fetch end out of bounds");
+      BsaLog::post(LogEndOutOfBounds, array, end, start, last);
+      return _status(BsaEndOutOfBounds);
     }
 
-    _sFull->getVal(&wrap     ,1,&rng);
-
     if (end == begin && end == start && !wrap) {  // Trap a common error
-      syslog(LOG_ERR,"<E> %s  %s:%-4d [No data to read]  wrAddr 0x%09llx",
-             timestr(),__FILE__,__LINE__,end);
-      throw("fetch no data to read");
+      BsaLog::post(LogNoData, array, end);
+      return _status(BsaNoData);
     }
 
     if (end <= begin /*&& wrap*/) {
@@ -264,15 +395,12 @@ Record*  AmcCarrierBase::get       (unsigned array,
       unsigned entries = nb/sizeof(Entry);
 
       if(!wrap) {
-        syslog(LOG_ERR,"<E> %s  %s:%-4d [Wrap flag issue] reading %u entries (array (%u), begin 0x%09llx, end 0x%09llx)",
-               timestr(),__FILE__,__LINE__, entries, array, begin, end);
-        throw("Wrap flag issue");
+        BsaLog::post(LogWrapFlag, array, entries, begin, end);
+        return _status(BsaWrapFlag);
       }
-      if ((array <  HSTARRAY0 && entries > BSASIZE_U) ||
-          (array >= HSTARRAYN && entries > FAULTSIZE)) {
-        syslog(LOG_ERR,"<E> %s  %s:%-4d [oversize] reading %u entries (array (%u), begin 0x%09llx, end 0x%09llx)",
-               timestr(),__FILE__,__LINE__, entries, array, begin, end);
-        throw("Entries > MAXSIZE");
+      if (entries > capacity) {
+        BsaLog::post(LogOversize, array, entries, begin, end);
+        return _status(BsaOversize);
       }
       end += sizeof(Entry)*entries - nb;
       record.entries.resize( entries );
@@ -285,11 +413,9 @@ Record*  AmcCarrierBase::get       (unsigned array,
     }
     else {
       unsigned entries = (end -begin)/sizeof(Entry);
-      if ((array <  HSTARRAY0 && entries > BSASIZE_U) ||
-          (array >= HSTARRAYN && entries > FAULTSIZE)) {
-        syslog(LOG_ERR,"<E> %s  %s:%-4d [oversize] reading %u entries (array (%u), begin 0x%09llx, end 0x%09llx)",
-               timestr(),__FILE__,__LINE__, entries, array, begin, end);
-        throw("Entries > MAXSIZE");
+      if (entries > capacity) {
+        BsaLog::post(LogOversize, array, entries, begin, end);
+        return _status(BsaOversize);
       }
       if (entries) {
         end = begin+entries*sizeof(Entry);
@@ -301,15 +427,17 @@ Record*  AmcCarrierBase::get       (unsigned array,
     }
   }
 
-  *next = end;
+  *next    = end;
+  *precord = &record;
 
-  return &record;
+  return _status(BsaOk);
 }
 
 void AmcCarrierBase::_fill(void*    dst,
                            uint64_t begin,
                            uint64_t end) const
 {
+  const uint64_t first = begin, last = end;
   begin >>= 3;
   end   >>= 3;
 
@@ -322,9 +450,15 @@ void AmcCarrierBase::_fill(void*    dst,
     if (rng.getTo() >= int64_t(end))
       rng.setTo( end-1 );
     
-    _dram->getVal( &p[rng.getFrom()-begin], BLOCK_SIZE, &rng );
+    { TraceScope scope(TraceDram, uint64_t(rng.getFrom())<<3,
+                       (rng.getTo()-rng.getFrom()+1)<<3);
+      _dram->getVal( &p[rng.getFrom()-begin], BLOCK_SIZE, &rng );
+      scope.completed(); }
     ++rng;
   }
+
+  if (BsaCapture::enabled())
+    BsaCapture::dram(first, last, dst);
 }
 
 static void printAddr(const Path& path, const char* name, IndexRange& rng) {
@@ -342,6 +476,20 @@ static void printAddr(const Path& path, const char* name, IndexRange& rng) {
 	}
 }
 
+static void printAddr(ScalVal_RO s, const char* name, IndexRange& rng) {
+	uint64_t v;
+	try {
+		s->getVal(&v, 1, &rng);
+		printf("%09llx ", (unsigned long long)(v));
+	}
+	catch(const CPSWError& e) {
+		printf("%s print failed: %s\n", name, e.getInfo().c_str());
+	}
+	catch(...) {
+		printf("%s print failed: unknown error\n", name);
+	}
+}
+
 void AmcCarrierBase::_printBuffer(Path path, ScalVal_RO ts, unsigned i,
                                   uint64_t done , uint64_t full, 
                                   uint64_t empty, uint64_t error) const
@@ -384,3 +532,45 @@ void AmcCarrierBase::_printBuffer(Path path, unsigned i,
 
 }
 
+
+void AmcCarrierBase::_printBuffer(RamBlock b, ScalVal_RO ts, unsigned i,
+                                  uint64_t done , uint64_t full, 
+                                  uint64_t empty, uint64_t error) const
+{
+    IndexRange rng(i);
+    printf("%4.4x ",i);
+    printAddr(_regs.ro(b,StartAddr  ), "StartAddr", rng); 
+    printAddr(_regs.ro(b,EndAddr    ), "EndAddr", rng);
+    printAddr(_regs.ro(b,WrAddr     ), "WrAddr", rng);
+    printAddr(_regs.ro(b,TriggerAddr), "TriggerAddr", rng);
+    uint64_t tstamp;
+    ts->getVal(&tstamp,1,&rng);
+    printf("%10.10u.%09u ",unsigned(tstamp>>32),unsigned(tstamp&0xffffffff));
+
+    printf("%4.4s ", (done &(1ULL<<i)) ? "X": "-");
+    printf("%4.4s ", (full &(1ULL<<i)) ? "X": "-");
+    printf("%4.4s ", (empty&(1ULL<<i)) ? "X": "-");
+    printf("%4.4s ", (error&(1ULL<<i)) ? "X": "-");
+    printf("\n");
+
+}
+
+void AmcCarrierBase::_printBuffer(RamBlock b, unsigned i,
+                                  uint64_t done , uint64_t full, 
+                                  uint64_t empty, uint64_t error) const
+{
+    IndexRange rng(i);
+    printf("%4.4x ",i);
+    printAddr(_regs.ro(b,StartAddr  ), "StartAddr", rng); 
+    printAddr(_regs.ro(b,EndAddr    ), "EndAddr", rng);
+    printAddr(_regs.ro(b,WrAddr     ), "WrAddr", rng);
+    printAddr(_regs.ro(b,TriggerAddr), "TriggerAddr", rng);
+    printf("%20.20s ", "-");
+
+    printf("%4.4s ", (done &(1ULL<<i)) ? "X": "-");
+    printf("%4.4s ", (full &(1ULL<<i)) ? "X": "-");
+    printf("%4.4s ", (empty&(1ULL<<i)) ? "X": "-");
+    printf("%4.4s ", (error&(1ULL<<i)) ? "X": "-");
+    printf("\n");
+
+}
@@ -16,31 +16,62 @@
 #include <vector>
 
 #include <BsaDefs.hh>
+#include <RegisterCache.hh>
 
 namespace Bsa {
+  class DramLayout;
+
   class AmcCarrierBase {
   public:
     AmcCarrierBase();
     virtual ~AmcCarrierBase() {}
   public:
     //  BSA buffers
+    //  (the hardware accesses are virtual so that they may be served remotely)
+    //  Fetch the entries of an array from begin to its write pointer
+    virtual BsaStatus fetch    (unsigned  array,
+                                uint64_t  begin,
+                                uint64_t* next,
+                                Record**  record) const;
+    //  As fetch, but throws the status text on error
     Record*  get       (unsigned array,
                         uint64_t begin,
                         uint64_t* next) const;
-  private:
-    void     _fill     (void*    dst,
-                        uint64_t begin,
-                        uint64_t end) const;
+  protected:
+    //  The bounds checks and copy of fetch, given the array's registers
+    BsaStatus        _fetch    (unsigned  array,
+                                uint64_t  begin,
+                                uint64_t  tstamp,
+                                uint64_t  wrAddr,
+                                unsigned  wrap,
+                                uint64_t* next,
+                                Record**  record) const;
+    virtual void     _fill     (void*    dst,
+                                uint64_t begin,
+                                uint64_t end) const;
+    //  The standard partition of DRAM among the arrays
+    void             _defaultLayout();
+    //  The partition of a plan
+    void             _layout   (const DramLayout&);
+    //  Bytes of DRAM (0 where the carrier has no DRAM field)
+    uint64_t         _dramSize () const;
+    //  Reserve the record for a fetch of the largest array
+    void             _reserve  ();
   public:
-    void     initialize();
-    void     reset     (unsigned array);
-    void     ackClear  (unsigned array);
-    uint64_t inprogress() const;
-    uint64_t done      () const;
-    bool     done      (unsigned array) const;
-    uint32_t status    (unsigned array) const;
-    ArrayState state   (unsigned array) const;
-    const std::vector<ArrayState>& state   ();
+    //  Program the layout planned from BSA_LAYOUT and enable the arrays
+    virtual void     initialize();
+    //  Program a planned layout and enable the arrays
+    virtual void     initialize(const DramLayout&);
+    //  Read the buffer layout set by another process's initialize()
+    virtual void     layout    ();
+    virtual void     reset     (unsigned array);
+    virtual void     ackClear  (unsigned array);
+    virtual uint64_t inprogress() const;
+    virtual uint64_t done      () const;
+    virtual bool     done      (unsigned array) const;
+    virtual uint32_t status    (unsigned array) const;
+    virtual ArrayState state   (unsigned array) const;
+    virtual const std::vector<ArrayState>& state   ();
 
     Record*  getRecord (unsigned array) const;
     Record*  getRecord (unsigned array,
@@ -50,13 +81,23 @@ namespace Bsa {
     uint8_t* getBuffer (uint64_t begin,
                         uint64_t end  ) const;
     virtual  RingState ring  (unsigned array) const = 0;
+    const RegisterCache& registers() const { return _regs; }
+    //  Results of fetch by category
+    const StatusCounts&  errors   () const { return _errors; }
   protected:
+    BsaStatus _status(BsaStatus s) const { _errors.count(s); return s; }
     void    _printBuffer(Path path, ScalVal_RO ts, unsigned i,
                          uint64_t done , uint64_t full, 
                          uint64_t empty, uint64_t error) const;
     void    _printBuffer(Path path, unsigned i,
                          uint64_t done , uint64_t full, 
                          uint64_t empty, uint64_t error) const;
+    void    _printBuffer(RamBlock b, ScalVal_RO ts, unsigned i,
+                         uint64_t done , uint64_t full, 
+                         uint64_t empty, uint64_t error) const;
+    void    _printBuffer(RamBlock b, unsigned i,
+                         uint64_t done , uint64_t full, 
+                         uint64_t empty, uint64_t error) const;
   protected:
     std::vector<ArrayState> _state;
     std::vector<uint64_t>   _begin;
@@ -83,9 +124,13 @@ namespace Bsa {
     ScalVal_RO _trAddr;
     ScalVal_RO _dram;
     uint64_t   _memEnd;
+    RegisterCache _regs;
+    mutable StatusCounts _errors;
 
     friend class Reader;
     friend class ProcessorImpl;
+    friend class AmcCarrierBroker;
+    friend class RawCapture;
   };
 };
 
@@ -0,0 +1,646 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "AmcCarrierBroker.hh"
+
+#include <cpsw_api_user.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+using namespace Bsa;
+
+static uint64_t monotonicUs()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return uint64_t(ts.tv_sec)*1000000ULL + ts.tv_nsec/1000;
+}
+
+static void unixAddress(sockaddr_un& addr, const char* path)
+{
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+}
+
+//
+//  Broker side of a client connection
+//
+class AmcCarrierBroker::Client {
+public:
+  Client(int fd, size_t size) : fd(fd), shmFd(-1), shm(0), size(size), sentShm(false)
+  {
+    //  The buffer is unlinked at once; it is passed to the client by descriptor
+    char name[64];
+    static unsigned _nclients = 0;
+    snprintf(name, sizeof(name), "/bsa_broker.%d.%u", getpid(), _nclients++);
+    shmFd = shm_open(name, O_CREAT|O_EXCL|O_RDWR, 0600);
+    if (shmFd < 0)
+      throw(std::string("AmcCarrierBroker: shm_open failed"));
+    shm_unlink(name);
+    void* p = MAP_FAILED;
+    if (ftruncate(shmFd, size) == 0)
+      p = mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, shmFd, 0);
+    if (p == MAP_FAILED) {
+      ::close(shmFd);
+      throw(std::string("AmcCarrierBroker: shared buffer allocation failed"));
+    }
+    shm = reinterpret_cast<char*>(p);
+  }
+  ~Client()
+  {
+    munmap(shm, size);
+    if (shmFd >= 0)
+      ::close(shmFd);
+    ::close(fd);
+  }
+public:
+  int    fd;
+  int    shmFd;
+  char*  shm;
+  size_t size;
+  bool   sentShm;
+};
+
+AmcCarrierBroker::AmcCarrierBroker(AmcCarrierBase& hw,
+                                   const char*     path,
+                                   size_t          shmSize,
+                                   unsigned        cacheUs) :
+  _hw        (hw),
+  _path      (path),
+  _shmSize   (shmSize&~7ULL),
+  _cacheUs   (cacheUs),
+  _fd        (-1),
+  _stop      (false),
+  _owner     (0),
+  _round     (0),
+  _done      (0),
+  _inprogress(0),
+  _requests  (0),
+  _accesses  (0),
+  _cacheHits (0),
+  _errors    (0)
+{
+  _invalidate();
+
+  //  The buffer tables and array states must fit in the shared buffer
+  if (_shmSize < HSTARRAYN*sizeof(ArrayState) ||
+      _shmSize < 2*HSTARRAYN*sizeof(uint64_t))
+    throw(std::string("AmcCarrierBroker: shared buffer too small"));
+
+  _fd = ::socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (_fd < 0) {
+    syslog(LOG_ERR,"<E> AmcCarrierBroker: socket failed: %s", strerror(errno));
+    throw(std::string("AmcCarrierBroker: socket failed"));
+  }
+
+  //  The directory of the socket, if missing
+  std::string dir(path);
+  size_t sep = dir.rfind('/');
+  if (sep != std::string::npos && sep > 0) {
+    dir.resize(sep);
+    if (::mkdir(dir.c_str(), 0770) < 0 && errno != EEXIST)
+      syslog(LOG_ERR,"<E> AmcCarrierBroker: mkdir %s failed: %s", dir.c_str(), strerror(errno));
+  }
+
+  //  Restricted to the broker's user and group before anyone may connect
+  sockaddr_un addr;
+  unixAddress(addr, path);
+  ::unlink(path);
+  if (::bind(_fd, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+      ::chmod(path, 0660) < 0 ||
+      ::listen(_fd, 16) < 0) {
+    syslog(LOG_ERR,"<E> AmcCarrierBroker: bind/listen %s failed: %s", path, strerror(errno));
+    ::close(_fd);
+    throw(std::string("AmcCarrierBroker: bind failed"));
+  }
+}
+
+AmcCarrierBroker::~AmcCarrierBroker()
+{
+  for(unsigned i=0; i<_clients.size(); i++)
+    delete _clients[i];
+  ::close(_fd);
+  ::unlink(_path.c_str());
+}
+
+void AmcCarrierBroker::stop() { _stop = true; }
+
+void AmcCarrierBroker::run()
+{
+  std::vector<pollfd> pfd;
+  while(!_stop) {
+    pfd.resize(1+_clients.size());
+    pfd[0].fd     = _fd;
+    pfd[0].events = POLLIN;
+    for(unsigned i=0; i<_clients.size(); i++) {
+      pfd[i+1].fd     = _clients[i]->fd;
+      pfd[i+1].events = POLLIN;
+    }
+
+    int n = ::poll(&pfd[0], pfd.size(), 100);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      syslog(LOG_ERR,"<E> AmcCarrierBroker: poll failed: %s", strerror(errno));
+      break;
+    }
+    if (n == 0)
+      continue;
+
+    //  Requests read in the same round share the array state reads
+    _round++;
+
+    for(unsigned i=_clients.size(); i>0; i--) {
+      if (!pfd[i].revents)
+        continue;
+      if (!_serve(*_clients[i-1])) {
+        if (_clients[i-1] == _owner) {
+          syslog(LOG_INFO,"<I> AmcCarrierBroker: owner disconnected");
+          _owner = 0;
+        }
+        delete _clients[i-1];
+        _clients.erase(_clients.begin()+i-1);
+      }
+    }
+
+    if (pfd[0].revents & POLLIN)
+      _accept();
+  }
+}
+
+void AmcCarrierBroker::_accept()
+{
+  int fd = ::accept(_fd, 0, 0);
+  if (fd < 0) {
+    syslog(LOG_ERR,"<E> AmcCarrierBroker: accept failed: %s", strerror(errno));
+    return;
+  }
+
+  //  Only root and the broker's user or group may use the carrier
+  ucred     cred;
+  memset(&cred, 0, sizeof(cred));
+  socklen_t len = sizeof(cred);
+  if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 ||
+      (cred.uid != 0 && cred.uid != ::geteuid() && cred.gid != ::getegid())) {
+    syslog(LOG_WARNING,"<W> AmcCarrierBroker: refused pid %d uid %u gid %u",
+           int(cred.pid), unsigned(cred.uid), unsigned(cred.gid));
+    ::close(fd);
+    return;
+  }
+  try {
+    _clients.push_back(new Client(fd, _shmSize));
+  }
+  catch(std::string& e) {
+    syslog(LOG_ERR,"<E> %s", e.c_str());
+    ::close(fd);
+  }
+}
+
+bool AmcCarrierBroker::_serve(Client& client)
+{
+  BrokerRequest req;
+  ssize_t n = ::recv(client.fd, &req, sizeof(req), 0);
+  if (n <= 0)
+    return false;
+
+  _requests++;
+
+  BrokerReply rep;
+  memset(&rep, 0, sizeof(rep));
+  if (n != sizeof(req) || req.op >= BrokerNumOps ||
+      (req.array >= HSTARRAYN && req.op != BrokerFill)) {
+    rep.status = -EINVAL;
+    strcpy(rep.error, "AmcCarrierBroker: bad request");
+  }
+  else {
+    try {
+      _handle(client, req, rep);
+    }
+    catch(CPSWError& e) {
+      rep.status = -EIO;
+      strncpy(rep.error, e.getInfo().c_str(), sizeof(rep.error)-1);
+    }
+    catch(std::string& e) {
+      rep.status = -EIO;
+      strncpy(rep.error, e.c_str(), sizeof(rep.error)-1);
+    }
+    catch(const char* e) {
+      rep.status = -EIO;
+      strncpy(rep.error, e, sizeof(rep.error)-1);
+    }
+    catch(...) {
+      rep.status = -EIO;
+      strcpy(rep.error, "AmcCarrierBroker: unknown exception");
+    }
+    if (rep.status < 0)
+      _invalidate();
+  }
+
+  if (rep.status)
+    _errors++;
+
+  msghdr msg;
+  iovec  iov;
+  char   cbuf[CMSG_SPACE(sizeof(int))];
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base   = &rep;
+  iov.iov_len    = sizeof(rep);
+  msg.msg_iov    = &iov;
+  msg.msg_iovlen = 1;
+
+  //  The shared buffer goes with the first reply
+  if (!client.sentShm) {
+    msg.msg_control    = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsghdr* cmsg   = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &client.shmFd, sizeof(int));
+  }
+
+  if (::sendmsg(client.fd, &msg, MSG_NOSIGNAL) != sizeof(rep))
+    return false;
+
+  if (!client.sentShm) {
+    client.sentShm = true;
+    ::close(client.shmFd);
+    client.shmFd = -1;
+  }
+  return true;
+}
+
+void AmcCarrierBroker::_handle(Client&              client,
+                               const BrokerRequest& req,
+                               BrokerReply&         rep)
+{
+  unsigned array = req.array;
+
+  //  Only the owner changes the state of the arrays
+  if ((req.op == BrokerInitialize ||
+       req.op == BrokerReset      ||
+       req.op == BrokerAckClear) && &client != _owner) {
+    rep.status = -EPERM;
+    strcpy(rep.error, "AmcCarrierBroker: not the owner");
+    return;
+  }
+
+  switch(req.op) {
+  case BrokerHello:
+    rep.value = client.size;
+    rep.bytes = _tables(client);
+    return;
+  case BrokerOwn:
+    if (_owner && _owner != &client) {
+      rep.status = -EBUSY;
+      strcpy(rep.error, "AmcCarrierBroker: owned by another client");
+    }
+    else
+      _owner = &client;
+    return;
+  case BrokerInitialize:
+    _hw.initialize();
+    _invalidate();
+    rep.bytes = _tables(client);
+    break;
+  case BrokerLayout:
+    _hw.layout();
+    rep.bytes = _tables(client);
+    break;
+  case BrokerReset:
+    _hw.reset(array);
+    _invalidate();
+    break;
+  case BrokerAckClear:
+    _hw.ackClear(array);
+    _invalidate();
+    break;
+  case BrokerInprogress:
+    if (!_cached(req.op))
+      _inprogress = _hw.inprogress();
+    rep.value = _inprogress;
+    return;
+  case BrokerDoneAll:
+    if (!_cached(req.op))
+      _done = _hw.done();
+    rep.value = _done;
+    return;
+  case BrokerDone:
+    rep.value = _hw.done(array);
+    break;
+  case BrokerStatus:
+    rep.value = _hw.status(array);
+    break;
+  case BrokerState:
+    { ArrayState s = _hw.state(array);
+      memcpy(client.shm, &s, sizeof(s));
+      rep.bytes = sizeof(s); }
+    break;
+  case BrokerStateAll:
+    if (!_cached(req.op))
+      _states = _hw.state();
+    rep.bytes = _states.size()*sizeof(ArrayState);
+    memcpy(client.shm, _states.data(), rep.bytes);
+    return;
+  case BrokerGet:
+    { Record* record;
+      rep.status = _hw.fetch(array, req.begin, &rep.next, &record);
+      if (rep.status != BsaOk)
+        break;
+      rep.value = (uint64_t(record->time_secs)<<32) | record->time_nsecs;
+      rep.bytes = record->entries.size()*sizeof(Entry);
+      if (rep.bytes > client.size)
+        throw(std::string("AmcCarrierBroker: record exceeds shared buffer"));
+      memcpy(client.shm, record->entries.data(), rep.bytes); }
+    break;
+  case BrokerFill:
+    if (req.end < req.begin || req.end-req.begin > client.size)
+      throw(std::string("AmcCarrierBroker: fill exceeds shared buffer"));
+    _hw._fill(client.shm, req.begin, req.end);
+    rep.bytes = req.end-req.begin;
+    break;
+  case BrokerRing:
+    { RingState s = _hw.ring(array);
+      memcpy(client.shm, &s, sizeof(s));
+      rep.bytes = sizeof(s); }
+    break;
+  default:
+    break;
+  }
+  _accesses++;
+}
+
+size_t AmcCarrierBroker::_tables(Client& client)
+{
+  uint64_t* p = reinterpret_cast<uint64_t*>(client.shm);
+  for(unsigned i=0; i<HSTARRAYN; i++) {
+    p[i]           = i < _hw._begin.size() ? _hw._begin[i] : 0;
+    p[i+HSTARRAYN] = i < _hw._end  .size() ? _hw._end  [i] : 0;
+  }
+  return 2*HSTARRAYN*sizeof(uint64_t);
+}
+
+//
+//  The array state reads are shared between the requests of a poll round,
+//  or for cacheUs microseconds
+//
+bool AmcCarrierBroker::_cached(unsigned op)
+{
+  uint64_t now = monotonicUs();
+  if (_cacheValid[op] &&
+      (_cacheRound[op] == _round || now - _cacheTime[op] < _cacheUs)) {
+    _cacheHits++;
+    return true;
+  }
+  _cacheValid[op] = true;
+  _cacheRound[op] = _round;
+  _cacheTime [op] = now;
+  _accesses++;
+  return false;
+}
+
+void AmcCarrierBroker::_invalidate()
+{
+  for(unsigned i=0; i<BrokerNumOps; i++)
+    _cacheValid[i] = false;
+}
+
+AmcCarrierClient::AmcCarrierClient(const char* path,
+                                   bool        owner) :
+  _owner(owner), _fd(-1), _shm(0), _shmSize(0)
+{
+  _fd = ::socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (_fd < 0)
+    throw(std::string("AmcCarrierClient: socket failed"));
+
+  sockaddr_un addr;
+  unixAddress(addr, path);
+  if (::connect(_fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    syslog(LOG_ERR,"<E> AmcCarrierClient: connect %s failed: %s", path, strerror(errno));
+    ::close(_fd);
+    throw(std::string("AmcCarrierClient: connect failed"));
+  }
+
+  //  The first reply carries the shared buffer descriptor
+  BrokerRequest req;
+  memset(&req, 0, sizeof(req));
+  req.op = BrokerHello;
+
+  msghdr msg;
+  iovec  iov;
+  char   cbuf[CMSG_SPACE(sizeof(int))];
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base       = &_reply;
+  iov.iov_len        = sizeof(_reply);
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+
+  int shmFd = -1;
+  if (::send(_fd, &req, sizeof(req), 0) == sizeof(req) &&
+      ::recvmsg(_fd, &msg, 0) == sizeof(_reply)) {
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy(&shmFd, CMSG_DATA(cmsg), sizeof(int));
+  }
+  if (shmFd < 0) {
+    ::close(_fd);
+    throw(std::string("AmcCarrierClient: broker handshake failed"));
+  }
+
+  _shmSize = _reply.value;
+  void* p = mmap(0, _shmSize, PROT_READ, MAP_SHARED, shmFd, 0);
+  ::close(shmFd);
+  if (p == MAP_FAILED) {
+    ::close(_fd);
+    throw(std::string("AmcCarrierClient: mmap failed"));
+  }
+  _shm = reinterpret_cast<const char*>(p);
+
+  _layout();
+
+  if (_owner) {
+    try {
+      _request(BrokerOwn);
+    }
+    catch(std::string&) {
+      munmap(p, _shmSize);
+      ::close(_fd);
+      throw;
+    }
+  }
+}
+
+AmcCarrierClient::~AmcCarrierClient()
+{
+  munmap(const_cast<char*>(_shm), _shmSize);
+  ::close(_fd);
+}
+
+const BrokerReply& AmcCarrierClient::_request(unsigned op,
+                                              unsigned array,
+                                              uint64_t begin,
+                                              uint64_t end) const
+{
+  BrokerRequest req;
+  req.op    = op;
+  req.array = array;
+  req.begin = begin;
+  req.end   = end;
+
+  if (::send(_fd, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req) ||
+      ::recv(_fd, &_reply, sizeof(_reply), 0) != sizeof(_reply)) {
+    syslog(LOG_ERR,"<E> AmcCarrierClient: broker connection lost");
+    throw(std::string("AmcCarrierClient: broker connection lost"));
+  }
+
+  if (_reply.status < 0) {
+    _reply.error[sizeof(_reply.error)-1] = 0;
+    syslog(LOG_ERR,"<E> AmcCarrierClient: op %u array %u: %s", op, array, _reply.error);
+    throw(std::string(_reply.error));
+  }
+
+  return _reply;
+}
+
+void AmcCarrierClient::_layout()
+{
+  const uint64_t* p = reinterpret_cast<const uint64_t*>(_shm);
+  _begin.resize(HSTARRAYN);
+  _end  .resize(HSTARRAYN);
+  _memEnd = 0;
+  for(unsigned i=0; i<HSTARRAYN; i++) {
+    _begin[i] = p[i];
+    _end  [i] = p[i+HSTARRAYN];
+    if (_end[i] > _memEnd)
+      _memEnd = _end[i];
+  }
+  _reserve();
+}
+
+BsaStatus AmcCarrierClient::fetch(unsigned  array,
+                                  uint64_t  begin,
+                                  uint64_t* next,
+                                  Record**  precord) const
+{
+  const BrokerReply& rep = _request(BrokerGet, array, begin);
+  if (rep.status != BsaOk)
+    return _status(BsaStatus(rep.status));
+  Record& record = _record;
+  record.buffer     = array;
+  record.time_secs  = rep.value>>32;
+  record.time_nsecs = rep.value&0xffffffff;
+  record.entries.resize(rep.bytes/sizeof(Entry));
+  memcpy(record.entries.data(), _shm, rep.bytes);
+  *next    = rep.next;
+  *precord = &record;
+  return _status(BsaOk);
+}
+
+void AmcCarrierClient::_fill(void*    dst,
+                             uint64_t begin,
+                             uint64_t end) const
+{
+  //  Large reads are split into pieces that fit the shared buffer
+  uint8_t* p = reinterpret_cast<uint8_t*>(dst);
+  while(begin < end) {
+    uint64_t next = (end-begin > _shmSize) ? begin+_shmSize : end;
+    _request(BrokerFill, 0, begin, next);
+    memcpy(p, _shm, next-begin);
+    p    += next-begin;
+    begin = next;
+  }
+}
+
+void AmcCarrierClient::initialize()
+{
+  _request(_owner ? BrokerInitialize : BrokerLayout);
+  _layout();
+}
+
+//  The broker owns the hardware and plans the layout from its own BSA_LAYOUT
+void AmcCarrierClient::initialize(const DramLayout&)
+{
+  throw(std::string("AmcCarrierClient: the layout is planned by the broker (BSA_LAYOUT)"));
+}
+
+void AmcCarrierClient::layout()
+{
+  _request(BrokerLayout);
+  _layout();
+}
+
+void AmcCarrierClient::reset(unsigned array)
+{
+  if (_owner)
+    _request(BrokerReset, array);
+}
+
+void AmcCarrierClient::ackClear(unsigned array)
+{
+  if (_owner)
+    _request(BrokerAckClear, array);
+}
+
+uint64_t AmcCarrierClient::inprogress() const
+{
+  return _request(BrokerInprogress).value;
+}
+
+uint64_t AmcCarrierClient::done() const
+{
+  return _request(BrokerDoneAll).value;
+}
+
+bool AmcCarrierClient::done(unsigned array) const
+{
+  return _request(BrokerDone, array).value;
+}
+
+uint32_t AmcCarrierClient::status(unsigned array) const
+{
+  return _request(BrokerStatus, array).value;
+}
+
+ArrayState AmcCarrierClient::state(unsigned array) const
+{
+  _request(BrokerState, array);
+  ArrayState s;
+  memcpy(&s, _shm, sizeof(s));
+  return s;
+}
+
+const std::vector<ArrayState>& AmcCarrierClient::state()
+{
+  const BrokerReply& rep = _request(BrokerStateAll);
+  _state.resize(rep.bytes/sizeof(ArrayState));
+  memcpy(_state.data(), _shm, rep.bytes);
+  return _state;
+}
+
+RingState AmcCarrierClient::ring(unsigned array) const
+{
+  _request(BrokerRing, array);
+  RingState s;
+  memcpy(&s, _shm, sizeof(s));
+  return s;
+}
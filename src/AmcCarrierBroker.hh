@@ -0,0 +1,177 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef Bsa_AmcCarrierBroker_hh
+#define Bsa_AmcCarrierBroker_hh
+
+#include <AmcCarrierBase.hh>
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+//
+//  Local broker for one AmcCarrier
+//
+//  The broker owns the carrier connection and serves the AmcCarrierBase
+//  hardware accesses of several processes over a Unix-domain socket
+//  (SOCK_SEQPACKET, one fixed size request and reply per access).  Bulk
+//  data (DRAM contents, buffer tables, array states) are returned in a
+//  shared memory buffer that the broker passes to each client when it
+//  connects.  Requests are served one at a time, so carrier accesses are
+//  serialized; array state reads requested by several clients in the
+//  same poll round (or within the cache time) are read from the carrier
+//  once.
+//
+//  Only one client, the owner, may change the state of the arrays
+//  (initialize, reset, ackClear); the others observe.  Ownership is
+//  released when the owner disconnects.
+//
+//  The socket is created mode 0660, in a directory made mode 0770 if it
+//  does not exist, and the broker also refuses peers that are neither
+//  root nor of its user or group.
+//
+#define BSA_BROKER_PATH "/run/bsa/broker"
+
+namespace Bsa {
+  enum BrokerOp { BrokerHello,
+                  BrokerInitialize,
+                  BrokerLayout,
+                  BrokerReset,
+                  BrokerAckClear,
+                  BrokerInprogress,
+                  BrokerDoneAll,
+                  BrokerDone,
+                  BrokerStatus,
+                  BrokerState,
+                  BrokerStateAll,
+                  BrokerGet,
+                  BrokerFill,
+                  BrokerRing,
+                  BrokerOwn,
+                  BrokerNumOps };
+
+  struct BrokerRequest {
+    uint32_t op;
+    uint32_t array;
+    uint64_t begin;
+    uint64_t end;
+  };
+
+  struct BrokerReply {
+    int32_t  status;        // 0 on success, -errno on failure,
+                            // BrokerGet: BsaStatus of the fetch
+    uint32_t reserved;
+    uint64_t value;         // scalar result
+    uint64_t next;          // BrokerGet: next read address
+    uint64_t bytes;         // bytes written to the shared buffer
+    char     error[64];
+  };
+
+  class AmcCarrierBroker {
+  public:
+    AmcCarrierBroker(AmcCarrierBase& hw,
+                     const char*     path=BSA_BROKER_PATH,
+                     size_t          shmSize=64<<20,   // shared buffer per client
+                     unsigned        cacheUs=0);       // age of array states shared between clients
+    ~AmcCarrierBroker();
+  public:
+    //
+    //  Serve clients until stop()
+    //
+    void     run ();
+    void     stop();
+  public:
+    unsigned clients   () const { return _clients.size(); }
+    bool     owned     () const { return _owner; }
+    uint64_t requests  () const { return _requests; }
+    uint64_t accesses  () const { return _accesses; }   // requests served from the carrier
+    uint64_t cacheHits () const { return _cacheHits; }
+    uint64_t errors    () const { return _errors; }
+  private:
+    class Client;
+    void     _accept ();
+    bool     _serve  (Client&);
+    void     _handle (Client&, const BrokerRequest&, BrokerReply&);
+    bool     _cached (unsigned op);
+    void     _invalidate();
+    size_t   _tables (Client&);
+  private:
+    AmcCarrierBase&      _hw;
+    std::string          _path;
+    size_t               _shmSize;
+    unsigned             _cacheUs;
+    int                  _fd;
+    volatile bool        _stop;
+    std::vector<Client*> _clients;
+    Client*              _owner;
+    uint64_t             _round;
+    bool                 _cacheValid[BrokerNumOps];
+    uint64_t             _cacheRound[BrokerNumOps];
+    uint64_t             _cacheTime [BrokerNumOps];
+    uint64_t             _done;
+    uint64_t             _inprogress;
+    std::vector<ArrayState> _states;
+    uint64_t             _requests;
+    uint64_t             _accesses;
+    uint64_t             _cacheHits;
+    uint64_t             _errors;
+  };
+
+  //
+  //  AmcCarrierBase served by the broker
+  //  (like the base class, not to be shared between threads)
+  //
+  //  An observer (owner=false) leaves the array state to the owner:
+  //  reset and ackClear do nothing and initialize reads the layout.
+  //
+  class AmcCarrierClient : public AmcCarrierBase {
+  public:
+    AmcCarrierClient(const char* path=BSA_BROKER_PATH,
+                     bool        owner=false);  // throws if the broker is absent
+                                                // or, for an owner, owned
+    ~AmcCarrierClient();
+  public:
+    bool       owner     () const { return _owner; }
+    BsaStatus  fetch     (unsigned  array,
+                          uint64_t  begin,
+                          uint64_t* next,
+                          Record**  record) const;
+    void       initialize();
+    void       initialize(const DramLayout&);
+    void       layout    ();
+    void       reset     (unsigned array);
+    void       ackClear  (unsigned array);
+    uint64_t   inprogress() const;
+    uint64_t   done      () const;
+    bool       done      (unsigned array) const;
+    uint32_t   status    (unsigned array) const;
+    ArrayState state     (unsigned array) const;
+    const std::vector<ArrayState>& state();
+    RingState  ring      (unsigned array) const;
+  protected:
+    void       _fill     (void*    dst,
+                          uint64_t begin,
+                          uint64_t end) const;
+  private:
+    const BrokerReply& _request(unsigned op,
+                                unsigned array=0,
+                                uint64_t begin=0,
+                                uint64_t end  =0) const;
+    void       _layout   ();
+  private:
+    bool                _owner;
+    int                 _fd;
+    const char*         _shm;
+    size_t              _shmSize;
+    mutable BrokerReply _reply;
+  };
+};
+
+#endif
@@ -0,0 +1,275 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "AmcCarrierReplay.hh"
+
+#include <fcntl.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+
+using namespace Bsa;
+
+static uint64_t _now()
+{
+  timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return uint64_t(tv.tv_sec)*1000000000ULL + tv.tv_nsec;
+}
+
+static size_t _padded(uint32_t bytes)
+{
+  return sizeof(CaptureEvent) + ((bytes+7)&~7U);
+}
+
+AmcCarrierReplay::AmcCarrierReplay(const char* path,
+                                   bool        realTime) :
+  _realTime(realTime),
+  _cursor  (sizeof(CaptureHeader)),
+  _rounds  (0),
+  _misses  (0)
+{
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    throw(std::string("AmcCarrierReplay: open failed"));
+  struct stat st;
+  if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(CaptureHeader)) {
+    ::close(fd);
+    throw(std::string("AmcCarrierReplay: capture too short"));
+  }
+  void* p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED)
+    throw(std::string("AmcCarrierReplay: mmap failed"));
+  _base = reinterpret_cast<const uint8_t*>(p);
+  _size = st.st_size;
+
+  if (memcmp(_base, "BSAC", 4)) {
+    munmap(p, _size);
+    throw(std::string("AmcCarrierReplay: not a capture"));
+  }
+  madvise(p, _size, MADV_SEQUENTIAL);
+
+  memset(_image, 0, sizeof(_image));
+
+  //  The layout is the first one captured, or the standard one
+  _defaultLayout();
+  for(size_t o = _cursor; o + sizeof(CaptureEvent) <= _size; ) {
+    const CaptureEvent* e = reinterpret_cast<const CaptureEvent*>(_base+o);
+    if (e->type == CaptureLayout) {
+      _apply(e);
+      _cursor = sizeof(CaptureHeader);
+      break;
+    }
+    o += _padded(e->bytes);
+  }
+
+  _start = _now();
+  syslog(LOG_INFO,"<I> AmcCarrierReplay: %s, %zu bytes", path, _size);
+}
+
+AmcCarrierReplay::~AmcCarrierReplay()
+{
+  munmap(const_cast<uint8_t*>(_base), _size);
+}
+
+const CaptureEvent* AmcCarrierReplay::_next() const
+{
+  if (_cursor + sizeof(CaptureEvent) > _size)
+    return 0;
+  const CaptureEvent* e = reinterpret_cast<const CaptureEvent*>(_base+_cursor);
+  if (_cursor + sizeof(CaptureEvent) + e->bytes > _size) {
+    //  Truncated by the end of the recording
+    _cursor = _size;
+    return 0;
+  }
+  return e->type == CapturePoll ? 0 : e;
+}
+
+void AmcCarrierReplay::_apply(const CaptureEvent* e) const
+{
+  const uint8_t* payload = reinterpret_cast<const uint8_t*>(e+1);
+  switch(e->type) {
+  case CaptureLayout:
+    { const uint64_t* v = reinterpret_cast<const uint64_t*>(payload);
+      AmcCarrierReplay& self = const_cast<AmcCarrierReplay&>(*this);
+      for(unsigned i=0; i<HSTARRAYN; i++) {
+        self._begin[i] = v[i];
+        self._end  [i] = v[HSTARRAYN+i];
+      } } break;
+  case CaptureRegs:
+    { const CaptureRegsHeader* h = reinterpret_cast<const CaptureRegsHeader*>(payload);
+      const uint64_t*          v = reinterpret_cast<const uint64_t*>(h+1);
+      if (h->target < NumTraceTargets)
+        for(unsigned i=0; i<h->n && h->first+i<HSTARRAYN; i++)
+          _image[h->target][h->first+i] = v[i];
+    } break;
+  case CaptureDram:
+    { const uint64_t* v = reinterpret_cast<const uint64_t*>(payload);
+      Block b;
+      b.end  = v[1];
+      b.data = payload + 2*sizeof(uint64_t);
+      _blocks[v[0]] = b;
+    } break;
+  default:
+    break;
+  }
+  _cursor += _padded(e->bytes);
+}
+
+//
+//  Apply events until the next value of the register is captured
+//
+uint64_t AmcCarrierReplay::_reg(unsigned target,
+                                unsigned array,
+                                unsigned n) const
+{
+  while(const CaptureEvent* e = _next()) {
+    _apply(e);
+    if (e->type == CaptureRegs) {
+      const CaptureRegsHeader* h = reinterpret_cast<const CaptureRegsHeader*>(e+1);
+      if (h->target == target && h->first == array && h->n == n)
+        break;
+    }
+  }
+  return _image[target][array];
+}
+
+BsaStatus AmcCarrierReplay::fetch(unsigned  array,
+                                  uint64_t  begin,
+                                  uint64_t* next,
+                                  Record**  record) const
+{
+  uint64_t tstamp = _reg(TraceTimestamp, array);
+  uint64_t wrAddr = _reg(TraceWrAddr   , array);
+  unsigned wrap   = _reg(TraceFull     , array);
+  return _fetch(array, begin, tstamp, wrAddr, wrap, next, record);
+}
+
+void AmcCarrierReplay::_fill(void*    dst,
+                             uint64_t begin,
+                             uint64_t end) const
+{
+  //  Apply events until the block is captured
+  std::map<uint64_t,Block>::const_iterator it;
+  while(1) {
+    it = _blocks.find(begin);
+    if (it != _blocks.end() && it->second.end >= end)
+      break;
+    const CaptureEvent* e = _next();
+    if (!e) {
+      //  Otherwise, look for a captured block containing it
+      it = _blocks.upper_bound(begin);
+      if (it != _blocks.begin() && (--it)->second.end >= end)
+        break;
+      memset(dst, 0, end-begin);
+      _misses++;
+      return;
+    }
+    _apply(e);
+  }
+  memcpy(dst, it->second.data + (begin - it->first), end-begin);
+}
+
+void AmcCarrierReplay::initialize()
+{
+}
+
+//  The layout is the captured one
+void AmcCarrierReplay::initialize(const DramLayout&)
+{
+}
+
+void AmcCarrierReplay::layout()
+{
+}
+
+void AmcCarrierReplay::reset(unsigned)
+{
+}
+
+void AmcCarrierReplay::ackClear(unsigned)
+{
+}
+
+uint64_t AmcCarrierReplay::inprogress() const
+{
+  _reg(TraceEmpty, 0, HSTARRAYN);
+  uint64_t r=0;
+  for(unsigned i=0; i<HSTARRAYN; i++)
+    if (!_image[TraceEmpty][i])
+      r |= 1ULL<<i;
+  return r;
+}
+
+uint64_t AmcCarrierReplay::done() const
+{
+  _reg(TraceStatus, 0, HSTARRAYN);
+  uint64_t r=0;
+  for(unsigned i=0; i<HSTARRAYN; i++)
+    if (_image[TraceStatus][i]&4)
+      r |= 1ULL<<i;
+  return r;
+}
+
+bool AmcCarrierReplay::done(unsigned array) const
+{
+  return _reg(TraceDone, array);
+}
+
+uint32_t AmcCarrierReplay::status(unsigned array) const
+{
+  return _reg(TraceDone, array);
+}
+
+ArrayState AmcCarrierReplay::state(unsigned array) const
+{
+  ArrayState s;
+  s.timestamp = _reg(TraceTimestamp, array);
+  s.wrAddr    = _reg(TraceWrAddr   , array);
+  s.clear     = _reg(TraceClear    , array);
+  s.wrap      = _reg(TraceFull     , array);
+  return s;
+}
+
+const std::vector<ArrayState>& AmcCarrierReplay::state()
+{
+  //  Finish the round and start the next, if it is time
+  while(const CaptureEvent* e = _next())
+    _apply(e);
+  if (_cursor < _size) {
+    const CaptureEvent* e = reinterpret_cast<const CaptureEvent*>(_base+_cursor);
+    if (!_realTime || _now() - _start >= e->time) {
+      _cursor += _padded(e->bytes);
+      _rounds++;
+    }
+  }
+
+  _reg(TraceTimestamp, 0, HSTARRAYN);
+  _reg(TraceClear    , 0, HSTARRAYN);
+  _reg(TraceWrAddr   , 0, HSTARRAYN);
+  for(unsigned i=0; i<HSTARRAYN; i++) {
+    _state[i].timestamp = _image[TraceTimestamp][i];
+    _state[i].clear     = _image[TraceClear    ][i];
+    _state[i].wrAddr    = _image[TraceWrAddr   ][i];
+  }
+  return _state;
+}
+
+RingState AmcCarrierReplay::ring(unsigned) const
+{
+  RingState s;
+  memset(&s, 0, sizeof(s));
+  return s;
+}
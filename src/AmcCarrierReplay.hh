@@ -0,0 +1,83 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef Bsa_AmcCarrierReplay_hh
+#define Bsa_AmcCarrierReplay_hh
+
+#include <AmcCarrierBase.hh>
+#include <BsaTrace.hh>
+#include <BsaCapture.hh>
+
+#include <map>
+#include <stdint.h>
+
+//
+//  AmcCarrierBase served from a BsaCapture file
+//
+//  The capture is mapped read-only and its events are applied in order:
+//  register values to an image of the registers, DRAM blocks to an index
+//  of the mapping.  Each read takes the next value captured for the same
+//  register and array, so a Processor making the reads it made when the
+//  capture was recorded sees the same values.  DRAM is copied from the
+//  mapping straight into the record.  Each poll of all arrays starts the
+//  next round of the capture, immediately or, in real time, once the
+//  time between rounds has passed.  Writes are ignored.
+//
+namespace Bsa {
+  class AmcCarrierReplay : public AmcCarrierBase {
+  public:
+    AmcCarrierReplay(const char* path,            // throws if not a capture
+                     bool        realTime=false);
+    ~AmcCarrierReplay();
+  public:
+    BsaStatus  fetch     (unsigned  array,
+                          uint64_t  begin,
+                          uint64_t* next,
+                          Record**  record) const;
+    void       initialize();
+    void       initialize(const DramLayout&);
+    void       layout    ();
+    void       reset     (unsigned array);
+    void       ackClear  (unsigned array);
+    uint64_t   inprogress() const;
+    uint64_t   done      () const;
+    bool       done      (unsigned array) const;
+    uint32_t   status    (unsigned array) const;
+    ArrayState state     (unsigned array) const;
+    const std::vector<ArrayState>& state();
+    RingState  ring      (unsigned array) const;
+  public:
+    bool       finished  () const { return _cursor >= _size; }
+    uint64_t   rounds    () const { return _rounds; }
+    uint64_t   misses    () const { return _misses; }  // DRAM reads not in the capture
+  protected:
+    void       _fill     (void*    dst,
+                          uint64_t begin,
+                          uint64_t end) const;
+  private:
+    uint64_t   _reg      (unsigned target,
+                          unsigned array,
+                          unsigned n=1) const;
+    const CaptureEvent* _next() const;       // 0 at a poll or the end
+    void       _apply    (const CaptureEvent*) const;
+  private:
+    struct Block { uint64_t end; const uint8_t* data; };
+    const uint8_t*  _base;
+    size_t          _size;
+    bool            _realTime;
+    uint64_t        _start;
+    mutable size_t  _cursor;
+    mutable uint64_t _image[NumTraceTargets][HSTARRAYN];
+    mutable std::map<uint64_t,Block> _blocks;
+    uint64_t        _rounds;
+    mutable uint64_t _misses;
+  };
+};
+
+#endif
@@ -18,10 +18,9 @@
 
 #include <syslog.h>
 
-static uint64_t GET_U1(Path pre, unsigned nelms)
+static uint64_t GET_U1(ScalVal_RO s, unsigned nelms)
 {
   uint64_t r=0;
-  ScalVal_RO s = IScalVal_RO::create( pre );
   for(unsigned i=0; i<nelms; i++) {
     IndexRange rng(i);
     unsigned v;
@@ -32,18 +31,19 @@ static uint64_t GET_U1(Path pre, unsigned nelms)
   return r;
 }
 
-#define SET_REG(name,val) {                                             \
+#define SET_REG(id,val) {                                               \
     unsigned v(val);                                                    \
-    ScalVal s = IScalVal::create( _bpath->findByName(name) );     \
-    s->setVal(&v,1,&rng);                                               \
+    _regs.rw(id)->setVal(&v,1,&rng);                                    \
   }
 
-#define SET_REGL(name,val) {                                            \
+#define SET_REGL(id,val) {                                              \
     uint64_t v(val);                                                    \
-    ScalVal s = IScalVal::create( _bpath->findByName(name) );     \
-    s->setVal(&v,1,&rng);                                               \
+    _regs.rw(id)->setVal(&v,1,&rng);                                    \
   }
 
+static const char* ramPaths[] = { "BsaBufferControl/BsaBuffers",
+                                  "BsaWaveformEngine[0]/WaveformEngineBuffers",
+                                  "BsaWaveformEngine[1]/WaveformEngineBuffers" };
 
 using namespace Bsa;
 
@@ -71,6 +71,7 @@ AmcCarrierYaml::AmcCarrierYaml(Path mmio,
   _wrAddr    = IScalVal_RO::create( _bpath->findByName("WrAddr") );
   _trAddr    = IScalVal_RO::create( _bpath->findByName("TriggerAddr") );
   _memEnd    = 0;
+  _regs.resolve(_path, ramPaths, 0);
 
   syslog(LOG_DEBUG,"<D> dram array is (%u,%llu)", _dram->getNelms(), _dram->getSizeBits());
 }
@@ -85,8 +86,8 @@ unsigned AmcCarrierYaml::nArrays   () const
 uint32_t AmcCarrierYaml::doneRaw   () const
 {
   uint32_t done;
-  done  = (GET_U1(_wpath0->findByName("Done"),4)<<0)
-        | (GET_U1(_wpath1->findByName("Done"),4)<<4);
+  done  = (GET_U1(_regs.ro(Waveform0,Done),4)<<0)
+        | (GET_U1(_regs.ro(Waveform1,Done),4)<<4);
   return done;
 }
 
@@ -94,10 +95,10 @@ RingState AmcCarrierYaml::ring     (unsigned array) const
 {
   RingState s;
   IndexRange rng(array%4);
-  Path bpath = array < 4 ? _wpath0 : _wpath1;
-  IScalVal_RO::create( bpath->findByName("StartAddr") )->getVal(&s.begAddr,1,&rng);
-  IScalVal_RO::create( bpath->findByName("EndAddr"  ) )->getVal(&s.endAddr,1,&rng);
-  IScalVal_RO::create( bpath->findByName("WrAddr"   ) )->getVal(&s.nxtAddr,1,&rng);
+  RamBlock b = waveform(array);
+  _regs.ro(b,StartAddr)->getVal(&s.begAddr,1,&rng);
+  _regs.ro(b,EndAddr  )->getVal(&s.endAddr,1,&rng);
+  _regs.ro(b,WrAddr   )->getVal(&s.nxtAddr,1,&rng);
   return s;
 }
 
@@ -107,7 +108,7 @@ void     AmcCarrierYaml::initializ_(unsigned index,
 {
   const uint64_t BlockMask = (0x1ULL<<12)-1;  // Buffers must be in blocks of 4kB
 
-  Path path = index < 4 ? _wpath0 : _wpath1;
+  RamBlock b = waveform(index);
     
   //  Setup the waveform memory
   uint64_t p = _memEnd;
@@ -115,30 +116,30 @@ void     AmcCarrierYaml::initializ_(unsigned index,
   uint32_t one(1), zero(0), mode(doneWhenFull ? 1:0);
   IndexRange rng(index%4);
   syslog(LOG_DEBUG,"<D> Setup waveform memory %i %llx:%llx", index, p,pn);
-  IScalVal::create( path->findByName("StartAddr"))->setVal(&p   ,1,&rng);
-  IScalVal::create( path->findByName("EndAddr"  ))->setVal(&pn  ,1,&rng);
-  IScalVal::create( path->findByName("Enabled"  ))->setVal(&one ,1,&rng);
-  IScalVal::create( path->findByName("Mode"     ))->setVal(&mode,1,&rng);
-  IScalVal::create( path->findByName("Init"     ))->setVal(&one ,1,&rng);
-  IScalVal::create( path->findByName("Init"     ))->setVal(&zero,1,&rng);
+  _regs.rw(b,StartAddr)->setVal(&p   ,1,&rng);
+  _regs.rw(b,EndAddr  )->setVal(&pn  ,1,&rng);
+  _regs.rw(b,Enabled  )->setVal(&one ,1,&rng);
+  _regs.rw(b,Mode     )->setVal(&mode,1,&rng);
+  _regs.rw(b,Init     )->setVal(&one ,1,&rng);
+  _regs.rw(b,Init     )->setVal(&zero,1,&rng);
   _memEnd = pn;
 }
 
 void     AmcCarrierYaml::rearm(unsigned index)
 {
   uint32_t one(1), zero(0), mode(1);
-  Path path = index<4 ? _wpath0 : _wpath1;
+  RamBlock b = waveform(index);
   IndexRange rng(index%4);
-  IScalVal::create( path->findByName("Mode"     ))->setVal(&mode,1,&rng);
-  IScalVal::create( path->findByName("Init"     ))->setVal(&one ,1,&rng);
-  IScalVal::create( path->findByName("Init"     ))->setVal(&zero,1,&rng);
+  _regs.rw(b,Mode     )->setVal(&mode,1,&rng);
+  _regs.rw(b,Init     )->setVal(&one ,1,&rng);
+  _regs.rw(b,Init     )->setVal(&zero,1,&rng);
 }
 
 void     AmcCarrierYaml::clear     (unsigned array)
 {
   IndexRange rng(array);
-  SET_REG ("Init"     , 1);
-  SET_REG ("Init"     , 0);
+  SET_REG (regId(BsaBuffers,Init), 1);
+  SET_REG (regId(BsaBuffers,Init), 0);
 }
 
 void     AmcCarrierYaml::dump      () const
@@ -149,10 +150,10 @@ void     AmcCarrierYaml::dump      () const
   //  Print BSA buffer status summary
   //
   uint64_t done, full, empty, error;
-  done  = GET_U1(_bpath->findByName("Done"),64);
-  full  = GET_U1(_bpath->findByName("Full"),64);
-  empty = GET_U1(_bpath->findByName("Empty"),64);
-  error = GET_U1(_bpath->findByName("Error"),64);
+  done  = GET_U1(_regs.ro(BsaBuffers,Done ),64);
+  full  = GET_U1(_regs.ro(BsaBuffers,Full ),64);
+  empty = GET_U1(_regs.ro(BsaBuffers,Empty),64);
+  error = GET_U1(_regs.ro(BsaBuffers,Error),64);
 
   printf("BufferDone [%016llx]\t  Full[%016llx]\t  Empty[%016llx]\n",
          (unsigned long long)done,(unsigned long long)full,(unsigned long long)empty);
@@ -170,25 +171,28 @@ void     AmcCarrierYaml::dump      () const
   printf("\n");
 
   for(unsigned i=0; i<NArrays; i++) {
-    _printBuffer(_bpath, _tstamp, i, done, full, empty, error);
+    _printBuffer(BsaBuffers, _tstamp, i, done, full, empty, error);
   }
 
-  done  = GET_U1(_wpath0->findByName("Done"),4);
-  full  = GET_U1(_wpath0->findByName("Full"),4);
-  empty = GET_U1(_wpath0->findByName("Empty"),4);
-  error = GET_U1(_wpath0->findByName("Error"),4);
+  done  = GET_U1(_regs.ro(Waveform0,Done ),4);
+  full  = GET_U1(_regs.ro(Waveform0,Full ),4);
+  empty = GET_U1(_regs.ro(Waveform0,Empty),4);
+  error = GET_U1(_regs.ro(Waveform0,Error),4);
 
   for(unsigned i=0; i<4; i++) {
-    _printBuffer(_wpath0,i, done, full, empty, error);
+    _printBuffer(Waveform0,i, done, full, empty, error);
   }
 
-  done  = GET_U1(_wpath1->findByName("Done"),4);
-  full  = GET_U1(_wpath1->findByName("Full"),4);
-  empty = GET_U1(_wpath1->findByName("Empty"),4);
-  error = GET_U1(_wpath1->findByName("Error"),4);
+  done  = GET_U1(_regs.ro(Waveform1,Done ),4);
+  full  = GET_U1(_regs.ro(Waveform1,Full ),4);
+  empty = GET_U1(_regs.ro(Waveform1,Empty),4);
+  error = GET_U1(_regs.ro(Waveform1,Error),4);
 
   for(unsigned i=0; i<4; i++) {
-    _printBuffer(_wpath1,i, done, full, empty, error);
+    _printBuffer(Waveform1,i, done, full, empty, error);
   }
-}
 
+  printf("Register lookups %llu  cache hits %llu\n",
+         (unsigned long long)_regs.lookups(),
+         (unsigned long long)_regs.hits());
+}
@@ -27,9 +27,6 @@ namespace Bsa {
   public:
     //  BSA buffers
     unsigned nArrays   () const;
-    Record*  get       (unsigned array,
-                        uint64_t begin,
-                        uint64_t* next) const;
 
     void     dump      () const;
   public:
@@ -44,10 +41,6 @@ namespace Bsa {
                          uint64_t end  ) const;
   public:
     void      clear     (unsigned array);
-  private:
-    void      _fill     (void*    dst,
-                         uint64_t begin,
-                         uint64_t end) const;
   };
 };
 
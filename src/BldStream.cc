@@ -0,0 +1,496 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "BldStream.hh"
+
+#include "socketAPI.h"
+
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace Bld;
+
+BldEventIterator::BldEventIterator(const char* b, size_t sz) :
+    _buff (reinterpret_cast<const uint32_t*>(b)),
+    _end  (reinterpret_cast<const uint32_t*>(b+sz)),
+    _next (_buff),
+    _error(false)
+{
+    first(sz);
+}
+
+void BldEventIterator::first(size_t sz)
+{
+    if(sz < 7*sizeof(uint32_t)) {
+        _error = true;
+        _next  = _end;
+        return;
+    }
+
+    //
+    //  Validate size of packet (sz = sizeof_first + n*sizeof_next)
+    //  before reading the channels
+    //
+    unsigned nchn         = __builtin_popcount(_buff[4]);
+    size_t   sizeof_first = 4*(nchn+7);
+    size_t   sizeof_next  = 4*(nchn+3);
+    if(sz < sizeof_first || ((sz - sizeof_first)%sizeof_next) != 0) {
+        _error = true;
+        _next  = _end;
+        return;
+    }
+
+    v.timeStamp = _buff[1]; v.timeStamp <<= 32; v.timeStamp += _buff[0];
+    v.pulseId   = _buff[3]; v.pulseId   <<= 32; v.pulseId   += _buff[2];
+    v.mask      = _buff[4];
+    v.beam      = _buff[5];
+    v.channels.resize(nchn);
+    unsigned i = 6;
+    for(unsigned m = v.mask; m != 0; m &= (m-1), i++)
+        v.channels[i-6] = _buff[i];
+
+    v.valid     = _buff[i++];
+    _next       = _buff+i;
+}
+
+bool BldEventIterator::next()
+{
+    if(_next >= _end)
+        return false;
+
+    v.timeStamp = _buff[1]; v.timeStamp <<= 32; v.timeStamp += _buff[0];
+    v.pulseId   = _buff[3]; v.pulseId   <<= 32; v.pulseId   += _buff[2];
+    v.timeStamp+= ((_next[0]>> 0)&0xfffff);
+    v.pulseId  += ((_next[0]>>20)&0xfff);
+    v.beam      = _next[1];
+    unsigned i = 2;
+    for(unsigned m = v.mask; m != 0; m &= (m-1), i++)
+        v.channels[i-2] = _next[i];
+    v.valid     = _next[i++];
+    _next      += i;
+    return true;
+}
+
+BldEventBuilder::BldEventBuilder(BldCombinedHandler& handler, unsigned nsources, uint64_t window,
+                                 unsigned partition, unsigned npartitions) :
+    _handler    (handler),
+    _nsources   (nsources),
+    _all        (nsources < 32 ? (1U<<nsources)-1 : ~0U),
+    _window     (window),
+    _partition  (partition),
+    _npartitions(npartitions ? npartitions : 1),
+    _emitted    (false),
+    _lastEmitted(0),
+    _newest     (0),
+    _complete   (0),
+    _partial    (0),
+    _late       (0),
+    _missing    (0),
+    _duplicate  (0),
+    _errors     (0)
+{
+}
+
+BldEventBuilder::~BldEventBuilder()
+{
+    for(unsigned i = 0; i < _pending.size(); i++)
+        delete _pending[i];
+    for(unsigned i = 0; i < _free.size(); i++)
+        delete _free[i];
+}
+
+BldCombined* BldEventBuilder::_alloc()
+{
+    //  Slots are recycled so their event vectors keep their capacity
+    if(_free.empty()) {
+        BldCombined* c = new BldCombined;
+        c->events.resize(_nsources);
+        return c;
+    }
+    BldCombined* c = _free.back();
+    _free.pop_back();
+    return c;
+}
+
+int BldEventBuilder::process(unsigned source, const char* buff, size_t sz)
+{
+    BldEventIterator it(buff, sz);
+    if(!it.valid()) {
+        syslog(LOG_ERR, "<E> BldEventBuilder: size of packet error: source %u, sz %u",
+               source, unsigned(sz));
+        _errors++;
+        return 0;
+    }
+
+    int nevents = 0;
+    do {
+        const BldEvent& ev = *it;
+        if((ev.pulseId % _npartitions) == _partition) {
+            insert(source, ev);
+            nevents++;
+        }
+    } while(it.next());
+    return nevents;
+}
+
+void BldEventBuilder::insert(unsigned source, const BldEvent& ev)
+{
+    if(source >= _nsources || source >= 32) {
+        _errors++;
+        return;
+    }
+
+    if(_emitted && ev.pulseId <= _lastEmitted) {
+        _late++;
+        return;
+    }
+
+    //  Contributions mostly arrive in order, so search from the newest
+    std::deque<BldCombined*>::iterator it = _pending.end();
+    while(it != _pending.begin() && (*(it-1))->pulseId > ev.pulseId)
+        --it;
+
+    BldCombined* c;
+    if(it != _pending.begin() && (*(it-1))->pulseId == ev.pulseId) {
+        c = *(it-1);
+        if(c->contributors & (1U<<source)) {
+            _duplicate++;
+            return;
+        }
+    }
+    else {
+        c = _alloc();
+        c->pulseId      = ev.pulseId;
+        c->timeStamp    = ev.timeStamp;
+        c->contributors = 0;
+        _pending.insert(it, c);
+    }
+
+    c->events[source] = ev;
+    c->contributors  |= (1U<<source);
+
+    if(ev.pulseId > _newest)
+        _newest = ev.pulseId;
+
+    _emit(_newest);
+}
+
+void BldEventBuilder::_emit(uint64_t newest)
+{
+    while(!_pending.empty()) {
+        BldCombined* c = _pending.front();
+        bool complete = (c->contributors == _all);
+        if(!complete && newest - c->pulseId <= _window)
+            break;
+
+        _handler.process(*c, complete);
+        if(complete)
+            _complete++;
+        else {
+            _partial++;
+            _missing += __builtin_popcount(_all & ~c->contributors);
+        }
+        _lastEmitted = c->pulseId;
+        _emitted     = true;
+        _pending.pop_front();
+        _free.push_back(c);
+    }
+}
+
+void BldEventBuilder::flush()
+{
+    if(!_pending.empty())
+        _emit(_pending.back()->pulseId + _window + 1);
+}
+
+BldEventBuilderPool::BldEventBuilderPool(BldCombinedHandler& handler, unsigned nsources, uint64_t window,
+                                         unsigned npartitions)
+{
+    if(!npartitions)
+        npartitions = 1;
+
+    for(unsigned i = 0; i < npartitions; i++) {
+        Partition* p = new Partition;
+        p->builder = new BldEventBuilder(handler, nsources, window, i, npartitions);
+        p->ninput  = 0;
+        p->busy    = false;
+        p->flush   = false;
+        p->done    = false;
+        pthread_mutex_init(&p->lock, NULL);
+        pthread_cond_init (&p->cond, NULL);
+        _partitions.push_back(p);
+    }
+
+    for(unsigned i = 0; i < npartitions; i++) {
+        Partition* p = _partitions[i];
+        if(pthread_create(&p->thread, NULL, &_thread, p))
+            syslog(LOG_ERR, "<E> BldEventBuilderPool: failed to create partition thread %u", i);
+    }
+}
+
+BldEventBuilderPool::~BldEventBuilderPool()
+{
+    for(unsigned i = 0; i < _partitions.size(); i++) {
+        Partition* p = _partitions[i];
+        pthread_mutex_lock(&p->lock);
+        p->done = true;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+        pthread_join(p->thread, NULL);
+        pthread_mutex_destroy(&p->lock);
+        pthread_cond_destroy (&p->cond);
+        delete p->builder;
+        delete p;
+    }
+}
+
+int BldEventBuilderPool::process(unsigned source, const char* buff, size_t sz)
+{
+    unsigned n = _partitions.size();
+    int nevents = 0;
+
+    //  One pass over the (small) packet per partition keeps the lock
+    //  to once per packet and partition
+    for(unsigned i = 0; i < n; i++) {
+        BldEventIterator it(buff, sz);
+        if(!it.valid()) {
+            syslog(LOG_ERR, "<E> BldEventBuilderPool: size of packet error: source %u, sz %u",
+                   source, unsigned(sz));
+            return 0;
+        }
+
+        Partition* p = _partitions[i];
+        pthread_mutex_lock(&p->lock);
+        unsigned ninput = p->ninput;
+        do {
+            const BldEvent& ev = *it;
+            if((ev.pulseId % n) != i)
+                continue;
+            if(p->ninput == p->input.size())
+                p->input.resize(p->ninput+1);
+            Queued& q = p->input[p->ninput++];
+            q.source  = source;
+            q.event   = ev;
+        } while(it.next());
+        if(p->ninput != ninput) {
+            nevents += p->ninput - ninput;
+            pthread_cond_signal(&p->cond);
+        }
+        pthread_mutex_unlock(&p->lock);
+    }
+    return nevents;
+}
+
+void BldEventBuilderPool::flush()
+{
+    for(unsigned i = 0; i < _partitions.size(); i++) {
+        Partition* p = _partitions[i];
+        pthread_mutex_lock(&p->lock);
+        p->flush = true;
+        pthread_cond_broadcast(&p->cond);
+        while(p->flush || p->busy || p->ninput)
+            pthread_cond_wait(&p->cond, &p->lock);
+        pthread_mutex_unlock(&p->lock);
+    }
+}
+
+void* BldEventBuilderPool::_thread(void* arg)
+{
+    Partition* p = reinterpret_cast<Partition*>(arg);
+
+    pthread_mutex_lock(&p->lock);
+    while(1) {
+        while(!p->ninput && !p->flush && !p->done)
+            pthread_cond_wait(&p->cond, &p->lock);
+
+        p->input.swap(p->work);
+        unsigned n     = p->ninput;
+        bool     flush = p->flush;
+        bool     done  = p->done;
+        p->ninput = 0;
+        p->flush  = false;
+        p->busy   = true;
+        pthread_mutex_unlock(&p->lock);
+
+        for(unsigned i = 0; i < n; i++)
+            p->builder->insert(p->work[i].source, p->work[i].event);
+        if(flush || done)
+            p->builder->flush();
+
+        pthread_mutex_lock(&p->lock);
+        p->busy = false;
+        pthread_cond_broadcast(&p->cond);
+        if(done)
+            break;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+static uint64_t monotonicNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+}
+
+BldCoalescer::BldCoalescer(SocketAPISpace::socketAPIInterface& out,
+                           unsigned maxBytes, unsigned deadlineUs) :
+    _out          (out),
+    _maxWords     (maxBytes/sizeof(uint32_t)),
+    _deadline     (uint64_t(deadlineUs)*1000),
+    _running      (false),
+    _buff         (maxBytes/sizeof(uint32_t)),
+    _nwords       (0),
+    _nchn         (0),
+    _mask         (0),
+    _pulseId      (0),
+    _timeStamp    (0),
+    _opened       (0),
+    _events       (0),
+    _packets      (0),
+    _flushFull    (0),
+    _flushBreak   (0),
+    _flushDeadline(0)
+{
+    pthread_mutex_init(&_lock, NULL);
+}
+
+BldCoalescer::~BldCoalescer()
+{
+    if(_running) {
+        pthread_mutex_lock(&_lock);
+        _running = false;
+        pthread_mutex_unlock(&_lock);
+        pthread_join(_thread, NULL);
+    }
+    flush();
+    pthread_mutex_destroy(&_lock);
+}
+
+bool BldCoalescer::startTimer()
+{
+    _running = true;
+    if(pthread_create(&_thread, NULL, &_timer, this)) {
+        syslog(LOG_ERR, "<E> BldCoalescer: failed to create timer thread");
+        _running = false;
+    }
+    return _running;
+}
+
+void* BldCoalescer::_timer(void* arg)
+{
+    BldCoalescer& c = *reinterpret_cast<BldCoalescer*>(arg);
+    unsigned us = c._deadline/4000;
+    if(us < 100)
+        us = 100;
+
+    while(1) {
+        usleep(us);
+        pthread_mutex_lock(&c._lock);
+        bool running = c._running;
+        if(c._nwords && monotonicNs() - c._opened >= c._deadline) {
+            c._flushDeadline++;
+            c._flush();
+        }
+        pthread_mutex_unlock(&c._lock);
+        if(!running)
+            break;
+    }
+    return 0;
+}
+
+void BldCoalescer::add(const BldEvent& ev)
+{
+    pthread_mutex_lock(&_lock);
+
+    unsigned nchn = __builtin_popcount(ev.mask);
+
+    if(_nwords) {
+        uint64_t dpid = ev.pulseId   - _pulseId;
+        uint64_t dts  = ev.timeStamp - _timeStamp;
+        if(ev.mask != _mask || ev.pulseId < _pulseId || ev.timeStamp < _timeStamp ||
+           dpid > 0xfff || dts > 0xfffff) {
+            _flushBreak++;
+            _flush();
+        }
+    }
+
+    if(!_nwords) {
+        if(7 + nchn > _maxWords) {  // header, channels and valid mask
+            syslog(LOG_ERR, "<E> BldCoalescer: event of %u channels exceeds %u bytes",
+                   nchn, unsigned(_maxWords*sizeof(uint32_t)));
+            pthread_mutex_unlock(&_lock);
+            return;
+        }
+        uint32_t* p = &_buff[0];
+        p[0] = ev.timeStamp & 0xffffffff;
+        p[1] = ev.timeStamp >> 32;
+        p[2] = ev.pulseId   & 0xffffffff;
+        p[3] = ev.pulseId   >> 32;
+        p[4] = ev.mask;
+        p[5] = ev.beam;
+        _nwords    = 6;
+        _nchn      = nchn;
+        _mask      = ev.mask;
+        _pulseId   = ev.pulseId;
+        _timeStamp = ev.timeStamp;
+        _opened    = monotonicNs();
+    }
+    else {
+        _buff[_nwords++] = uint32_t((ev.timeStamp - _timeStamp) & 0xfffff) |
+                           uint32_t((ev.pulseId   - _pulseId  ) << 20);
+        _buff[_nwords++] = ev.beam;
+    }
+
+    for(unsigned i = 0; i < nchn && i < ev.channels.size(); i++)
+        _buff[_nwords++] = ev.channels[i];
+    for(unsigned i = ev.channels.size(); i < nchn; i++)
+        _buff[_nwords++] = 0;
+    _buff[_nwords++] = ev.valid;
+    _events++;
+
+    if(_nwords + 2 + nchn + 1 > _maxWords) {
+        _flushFull++;
+        _flush();
+    }
+    else if(monotonicNs() - _opened >= _deadline) {
+        _flushDeadline++;
+        _flush();
+    }
+
+    pthread_mutex_unlock(&_lock);
+}
+
+void BldCoalescer::poll()
+{
+    pthread_mutex_lock(&_lock);
+    if(_nwords && monotonicNs() - _opened >= _deadline) {
+        _flushDeadline++;
+        _flush();
+    }
+    pthread_mutex_unlock(&_lock);
+}
+
+void BldCoalescer::flush()
+{
+    pthread_mutex_lock(&_lock);
+    _flush();
+    pthread_mutex_unlock(&_lock);
+}
+
+void BldCoalescer::_flush()
+{
+    if(!_nwords)
+        return;
+    _out.sendRawData(_nwords*sizeof(uint32_t), reinterpret_cast<const char*>(&_buff[0]));
+    _packets++;
+    _nwords = 0;
+}
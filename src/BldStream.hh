@@ -0,0 +1,231 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef BldStream_hh
+#define BldStream_hh
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <vector>
+#include <deque>
+
+namespace SocketAPISpace { class socketAPIInterface; }
+
+//
+//  BLD packet (32-bit words)
+//
+//  first event
+//    0     timestamp nanoseconds
+//    1     timestamp seconds
+//    2     pulse ID lower word
+//    3     pulse ID upper word
+//    4     channel mask
+//    5     beam/service mask
+//    then one word for each channel in the mask (lowest first)
+//    valid mask
+//  each following event
+//    0     [19:0] timestamp delta, [31:20] pulse ID delta from the first event
+//    1     beam/service mask
+//    then one word for each channel in the mask
+//    valid mask
+//
+namespace Bld {
+    class BldEvent {
+        public:
+            uint64_t  timeStamp;
+            uint64_t  pulseId;
+            uint32_t  mask;
+            uint32_t  beam;
+            std::vector<uint32_t> channels;
+            uint32_t  valid;
+    };
+
+    class BldEventIterator {
+        public:
+            BldEventIterator(const char* b, size_t sz);
+        public:
+            // false if the packet size does not match its channel mask
+            bool     valid() const { return !_error; }
+            bool     next ();
+            const BldEvent& operator*() const { return v; }
+        private:
+            void     first(size_t sz);
+        private:
+            const uint32_t* _buff;
+            const uint32_t* _end;
+            const uint32_t* _next;
+            bool            _error;
+            BldEvent        v;
+    }; /* class BldEventIterator */
+
+    //  Events of all sources for one pulse ID
+    class BldCombined {
+        public:
+            uint64_t  pulseId;
+            uint64_t  timeStamp;
+            uint32_t  contributors;            // bit per source that delivered its event
+            std::vector<BldEvent> events;      // indexed by source, valid for the contributors
+    };
+
+    class BldCombinedHandler {
+        public:
+            virtual ~BldCombinedHandler() {}
+            // complete when contributors covers all sources
+            virtual void process(const BldCombined& event, bool complete) = 0;
+    };
+
+    //
+    //  Merges the BLD streams of several sources (carriers) by pulse ID.
+    //  Pending events are emitted in pulse ID order, either complete or,
+    //  once the newest pulse ID seen is more than window beyond them,
+    //  partial with the mask of sources that contributed.
+    //  With npartitions > 1 this builder only accepts pulse IDs where
+    //  pulseId % npartitions == partition.
+    //
+    class BldEventBuilder {
+        public:
+            BldEventBuilder(BldCombinedHandler& handler, unsigned nsources, uint64_t window,
+                            unsigned partition=0, unsigned npartitions=1);
+            virtual ~BldEventBuilder();
+
+            // decode one packet of a source; returns the number of events accepted
+            int      process(unsigned source, const char* buff, size_t sz);
+            void     insert (unsigned source, const BldEvent& event);
+            // emit all pending events
+            void     flush  ();
+
+            uint64_t complete () const { return _complete; }
+            uint64_t partial  () const { return _partial; }
+            uint64_t late     () const { return _late; }        // contributions after their pulse ID was emitted
+            uint64_t missing  () const { return _missing; }     // contributions absent from partial events
+            uint64_t duplicate() const { return _duplicate; }   // second contribution of a source to a pulse ID
+            uint64_t errors   () const { return _errors; }      // malformed packets
+            unsigned pending  () const { return _pending.size(); }
+
+        private:
+            void     _emit  (uint64_t newest);
+            BldCombined* _alloc();
+
+        private:
+            BldCombinedHandler&       _handler;
+            unsigned                  _nsources;
+            uint32_t                  _all;
+            uint64_t                  _window;
+            unsigned                  _partition;
+            unsigned                  _npartitions;
+            std::deque<BldCombined*>  _pending;        // ascending pulse ID
+            std::vector<BldCombined*> _free;
+            bool                      _emitted;
+            uint64_t                  _lastEmitted;
+            uint64_t                  _newest;
+            uint64_t                  _complete;
+            uint64_t                  _partial;
+            uint64_t                  _late;
+            uint64_t                  _missing;
+            uint64_t                  _duplicate;
+            uint64_t                  _errors;
+    }; /* class BldEventBuilder */
+
+    //
+    //  Spreads the event building over npartitions threads by pulse ID.
+    //  process() may be called from one receive thread per source; the
+    //  handler is called from the partition threads.
+    //
+    class BldEventBuilderPool {
+        public:
+            BldEventBuilderPool(BldCombinedHandler& handler, unsigned nsources, uint64_t window,
+                                unsigned npartitions);
+            virtual ~BldEventBuilderPool();
+
+            int      process(unsigned source, const char* buff, size_t sz);
+            // wait for the queued events and emit everything pending
+            void     flush  ();
+
+            unsigned               partitions() const { return _partitions.size(); }
+            const BldEventBuilder& builder(unsigned i) const { return *_partitions[i]->builder; }
+
+        private:
+            class Queued {
+                public:
+                    unsigned source;
+                    BldEvent event;
+            };
+            class Partition {
+                public:
+                    BldEventBuilder*    builder;
+                    pthread_t           thread;
+                    pthread_mutex_t     lock;
+                    pthread_cond_t      cond;
+                    std::vector<Queued> input;
+                    std::vector<Queued> work;
+                    unsigned            ninput;
+                    bool                busy;
+                    bool                flush;
+                    bool                done;
+            };
+            static void* _thread(void*);
+
+        private:
+            std::vector<Partition*> _partitions;
+    }; /* class BldEventBuilderPool */
+
+    //
+    //  Packs events with the same channel mask into BLD packets of at most
+    //  maxBytes, delta encoding the events after the first.  A packet is
+    //  sent when the next event does not fit (size, mask or delta range)
+    //  or when its first event is older than the deadline.  The deadline
+    //  is checked on add() and poll(), or by the timer thread.
+    //
+    class BldCoalescer {
+        public:
+            BldCoalescer(SocketAPISpace::socketAPIInterface& out,
+                         unsigned maxBytes=1472, unsigned deadlineUs=1000);
+            virtual ~BldCoalescer();
+
+            void     add  (const BldEvent& event);
+            void     flush();
+            void     poll ();
+            // poll from a thread every quarter deadline
+            bool     startTimer();
+
+            uint64_t events        () const { return _events; }
+            uint64_t packets       () const { return _packets; }
+            uint64_t flushFull     () const { return _flushFull; }      // packet reached maxBytes
+            uint64_t flushBreak    () const { return _flushBreak; }     // mask change or delta out of range
+            uint64_t flushDeadline () const { return _flushDeadline; }
+
+        private:
+            void     _flush();
+            static void* _timer(void*);
+
+        private:
+            SocketAPISpace::socketAPIInterface& _out;
+            unsigned              _maxWords;
+            uint64_t              _deadline;           // ns
+            pthread_mutex_t       _lock;
+            pthread_t             _thread;
+            bool                  _running;
+            std::vector<uint32_t> _buff;
+            unsigned              _nwords;
+            unsigned              _nchn;
+            uint32_t              _mask;
+            uint64_t              _pulseId;            // of the first event
+            uint64_t              _timeStamp;
+            uint64_t              _opened;             // ns
+            uint64_t              _events;
+            uint64_t              _packets;
+            uint64_t              _flushFull;
+            uint64_t              _flushBreak;
+            uint64_t              _flushDeadline;
+    }; /* class BldCoalescer */
+
+} /* namespace Bld */
+
+#endif /* BldStream_hh */
@@ -0,0 +1,153 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "BsaCapture.hh"
+#include "BsaDefs.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+using namespace Bsa;
+
+int BsaCapture::_fd = -1;
+
+static uint64_t        _start = 0;
+static uint64_t        _bytes = 0;
+static pthread_mutex_t _lock  = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t _clock(clockid_t id)
+{
+  timespec tv;
+  clock_gettime(id, &tv);
+  return uint64_t(tv.tv_sec)*1000000000ULL + tv.tv_nsec;
+}
+
+bool BsaCapture::open(const char* path)
+{
+  close();
+
+  int fd = ::open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (fd < 0) {
+    syslog(LOG_ERR,"<E> BsaCapture: open %s failed: %s", path, strerror(errno));
+    return false;
+  }
+
+  CaptureHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, "BSAC", 4);
+  h.version   = 1;
+  h.realtime  = _clock(CLOCK_REALTIME);
+  h.monotonic = _clock(CLOCK_MONOTONIC);
+  if (::write(fd, &h, sizeof(h)) != ssize_t(sizeof(h))) {
+    syslog(LOG_ERR,"<E> BsaCapture: write %s failed: %s", path, strerror(errno));
+    ::close(fd);
+    return false;
+  }
+
+  _start = h.monotonic;
+  _bytes = sizeof(h);
+  _fd    = fd;
+
+  syslog(LOG_INFO,"<I> BsaCapture: recording to %s", path);
+  return true;
+}
+
+void BsaCapture::close()
+{
+  pthread_mutex_lock(&_lock);
+  if (_fd >= 0) {
+    ::close(_fd);
+    _fd = -1;
+  }
+  pthread_mutex_unlock(&_lock);
+}
+
+uint64_t BsaCapture::bytes()
+{
+  return _bytes;
+}
+
+void BsaCapture::_write(unsigned    type,
+                        const void* p0, size_t n0,
+                        const void* p1, size_t n1)
+{
+  static const uint64_t zero = 0;
+
+  CaptureEvent e;
+  e.type  = type;
+  e.bytes = n0+n1;
+  e.time  = _clock(CLOCK_MONOTONIC) - _start;
+
+  iovec iov[4];
+  unsigned niov = 0;
+  iov[niov].iov_base = &e;              iov[niov++].iov_len = sizeof(e);
+  if (n0) { iov[niov].iov_base = const_cast<void*>(p0); iov[niov++].iov_len = n0; }
+  if (n1) { iov[niov].iov_base = const_cast<void*>(p1); iov[niov++].iov_len = n1; }
+  size_t pad = (8 - (e.bytes&7))&7;
+  if (pad) { iov[niov].iov_base = const_cast<uint64_t*>(&zero); iov[niov++].iov_len = pad; }
+
+  size_t len = sizeof(e) + e.bytes + pad;
+
+  pthread_mutex_lock(&_lock);
+  if (_fd >= 0) {
+    if (::writev(_fd, iov, niov) == ssize_t(len))
+      _bytes += len;
+    else {
+      //  A short capture is useless for replay; stop recording
+      syslog(LOG_ERR,"<E> BsaCapture: write failed: %s", strerror(errno));
+      ::close(_fd);
+      _fd = -1;
+    }
+  }
+  pthread_mutex_unlock(&_lock);
+}
+
+void BsaCapture::_regs(unsigned        target,
+                       unsigned        first,
+                       unsigned        n,
+                       const uint64_t* v)
+{
+  CaptureRegsHeader h;
+  h.target   = target;
+  h.first    = first;
+  h.n        = n;
+  h.reserved = 0;
+  _write(CaptureRegs, &h, sizeof(h), v, n*sizeof(uint64_t));
+}
+
+void BsaCapture::dram(uint64_t    begin,
+                      uint64_t    end,
+                      const void* data)
+{
+  uint64_t range[2] = { begin, end };
+  _write(CaptureDram, range, sizeof(range), data, end-begin);
+}
+
+void BsaCapture::poll()
+{
+  _write(CapturePoll, 0, 0);
+}
+
+void BsaCapture::layout(const std::vector<uint64_t>& begin,
+                        const std::vector<uint64_t>& end)
+{
+  uint64_t v[2*HSTARRAYN];
+  memset(v, 0, sizeof(v));
+  for(unsigned i=0; i<HSTARRAYN && i<begin.size() && i<end.size(); i++) {
+    v[i]           = begin[i];
+    v[HSTARRAYN+i] = end  [i];
+  }
+  _write(CaptureLayout, v, sizeof(v));
+}
@@ -0,0 +1,95 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef Bsa_BsaCapture_hh
+#define Bsa_BsaCapture_hh
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace Bsa {
+  //
+  //  Capture file: a CaptureHeader followed by events, each a CaptureEvent
+  //  and its payload padded to 8 bytes
+  //
+  enum CaptureType { CaptureLayout,   // uint64_t begin[HSTARRAYN], end[HSTARRAYN]
+                     CaptureRegs,     // CaptureRegsHeader, uint64_t v[n]
+                     CaptureDram,     // uint64_t begin, end, then the bytes
+                     CapturePoll };   // (none) a poll of all arrays
+
+  struct CaptureHeader {
+    char     magic[4];    // "BSAC"
+    uint32_t version;
+    uint64_t realtime;    // CLOCK_REALTIME ns when opened
+    uint64_t monotonic;   // CLOCK_MONOTONIC ns when opened
+    uint64_t reserved;
+  };
+
+  struct CaptureEvent {
+    uint32_t type;        // CaptureType
+    uint32_t bytes;       // payload, before padding
+    uint64_t time;        // ns since opened
+  };
+
+  struct CaptureRegsHeader {
+    uint32_t target;      // TraceTarget
+    uint32_t first;       // first array
+    uint32_t n;           // arrays
+    uint32_t reserved;
+  };
+
+  //
+  //  Recorder of the values AmcCarrierBase reads from the hardware, so that
+  //  a session can be replayed offline through AmcCarrierReplay.
+  //
+  //  Each register read and DRAM block is appended to the file as it is
+  //  read; each poll of all arrays marks a round of the replay.  Unlike
+  //  BsaTrace, the capture keeps the data and grows without bound, so it
+  //  is meant for short sessions and is only opened explicitly (bsa_tst -C),
+  //  never from the environment.
+  //
+  class BsaCapture {
+  public:
+    static bool     open   (const char* path);
+    static void     close  ();
+    static bool     enabled() { return _fd >= 0; }
+    static uint64_t bytes  ();
+    template <class T>
+    static void     regs   (unsigned target,
+                            unsigned first,
+                            unsigned n,
+                            const T* v)
+    {
+      uint64_t u[64];
+      if (n > 64) n = 64;
+      for(unsigned i=0; i<n; i++)
+        u[i] = v[i];
+      _regs(target, first, n, u);
+    }
+    static void     dram   (uint64_t    begin,
+                            uint64_t    end,
+                            const void* data);
+    static void     poll   ();
+    static void     layout (const std::vector<uint64_t>& begin,
+                            const std::vector<uint64_t>& end);
+  private:
+    static void     _regs  (unsigned target,
+                            unsigned first,
+                            unsigned n,
+                            const uint64_t* v);
+    static void     _write (unsigned    type,
+                            const void* p0, size_t n0,
+                            const void* p1=0, size_t n1=0);
+  private:
+    static int      _fd;
+  };
+};
+
+#endif
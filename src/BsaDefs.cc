@@ -10,6 +10,7 @@
 #include <BsaDefs.hh>
 
 #include <math.h>
+#include <string.h>
  
 using namespace Bsa;
 
@@ -73,3 +74,34 @@ uint64_t Entry::pulseId() const
   v |= data[1];
   return v;
 }
+
+//
+//  The text thrown by the compatibility wrappers
+//
+const char* Bsa::statusText(BsaStatus s)
+{
+  static const char* _text[] = { "ok",
+                                 "fetch begin out of bounds",
+                                 "fetch end out of bounds",
+                                 "fetch no data to read",
+                                 "Wrap flag issue",
+                                 "Entries > MAXSIZE",
+                                 "Too many entries",
+                                 "fault buffer not ready",
+                                 "readout aborted",
+                                 "hardware access failed" };
+  return unsigned(s) < NumBsaStatus ? _text[s] : "unknown status";
+}
+
+void StatusCounts::clear()
+{
+  memset(_n, 0, sizeof(_n));
+}
+
+uint64_t StatusCounts::errors() const
+{
+  uint64_t v = 0;
+  for(unsigned i=BsaOk+1; i<NumBsaStatus; i++)
+    v += _n[i];
+  return v;
+}
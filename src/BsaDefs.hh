@@ -38,6 +38,7 @@ namespace Bsa {
     unsigned nchannels() const;
     uint64_t pulseId  () const;
   private:
+    friend class SoftBsa;
     uint32_t  data[3];
   public:
     ChannelData channel_data[31];
@@ -66,6 +67,38 @@ namespace Bsa {
     unsigned nacq;
   };
 
+  //
+  //  Result of a buffer fetch, a fault readout, or an update
+  //
+  enum BsaStatus { BsaOk,
+                   BsaBeginOutOfBounds,   // fetch start outside the array's buffer
+                   BsaEndOutOfBounds,     // write pointer outside the array's buffer
+                   BsaNoData,             // nothing written and no wrap
+                   BsaWrapFlag,           // write pointer behind the read but no wrap flag
+                   BsaOversize,           // more entries than the array can hold
+                   BsaReadoutSize,        // fault readout larger than the record
+                   BsaNotReady,           // fault buffer still being written
+                   BsaAborted,            // fault readout aborted by a previous error
+                   BsaHardware,           // register or memory access failed
+                   NumBsaStatus };
+
+  const char* statusText(BsaStatus);
+
+  //
+  //  Count of results in each category
+  //
+  class StatusCounts {
+  public:
+    StatusCounts() { clear(); }
+  public:
+    void     clear();
+    void     count(BsaStatus s) { _n[s]++; }
+    uint64_t operator[](unsigned s) const { return _n[s]; }
+    uint64_t errors() const;   // all but BsaOk
+  private:
+    uint64_t _n[NumBsaStatus];
+  };
+
   class RingState {
   public:
     uint64_t begAddr;
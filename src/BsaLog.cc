@@ -0,0 +1,336 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "BsaLog.hh"
+#include "BsaDefs.hh"
+#include "BsaRealTime.hh"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <syslog.h>
+
+using namespace Bsa;
+
+namespace Bsa {
+  class LogEvent {
+  public:
+    uint64_t time;        // CLOCK_REALTIME ns
+    uint16_t code;
+    uint16_t array;
+    uint32_t reserved;
+    uint64_t arg[5];
+  };
+};
+
+struct LogFormat {
+  int         priority;
+  const char* source;
+  const char* format;     // of the five arguments as unsigned long long
+};
+
+static const LogFormat _formats[] = {
+  { LOG_WARNING, "Processor.cc"     , "[reset]: not ready 0x%09llx  wrAddr 0x%09llx" },
+  { LOG_WARNING, "Processor.cc"     , "[reset] misaligned _last 0x%09llx" },
+  { LOG_DEBUG  , "Processor.cc"     , "[reset]  _timestamp 0x%016llx  _next 0x%09llx  _last 0x%09llx  _end 0x%09llx  done 0x%09llx" },
+  { LOG_ERR    , "Processor.cc"     , "[Reader::next] allocating record with %llu entries" },
+  { LOG_ERR    , "Processor.cc"     , "[Misaligned record]  _next 0x%09llx  nch %llu  pid 0x%09llx" },
+  { LOG_ERR    , "Processor.cc"     , "[Truncated record]  _next 0x%09llx  next 0x%09llx  _last 0x%09llx  _end 0x%09llx  n %llu" },
+  { LOG_DEBUG  , "Processor.cc"     , "[done]  hw.done 0x%09llx" },
+  { LOG_DEBUG  , "Processor.cc"     , "[ProcessorImpl] next 0x%09llx" },
+  { LOG_WARNING, "Processor.cc"     , "[ProcessorImpl] sharing the carrier interface" },
+  { LOG_DEBUG  , "Processor.cc"     , "NEW TS [%llu.%09llu -> %llu.%09llu]  wrAddr 0x%09llx" },
+  { LOG_DEBUG  , "Processor.cc"     , "wrAddr 0x%09llx  next 0x%09llx  clear %llu  wrap %llu  nacq %llu" },
+  { LOG_ERR    , "Processor.cc"     , "update failed (status %llu). abort. next 0x%09llx  wrAddr 0x%09llx  ts 0x%016llx" },
+  { LOG_DEBUG  , "AmcCarrierBase.cc", "startAddr 0x%09llx  endAddr 0x%09llx" },
+  { LOG_INFO   , "AmcCarrierBase.cc", "initialized with %llu ranged writes in %llu us; one single-element write took %llu us, so %llu per-array writes would take ~%llu us (estimated)" },
+  { LOG_ERR    , "AmcCarrierBase.cc", "[Begin out of bounds]  begin 0x%09llx  startAddr 0x%09llx  endAddr 0x%09llx" },
+  { LOG_ERR    , "AmcCarrierBase.cc", "[End out of bounds]  wrAddr 0x%09llx  startAddr 0x%09llx  endAddr 0x%09llx" },
+  { LOG_ERR    , "AmcCarrierBase.cc", "[No data to read]  wrAddr 0x%09llx" },
+  { LOG_ERR    , "AmcCarrierBase.cc", "[Wrap flag issue] reading %llu entries (begin 0x%09llx, end 0x%09llx)" },
+  { LOG_ERR    , "AmcCarrierBase.cc", "[oversize] reading %llu entries (begin 0x%09llx, end 0x%09llx)" },
+  { LOG_WARNING, "Processor.cc"     , "[resync] dropped %llu entries, kept %llu" },
+};
+
+static const char _letter[] = { 'M', 'A', 'C', 'E', 'W', 'N', 'I', 'D' };
+
+//
+//  Bounded ring with a sequence number per cell, so that producers claim
+//  cells with one compare-and-swap and the consumer needs no lock against them
+//
+static const unsigned RING_SIZE = 4096;
+
+struct LogCell {
+  uint64_t seq;
+  LogEvent ev;
+} __attribute__((aligned(64)));
+
+static LogCell         _ring[RING_SIZE];
+static uint64_t        _head = 0;
+static uint64_t        _tail = 0;
+static volatile int    _mask = 0xff;
+static uint64_t        _posted     = 0;
+static uint64_t        _dropped    = 0;
+static uint64_t        _suppressed = 0;
+static pthread_once_t  _once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t _consumer = PTHREAD_MUTEX_INITIALIZER;
+
+//
+//  Rate and repeat state for each code and array
+//
+class LogLimit {
+public:
+  uint64_t window;
+  unsigned count;
+  uint64_t repeats;
+  uint64_t suppressed;
+  bool     valid;
+  uint64_t last[5];
+};
+
+static unsigned _burst    = 5;
+static unsigned _interval = 1;
+static LogLimit _limits[NumLogCodes][HSTARRAYN+1];
+
+char* Bsa::timestr(char* buf, size_t len, time_t t)
+{
+  struct tm tm;
+  localtime_r(&t, &tm);
+  strftime(buf, len, "%a %b %e %H:%M:%S %Y", &tm);
+  return buf;
+}
+
+static void _emit(const LogEvent& ev, const char* suffix)
+{
+  const LogFormat& f = _formats[ev.code];
+  char tbuf[32];
+  char msg[256];
+  snprintf(msg, sizeof(msg), f.format,
+           (unsigned long long)ev.arg[0], (unsigned long long)ev.arg[1],
+           (unsigned long long)ev.arg[2], (unsigned long long)ev.arg[3],
+           (unsigned long long)ev.arg[4]);
+  timestr(tbuf, sizeof(tbuf), ev.time/1000000000ULL);
+  if (ev.array == LogNoArray)
+    syslog(f.priority, "<%c> %s:  %s  %s%s",
+           _letter[f.priority&7], tbuf, f.source, msg, suffix);
+  else
+    syslog(f.priority, "<%c> %s:  %s  array %u  %s%s",
+           _letter[f.priority&7], tbuf, f.source, ev.array, msg, suffix);
+}
+
+//
+//  Report what was held back for one code and array, once per interval
+//
+static void _report(LogLimit& l, LogEvent& ev)
+{
+  if (l.repeats || l.suppressed) {
+    char suffix[80];
+    memcpy(ev.arg, l.last, sizeof(ev.arg));
+    snprintf(suffix, sizeof(suffix), "  [last repeated %llu times, %llu others suppressed]",
+             (unsigned long long)l.repeats, (unsigned long long)l.suppressed);
+    _emit(ev, suffix);
+    l.repeats    = 0;
+    l.suppressed = 0;
+  }
+}
+
+static void _format(LogEvent& ev)
+{
+  unsigned  ia = ev.array < HSTARRAYN ? ev.array : unsigned(HSTARRAYN);
+  LogLimit& l  = _limits[ev.code][ia];
+
+  uint64_t window = ev.time/(1000000000ULL*_interval);
+  if (window != l.window) {
+    LogEvent rev = ev;
+    _report(l, rev);
+    l.window = window;
+    l.count  = 0;
+  }
+
+  if (l.valid && memcmp(l.last, ev.arg, sizeof(l.last))==0) {
+    l.repeats++;
+    __atomic_fetch_add(&_suppressed, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  memcpy(l.last, ev.arg, sizeof(l.last));
+  l.valid = true;
+
+  if (l.count >= _burst) {
+    l.suppressed++;
+    __atomic_fetch_add(&_suppressed, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  l.count++;
+  _emit(ev, "");
+}
+
+//
+//  Report held back messages whose interval has passed
+//
+static void _sweep(uint64_t now)
+{
+  uint64_t window = now/(1000000000ULL*_interval);
+  for(unsigned code=0; code<NumLogCodes; code++)
+    for(unsigned ia=0; ia<=HSTARRAYN; ia++) {
+      LogLimit& l = _limits[code][ia];
+      if (l.window != window && (l.repeats || l.suppressed)) {
+        LogEvent ev;
+        ev.time  = now;
+        ev.code  = code;
+        ev.array = ia < HSTARRAYN ? ia : unsigned(LogNoArray);
+        _report(l, ev);
+        l.valid = false;
+      }
+    }
+}
+
+static uint64_t _now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return uint64_t(ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+}
+
+//
+//  Format the events in the ring; returns the number formatted
+//
+static unsigned _drain()
+{
+  unsigned n = 0;
+  pthread_mutex_lock(&_consumer);
+  while(1) {
+    LogCell& c = _ring[_tail % RING_SIZE];
+    if (__atomic_load_n(&c.seq, __ATOMIC_ACQUIRE) != _tail+1)
+      break;
+    LogEvent ev = c.ev;
+    __atomic_store_n(&c.seq, _tail+RING_SIZE, __ATOMIC_RELEASE);
+    _tail++;
+    _format(ev);
+    n++;
+  }
+  pthread_mutex_unlock(&_consumer);
+  return n;
+}
+
+static void* _formatter(void*)
+{
+  BsaRealTime::worker();
+  uint64_t last = 0;
+  uint64_t reported = 0;
+  while(1) {
+    if (!_drain())
+      usleep(10000);
+
+    uint64_t now = _now();
+    if (now - last > 1000000000ULL) {
+      last  = now;
+      _mask = setlogmask(0);
+      pthread_mutex_lock(&_consumer);
+      _sweep(now);
+      pthread_mutex_unlock(&_consumer);
+      uint64_t dropped = __atomic_load_n(&_dropped, __ATOMIC_RELAXED);
+      if (dropped != reported) {
+        syslog(LOG_WARNING, "<W> BsaLog: %llu messages dropped on a full ring",
+               (unsigned long long)(dropped-reported));
+        reported = dropped;
+      }
+    }
+  }
+  return 0;
+}
+
+static void _start()
+{
+  for(unsigned i=0; i<RING_SIZE; i++)
+    _ring[i].seq = i;
+  for(unsigned code=0; code<NumLogCodes; code++)
+    for(unsigned ia=0; ia<=HSTARRAYN; ia++)
+      memset(&_limits[code][ia], 0, sizeof(LogLimit));
+  _mask = setlogmask(0);
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_t thr;
+  if (pthread_create(&thr, &attr, _formatter, 0))
+    syslog(LOG_ERR, "<E> BsaLog: failed to start the formatter thread");
+  pthread_attr_destroy(&attr);
+}
+
+void BsaLog::post(LogCode  code,
+                  unsigned array,
+                  uint64_t a0,
+                  uint64_t a1,
+                  uint64_t a2,
+                  uint64_t a3,
+                  uint64_t a4)
+{
+  pthread_once(&_once, _start);
+
+  if (!(LOG_MASK(_formats[code].priority) & _mask))
+    return;
+
+  __atomic_fetch_add(&_posted, 1, __ATOMIC_RELAXED);
+
+  uint64_t pos = __atomic_load_n(&_head, __ATOMIC_RELAXED);
+  LogCell* c;
+  while(1) {
+    c = &_ring[pos % RING_SIZE];
+    uint64_t seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+    int64_t  dif = int64_t(seq) - int64_t(pos);
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&_head, &pos, pos+1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }
+    else if (dif < 0) {
+      __atomic_fetch_add(&_dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+    else
+      pos = __atomic_load_n(&_head, __ATOMIC_RELAXED);
+  }
+
+  LogEvent& ev = c->ev;
+  ev.time   = _now();
+  ev.code   = code;
+  ev.array  = array;
+  ev.arg[0] = a0;
+  ev.arg[1] = a1;
+  ev.arg[2] = a2;
+  ev.arg[3] = a3;
+  ev.arg[4] = a4;
+  __atomic_store_n(&c->seq, pos+1, __ATOMIC_RELEASE);
+}
+
+void BsaLog::start()
+{
+  pthread_once(&_once, _start);
+}
+
+void BsaLog::flush()
+{
+  pthread_once(&_once, _start);
+  _drain();
+}
+
+void BsaLog::setRate(unsigned burst,
+                     unsigned intervalSec)
+{
+  pthread_mutex_lock(&_consumer);
+  _burst    = burst;
+  _interval = intervalSec ? intervalSec : 1;
+  pthread_mutex_unlock(&_consumer);
+}
+
+uint64_t BsaLog::posted    () { return __atomic_load_n(&_posted    , __ATOMIC_RELAXED); }
+uint64_t BsaLog::dropped   () { return __atomic_load_n(&_dropped   , __ATOMIC_RELAXED); }
+uint64_t BsaLog::suppressed() { return __atomic_load_n(&_suppressed, __ATOMIC_RELAXED); }
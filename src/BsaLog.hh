@@ -0,0 +1,90 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef Bsa_BsaLog_hh
+#define Bsa_BsaLog_hh
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+namespace Bsa {
+  //
+  //  Messages of the readout path; the text of each is in BsaLog.cc
+  //
+  enum LogCode { LogResetNotReady,
+                 LogResetMisaligned,
+                 LogResetDone,
+                 LogReadoutSize,
+                 LogMisalignedRecord,
+                 LogTruncatedRecord,
+                 LogReadoutDone,
+                 LogProcessorNext,
+                 LogProcessorShared,
+                 LogNewAcquisition,
+                 LogFaultState,
+                 LogUpdateAbort,
+                 LogArrayLayout,
+                 LogInitialized,
+                 LogBeginOutOfBounds,
+                 LogEndOutOfBounds,
+                 LogNoData,
+                 LogWrapFlag,
+                 LogOversize,
+                 LogResync,
+                 NumLogCodes };
+
+  enum { LogNoArray = 0xffff };
+
+  //
+  //  Logging for the readout path.
+  //
+  //  post() records a binary event (code, array, up to five values) in a
+  //  lock-free ring and returns; it never formats or blocks.  A
+  //  background thread formats the events into syslog.  For each code and
+  //  array at most "burst" messages are written per interval; identical
+  //  repeats and the messages over the limit are counted and reported
+  //  once.  Events posted while the ring is full are dropped and counted.
+  //  Events below the syslog mask are discarded when posted.
+  //
+  class BsaLog {
+  public:
+    static void post(LogCode  code,
+                     unsigned array,
+                     uint64_t a0=0,
+                     uint64_t a1=0,
+                     uint64_t a2=0,
+                     uint64_t a3=0,
+                     uint64_t a4=0);
+    //
+    //  Start the formatter thread now rather than at the first post
+    //
+    static void start();
+    //
+    //  Format everything posted so far
+    //
+    static void flush();
+    //
+    //  Messages allowed per code and array in each interval
+    //
+    static void setRate(unsigned burst,
+                        unsigned intervalSec);
+  public:
+    static uint64_t posted    ();
+    static uint64_t dropped   ();
+    static uint64_t suppressed();   // repeats and messages over the rate
+  };
+
+  //
+  //  Reentrant replacement of asctime(localtime(&t)) without the newline
+  //
+  char* timestr(char* buf, size_t len, time_t t);
+};
+
+#endif
@@ -0,0 +1,334 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "BsaRealTime.hh"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT 4   // Linux 4.4
+#endif
+
+using namespace Bsa;
+
+void LatencyStats::clear()
+{
+  _n = _sum = _max = 0;
+  _min = ~0ULL;
+  memset(_bins, 0, sizeof(_bins));
+}
+
+void LatencyStats::record(uint64_t ns)
+{
+  _n++;
+  _sum += ns;
+  if (ns < _min) _min = ns;
+  if (ns > _max) _max = ns;
+  _bins[ns ? 63-__builtin_clzll(ns) : 0]++;
+}
+
+uint64_t LatencyStats::percentile(double p) const
+{
+  uint64_t n = 0, target = uint64_t(p*double(_n));
+  for(unsigned i=0; i<64; i++) {
+    n += _bins[i];
+    if (n > target)
+      return i<63 ? 2ULL<<i : ~0ULL;
+  }
+  return _max;
+}
+
+static pthread_once_t  _once    = PTHREAD_ONCE_INIT;
+static pthread_mutex_t _lock    = PTHREAD_MUTEX_INITIALIZER;
+static bool            _enabled = false;
+static bool            _prefault= true;
+static bool            _lockMem = true;
+static bool            _onFault = false;
+static bool            _pinCpus = false;
+static cpu_set_t       _cpus;
+static int             _fifo    = 0;
+static bool            _pinWorkers = false;
+static cpu_set_t       _workers;
+static int             _wfifo   = 0;
+static unsigned        _probeUs = 0;
+static LatencyStats    _wakeup;
+static LatencyStats    _updates;
+static uint64_t        _minflt  = 0;
+static uint64_t        _majflt  = 0;
+static int             _node    = -1;
+static uint64_t        _pages   = 0;
+static uint64_t        _local   = 0;
+static __thread bool   _pinned  = false;
+
+//
+//  CPU list as "2,3" or "2-3" (or a mix), separated by ','
+//
+static bool _parseCpus(const char* s, cpu_set_t* set)
+{
+  CPU_ZERO(set);
+  while(*s) {
+    char* e;
+    unsigned a = strtoul(s, &e, 0), b = a;
+    if (e == s)
+      return false;
+    if (*e == '-')
+      b = strtoul(e+1, &e, 0);
+    for(unsigned c=a; c<=b && c<CPU_SETSIZE; c++)
+      CPU_SET(c, set);
+    if (*e == ',')
+      e++;
+    else if (*e && *e != '\n')
+      return false;
+    else
+      break;
+    s = e;
+  }
+  return CPU_COUNT(set) > 0;
+}
+
+static bool _nodeCpus(unsigned node, cpu_set_t* set)
+{
+  char path[64], buff[256];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+  FILE* f = fopen(path, "r");
+  if (!f)
+    return false;
+  bool ok = fgets(buff, sizeof(buff), f) && _parseCpus(buff, set);
+  fclose(f);
+  return ok;
+}
+
+static void _apply(const char* who, bool pin, const cpu_set_t& cpus, int fifo)
+{
+  if (pin) {
+    int e = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (e)
+      syslog(LOG_ERR,"<E> BsaRealTime: pinning the %s thread failed: %s", who, strerror(e));
+  }
+  if (fifo) {
+    sched_param p;
+    p.sched_priority = fifo;
+    int e = pthread_setschedparam(pthread_self(), SCHED_FIFO, &p);
+    if (e)
+      syslog(LOG_ERR,"<E> BsaRealTime: SCHED_FIFO %d for the %s thread failed: %s",
+             fifo, who, strerror(e));
+  }
+}
+
+//
+//  Oversleep of a periodic thread on the readout CPUs
+//
+static void* _probe(void*)
+{
+  _apply("probe", _pinCpus, _cpus, _fifo);
+
+  const uint64_t period = uint64_t(_probeUs)*1000;
+  timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while(1) {
+    uint64_t t = uint64_t(next.tv_nsec) + period;
+    next.tv_sec  += t/1000000000ULL;
+    next.tv_nsec  = t%1000000000ULL;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, 0);
+    uint64_t late = BsaRealTime::now() -
+      (uint64_t(next.tv_sec)*1000000000ULL + next.tv_nsec);
+    pthread_mutex_lock(&_lock);
+    _wakeup.record(late);
+    pthread_mutex_unlock(&_lock);
+  }
+  return 0;
+}
+
+static void _init()
+{
+  const char* env = getenv("BSA_RT");
+  if (!env)
+    return;
+
+  char spec[256];
+  strncpy(spec, env, sizeof(spec)-1);
+  spec[sizeof(spec)-1] = 0;
+  for(char* save, *opt = strtok_r(spec, ":", &save); opt; opt = strtok_r(0, ":", &save)) {
+    char* v = strchr(opt, '=');
+    if (v) *v++ = 0;
+    if      (!strcmp(opt, "nolock"))     _lockMem  = false;
+    else if (!strcmp(opt, "noprefault")) _prefault = false;
+    else if (!strcmp(opt, "cpus") && v)  _pinCpus  = _parseCpus(v, &_cpus);
+    else if (!strcmp(opt, "node") && v)  _pinCpus  = _nodeCpus(strtoul(v,0,0), &_cpus);
+    else if (!strcmp(opt, "fifo") && v)  _fifo     = strtoul(v,0,0);
+    else if (!strcmp(opt, "workers") && v) _pinWorkers = _parseCpus(v, &_workers);
+    else if (!strcmp(opt, "wfifo") && v) _wfifo    = strtoul(v,0,0);
+    else if (!strcmp(opt, "probe") && v) _probeUs  = strtoul(v,0,0);
+    else if (*opt)
+      syslog(LOG_ERR,"<E> BsaRealTime: unknown option %s", opt);
+  }
+
+  //  Lock pages as they are first touched, not when mapped, so that the
+  //  prefault on the readout CPUs rather than this thread or the one
+  //  allocating decides their node
+  if (_lockMem && mlockall(MCL_CURRENT|MCL_FUTURE|MCL_ONFAULT) == 0)
+    _onFault = true;
+  else if (_lockMem) {
+    if (errno == EINVAL && mlockall(MCL_CURRENT|MCL_FUTURE) == 0)
+      syslog(LOG_WARNING,"<W> BsaRealTime: no MCL_ONFAULT, buffers are placed where they are allocated");
+    else
+      syslog(LOG_ERR,"<E> BsaRealTime: mlockall failed: %s", strerror(errno));
+  }
+
+  _enabled = true;
+
+  if (_probeUs) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thr;
+    if (pthread_create(&thr, &attr, _probe, 0))
+      syslog(LOG_ERR,"<E> BsaRealTime: failed to start the probe thread");
+    pthread_attr_destroy(&attr);
+  }
+
+  syslog(LOG_INFO,"<I> BsaRealTime: %s (lock %d, prefault %d, cpus %d, fifo %d, workers %d, probe %u us)",
+         env, _lockMem, _prefault, _pinCpus ? CPU_COUNT(&_cpus) : 0, _fifo,
+         _pinWorkers ? CPU_COUNT(&_workers) : 0, _probeUs);
+}
+
+bool BsaRealTime::enabled()
+{
+  pthread_once(&_once, _init);
+  return _enabled;
+}
+
+void BsaRealTime::readout()
+{
+  if (_pinned || !enabled())
+    return;
+  _apply("readout", _pinCpus, _cpus, _fifo);
+  _pinned = true;
+
+  //  Pages are locked when touched, so touch the stack updates will use
+  volatile char stack[64*1024];
+  memset(const_cast<char*>(stack), 0, sizeof(stack));
+}
+
+void BsaRealTime::worker()
+{
+  if (_pinned || !enabled())
+    return;
+  _apply("worker", _pinWorkers, _workers, _wfifo);
+  _pinned = true;
+}
+
+void BsaRealTime::prefault(Record& record)
+{
+  if (!enabled() || !_prefault)
+    return;
+
+  //  First touch places the pages on the node of the readout CPUs
+  cpu_set_t saved;
+  bool pin = _pinCpus &&
+    pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved) == 0 &&
+    pthread_setaffinity_np(pthread_self(), sizeof(_cpus), &_cpus) == 0;
+
+  size_t n = record.entries.size();
+  record.entries.resize(record.entries.capacity());
+  record.entries.resize(n);
+
+  //  Where the pages landed, against the node of the CPU doing the touch
+  unsigned cpu, node;
+  if (pin && syscall(SYS_getcpu, &cpu, &node, 0) == 0) {
+    _node = node;
+    const long  page  = sysconf(_SC_PAGESIZE);
+    const char* begin = reinterpret_cast<const char*>(record.entries.data());
+    const char* end   = begin + record.entries.capacity()*sizeof(Entry);
+    const char* p     = reinterpret_cast<const char*>(uintptr_t(begin) & ~uintptr_t(page-1));
+    while(p < end) {
+      enum { Batch = 256 };
+      void* pages [Batch];
+      int   status[Batch];
+      unsigned k;
+      for(k=0; k<Batch && p<end; k++, p+=page)
+        pages[k] = const_cast<char*>(p);
+      if (syscall(SYS_move_pages, 0, k, pages, 0, status, 0) < 0)
+        break;
+      for(unsigned i=0; i<k; i++) {
+        _pages++;
+        if (status[i] == int(node))
+          _local++;
+      }
+    }
+  }
+
+  if (pin)
+    pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+}
+
+void BsaRealTime::lock()
+{
+  if (!enabled() || !_lockMem)
+    return;
+
+  //  The readout buffers are placed; populate everything else now, and
+  //  keep later buffers (another Processor's) to be placed when touched
+  if (mlockall(MCL_CURRENT|MCL_FUTURE) < 0 ||
+      (_onFault && mlockall(MCL_CURRENT|MCL_FUTURE|MCL_ONFAULT) < 0))
+    syslog(LOG_ERR,"<E> BsaRealTime: mlockall failed: %s", strerror(errno));
+}
+
+int      BsaRealTime::readoutNode()         { return _node; }
+uint64_t BsaRealTime::prefaultPages()       { return _pages; }
+uint64_t BsaRealTime::localPages()          { return _local; }
+
+const LatencyStats& BsaRealTime::wakeup ()  { return _wakeup; }
+const LatencyStats& BsaRealTime::updates()  { return _updates; }
+uint64_t BsaRealTime::minorFaults()         { return _minflt; }
+uint64_t BsaRealTime::majorFaults()         { return _majflt; }
+
+void BsaRealTime::clearStats()
+{
+  pthread_mutex_lock(&_lock);
+  _wakeup .clear();
+  _updates.clear();
+  _minflt = _majflt = 0;
+  pthread_mutex_unlock(&_lock);
+}
+
+void BsaRealTime::updated(uint64_t ns, uint64_t minflt, uint64_t majflt)
+{
+  pthread_mutex_lock(&_lock);
+  _updates.record(ns);
+  _minflt += minflt;
+  _majflt += majflt;
+  pthread_mutex_unlock(&_lock);
+}
+
+uint64_t BsaRealTime::now()
+{
+  timespec tv;
+  clock_gettime(CLOCK_MONOTONIC, &tv);
+  return uint64_t(tv.tv_sec)*1000000000ULL + tv.tv_nsec;
+}
+
+void BsaRealTime::faults(uint64_t* minflt, uint64_t* majflt)
+{
+  rusage u;
+  getrusage(RUSAGE_THREAD, &u);
+  *minflt = u.ru_minflt;
+  *majflt = u.ru_majflt;
+}
@@ -0,0 +1,123 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef Bsa_BsaRealTime_hh
+#define Bsa_BsaRealTime_hh
+
+#include <stdint.h>
+#include <vector>
+
+#include "BsaDefs.hh"
+
+namespace Bsa {
+  //
+  //  Latency distribution in power-of-2 bins of nanoseconds
+  //
+  class LatencyStats {
+  public:
+    LatencyStats() { clear(); }
+  public:
+    void     clear ();
+    void     record(uint64_t ns);
+  public:
+    uint64_t count () const { return _n; }
+    uint64_t min   () const { return _n ? _min : 0; }
+    uint64_t max   () const { return _max; }
+    uint64_t mean  () const { return _n ? _sum/_n : 0; }
+    //  Upper edge of the bin holding the fraction p of the samples
+    uint64_t percentile(double p) const;
+    const uint64_t* bins() const { return _bins; }   // bin i holds [2^i, 2^(i+1)) ns
+  private:
+    uint64_t _n;
+    uint64_t _sum;
+    uint64_t _min;
+    uint64_t _max;
+    uint64_t _bins[64];
+  };
+
+  //
+  //  Real-time mode of the readout, configured by BSA_RT:
+  //
+  //    BSA_RT=<option>[:<option>...]
+  //      nolock          do not lock memory (mlockall)
+  //      noprefault      do not touch the readout buffers when created
+  //      cpus=<list>     pin the readout thread to these CPUs ("2,3" or "2-3")
+  //      node=<n>        pin the readout thread to the CPUs of NUMA node n
+  //      fifo=<prio>     run the readout thread SCHED_FIFO at this priority
+  //      workers=<list>  pin the worker threads (log formatter, raw capture)
+  //      wfifo=<prio>    run the worker threads SCHED_FIFO at this priority
+  //      probe=<us>      measure the wakeup latency on the readout CPUs
+  //                      with a thread that sleeps for this period
+  //
+  //  The readout thread is the one calling Processor::update().  It is
+  //  pinned when it first calls it; the readout buffers are prefaulted
+  //  on the readout CPUs when the Processor is created, so that they are
+  //  local to its node.  Memory is locked on fault (MCL_ONFAULT) until
+  //  then, so that neither mlockall nor the allocating thread places the
+  //  buffers first, and is populated and locked after.
+  //  Update times, the page faults taken during updates, the probe's
+  //  wakeup latencies and the node of the prefaulted pages are recorded.
+  //
+  class BsaRealTime {
+  public:
+    static bool enabled();
+    //  Pin (and set the policy of) the calling thread
+    static void readout();
+    static void worker ();
+    //  Touch all of a record's capacity (on the readout CPUs)
+    static void prefault(Record&);
+    //  Populate and lock all memory, once the buffers are prefaulted
+    static void lock    ();
+    //  Node of the readout CPUs (-1 if not pinned), and of the pages
+    //  prefaulted there, how many are on that node
+    static int      readoutNode  ();
+    static uint64_t prefaultPages();
+    static uint64_t localPages   ();
+  public:
+    static const LatencyStats& wakeup ();   // probe oversleep
+    static const LatencyStats& updates();   // Processor::update
+    static uint64_t minorFaults();          // during updates
+    static uint64_t majorFaults();
+    static void     clearStats ();
+  public:
+    static void     updated(uint64_t ns, uint64_t minflt, uint64_t majflt);
+    static uint64_t now    ();
+    static void     faults (uint64_t* minflt, uint64_t* majflt);
+  };
+
+  //
+  //  Records the time and page faults of an update in its scope
+  //
+  class ReadoutScope {
+  public:
+    ReadoutScope() : _start(0)
+    {
+      if (BsaRealTime::enabled()) {
+        BsaRealTime::readout();
+        BsaRealTime::faults(&_minflt, &_majflt);
+        _start = BsaRealTime::now();
+      }
+    }
+    ~ReadoutScope()
+    {
+      if (_start) {
+        uint64_t ns = BsaRealTime::now() - _start;
+        uint64_t minflt, majflt;
+        BsaRealTime::faults(&minflt, &majflt);
+        BsaRealTime::updated(ns, minflt-_minflt, majflt-_majflt);
+      }
+    }
+  private:
+    uint64_t _start;
+    uint64_t _minflt;
+    uint64_t _majflt;
+  };
+};
+
+#endif
@@ -0,0 +1,127 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "BsaTrace.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+using namespace Bsa;
+
+TraceHeader* BsaTrace::_header  = 0;
+TraceRecord* BsaTrace::_records = 0;
+uint64_t     BsaTrace::_mask    = 0;
+
+static const char* _names[] = { "dram", "StartAddr", "EndAddr", "WrAddr",
+                                "Enabled", "Mode", "Init", "Done", "Full",
+                                "Empty", "Error", "Status", "TimeStamp", "Clear" };
+
+static size_t _mapped = 0;
+
+static uint64_t _clock(clockid_t id)
+{
+  timespec tv;
+  clock_gettime(id, &tv);
+  return uint64_t(tv.tv_sec)*1000000000ULL + tv.tv_nsec;
+}
+
+uint64_t BsaTrace::now()
+{
+  return _clock(CLOCK_MONOTONIC);
+}
+
+const char* BsaTrace::name(unsigned target)
+{
+  return target < NumTraceTargets ? _names[target] : "unknown";
+}
+
+bool BsaTrace::open(const char* path,
+                    unsigned    capacity)
+{
+  close();
+
+  unsigned n = 1;
+  while(n < capacity)
+    n <<= 1;
+
+  size_t sz = sizeof(TraceHeader) + n*sizeof(TraceRecord);
+  int fd = ::open(path, O_RDWR|O_CREAT|O_TRUNC, 0644);
+  if (fd < 0) {
+    syslog(LOG_ERR,"<E> BsaTrace: open %s failed: %s", path, strerror(errno));
+    return false;
+  }
+  if (ftruncate(fd, sz) < 0) {
+    syslog(LOG_ERR,"<E> BsaTrace: sizing %s failed: %s", path, strerror(errno));
+    ::close(fd);
+    return false;
+  }
+  void* p = mmap(0, sz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    syslog(LOG_ERR,"<E> BsaTrace: mmap %s failed: %s", path, strerror(errno));
+    return false;
+  }
+
+  TraceHeader* h = reinterpret_cast<TraceHeader*>(p);
+  memcpy(h->magic, "BSAT", 4);
+  h->version    = 2;
+  h->recordSize = sizeof(TraceRecord);
+  h->capacity   = n;
+  h->head       = 0;
+  h->realtime   = _clock(CLOCK_REALTIME);
+  h->monotonic  = _clock(CLOCK_MONOTONIC);
+
+  _mapped  = sz;
+  _records = reinterpret_cast<TraceRecord*>(h+1);
+  _mask    = n-1;
+  __atomic_store_n(&_header, h, __ATOMIC_RELEASE);
+
+  syslog(LOG_INFO,"<I> BsaTrace: recording %u transactions to %s", n, path);
+  return true;
+}
+
+void BsaTrace::close()
+{
+  TraceHeader* h = _header;
+  if (!h)
+    return;
+  __atomic_store_n(&_header, (TraceHeader*)0, __ATOMIC_RELEASE);
+  munmap(h, _mapped);
+  _records = 0;
+}
+
+void BsaTrace::record(unsigned target,
+                      unsigned flags,
+                      uint64_t addr,
+                      uint32_t size,
+                      uint64_t issue,
+                      uint64_t complete)
+{
+  TraceHeader* h = __atomic_load_n(&_header, __ATOMIC_ACQUIRE);
+  if (!h)
+    return;
+
+  uint64_t     n = __atomic_fetch_add(&h->head, 1, __ATOMIC_RELAXED);
+  TraceRecord& r = _records[n & _mask];
+  //  A reader skips the record until its sequence matches
+  __atomic_store_n(&r.seq, uint64_t(0), __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  r.addr     = addr;
+  r.issue    = issue;
+  r.complete = complete;
+  r.size     = size;
+  r.target   = target;
+  r.flags    = flags;
+  __atomic_store_n(&r.seq, n+1, __ATOMIC_RELEASE);
+}
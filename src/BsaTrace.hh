@@ -0,0 +1,120 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef Bsa_BsaTrace_hh
+#define Bsa_BsaTrace_hh
+
+#include <stdint.h>
+
+namespace Bsa {
+  //
+  //  What a transaction accessed: the DRAM or one of the buffer registers
+  //
+  enum TraceTarget { TraceDram,
+                     TraceStartAddr,
+                     TraceEndAddr,
+                     TraceWrAddr,
+                     TraceEnabled,
+                     TraceMode,
+                     TraceInit,
+                     TraceDone,
+                     TraceFull,
+                     TraceEmpty,
+                     TraceError,
+                     TraceStatus,
+                     TraceTimestamp,
+                     TraceClear,
+                     NumTraceTargets };
+
+  enum { TraceWrite=1, TraceFailed=2 };
+
+  //
+  //  One transaction
+  //
+  struct TraceRecord {
+    uint64_t addr;        // DRAM byte address, or the first array of a register access
+    uint64_t issue;       // CLOCK_MONOTONIC ns
+    uint64_t complete;    // CLOCK_MONOTONIC ns
+    uint32_t size;        // bytes
+    uint8_t  target;      // TraceTarget
+    uint8_t  flags;       // TraceWrite, TraceFailed
+    uint64_t seq;         // record number + 1, 0 while written; written last
+  };
+
+  //
+  //  Start of the trace file; the records follow
+  //
+  struct TraceHeader {
+    char     magic[4];    // "BSAT"
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t capacity;    // records, a power of 2
+    uint64_t head;        // records written
+    uint64_t realtime;    // CLOCK_REALTIME ns when opened
+    uint64_t monotonic;   // CLOCK_MONOTONIC ns when opened
+    uint64_t reserved[3];
+  };
+
+  //
+  //  Tracer of the DRAM and register transactions of AmcCarrierBase.
+  //
+  //  While open, every access is recorded in a ring of TraceRecords in a
+  //  file mapped into memory, so the trace survives the process and can
+  //  be read while it runs (bsatrace_tst).  Recording takes two clock
+  //  reads and a fetch-and-add; while closed, one test of a pointer.
+  //  open() and close() must not race with traced accesses.
+  //
+  class BsaTrace {
+  public:
+    static bool        open   (const char* path,
+                               unsigned    capacity=1<<20);  // rounded up to a power of 2
+    static void        close  ();
+    static bool        enabled() { return _header; }
+    static uint64_t    now    ();
+    static void        record (unsigned target,
+                               unsigned flags,
+                               uint64_t addr,
+                               uint32_t size,
+                               uint64_t issue,
+                               uint64_t complete);
+    static const char* name   (unsigned target);
+  private:
+    static TraceHeader* _header;
+    static TraceRecord* _records;
+    static uint64_t     _mask;
+  };
+
+  //
+  //  Records the transaction in its scope; failed unless completed
+  //
+  class TraceScope {
+  public:
+    TraceScope(TraceTarget target,
+               uint64_t    addr,
+               uint32_t    size,
+               unsigned    flags=0) :
+      _target(target), _flags(flags|TraceFailed), _addr(addr), _size(size),
+      _issue(BsaTrace::enabled() ? BsaTrace::now() : 0) {}
+    ~TraceScope()
+    {
+      if (_issue)
+        BsaTrace::record(_target, _flags, _addr, _size, _issue, BsaTrace::now());
+    }
+  public:
+    void completed() { _flags &= ~TraceFailed; }
+  private:
+    unsigned _target;
+    unsigned _flags;
+    uint64_t _addr;
+    uint32_t _size;
+    uint64_t _issue;
+  };
+};
+
+#endif
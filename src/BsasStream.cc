@@ -0,0 +1,171 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "BsasStream.hh"
+
+#include <math.h>
+#include <syslog.h>
+
+using namespace Bsas;
+
+BsasTable::BsasTable(unsigned maxRows) :
+    _maxRows  (maxRows),
+    _rows     (0),
+    _table    (0),
+    _channelMask(0),
+    _pulseId  (maxRows),
+    _timeStamp(maxRows),
+    _rowNumber(maxRows),
+    _rowMask  (maxRows),
+    _n        (maxRows*NUM_BSAS_CHN),
+    _mean     (maxRows*NUM_BSAS_CHN),
+    _rms2     (maxRows*NUM_BSAS_CHN),
+    _min      (maxRows*NUM_BSAS_CHN),
+    _max      (maxRows*NUM_BSAS_CHN),
+    _sevr     (maxRows*NUM_BSAS_CHN),
+    _excpt    (maxRows*NUM_BSAS_CHN)
+{
+}
+
+//  Mark a channel absent from rows [first,last)
+void BsasTable::_absent(unsigned chn, unsigned first, unsigned last)
+{
+    for(unsigned k = chn*_maxRows+first; k < chn*_maxRows+last; k++) {
+        _n    [k] = 0;
+        _excpt[k] = 1;
+        _sevr [k] = 3;
+        _mean [k] = NAN;
+        _rms2 [k] = NAN;
+        _min  [k] = 0;
+        _max  [k] = 0;
+    }
+}
+
+void BsasTable::clear(unsigned table)
+{
+    _rows        = 0;
+    _table       = table;
+    _channelMask = 0;
+}
+
+BsasStreamReceiver::BsasStreamReceiver(BsasTableHandler& handler, unsigned maxRows) :
+    _handler   (handler),
+    _table     (maxRows),
+    _mask      (0),
+    _nchn      (0),
+    _lastRow   (-1),
+    _packets   (0),
+    _nrows     (0),
+    _tables    (0),
+    _errors    (0),
+    _overflows (0),
+    _missedRows(0)
+{
+}
+
+int BsasStreamReceiver::process(const char* buff, size_t sz)
+{
+    const uint32_t* p   = reinterpret_cast<const uint32_t*>(buff);
+    const uint32_t* end = p + (sz>>2);
+    int nrows = 0;
+
+    _packets++;
+
+    while(p + BSAS_HEADER_WORDS <= end) {
+        uint32_t mask = p[4] & ((1U<<NUM_BSAS_CHN)-1);
+        if(mask != _mask) {   // rebuild the channel index list only when the mask changes
+            _nchn = 0;
+            for(uint32_t m = mask; m != 0; m &= (m-1))
+                _chn[_nchn++] = __builtin_ctz(m);
+            _mask = mask;
+        }
+
+        if(p + BSAS_HEADER_WORDS + _nchn*BSAS_CHANNEL_WORDS > end) {
+            syslog(LOG_ERR, "<E> BsasStreamReceiver: truncated packet (%u bytes, %u channels)",
+                   unsigned(sz), _nchn);
+            _errors++;
+            break;
+        }
+
+        unsigned row   = p[5] & 0xffff;
+        unsigned table = (p[5] >> 16) & 0xff;
+        bool     reset = p[5] & (1<<24);
+
+        //  A new table begins on table reset or when the table count changes
+        if((reset || table != _table.table()) && _table.rows())
+            flush();
+        if(!_table.rows()) {
+            _table.clear(table);
+            _lastRow = -1;
+        }
+        if(_lastRow >= 0 && int(row) > _lastRow+1)
+            _missedRows += row - _lastRow - 1;
+        _lastRow = row;
+
+        if(_table.rows() < _table.maxRows()) {
+            _row(p, mask, _nchn);
+            nrows++;
+        }
+        else
+            _overflows++;
+
+        p += BSAS_HEADER_WORDS + _nchn*BSAS_CHANNEL_WORDS;
+    }
+
+    _nrows += nrows;
+    return nrows;
+}
+
+void BsasStreamReceiver::_row(const uint32_t* p, uint32_t mask, unsigned nchn)
+{
+    BsasTable& t = _table;
+    unsigned   r = t._rows++;
+
+    t._timeStamp[r] = (uint64_t(p[1])<<32) | p[0];
+    t._pulseId  [r] = (uint64_t(p[3])<<32) | p[2];
+    t._rowNumber[r] = p[5] & 0xffff;
+    t._rowMask  [r] = mask;
+
+    //  Channels that join the table are absent from the earlier rows,
+    //  and channels that leave it are absent from this one
+    if(mask != t._channelMask) {
+        for(uint32_t m = mask & ~t._channelMask; m != 0; m &= (m-1))
+            t._absent(__builtin_ctz(m), 0, r);
+        for(uint32_t m = t._channelMask & ~mask; m != 0; m &= (m-1))
+            t._absent(__builtin_ctz(m), r, r+1);
+        t._channelMask |= mask;
+    }
+
+    const uint32_t* q = p + BSAS_HEADER_WORDS;
+    for(unsigned i = 0; i < nchn; i++, q += BSAS_CHANNEL_WORDS) {
+        unsigned k     = _chn[i]*t._maxRows + r;
+        unsigned n     = q[0] & 0x1fff;
+        bool     excpt = q[0] & (1<<13);
+        double   sum   = double(int32_t(q[1]));
+        double   sqsum = double((uint64_t(q[3])<<32) | q[2]);
+
+        //  Same n/mean/rms2 semantics as Bsa::ChannelData
+        t._n    [k] = n;
+        t._excpt[k] = excpt;
+        t._sevr [k] = (q[0]>>14) & 0x3;
+        t._mean [k] = (n && !excpt) ? sum/double(n) : NAN;
+        t._rms2 [k] = (!n || excpt) ? NAN : (n==1 ? 0 : (sqsum - sum*sum/double(n))/double(n-1));
+        t._min  [k] = int32_t(q[4]);
+        t._max  [k] = int32_t(q[5]);
+    }
+}
+
+void BsasStreamReceiver::flush()
+{
+    if(!_table.rows())
+        return;
+    _handler.process(_table);
+    _tables++;
+    _table.clear(_table.table());
+}
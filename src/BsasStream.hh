@@ -0,0 +1,134 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef BsasStream_hh
+#define BsasStream_hh
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define  NUM_BSAS_CHN       31
+
+//
+//  BSAS stream packet (32-bit words); one packet per row advance
+//
+//    0     timestamp nanoseconds
+//    1     timestamp seconds
+//    2     pulse ID lower word
+//    3     pulse ID upper word
+//    4     channel mask
+//    5     [15:0] row number, [23:16] table count, [24] table reset
+//    then for each channel in the mask (lowest first)
+//    +0    [12:0] number of samples, [13] exception, [15:14] severity
+//    +1    sum of samples (signed)
+//    +2,3  sum of squares (lower, upper word)
+//    +4    minimum sample (signed)
+//    +5    maximum sample (signed)
+//
+namespace Bsas {
+    enum { BSAS_HEADER_WORDS  = 6 };
+    enum { BSAS_CHANNEL_WORDS = 6 };
+
+    // columns of one BSAS table, preallocated for maxRows rows
+    class BsasTable {
+        public:
+            BsasTable(unsigned maxRows);
+
+            void      clear(unsigned table);
+            unsigned  rows()    const { return _rows; }
+            unsigned  maxRows() const { return _maxRows; }
+            unsigned  table()   const { return _table; }
+            uint32_t  channelMask() const { return _channelMask; }
+
+            // row columns
+            const uint64_t* pulseId()   const { return &_pulseId  [0]; }
+            const uint64_t* timeStamp() const { return &_timeStamp[0]; }
+            const uint16_t* rowNumber() const { return &_rowNumber[0]; }
+            // channels present in each row
+            const uint32_t* rowMask()   const { return &_rowMask  [0]; }
+
+            // channel columns, defined for channels in channelMask(); a channel
+            // absent from a row (see rowMask()) has n 0, the exception flag set,
+            // invalid severity and NaN mean and rms2
+            const uint32_t* n    (unsigned chn) const { return &_n    [chn*_maxRows]; }
+            const double*   mean (unsigned chn) const { return &_mean [chn*_maxRows]; }
+            const double*   rms2 (unsigned chn) const { return &_rms2 [chn*_maxRows]; }
+            const int32_t*  min  (unsigned chn) const { return &_min  [chn*_maxRows]; }
+            const int32_t*  max  (unsigned chn) const { return &_max  [chn*_maxRows]; }
+            const uint8_t*  sevr (unsigned chn) const { return &_sevr [chn*_maxRows]; }
+            const uint8_t*  excpt(unsigned chn) const { return &_excpt[chn*_maxRows]; }
+
+        private:
+            void      _absent(unsigned chn, unsigned first, unsigned last);
+        private:
+            friend class BsasStreamReceiver;
+            unsigned _maxRows;
+            unsigned _rows;
+            unsigned _table;
+            uint32_t _channelMask;                   // OR of the masks of all rows
+            std::vector<uint64_t> _pulseId;
+            std::vector<uint64_t> _timeStamp;
+            std::vector<uint16_t> _rowNumber;
+            std::vector<uint32_t> _rowMask;
+            std::vector<uint32_t> _n;
+            std::vector<double>   _mean;
+            std::vector<double>   _rms2;
+            std::vector<int32_t>  _min;
+            std::vector<int32_t>  _max;
+            std::vector<uint8_t>  _sevr;
+            std::vector<uint8_t>  _excpt;
+    }; /* class BsasTable */
+
+    // consumer of completed tables
+    class BsasTableHandler {
+        public:
+            virtual ~BsasTableHandler() {}
+            virtual void process(const BsasTable& table) = 0;
+    };
+
+    // decodes BSAS stream packets into BsasTable columns
+    class BsasStreamReceiver {
+        public:
+            BsasStreamReceiver(BsasTableHandler& handler, unsigned maxRows);
+            virtual ~BsasStreamReceiver() {}
+
+            // decode one datagram (one or more packets); returns the number of rows decoded
+            int  process(const char* buff, size_t sz);
+            // hand over a partially filled table
+            void flush();
+
+            uint64_t packets()    const { return _packets; }
+            uint64_t rows()       const { return _nrows; }
+            uint64_t tables()     const { return _tables; }
+            uint64_t errors()     const { return _errors; }       // malformed packets
+            uint64_t overflows()  const { return _overflows; }    // rows dropped on a full table
+            uint64_t missedRows() const { return _missedRows; }   // gaps in the row number
+
+        private:
+            void     _row(const uint32_t* p, uint32_t mask, unsigned nchn);
+
+        private:
+            BsasTableHandler& _handler;
+            BsasTable         _table;
+            uint32_t          _mask;                 // channel mask of the cached index list
+            unsigned          _nchn;
+            unsigned          _chn[NUM_BSAS_CHN];    // channel index of each mask bit
+            int               _lastRow;
+            uint64_t          _packets;
+            uint64_t          _nrows;
+            uint64_t          _tables;
+            uint64_t          _errors;
+            uint64_t          _overflows;
+            uint64_t          _missedRows;
+    }; /* class BsasStreamReceiver */
+
+} /* namespace Bsas */
+
+#endif  /* BsasStream_hh */
@@ -14,8 +14,15 @@
 
 #include "CpswUtil.hh"
 
+#include <string.h>
+
 using namespace Bsas;
 
+BsasSnapshot::BsasSnapshot()
+{
+    memset(this, 0, sizeof(*this));
+}
+
 
 BsasControlYaml::BsasControlYaml(Path path)
 {
@@ -137,4 +144,27 @@ void BsasModuleYaml::SetChannelSeverity(int chn, uint64_t sevr)
 
 }
 
+void BsasModuleYaml::snapshot(BsasSnapshot *snapshot)
+{
+    BsasSnapshot& s = *snapshot;
+
+    pAcquire   ->getCount(&s.acquireCount);
+    pRowAdvance->getCount(&s.rowAdvanceCount);
+    pTableReset->getCount(&s.tableResetCount);
+    clock_gettime(CLOCK_MONOTONIC, &s.time);
 
+    s.interval       = 0;
+    s.acquireRate    = 0;
+    s.rowAdvanceRate = 0;
+    s.tableResetRate = 0;
+    if(_lastSnapshot.time.tv_sec || _lastSnapshot.time.tv_nsec) {
+        s.interval = double(s.time.tv_sec - _lastSnapshot.time.tv_sec) +
+                     1.e-9*(double(s.time.tv_nsec) - double(_lastSnapshot.time.tv_nsec));
+        if(s.interval > 0) {   // counter differences are modulo 2^32
+            s.acquireRate    = double(uint32_t(s.acquireCount    - _lastSnapshot.acquireCount   )) / s.interval;
+            s.rowAdvanceRate = double(uint32_t(s.rowAdvanceCount - _lastSnapshot.rowAdvanceCount)) / s.interval;
+            s.tableResetRate = double(uint32_t(s.tableResetCount - _lastSnapshot.tableResetCount)) / s.interval;
+        }
+    }
+    _lastSnapshot = s;
+}
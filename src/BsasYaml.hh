@@ -13,12 +13,31 @@
 
 #include <cpsw_api_builder.h>
 #include <stdint.h>
+#include <time.h>
 #include <vector>
 
 #define  NUM_BSAS_MODULES   4
 #define  NUM_BSAS_TABLES    4
 
 namespace Bsas {
+    // control block counters of a BSAS module, gathered with BsasModuleYaml::snapshot()
+    class BsasSnapshot {
+        public:
+            BsasSnapshot();
+
+        public:
+            timespec time;                  // host monotonic time when the counters were read
+            uint32_t acquireCount;
+            uint32_t rowAdvanceCount;
+            uint32_t tableResetCount;
+
+            // derived from the previous snapshot, zero for the first one
+            double   interval;              // seconds since the previous snapshot
+            double   acquireRate;           // events per second
+            double   rowAdvanceRate;
+            double   tableResetRate;
+    }; /* class BsasSnapshot */
+
     class BsasControlYaml {
         public:
             BsasControlYaml(Path path);
@@ -54,6 +73,10 @@ namespace Bsas {
             void SetChannelSeverity(uint64_t sevr);
             void SetChannelSeverity(int chn, uint64_t sevr);
 
+            // read the counters of all control blocks in one pass; each control
+            // block is a separate device of the register map, so one transaction each
+            void snapshot(BsasSnapshot *snapshot);
+
             BsasControlYaml *pAcquire;
             BsasControlYaml *pRowAdvance;
             BsasControlYaml *pTableReset;
@@ -68,6 +91,8 @@ namespace Bsas {
             ScalVal  _enable;          // BSAS stream control, enable and disable
             ScalVal  _channelMask;     // BSAS stream control, enable and disable the data channel
             ScalVal  _channelSevr;     // BSAS stream control, severity filtering
+
+            BsasSnapshot _lastSnapshot;  // previous snapshot for rate calculation
     };
 
 
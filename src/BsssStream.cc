@@ -0,0 +1,169 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "BsssStream.hh"
+
+#include <string.h>
+#include <syslog.h>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+using namespace Bsss;
+
+static const uint64_t SEVR_LO = 0x5555555555555555ULL;   // low bit of each 2-bit field
+
+//
+//  Channels whose severity is within the limit, one bit per channel.
+//  All 32 fields are compared at once on the 64-bit words and the
+//  resulting even bits are packed down to a 32-bit mask.
+//
+static inline uint32_t sevrValid(uint64_t sevr, uint64_t limit)
+{
+    uint64_t a1 = (sevr >>1)&SEVR_LO, a0 = sevr &SEVR_LO;
+    uint64_t b1 = (limit>>1)&SEVR_LO, b0 = limit&SEVR_LO;
+    uint64_t le = ((~a1 & b1) | (~(a1 ^ b1) & (~a0 | b0))) & SEVR_LO;
+#ifdef __BMI2__
+    return uint32_t(_pext_u64(le, SEVR_LO));
+#else
+    le = (le | (le>> 1)) & 0x3333333333333333ULL;
+    le = (le | (le>> 2)) & 0x0f0f0f0f0f0f0f0fULL;
+    le = (le | (le>> 4)) & 0x00ff00ff00ff00ffULL;
+    le = (le | (le>> 8)) & 0x0000ffff0000ffffULL;
+    le = (le | (le>>16)) & 0x00000000ffffffffULL;
+    return uint32_t(le);
+#endif
+}
+
+BsssEdefColumns::BsssEdefColumns() :
+    _rows       (0),
+    _nchn       (0),
+    _channelMask(0)
+{
+}
+
+BsssDemux::BsssDemux(BsssEdefHandler& handler, unsigned maxRows) :
+    _handler    (handler),
+    _maxRows    (maxRows),
+    _nchn       (0),
+    _channelMask(0),
+    _pending    (0),
+    _packets    (0),
+    _events     (0),
+    _rows       (0),
+    _errors     (0)
+{
+    for(unsigned i = 0; i < NUM_BSSS_EDEFS; i++) {
+        _sevrLimit[i] = ~0ULL;
+        _edef[i]._pulseId  .resize(maxRows);
+        _edef[i]._timeStamp.resize(maxRows);
+        _edef[i]._valid    .resize(maxRows);
+    }
+}
+
+void BsssDemux::setChannelSevr(unsigned edef, uint64_t sevr)
+{
+    if(edef < NUM_BSSS_EDEFS)
+        _sevrLimit[edef] = sevr;
+}
+
+int BsssDemux::process(const char* buff, size_t sz)
+{
+    const uint32_t* p   = reinterpret_cast<const uint32_t*>(buff);
+    const uint32_t* end = p + (sz>>2);
+
+    _packets++;
+
+    if(p + BSSS_FIRST_WORDS > end) {
+        syslog(LOG_ERR, "<E> BsssDemux: short packet (%u bytes)", unsigned(sz));
+        _errors++;
+        return 0;
+    }
+
+    uint64_t timeStamp = (uint64_t(p[1])<<32) | p[0];
+    uint64_t pulseId   = (uint64_t(p[3])<<32) | p[2];
+    uint32_t mask      = p[4];
+    unsigned nchn      = __builtin_popcount(mask);
+
+    //  The data columns are sized once per channel mask
+    if(mask != _channelMask) {
+        _flush();
+        for(unsigned i = 0; i < NUM_BSSS_EDEFS; i++) {
+            _edef[i]._data.resize(_maxRows*nchn);
+            _edef[i]._nchn        = nchn;
+            _edef[i]._channelMask = mask;
+        }
+        _channelMask = mask;
+        _nchn        = nchn;
+    }
+
+    unsigned sizeof_first = BSSS_FIRST_WORDS + nchn + BSSS_SEVR_WORDS;
+    unsigned sizeof_next  = BSSS_NEXT_WORDS  + nchn + BSSS_SEVR_WORDS;
+    unsigned words        = end - p;
+    if(words < sizeof_first || ((words - sizeof_first) % sizeof_next) != 0) {
+        syslog(LOG_ERR, "<E> BsssDemux: size of packet error: sz %u, first %u, next %u",
+               unsigned(sz), 4*sizeof_first, 4*sizeof_next);
+        _errors++;
+        return 0;
+    }
+
+    const uint32_t* q = p + BSSS_FIRST_WORDS + nchn;
+    _event((uint64_t(p[6])<<32) | p[5], pulseId, timeStamp,
+           p + BSSS_FIRST_WORDS, (uint64_t(q[1])<<32) | q[0]);
+    int nevents = 1;
+
+    for(const uint32_t* n = p + sizeof_first; n < end; n += sizeof_next, nevents++) {
+        q = n + BSSS_NEXT_WORDS + nchn;
+        _event((uint64_t(n[2])<<32) | n[1],
+               pulseId   + ((n[0]>>20)&0xfff),
+               timeStamp + ((n[0]>> 0)&0xfffff),
+               n + BSSS_NEXT_WORDS, (uint64_t(q[1])<<32) | q[0]);
+    }
+
+    _events += nevents;
+    _flush();
+    return nevents;
+}
+
+//
+//  Append one event to the columns of each EDEF in its mask
+//
+void BsssDemux::_event(uint64_t edefMask, uint64_t pulseId, uint64_t timeStamp,
+                       const uint32_t* data, uint64_t sevr)
+{
+    for(uint64_t m = edefMask; m != 0; m &= (m-1)) {
+        unsigned         edef = __builtin_ctzll(m);
+        BsssEdefColumns& c    = _edef[edef];
+        if(c._rows == _maxRows) {
+            _handler.process(edef, c);
+            c._rows = 0;
+        }
+        unsigned r = c._rows++;
+        c._pulseId  [r] = pulseId;
+        c._timeStamp[r] = timeStamp;
+        c._valid    [r] = sevrValid(sevr, _sevrLimit[edef]) & _channelMask;
+        memcpy(&c._data[r*_nchn], data, _nchn*sizeof(uint32_t));
+    }
+    _pending |= edefMask;
+    _rows    += __builtin_popcountll(edefMask);
+}
+
+void BsssDemux::_flush()
+{
+    for(uint64_t m = _pending; m != 0; m &= (m-1)) {
+        unsigned         edef = __builtin_ctzll(m);
+        BsssEdefColumns& c    = _edef[edef];
+        if(c._rows) {
+            _handler.process(edef, c);
+            c._rows = 0;
+        }
+    }
+    _pending = 0;
+}
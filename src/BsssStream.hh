@@ -0,0 +1,115 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef BsssStream_hh
+#define BsssStream_hh
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// EDEF mask width of the extended (R2.2.0) packet; BsssYaml configures MAX_EDEFS of them
+#define NUM_BSSS_EDEFS   64
+
+//
+//  BSSS packet (32-bit words)
+//
+//  first event
+//    0     timestamp nanoseconds
+//    1     timestamp seconds
+//    2     pulse ID lower word
+//    3     pulse ID upper word
+//    4     channel mask
+//    5,6   EDEF mask (lower, upper word)
+//    then one word for each channel in the mask (lowest first)
+//    2 words severity (lower, upper word), 2 bits per channel
+//  each following event
+//    0     [19:0] timestamp delta, [31:20] pulse ID delta from the first event
+//    1,2   EDEF mask (lower, upper word)
+//    then one word for each channel in the mask
+//    2 words severity
+//
+namespace Bsss {
+    enum { BSSS_FIRST_WORDS = 7 };     // header words of the first event
+    enum { BSSS_NEXT_WORDS  = 3 };     // header words of the following events
+    enum { BSSS_SEVR_WORDS  = 2 };
+
+    // events of one EDEF, in columns
+    class BsssEdefColumns {
+        public:
+            BsssEdefColumns();
+
+            unsigned  rows()        const { return _rows; }
+            unsigned  nchannels()   const { return _nchn; }
+            uint32_t  channelMask() const { return _channelMask; }
+
+            const uint64_t* pulseId()   const { return &_pulseId  [0]; }
+            const uint64_t* timeStamp() const { return &_timeStamp[0]; }
+            // channels whose severity is within this EDEF's limit, bit n for channel n
+            const uint32_t* valid()     const { return &_valid    [0]; }
+            // raw channel words, nchannels() per row
+            const uint32_t* data()      const { return &_data     [0]; }
+            uint32_t        value(unsigned row, unsigned i) const { return _data[row*_nchn+i]; }
+
+        private:
+            friend class BsssDemux;
+            unsigned _rows;
+            unsigned _nchn;
+            uint32_t _channelMask;
+            std::vector<uint64_t> _pulseId;
+            std::vector<uint64_t> _timeStamp;
+            std::vector<uint32_t> _valid;
+            std::vector<uint32_t> _data;
+    }; /* class BsssEdefColumns */
+
+    // consumer of the events of each EDEF
+    class BsssEdefHandler {
+        public:
+            virtual ~BsssEdefHandler() {}
+            virtual void process(unsigned edef, const BsssEdefColumns& columns) = 0;
+    };
+
+    // decodes BSSS packets and fans each event out to the EDEFs in its EDEF mask
+    class BsssDemux {
+        public:
+            BsssDemux(BsssEdefHandler& handler, unsigned maxRows=1024);
+            virtual ~BsssDemux() {}
+
+            // maximum channel severity for an EDEF, 2 bits per channel as the channelSevr register
+            void     setChannelSevr(unsigned edef, uint64_t sevr);
+            // decode one packet and hand the new rows to the handler; returns the number of events
+            int      process(const char* buff, size_t sz);
+
+            uint64_t packets() const { return _packets; }
+            uint64_t events()  const { return _events; }
+            uint64_t rows()    const { return _rows; }         // events x EDEFs
+            uint64_t errors()  const { return _errors; }
+
+        private:
+            void     _event(uint64_t edefMask, uint64_t pulseId, uint64_t timeStamp,
+                            const uint32_t* data, uint64_t sevr);
+            void     _flush();
+
+        private:
+            BsssEdefHandler& _handler;
+            unsigned         _maxRows;
+            unsigned         _nchn;
+            uint32_t         _channelMask;
+            uint64_t         _pending;                 // EDEFs with rows not yet handed over
+            uint64_t         _sevrLimit[NUM_BSSS_EDEFS];
+            BsssEdefColumns  _edef[NUM_BSSS_EDEFS];
+            uint64_t         _packets;
+            uint64_t         _events;
+            uint64_t         _rows;
+            uint64_t         _errors;
+    }; /* class BsssDemux */
+
+} /* namespace Bsss */
+
+#endif /* BsssStream_hh */
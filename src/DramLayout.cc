@@ -0,0 +1,123 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "DramLayout.hh"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+using namespace Bsa;
+
+//  Beyond any DRAM, and small enough for the placement arithmetic
+static const double MAX_ENTRIES = double(1ULL<<40);
+
+DramLayout::DramLayout() : _hold(10), _memEnd(0)
+{
+  for(unsigned i=0; i<HSTARRAYN; i++) {
+    _entries[i] = i<NBSAARRAYS ? uint64_t(BsaEntries) : uint64_t(FaultEntries);
+    _hz     [i] = 0;
+    _begin  [i] = _end[i] = 0;
+  }
+  plan();
+}
+
+void DramLayout::setEntries(unsigned array, uint64_t entries)
+{
+  if (array < HSTARRAYN) {
+    _entries[array] = entries;
+    _hz     [array] = 0;
+  }
+}
+
+void DramLayout::setRate(unsigned array, double hz)
+{
+  if (array < HSTARRAYN)
+    _hz[array] = hz;
+}
+
+void DramLayout::setHold(double seconds)
+{
+  if (seconds >= 0)
+    _hold = seconds;
+}
+
+bool DramLayout::configure(const char* spec)
+{
+  char buff[1024];
+  strncpy(buff, spec, sizeof(buff)-1);
+  buff[sizeof(buff)-1] = 0;
+
+  for(char* save, *tok = strtok_r(buff, ",", &save); tok; tok = strtok_r(0, ",", &save)) {
+    char* v = strchr(tok, '=');
+    if (!v) {
+      syslog(LOG_ERR,"<E> DramLayout: no value in %s", tok);
+      return false;
+    }
+    *v++ = 0;
+    char* e;
+    if (!strcmp(tok, "hold")) {
+      double x = strtod(v, &e);
+      if (e == v || *e || !(x >= 0)) {
+        syslog(LOG_ERR,"<E> DramLayout: bad hold %s", v);
+        return false;
+      }
+      _hold = x;
+      continue;
+    }
+    unsigned first = strtoul(tok, &e, 0), last = first;
+    bool ok = e != tok;
+    if (ok && *e == '-') {
+      char* r = e+1;
+      last = strtoul(r, &e, 0);
+      ok   = e != r;
+    }
+    if (!ok || *e || last >= HSTARRAYN || first > last) {
+      syslog(LOG_ERR,"<E> DramLayout: bad arrays %s", tok);
+      return false;
+    }
+    double x = strtod(v, &e);
+    bool   hz = !strcasecmp(e, "hz");
+    if (e == v || (*e && !hz) || !(x >= 0) || x > MAX_ENTRIES) {
+      syslog(LOG_ERR,"<E> DramLayout: bad size %s", v);
+      return false;
+    }
+    for(unsigned i=first; i<=last; i++) {
+      if (hz)
+        setRate(i, x);
+      else
+        setEntries(i, uint64_t(x));
+    }
+  }
+  return true;
+}
+
+bool DramLayout::plan(uint64_t base, uint64_t capacity)
+{
+  uint64_t p = (base + Alignment-1) & ~uint64_t(Alignment-1);
+  for(unsigned i=0; i<HSTARRAYN; i++) {
+    double   x = _hz[i] > 0 ? ceil(_hz[i]*_hold) : double(_entries[i]);
+    uint64_t n = x < MAX_ENTRIES ? uint64_t(x) : uint64_t(MAX_ENTRIES);
+    n = (n + EntryQuantum-1)/EntryQuantum*EntryQuantum;
+    if (n == 0)
+      n = EntryQuantum;
+    _begin[i] = p;
+    _end  [i] = p + n*sizeof(Entry);
+    p = _end[i];
+  }
+  _memEnd = p;
+
+  if (capacity && _memEnd > base+capacity) {
+    syslog(LOG_ERR,"<E> DramLayout: arrays need %llu bytes, %llu available",
+           (unsigned long long)(_memEnd-base), (unsigned long long)capacity);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,68 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef Bsa_DramLayout_hh
+#define Bsa_DramLayout_hh
+
+#include <stdint.h>
+
+#include "BsaDefs.hh"
+
+namespace Bsa {
+  //
+  //  Placement of the BSA and fault arrays in carrier DRAM.
+  //
+  //  Each array is sized from a number of entries or from its expected
+  //  rate and the time it must hold, rounded up to a multiple of
+  //  EntryQuantum entries so that every array starts and ends on a 4 kB
+  //  burst boundary.  The arrays are placed back to back in array order.
+  //  Arrays without a requirement keep the standard size (32k entries for
+  //  BSA, 1M for fault buffers), so an empty plan is the standard layout.
+  //
+  class DramLayout {
+  public:
+    enum { Alignment    = 4096 };
+    enum { EntryQuantum = 32 };            // 32 entries are 3 bursts
+    enum { BsaEntries   = 1<<15 };
+    enum { FaultEntries = 1<<20 };
+  public:
+    DramLayout();
+  public:
+    //  Requirements
+    void     setEntries(unsigned array, uint64_t entries);
+    void     setRate   (unsigned array, double hz);
+    //  Time that arrays sized by rate hold (default 10 s; negative is ignored)
+    void     setHold   (double seconds);
+    //
+    //  Requirements as "<arrays>=<entries>|<rate>hz,...,hold=<seconds>"
+    //  where <arrays> is an array or a range, e.g. "0-3=65536,4=120hz";
+    //  returns false on a syntax error
+    //
+    bool     configure (const char* spec);
+    //
+    //  Place the arrays from base; returns false if they do not fit
+    //  below base+capacity (0 for no limit)
+    //
+    bool     plan      (uint64_t base=0, uint64_t capacity=0);
+  public:
+    uint64_t begin  (unsigned array) const { return _begin[array]; }
+    uint64_t end    (unsigned array) const { return _end  [array]; }
+    uint64_t entries(unsigned array) const { return (_end[array]-_begin[array])/sizeof(Entry); }
+    uint64_t memEnd () const { return _memEnd; }
+  private:
+    uint64_t _entries[HSTARRAYN];
+    double   _hz     [HSTARRAYN];
+    double   _hold;
+    uint64_t _begin  [HSTARRAYN];
+    uint64_t _end    [HSTARRAYN];
+    uint64_t _memEnd;
+  };
+};
+
+#endif
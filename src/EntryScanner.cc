@@ -0,0 +1,145 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "EntryScanner.hh"
+
+#include <string.h>
+
+using namespace Bsa;
+
+static const unsigned ENTRY_WORDS = sizeof(Entry)/sizeof(uint32_t);
+static const unsigned MAX_NCH     = 31;
+
+static inline uint64_t _pulseId(const uint32_t* p)
+{
+  return (uint64_t(p[2])<<32) | p[1];
+}
+
+EntryScanner::EntryScanner(uint64_t maxGap) :
+  _maxGap (maxGap),
+  _entries(0),
+  _dropped(0),
+  _resyncs(0)
+{
+  reset();
+}
+
+void EntryScanner::reset()
+{
+  _nch          = 0;
+  _last         = 0;
+  _lastValid    = false;
+  _pendingValid = false;
+}
+
+bool EntryScanner::_plausible(const uint32_t* p, uint64_t last, bool lastValid) const
+{
+  unsigned nch = p[0]>>16;
+  if (_nch ? nch != _nch : (nch == 0 || nch > MAX_NCH))
+    return false;
+  if (!lastValid)
+    return true;
+  uint64_t pid = _pulseId(p);
+  return pid > last && pid-last <= _maxGap;
+}
+
+unsigned EntryScanner::scan(Record& record, size_t bytes)
+{
+  uint32_t* base   = reinterpret_cast<uint32_t*>(record.entries.data());
+  size_t    nwords = bytes/sizeof(uint32_t);
+  size_t    nfull  = bytes/sizeof(Entry);
+  size_t    nent   = (bytes+sizeof(Entry)-1)/sizeof(Entry);
+
+  //
+  //  Fast path: aligned and all plausible
+  //
+  if (nfull*sizeof(Entry) == bytes) {
+    if (nfull == 0) {
+      record.entries.resize(0);
+      return 0;
+    }
+    unsigned nch  = _nch ? _nch : (base[0]>>16);
+    uint64_t last = _lastValid ? _last : _pulseId(base)-1;
+    unsigned bad  = (nch == 0) | (nch > MAX_NCH);
+    const uint32_t* p = base;
+    for(size_t i=0; i<nfull; i++, p+=ENTRY_WORDS) {
+      uint64_t pid = _pulseId(p);
+      bad |= ((p[0]>>16) != nch) | (pid <= last) | (pid-last > _maxGap);
+      last = pid;
+    }
+    if (!bad) {
+      _nch       = nch;
+      _last      = last;
+      _lastValid = true;
+      _entries  += nfull;
+      record.entries.resize(nfull);
+      return 0;
+    }
+  }
+
+  //
+  //  Resynchronize: out of sync (and at the start, which may be
+  //  misaligned) an entry must be plausible and so must the one after it
+  //
+  size_t   w = 0, out = 0;
+  bool     sync = false;
+  while(w + ENTRY_WORDS <= nwords) {
+    const uint32_t* p = base+w;
+    bool ok = _plausible(p, _last, _lastValid);
+    bool follows = w + 2*ENTRY_WORDS <= nwords;
+    if (ok && !sync && follows) {
+      //  the following entry must have the same channel count
+      unsigned nch = _nch;
+      _nch = p[0]>>16;
+      ok   = _plausible(p+ENTRY_WORDS, _pulseId(p), true);
+      _nch = nch;
+    }
+    else if (!ok && _lastValid && _plausible(p, 0, false)) {
+      //  The pulse ID was reset or jumped by more than maxGap: re-anchor
+      //  on this entry if the one after it follows it, or on this entry
+      //  if it follows the one last rejected for its pulse ID (which may
+      //  have ended the previous fetch)
+      if (follows && _plausible(p+ENTRY_WORDS, _pulseId(p), true)) {
+        ok = true;
+        if (sync || w == 0)
+          _resyncs++;
+      }
+      else if (_pendingValid && _plausible(p, _pending, true))
+        ok = true;
+      else {
+        _pending      = _pulseId(p);
+        _pendingValid = true;
+      }
+    }
+    if (ok) {
+      _nch          = p[0]>>16;
+      _last         = _pulseId(p);
+      _lastValid    = true;
+      _pendingValid = false;
+      if (out != w)
+        memmove(base+out, p, sizeof(Entry));
+      out += ENTRY_WORDS;
+      w   += ENTRY_WORDS;
+      sync = true;
+    }
+    else {
+      if (sync || w == 0)
+        _resyncs++;
+      sync = false;
+      w++;
+    }
+  }
+
+  size_t kept = out/ENTRY_WORDS;
+  record.entries.resize(kept);
+  _entries += kept;
+  unsigned dropped = nent > kept ? nent-kept : 0;
+  _dropped += dropped;
+  return dropped;
+}
@@ -0,0 +1,74 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef Bsa_EntryScanner_hh
+#define Bsa_EntryScanner_hh
+
+#include "BsaDefs.hh"
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Bsa {
+  //
+  //  Validates the entries fetched from a BSA buffer.
+  //
+  //  An entry is plausible when its channel count is that of the array's
+  //  entries (learned from the first entry, at most 31) and its pulse ID
+  //  follows the previous entry's by at least 1 and at most maxGap.  When
+  //  the fetched bytes are aligned and every entry is plausible, as they
+  //  are normally, the check is a single pass without branches per entry.
+  //  Otherwise the scanner steps one word at a time to the next plausible
+  //  entry that the entry after it confirms, compacts the entries kept to
+  //  the front of the record and drops the rest.  Two entries that follow
+  //  each other but not the previous entry (a pulse ID reset, or a gap
+  //  longer than maxGap while the array did not acquire) re-anchor the
+  //  pulse ID, counted as a resync, even across fetches.
+  //
+  class EntryScanner {
+  public:
+    //
+    //  The largest pulse ID advance from one entry to the next: the most
+    //  events an entry averages (13 bits) at the slowest fixed rate (1 Hz,
+    //  928572 pulse IDs).  Sequence rates slower than 1 Hz need more.
+    //
+    static const uint64_t MaxGap = 8191ULL*928572ULL;
+  public:
+    EntryScanner(uint64_t maxGap=MaxGap);
+  public:
+    //
+    //  Validate the first "bytes" of record.entries (which may end within
+    //  an entry); returns the number of entries dropped
+    //
+    unsigned scan (Record& record, size_t bytes);
+    unsigned scan (Record& record) { return scan(record, record.entries.size()*sizeof(Entry)); }
+    //
+    //  Forget the channel count and previous pulse ID (new acquisition)
+    //
+    void     reset();
+  public:
+    uint64_t entries() const { return _entries; }   // entries kept
+    uint64_t dropped() const { return _dropped; }
+    uint64_t resyncs() const { return _resyncs; }
+  private:
+    bool     _plausible(const uint32_t* p, uint64_t last, bool lastValid) const;
+  private:
+    uint64_t _maxGap;
+    unsigned _nch;
+    uint64_t _last;
+    bool     _lastValid;
+    uint64_t _pending;      // last entry rejected only for its pulse ID
+    bool     _pendingValid;
+    uint64_t _entries;
+    uint64_t _dropped;
+    uint64_t _resyncs;
+  };
+};
+
+#endif
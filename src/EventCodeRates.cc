@@ -0,0 +1,86 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "EventCodeRates.hh"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace Tpr;
+
+EventCodeRates::EventCodeRates() :
+    _pending(0),
+    _events (0)
+{
+    memset(_planes, 0, sizeof(_planes));
+    memset(_counts, 0, sizeof(_counts));
+}
+
+void EventCodeRates::add(const uint32_t eventCodes[8])
+{
+#ifdef __SSE2__
+    __m128i c0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(eventCodes));
+    __m128i c1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(eventCodes)+1);
+    __m128i zero = _mm_setzero_si128();
+    for(unsigned p = 0; p < NPLANES; p++) {
+        __m128i* plane = reinterpret_cast<__m128i*>(_planes[p]);
+        __m128i  p0 = _mm_load_si128(plane);
+        __m128i  p1 = _mm_load_si128(plane+1);
+        _mm_store_si128(plane  , _mm_xor_si128(p0, c0));
+        _mm_store_si128(plane+1, _mm_xor_si128(p1, c1));
+        c0 = _mm_and_si128(p0, c0);
+        c1 = _mm_and_si128(p1, c1);
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(c0, c1), zero)) == 0xffff)
+            break;
+    }
+#else
+    uint64_t c[4];
+    memcpy(c, eventCodes, sizeof(c));
+    for(unsigned p = 0; p < NPLANES; p++) {
+        uint64_t any = 0;
+        for(unsigned w = 0; w < 4; w++) {
+            uint64_t t = _planes[p][w] & c[w];
+            _planes[p][w] ^= c[w];
+            c[w] = t;
+            any |= t;
+        }
+        if(!any)
+            break;
+    }
+#endif
+    _events++;
+    //  8 planes count up to 255
+    if(++_pending == 255)
+        flush();
+}
+
+void EventCodeRates::add(const TprEvent* ev, unsigned nev)
+{
+    for(unsigned i = 0; i < nev; i++)
+        add(ev[i].eventCodes);
+}
+
+void EventCodeRates::process(const char* buff, size_t sz)
+{
+    add(reinterpret_cast<const TprEvent*>(buff), sz / sizeof(TprEvent));
+}
+
+void EventCodeRates::flush()
+{
+    for(unsigned p = 0; p < NPLANES; p++)
+        for(unsigned w = 0; w < NUM_EVENT_CODES/64; w++) {
+            for(uint64_t m = _planes[p][w]; m != 0; m &= (m-1))
+                _counts[(w<<6) + __builtin_ctzll(m)] += (1ULL<<p);
+            _planes[p][w] = 0;
+        }
+    _pending = 0;
+}
@@ -0,0 +1,54 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef EventCodeRates_hh
+#define EventCodeRates_hh
+
+#include "TprStream.hh"
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Tpr {
+    //
+    //  Counts events per event code.
+    //
+    //  The 256-bit event code masks are added into bit-sliced counters:
+    //  plane p holds bit p of the count of every code, so adding an event
+    //  is a ripple carry over a few 256-bit planes instead of a loop over
+    //  its codes.  Every 255 events the planes are transposed into the
+    //  64-bit totals.
+    //
+    class EventCodeRates {
+        public:
+            EventCodeRates();
+            virtual ~EventCodeRates() {}
+
+            void     add    (const uint32_t eventCodes[8]);
+            void     add    (const TprEvent* ev, unsigned nev);
+            // add the events of a timing stream datagram
+            void     process(const char* buff, size_t sz);
+            // move the pending counts into the totals
+            void     flush  ();
+
+            // totals per event code, up to the last flush (every 255 events)
+            const uint64_t* counts() const { return _counts; }
+            uint64_t        events() const { return _events; }
+
+        private:
+            enum { NPLANES = 8 };
+            uint64_t  _planes[NPLANES][NUM_EVENT_CODES/64] __attribute__((aligned(16)));
+            unsigned  _pending;
+            uint64_t  _counts[NUM_EVENT_CODES];
+            uint64_t  _events;
+    }; /* class EventCodeRates */
+
+} /* namespace Tpr */
+
+#endif /* EventCodeRates_hh */
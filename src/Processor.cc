@@ -11,27 +11,22 @@
 #include "AmcCarrier.hh"
 #include "AmcCarrierYaml.hh"
 #include "BsaDefs.hh"
+#include "ShmExport.hh"
+#include "EntryScanner.hh"
+#include "BsaLog.hh"
+#include "BsaRealTime.hh"
 
 #include <cpsw_api_builder.h>
 
 #include <queue>
 #include <stdio.h>
 #include <time.h>
-#include <syslog.h>
 
 #define DONE_WORKAROUND
 
 static unsigned _nReadout = 1024 * 128;
 static const unsigned MAXREADOUT = 1<<20;
 
-static char* timestr() 
-{
-  time_t t = time(NULL);
-  char* v = asctime(localtime(&t));
-  *strchr(v,'\n')=0; // strip the carriage return
-  return v;
-}
-
 namespace Bsa {
 
   class Reader {
@@ -44,24 +39,24 @@ namespace Bsa {
     ~Reader() {}
   public:
     void     abort() { _abort = true; }
+    void     prefault() { BsaRealTime::prefault(_record); }
     bool     done () const { return _next==_last; }
     void     preset (const ArrayState&    state) { _preset = state.wrAddr; }
-    bool     reset(PvArray&              array, 
-                   const ArrayState&     state,
-                   AmcCarrierBase&       hw,
-                   uint64_t              timestamp)
+    BsaStatus reset(PvArray&              array, 
+                    const ArrayState&     state,
+                    AmcCarrierBase&       hw,
+                    uint64_t              timestamp)
     {
       if (_abort) {
         _next = _last = state.wrAddr;
         _abort = false;
-        return false;
+        return BsaAborted;
       }
 
       //  Check if wrAddr pointer has moved.  If so, the acquisition isn't done
       if (state.wrAddr != _preset) {
-        syslog(LOG_WARNING,"<W> %s:  %s:%-4d [reset]: not ready 0x%09llx  wrAddr 0x%09llx",
-               timestr(),__FILE__,__LINE__,_preset,state.wrAddr);
-        return false;
+        BsaLog::post(LogResetNotReady, array.array(), _preset, state.wrAddr);
+        return BsaNotReady;
       }
 
       _timestamp = state.timestamp;
@@ -75,28 +70,29 @@ namespace Bsa {
       _last = state.wrAddr;
 
       //  Check if wrAddr is properly aligned to the record size.
+      //  (the scanner drops the partial entry)
       unsigned n0 = _last / sizeof(Entry);
       if (n0*sizeof(Entry) != _last) {
-        syslog(LOG_WARNING,"<W> %s:  %s:%-4d [reset] misaligned _last 0x%09llx",
-               timestr(),__FILE__,__LINE__,_last);
-        return false;
+        BsaLog::post(LogResetMisaligned, iarray, _last);
       }
+      _scanner.reset();
 
       array.reset(timestamp>>32,timestamp&0xffffffff);
 
       uint64_t hw_done = hw.done();
-      syslog(LOG_DEBUG,"<D> %s:  %s:%-4d []  array %u  _timestamp 0x%016llx  _next 0x%09llx  _last 0x%09llx  __end 0x%09llx  done 0x%09llx",
-             timestr(),__FILE__,__LINE__,array.array(),_timestamp,_next,_last,_end,hw_done);
+      BsaLog::post(LogResetDone, iarray, _timestamp, _next, _last, _end, hw_done);
 
-      return true;
+      return BsaOk;
     }
 
-    Record* next(PvArray& array, AmcCarrierBase& hw)
+    BsaStatus next(PvArray& array, AmcCarrierBase& hw, Record** precord)
     {
+      *precord = &_record;
+
       if (_abort) {
         _next = _last;
         _record.entries.resize(0);
-        return &_record;
+        return BsaOk;
       }
 
       unsigned n = _nReadout;
@@ -131,12 +127,13 @@ namespace Bsa {
       }
 
       if (n > MAXREADOUT) {
-        syslog(LOG_ERR,"<E> Reader::next allocating record with %u entries", n);
-        throw(std::string("Too many entries"));
+        BsaLog::post(LogReadoutSize, array.array(), n);
+        return BsaReadoutSize;
       }
 
       Record& record = _record;
-      record.entries.resize(n);
+      uint64_t nbytes = next - _next;
+      record.entries.resize((nbytes+sizeof(Entry)-1)/sizeof(Entry));
 
       hw._fill(record.entries.data(), _next, next);
 
@@ -144,26 +141,29 @@ namespace Bsa {
       unsigned n0 = _next / sizeof(Entry);
       if (n0*sizeof(Entry) != _next) {
         const Entry& e = record.entries[0];
-        syslog(LOG_ERR,"<E> %s  %s:%-4d [Misaligned record]  _next 0x%09llx  nch %u  pid 0x%09llx",
-               timestr(),__FILE__,__LINE__,_next,e.nchannels(),e.pulseId());
+        BsaLog::post(LogMisalignedRecord, array.array(), _next, e.nchannels(), e.pulseId());
       }
       
       //  _last or _end dont occur at an Entry boundary
       if (_next + n*sizeof(Entry) != next) {
-        syslog(LOG_ERR,"<E> %s:  %s:%-4d [Truncated record]  _next 0x%09llx  next 0x%09llx  _last 0x%09llx  _end 0x%09llx  _next+n 0x%09llx  n %u",
-               timestr(),__FILE__,__LINE__,_next,next,_last,_end,_next+n*sizeof(Entry),n);
+        BsaLog::post(LogTruncatedRecord, array.array(), _next, next, _last, _end, n);
       }
 
+      //  Keep the valid entries
+      unsigned dropped = _scanner.scan(record, nbytes);
+      if (dropped)
+        BsaLog::post(LogResync, array.array(), dropped, record.entries.size());
+
       _next = nnext;
 
       if (done()) {
         hw   .reset(array.array());
         array.set(_timestamp>>32, _timestamp&0xffffffff);
         uint64_t hw_done = hw.done();
-        syslog(LOG_DEBUG,"<D> %s:%-4d [done]:  array %u  hw.done 0x%09llx",__FILE__,__LINE__,array.array(),hw_done);
+        BsaLog::post(LogReadoutDone, array.array(), hw_done);
       }
 
-      return &record;
+      return BsaOk;
     }
   private:
     AmcCarrierBase* _hw;
@@ -175,46 +175,73 @@ namespace Bsa {
     uint64_t _preset;
     bool     _abort;
     Record   _record;
+    EntryScanner _scanner;
   };
 
   class ProcessorImpl : public Processor {
   public:
     ProcessorImpl(Path reg,
                   Path ram,
-                  bool lInit) : _hw(*new AmcCarrierYaml(reg,ram))
+                  bool lInit) : _hw(*new AmcCarrierYaml(reg,ram)), _export(0)
     {
       if (lInit) _hw.initialize();
       for(unsigned i=0; i<HSTARRAYN; i++) {
 	_state[i].next = _hw._begin[i];
-	syslog(LOG_DEBUG,"<D> %s:  %s:%-4d [ProcessorImpl] next[%u] 0x%09llx",
-	       timestr(),__FILE__,__LINE__, i,_state[i].next);
+	BsaLog::post(LogProcessorNext, i, _state[i].next);
       }
+      _prefault();
     }
     ProcessorImpl(const char* ip,
 		  bool lInit,
-		  bool lDebug) : _hw(*new AmcCarrier(ip))
+		  bool lDebug) : _hw(*new AmcCarrier(ip)), _export(0)
     {
       if (lInit) _hw.initialize();
       for(unsigned i=0; i<HSTARRAYN; i++)
 	_state[i].next = _hw._begin[i];
+      _prefault();
     }
-    ProcessorImpl() : _hw(*AmcCarrier::instance())
+    ProcessorImpl() : _hw(*AmcCarrier::instance()), _export(0)
     {
-      syslog(LOG_WARNING,"<W> %s:  %s:%-4d [ProcessorImpl]",
-	     timestr(),__FILE__,__LINE__);
+      BsaLog::post(LogProcessorShared, LogNoArray);
+      _prefault();
+    }
+    ProcessorImpl(AmcCarrierBase& hw) : _hw(hw), _export(0)
+    {
+      for(unsigned i=0; i<HSTARRAYN; i++)
+	_state[i].next = _hw._begin[i];
+      _prefault();
     }
     ~ProcessorImpl();
   public:
     uint64_t pending();
     int      update(PvArray&);
+    BsaStatus update(PvArray&, int* nacq);
+    const StatusCounts& errors() const { return _errors; }
+    void     setExport(ShmExport* e) { delete _export; _export = e; }
     AmcCarrierBase *getHardware();
   private:
     void     abort (PvArray&);
+    //  Touch the readout buffers in real-time mode, and start the log
+    //  formatter, so that neither faults in pages during an update
+    void     _prefault()
+    {
+      if (!BsaRealTime::enabled())
+        return;
+      BsaLog::start();
+      BsaRealTime::prefault(_hw._record);
+      for(unsigned i=0; i<HSTARRAYN-HSTARRAY0; i++)
+        _reader[i].prefault();
+      BsaRealTime::prefault(_emptyRecord);
+      BsaRealTime::lock();
+    }
     AmcCarrierBase&      _hw;
     ArrayState           _state [HSTARRAYN];
     Reader               _reader[HSTARRAYN-HSTARRAY0];
+    EntryScanner         _scanner[HSTARRAY0];
     std::queue<unsigned> _readerQueue;
     Record               _emptyRecord;
+    ShmExport*           _export;
+    StatusCounts         _errors;
   };
 
 };
@@ -246,16 +273,25 @@ uint64_t ProcessorImpl::pending()
 
 int ProcessorImpl::update(PvArray& array)
 {
+  int nacq;
+  update(array, &nacq);
+  return nacq;
+}
+
+BsaStatus ProcessorImpl::update(PvArray& array, int* nacq)
+{
+  ReadoutScope  rt;
   unsigned      iarray = array.array();
   std::vector<Pv*> pvs = array.pvs();
   ArrayState current(_hw.state(iarray));
 
-  Record* record;
+  Record*   record = &_emptyRecord;
+  bool      lreset = false;
+  BsaStatus status = BsaOk;
 
-  try {
+  *nacq = 0;
 
-    // syslog(LOG_DEBUG,"<W> %s:  %s:%-4d []: array %u  next 0x%09llx",
-    // 	   timestr(),__FILE__,__LINE__,iarray,_state[iarray].next);
+  try {
 
     if (array.array() < HSTARRAY0) {
       if (current != _state[iarray]) {
@@ -266,18 +302,19 @@ int ProcessorImpl::update(PvArray& array)
           //
           _hw.ackClear(iarray);
 
-          syslog(LOG_DEBUG,"<D> %s:  %s:%-4d [current %d]: NEW TS [%u.%09u -> %u.%09u]  wrAddr %09llx\n",
-                 timestr(),__FILE__,__LINE__,iarray,
-                 _state[iarray].timestamp>>32,
-                 _state[iarray].timestamp&0xffffffff,
-                 current.timestamp>>32,
-                 current.timestamp&0xffffffff,
-                 current.wrAddr);
+          BsaLog::post(LogNewAcquisition, iarray,
+                       _state[iarray].timestamp>>32,
+                       _state[iarray].timestamp&0xffffffff,
+                       current.timestamp>>32,
+                       current.timestamp&0xffffffff,
+                       current.wrAddr);
 
           array.reset(current.timestamp>>32,
                       current.timestamp&0xffffffff);
           current.nacq = 0; 
-          record = _hw.getRecord(iarray,&current.next);  // read from beginning
+          lreset = true;
+          _scanner[iarray].reset();
+          status = _hw.fetch(iarray,_hw._begin[iarray],&current.next,&record);  // read from beginning
         }
         else {
           //
@@ -285,76 +322,89 @@ int ProcessorImpl::update(PvArray& array)
           //
           array.set(current.timestamp>>32,
                     current.timestamp&0xffffffff);
-          record = _hw.get(iarray,_state[iarray].next,&current.next);
+          status = _hw.fetch(iarray,_state[iarray].next,&current.next,&record);
+        }
+
+        //  Keep the valid entries
+        if (status == BsaOk) {
+          unsigned dropped = _scanner[iarray].scan(*record);
+          if (dropped)
+            BsaLog::post(LogResync, iarray, dropped, record->entries.size());
         }
 
       }
     }
     else {  // >= HSTARRAY0
 
-      syslog(LOG_DEBUG,"<D> %s:  %s:%-4d [current %d]: wrAddr %09llx  next %09llx  clear %u  wrap %u  nacq %u",
-             timestr(),__FILE__,__LINE__,iarray,current.wrAddr,current.next,current.clear,current.wrap,current.nacq);
+      BsaLog::post(LogFaultState, iarray, current.wrAddr, current.next, current.clear, current.wrap, current.nacq);
 
       unsigned ifltb = array.array()-HSTARRAY0;
       Reader& reader = _reader[ifltb];
       if (_readerQueue.empty()) {
         reader.preset(current);  // prepare check for erroneous hw.done signal
         _readerQueue.push(ifltb);
-        record = &_emptyRecord;
       }
       else if (_readerQueue.front()==ifltb) {
         if (reader.done()) {
           //  A new fault was latched
           current.nacq = 0;
-          if (reader.reset(array,current,_hw,current.timestamp-(1ULL<<32))) {
-            record = reader.next(array,_hw);
-          }
-          else {
+          lreset = true;
+          status = reader.reset(array,current,_hw,current.timestamp-(1ULL<<32));
+          if (status != BsaOk) {
             // We got the wrong done signal.  Find the correct one and queue it.
+            _errors.count(status);
             _hw.reset(iarray);
             _readerQueue.pop();
-            return 0;  // don't try to correct anything, just skip
+            return status;  // don't try to correct anything, just skip
           }
+          status = reader.next(array,_hw,&record);
         }
         else {
           //  A previous fault readout is in progress
-          record = reader.next(array,_hw);
+          status = reader.next(array,_hw,&record);
         }
 
-        if (reader.done())
+        if (status == BsaOk && reader.done())
           _readerQueue.pop();
       }
       else {  // Some other fault buffer readout is in progress
-        record = &_emptyRecord;
       }
     }
 
-    // syslog(LOG_DEBUG,"<W> %s:  %s:%-4d []: array %u  entries %u",
-    // 	   timestr(),__FILE__,__LINE__,iarray,record->entries.size());
-
-    for(unsigned i=0; i<record->entries.size(); i++) {
-      const Entry& entry = record->entries[i];
-      //  fill pulseid waveform
-      array.append(entry.pulseId());
-      //  fill channel data waveforms
-      for(unsigned j=0; j<pvs.size(); j++)
-        pvs[j]->append(entry.channel_data[j].n(),
-                       entry.channel_data[j].mean(),
-                       entry.channel_data[j].rms2());
-    }
+    if (status == BsaOk) {
+      for(unsigned i=0; i<record->entries.size(); i++) {
+        const Entry& entry = record->entries[i];
+        //  fill pulseid waveform
+        array.append(entry.pulseId());
+        //  fill channel data waveforms
+        for(unsigned j=0; j<pvs.size(); j++)
+          pvs[j]->append(entry.channel_data[j].n(),
+                         entry.channel_data[j].mean(),
+                         entry.channel_data[j].rms2());
+      }
+
+      if (_export && (lreset || record->entries.size()))
+        _export->publish(iarray, current.timestamp, lreset, record->entries);
 
-    current.nacq += record->entries.size();
-    _state[iarray] = current;
+      current.nacq += record->entries.size();
+      _state[iarray] = current;
+    }
   }
   catch(...) {
+    status = BsaHardware;
+  }
+
+  _errors.count(status);
+
+  if (status != BsaOk) {
     // Something bad happened.  Abort this acquisition.
-    syslog(LOG_ERR,"<E> %s:  %s:%-4d [current %d]: caught exception. abort. next 0x%09llx  wrAddr 0x%09llx  ts 0x%016llx",
-           timestr(),__FILE__,__LINE__,iarray,_state[iarray].next,_state[iarray].wrAddr,_state[iarray].timestamp);
+    BsaLog::post(LogUpdateAbort, iarray, status, _state[iarray].next, _state[iarray].wrAddr, _state[iarray].timestamp);
     abort(array);
-    return 0;
+    return status;
   }
 
-  return current.nacq;
+  *nacq = current.nacq;
+  return BsaOk;
 }
 
 //
@@ -369,6 +419,8 @@ void ProcessorImpl::abort(PvArray& array)
               current.timestamp&0xffffffff);
 
   if (iarray < HSTARRAY0) {
+    //  The entries are read again from the start of the buffer
+    _scanner[iarray].reset();
   }
   else {
     unsigned ifltb = iarray-HSTARRAY0;
@@ -407,6 +459,12 @@ Processor* Processor::create()
   return new ProcessorImpl();
 }
 
+Processor* Processor::create(AmcCarrierBase* hw)
+{
+  return new ProcessorImpl(*hw);
+}
+
 ProcessorImpl::~ProcessorImpl()
 {
+  delete _export;
 }
@@ -19,6 +19,7 @@
 #include <cpsw_api_user.h>
 
 namespace Bsa {
+  class ShmExport;
   //
   //  Class that defines the interface from the BSA processor to a PV record
   //
@@ -103,6 +104,11 @@ namespace Bsa {
     //  Share the interface to the AmcCarrier
     //
     static Processor* create();
+    //
+    //  Process the arrays of a carrier interface the caller owns
+    //  (e.g. an AmcCarrierClient of the broker, a replay or a simulation)
+    //
+    static Processor* create(AmcCarrierBase* hw);
   public:
     //
     //  Fetch a bit mask of arrays with pending data
@@ -114,10 +120,26 @@ namespace Bsa {
     //
     virtual int update(PvArray&) = 0;
     //
+    //  Update as above, returning the result of the readout and setting
+    //  nacq to the value update(PvArray&) returns.  An error aborts the
+    //  acquisition as update(PvArray&) does.
+    //
+    virtual BsaStatus update(PvArray&, int* nacq) = 0;
+    //
+    //  Results of update by category
+    //
+    virtual const StatusCounts& errors() const = 0;
+    //
     //  Abort an acquisition readout
     //
     //    virtual void abort(PvArray&) = 0;
     //
+    //  Also publish each update to a shared memory export (0 to stop).
+    //  The processor takes ownership: the export is deleted when it is
+    //  replaced or when the processor is destroyed.
+    //
+    virtual void setExport(ShmExport*) = 0;
+    //
     //  
     //
     virtual AmcCarrierBase *getHardware() = 0;
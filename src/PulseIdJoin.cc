@@ -0,0 +1,231 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "PulseIdJoin.hh"
+
+#include <stdio.h>
+
+#include <string>
+
+static const unsigned MAX_NCH = 31;   // channel_data of an Entry
+
+namespace Bsa {
+  //
+  //  Forwards a channel's updates and records its mean
+  //
+  class JoinPv : public Pv {
+  public:
+    JoinPv(Pv* forward, std::vector<double>* column) :
+      _forward(forward), _column(column) {}
+  public:
+    void setTimestamp(unsigned sec,
+                      unsigned nsec)
+    { if (_forward) _forward->setTimestamp(sec,nsec); }
+    void clear()
+    { if (_forward) _forward->clear(); }
+    void append(unsigned n,
+                double   mean,
+                double   rms2)
+    { if (_forward) _forward->append(n,mean,rms2);
+      if (_column)  _column->push_back(mean); }
+    void flush()
+    { if (_forward) _forward->flush(); }
+  private:
+    Pv*                  _forward;
+    std::vector<double>* _column;
+  };
+
+  class PulseIdJoin::Input : public PvArray {
+  public:
+    Input(unsigned                     array,
+          const std::vector<unsigned>& channels,
+          PvArray*                     forward) :
+      _array    (array),
+      _forward  (forward),
+      _mean     (channels.size()),
+      _head     (0),
+      _unmatched(0)
+    {
+      std::vector<Pv*> fpvs;
+      if (forward)
+        fpvs = forward->pvs();
+
+      unsigned npvs = fpvs.size();
+      for(unsigned k=0; k<channels.size(); k++)
+        if (channels[k] >= npvs)
+          npvs = channels[k]+1;
+
+      std::vector<std::vector<double>*> column(npvs,(std::vector<double>*)0);
+      for(unsigned k=0; k<channels.size(); k++)
+        column[channels[k]] = &_mean[k];
+
+      for(unsigned j=0; j<npvs; j++)
+        _pvs.push_back(new JoinPv(j<fpvs.size() ? fpvs[j] : 0, column[j]));
+    }
+    ~Input()
+    {
+      for(unsigned j=0; j<_pvs.size(); j++)
+        delete _pvs[j];
+    }
+  public:
+    unsigned array() const { return _array; }
+    void reset(uint32_t sec,
+               uint32_t nsec)
+    {
+      if (_forward) _forward->reset(sec,nsec);
+      //  New acquisition; pending entries will not be matched
+      _unmatched += _pulseId.size()-_head;
+      _pulseId.clear();
+      for(unsigned k=0; k<_mean.size(); k++)
+        _mean[k].clear();
+      _head = 0;
+    }
+    void set(uint32_t sec,
+             uint32_t nsec)
+    { if (_forward) _forward->set(sec,nsec); }
+    void append(uint64_t pulseId)
+    { if (_forward) _forward->append(pulseId);
+      _pulseId.push_back(pulseId); }
+    std::vector<Pv*> pvs() { return _pvs; }
+  public:
+    //
+    //  Drop the consumed entries, and the oldest beyond maxPending
+    //
+    void compact(unsigned maxPending)
+    {
+      unsigned n = _pulseId.size()-_head;
+      if (n > maxPending) {
+        _unmatched += n-maxPending;
+        _head      += n-maxPending;
+      }
+      if (_head) {
+        _pulseId.erase(_pulseId.begin(), _pulseId.begin()+_head);
+        for(unsigned k=0; k<_mean.size(); k++)
+          _mean[k].erase(_mean[k].begin(), _mean[k].begin()+_head);
+        _head = 0;
+      }
+    }
+  public:
+    unsigned                          _array;
+    PvArray*                          _forward;
+    std::vector<Pv*>                  _pvs;
+    std::vector<uint64_t>             _pulseId;
+    std::vector<std::vector<double> > _mean;
+    unsigned                          _head;
+    uint64_t                          _unmatched;
+  };
+};
+
+using namespace Bsa;
+
+PulseIdJoin::PulseIdJoin(JoinHandler& handler,
+                         unsigned     maxPending) :
+  _handler   (handler),
+  _maxPending(maxPending),
+  _rows      (0)
+{
+}
+
+PulseIdJoin::~PulseIdJoin()
+{
+  for(unsigned i=0; i<_inputs.size(); i++)
+    delete _inputs[i];
+}
+
+PvArray& PulseIdJoin::add(unsigned                     array,
+                          const std::vector<unsigned>& channels,
+                          PvArray*                     forward)
+{
+  for(unsigned k=0; k<channels.size(); k++)
+    if (channels[k] >= MAX_NCH) {
+      char buff[64];
+      snprintf(buff, sizeof(buff), "PulseIdJoin: channel %u out of range", channels[k]);
+      throw(std::string(buff));
+    }
+
+  Input* input = new Input(array, channels, forward);
+  _out._offset.push_back(_out._mean.size());
+  _out._mean.resize(_out._mean.size()+channels.size());
+  _inputs.push_back(input);
+  return *input;
+}
+
+uint64_t PulseIdJoin::unmatched(unsigned input) const
+{
+  return input < _inputs.size() ? _inputs[input]->_unmatched : 0;
+}
+
+int PulseIdJoin::process()
+{
+  unsigned ninputs = _inputs.size();
+  if (!ninputs)
+    return 0;
+
+  _out._pulseId.clear();
+  for(unsigned c=0; c<_out._mean.size(); c++)
+    _out._mean[c].clear();
+
+  //
+  //  Merge join: the largest head pulse ID is the next candidate;
+  //  entries below it in any array can no longer match.
+  //
+  while(1) {
+    uint64_t next = 0;
+    bool     done = false;
+    for(unsigned i=0; i<ninputs; i++) {
+      Input& in = *_inputs[i];
+      if (in._head == in._pulseId.size()) {
+        done = true;
+        break;
+      }
+      if (in._pulseId[in._head] > next)
+        next = in._pulseId[in._head];
+    }
+    if (done)
+      break;
+
+    bool match = true;
+    for(unsigned i=0; i<ninputs; i++) {
+      Input& in = *_inputs[i];
+      while(in._head < in._pulseId.size() && in._pulseId[in._head] < next) {
+        in._head++;
+        in._unmatched++;
+      }
+      if (in._head == in._pulseId.size()) {
+        done = true;
+        break;
+      }
+      if (in._pulseId[in._head] != next)
+        match = false;
+    }
+    if (done)
+      break;
+
+    if (match) {
+      _out._pulseId.push_back(next);
+      for(unsigned i=0; i<ninputs; i++) {
+        Input& in = *_inputs[i];
+        unsigned c = _out._offset[i];
+        for(unsigned k=0; k<in._mean.size(); k++)
+          _out._mean[c+k].push_back(in._mean[k][in._head]);
+        in._head++;
+      }
+    }
+  }
+
+  for(unsigned i=0; i<ninputs; i++)
+    _inputs[i]->compact(_maxPending);
+
+  unsigned rows = _out._pulseId.size();
+  if (rows) {
+    _rows += rows;
+    _handler.process(_out);
+  }
+  return rows;
+}
@@ -0,0 +1,85 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef Bsa_PulseIdJoin_hh
+#define Bsa_PulseIdJoin_hh
+
+#include "Processor.hh"
+
+#include <vector>
+#include <stdint.h>
+
+namespace Bsa {
+  //
+  //  Rows of the pulse IDs acquired by every joined array
+  //
+  class JoinedColumns {
+  public:
+    unsigned rows() const { return _pulseId.size(); }
+    const std::vector<uint64_t>& pulseId() const { return _pulseId; }
+    //
+    //  Mean of the k-th selected channel of the i-th joined array
+    //
+    const std::vector<double>& mean(unsigned input, unsigned k) const
+    { return _mean[_offset[input]+k]; }
+  private:
+    friend class PulseIdJoin;
+    std::vector<uint64_t>            _pulseId;
+    std::vector<unsigned>            _offset;   // first column of each input
+    std::vector<std::vector<double> > _mean;
+  };
+
+  class JoinHandler {
+  public:
+    virtual ~JoinHandler() {}
+    virtual void process(const JoinedColumns&) = 0;
+  };
+
+  //
+  //  Aligns several BSA arrays on pulse ID as their entries arrive.
+  //
+  //  Each array is updated through the PvArray returned by add(), which
+  //  records the pulse IDs and selected channel means on their way to
+  //  the PvArray it forwards to.  process() merge-joins the monotonic
+  //  pulse ID columns accumulated since the last call and hands the
+  //  matching rows to the handler.  Entries that can no longer match
+  //  are discarded.
+  //
+  class PulseIdJoin {
+  public:
+    PulseIdJoin(JoinHandler& handler,
+                unsigned     maxPending=1000000);  // entries kept per array while waiting for a match
+    ~PulseIdJoin();
+  public:
+    //
+    //  Join array "array" on the channels (diagnostic bus element order) listed;
+    //  updates are also passed on to "forward" if given.  Throws if a
+    //  channel is not one of the 31 of an entry.
+    //
+    PvArray& add(unsigned                     array,
+                 const std::vector<unsigned>& channels,
+                 PvArray*                     forward=0);
+    //
+    //  Join the entries appended since the last call; returns the rows joined
+    //
+    int      process();
+  public:
+    uint64_t rows     () const { return _rows; }
+    uint64_t unmatched(unsigned input) const;
+  private:
+    class Input;
+    JoinHandler&        _handler;
+    unsigned            _maxPending;
+    std::vector<Input*> _inputs;
+    JoinedColumns       _out;
+    uint64_t            _rows;
+  };
+};
+
+#endif
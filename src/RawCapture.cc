@@ -0,0 +1,319 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "RawCapture.hh"
+#include "AmcCarrierBase.hh"
+#include "RegisterCache.hh"
+#include "BsaRealTime.hh"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+using namespace Bsa;
+
+static uint64_t _now(clockid_t id=CLOCK_MONOTONIC)
+{
+  timespec tv;
+  clock_gettime(id, &tv);
+  return uint64_t(tv.tv_sec)*1000000000ULL + tv.tv_nsec;
+}
+
+static void* pollThread(void* arg)
+{
+  BsaRealTime::worker();
+  reinterpret_cast<RawCapture*>(arg)->poll();
+  return 0;
+}
+
+static void* writeThread(void* arg)
+{
+  BsaRealTime::worker();
+  reinterpret_cast<RawCapture*>(arg)->write();
+  return 0;
+}
+
+RawCapture::RawCapture(AmcCarrierBase& hw,
+                       const char*     path,
+                       unsigned        ringMask,
+                       uint64_t        bufferSize,
+                       unsigned        chunkSize,
+                       unsigned        nchunks) :
+  _hw         (hw),
+  _path       (path),
+  _mask       (ringMask & ((1<<RAW_RINGS)-1)),
+  _size       ((bufferSize+RAW_BLOCK-1)&~uint64_t(RAW_BLOCK-1)),
+  _chunkSize  ((chunkSize+RAW_BLOCK-1)&~(RAW_BLOCK-1)),
+  _memBase    (hw._memEnd),
+  _memEnd     (hw._memEnd),
+  _stop       (false),
+  _running    (false),
+  _direct     (false),
+  _fd         (-1),
+  _written    (0),
+  _writeErrors(0)
+{
+  //  Two buffers per ring above everything allocated so far
+  for(unsigned r=0; r<RAW_RINGS; r++) {
+    if (!(_mask & (1<<r)))
+      continue;
+    _begin[r][0] = _memEnd;
+    _begin[r][1] = _memEnd + _size;
+    _memEnd += 2*_size;
+  }
+
+  //  The DRAM field gives the size where the carrier has one
+  uint64_t dramSize = _hw._dramSize();
+  if (dramSize && _memEnd > dramSize) {
+    char buff[128];
+    snprintf(buff, sizeof(buff), "RawCapture: buffers end at 0x%llx beyond DRAM size 0x%llx",
+             (unsigned long long)_memEnd, (unsigned long long)dramSize);
+    throw(std::string(buff));
+  }
+  _hw._memEnd = _memEnd;
+
+  memset(_stats, 0, sizeof(_stats));
+  memset(_half , 0, sizeof(_half));
+  memset(_armed, 0, sizeof(_armed));
+
+  pthread_mutex_init(&_lock, 0);
+  pthread_cond_init (&_freeCond, 0);
+  pthread_cond_init (&_fullCond, 0);
+
+  //  A header block and at least two chunks, so fetch and write overlap
+  if (nchunks < 3)
+    nchunks = 3;
+  for(unsigned i=0; i<nchunks; i++) {
+    void* p;
+    if (posix_memalign(&p, RAW_BLOCK, _chunkSize))
+      break;
+    _chunks.push_back(reinterpret_cast<uint8_t*>(p));
+    Chunk c = { reinterpret_cast<uint8_t*>(p), 0 };
+    _free.push_back(c);
+  }
+}
+
+RawCapture::~RawCapture()
+{
+  stop();
+  for(unsigned i=0; i<_chunks.size(); i++)
+    free(_chunks[i]);
+  pthread_cond_destroy (&_fullCond);
+  pthread_cond_destroy (&_freeCond);
+  pthread_mutex_destroy(&_lock);
+
+  //  Give the buffers back unless something was placed above them since
+  if (_hw._memEnd == _memEnd)
+    _hw._memEnd = _memBase;
+}
+
+bool RawCapture::start()
+{
+  if (_running)
+    return true;
+
+  _fd = ::open(_path, O_WRONLY|O_CREAT|O_TRUNC|O_DIRECT, 0644);
+  _direct = _fd >= 0;
+  if (_fd < 0 && errno == EINVAL)   // file system without O_DIRECT
+    _fd = ::open(_path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (_fd < 0) {
+    syslog(LOG_ERR,"<E> RawCapture: open %s failed: %s", _path, strerror(errno));
+    return false;
+  }
+
+  for(unsigned r=0; r<RAW_RINGS; r++)
+    if (_mask & (1<<r))
+      _arm(r, 0);
+
+  _stop    = false;
+  _running = true;
+  pthread_create(&_writeThread, 0, writeThread, this);
+  pthread_create(&_pollThread , 0, pollThread , this);
+  return true;
+}
+
+void RawCapture::stop()
+{
+  if (!_running)
+    return;
+
+  _stop = true;
+  pthread_join(_pollThread, 0);
+
+  //  The writer drains the queue and stops at the empty chunk
+  Chunk end = { 0, 0 };
+  pthread_mutex_lock(&_lock);
+  _full.push_back(end);
+  pthread_cond_signal(&_fullCond);
+  pthread_mutex_unlock(&_lock);
+  pthread_join(_writeThread, 0);
+
+  ::close(_fd);
+  _fd      = -1;
+  _running = false;
+}
+
+//
+//  Record into one buffer of the ring until it is full
+//
+void RawCapture::_arm(unsigned ring, unsigned half)
+{
+  uint64_t p  = _begin[ring][half];
+  uint64_t pn = p + _size;
+  uint32_t one(1), zero(0), mode(1);
+  RamBlock   b = waveform(ring);
+  IndexRange rng(ring%4);
+  _hw._regs.rw(b,StartAddr)->setVal(&p   ,1,&rng);
+  _hw._regs.rw(b,EndAddr  )->setVal(&pn  ,1,&rng);
+  _hw._regs.rw(b,Enabled  )->setVal(&one ,1,&rng);
+  _hw._regs.rw(b,Mode     )->setVal(&mode,1,&rng);
+  _hw._regs.rw(b,Init     )->setVal(&one ,1,&rng);
+  _hw._regs.rw(b,Init     )->setVal(&zero,1,&rng);
+  _half [ring] = half;
+  _armed[ring] = _now();
+}
+
+//
+//  One transaction per waveform block with rings in the mask
+//
+uint32_t RawCapture::_done() const
+{
+  uint32_t v[4], done = 0;
+  for(unsigned b=0; b<2; b++) {
+    if (!((_mask>>(4*b)) & 0xf))
+      continue;
+    _hw._regs.ro(b ? Waveform1 : Waveform0, Done)->getVal(v,4);
+    for(unsigned i=0; i<4; i++)
+      if (v[i]) done |= 1<<(4*b+i);
+  }
+  return done;
+}
+
+void RawCapture::poll()
+{
+  while(!_stop) {
+    uint64_t now  = _now();
+    uint32_t done = _mask & _done();
+
+    for(unsigned r=0; r<RAW_RINGS; r++) {
+      if (!(_mask & (1<<r)))
+        continue;
+      if (done & (1<<r)) {
+        //  Full sometime since it was last seen recording; re-arm first
+        uint64_t seen = _armed[r];
+        unsigned half = _half[r];
+        _arm(r, half^1);
+        _capture(r, half, _armed[r]-seen);
+      }
+      else
+        _armed[r] = now;
+    }
+
+    if (!done)
+      usleep(1000);
+  }
+}
+
+//
+//  Queue the header and the buffer's chunks for the writer
+//
+void RawCapture::_capture(unsigned ring, unsigned half, uint64_t dead)
+{
+  RingStats& st = _stats[ring];
+
+  Chunk c = _get();
+  memset(c.p, 0, RAW_BLOCK);
+  RawCaptureHeader& h = *reinterpret_cast<RawCaptureHeader*>(c.p);
+  memcpy(h.magic, "BSAR", 4);
+  h.ring    = ring;
+  h.seq     = st.buffers;
+  h.begAddr = _begin[ring][half];
+  h.bytes   = _size;
+  h.time    = _now(CLOCK_REALTIME);
+  h.deadNs  = dead;
+  c.bytes   = RAW_BLOCK;
+  _put(c);
+
+  for(uint64_t p=0; p<_size; p+=_chunkSize) {
+    uint64_t n = _size-p < _chunkSize ? _size-p : _chunkSize;
+    c = _get();
+    _hw._fill(c.p, h.begAddr+p, h.begAddr+p+n);
+    c.bytes = n;
+    _put(c);
+  }
+
+  st.buffers++;
+  st.bytes  += _size;
+  st.deadNs += dead;
+  if (dead > st.deadMaxNs)
+    st.deadMaxNs = dead;
+}
+
+RawCapture::Chunk RawCapture::_get()
+{
+  pthread_mutex_lock(&_lock);
+  while(_free.empty())
+    pthread_cond_wait(&_freeCond, &_lock);
+  Chunk c = _free.front();
+  _free.pop_front();
+  pthread_mutex_unlock(&_lock);
+  return c;
+}
+
+void RawCapture::_put(const Chunk& c)
+{
+  pthread_mutex_lock(&_lock);
+  _full.push_back(c);
+  pthread_cond_signal(&_fullCond);
+  pthread_mutex_unlock(&_lock);
+}
+
+void RawCapture::write()
+{
+  uint64_t offset = 0;
+  while(1) {
+    pthread_mutex_lock(&_lock);
+    while(_full.empty())
+      pthread_cond_wait(&_fullCond, &_lock);
+    Chunk c = _full.front();
+    _full.pop_front();
+    pthread_mutex_unlock(&_lock);
+
+    if (!c.p)
+      break;
+
+    size_t done = 0;
+    while(done < c.bytes) {
+      ssize_t n = pwrite(_fd, c.p+done, c.bytes-done, offset+done);
+      if (n <= 0) {
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (!_writeErrors++)
+          syslog(LOG_ERR,"<E> RawCapture: write to %s failed: %s", _path, strerror(errno));
+        break;
+      }
+      done += n;
+    }
+    //  Keep the file aligned for the next direct write
+    offset   += c.bytes;
+    _written += done;
+
+    pthread_mutex_lock(&_lock);
+    _free.push_back(c);
+    pthread_cond_signal(&_freeCond);
+    pthread_mutex_unlock(&_lock);
+  }
+}
@@ -0,0 +1,120 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef Bsa_RawCapture_hh
+#define Bsa_RawCapture_hh
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <deque>
+#include <vector>
+
+namespace Bsa {
+  class AmcCarrierBase;
+
+  enum { RAW_RINGS = 8 };       // raw diagnostic rings, 0-3 in waveform0 and 4-7 in waveform1
+  enum { RAW_BLOCK = 4096 };    // ring and file alignment
+
+  //
+  //  Block in front of each buffer in the capture file
+  //
+  struct RawCaptureHeader {
+    char     magic[4];    // "BSAR"
+    uint32_t ring;
+    uint64_t seq;         // buffers of this ring captured before
+    uint64_t begAddr;     // DRAM address the buffer was read from
+    uint64_t bytes;       // data bytes that follow
+    uint64_t time;        // CLOCK_REALTIME ns when found done
+    uint64_t deadNs;      // at most this long unarmed before the next buffer
+  };
+
+  //
+  //  Streams the raw diagnostic rings to a file.
+  //
+  //  Each ring in the mask gets two DRAM buffers of bufferSize above the
+  //  BSA arrays and is armed to stop when full.  The constructor throws if
+  //  the buffers do not fit in DRAM; the destructor gives them back.  When
+  //  a ring is found done it is re-armed on its other buffer first, then
+  //  the completed buffer is fetched in chunks while a writer thread
+  //  appends the previous chunks to the file (with O_DIRECT where the file
+  //  system allows it).  The ring is not recording from when it fills
+  //  until it is re-armed; the bound on that time is reported per ring as
+  //  its dead time.  The rings have no trigger counter, so triggers missed
+  //  in that time are not counted; the dead time bound is reported in
+  //  their place.  Fetches wait for a free chunk when the disk falls
+  //  behind, which shows up as dead time rather than lost data.
+  //
+  class RawCapture {
+  public:
+    RawCapture(AmcCarrierBase& hw,
+               const char*     path,
+               unsigned        ringMask,
+               uint64_t        bufferSize,
+               unsigned        chunkSize=1<<22,
+               unsigned        nchunks  =8);
+    ~RawCapture();
+  public:
+    bool     start();     // false if the file cannot be opened
+    void     stop ();
+  public:
+    class RingStats {
+    public:
+      uint64_t buffers;
+      uint64_t bytes;
+      uint64_t deadNs;    // total
+      uint64_t deadMaxNs;
+    };
+    const RingStats& stats (unsigned ring) const { return _stats[ring]; }
+    uint64_t written    () const { return _written; }
+    uint64_t writeErrors() const { return _writeErrors; }
+    bool     direct     () const { return _direct; }
+  public:
+    void     poll  ();    // capture thread
+    void     write ();    // writer thread
+  private:
+    struct Chunk {
+      uint8_t* p;
+      size_t   bytes;
+    };
+    void     _arm    (unsigned ring, unsigned half);
+    uint32_t _done   () const;
+    void     _capture(unsigned ring, unsigned half, uint64_t dead);
+    Chunk    _get    ();
+    void     _put    (const Chunk&);
+  private:
+    AmcCarrierBase& _hw;
+    const char*     _path;
+    unsigned        _mask;
+    uint64_t        _size;
+    unsigned        _chunkSize;
+    uint64_t        _memBase;   // the carrier's allocation before ours
+    uint64_t        _memEnd;    // and after
+    uint64_t        _begin  [RAW_RINGS][2];
+    unsigned        _half   [RAW_RINGS];    // buffer being recorded
+    uint64_t        _armed  [RAW_RINGS];    // last time seen recording
+    RingStats       _stats  [RAW_RINGS];
+    std::vector<uint8_t*> _chunks;
+    std::deque<Chunk>     _free;
+    std::deque<Chunk>     _full;
+    pthread_mutex_t _lock;
+    pthread_cond_t  _freeCond;
+    pthread_cond_t  _fullCond;
+    pthread_t       _pollThread;
+    pthread_t       _writeThread;
+    volatile bool   _stop;
+    bool            _running;
+    bool            _direct;
+    int             _fd;
+    uint64_t        _written;
+    uint64_t        _writeErrors;
+  };
+};
+
+#endif
@@ -0,0 +1,76 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include <RegisterCache.hh>
+
+#include <syslog.h>
+
+using namespace Bsa;
+
+static const char* ramRegName[] = { "StartAddr", "EndAddr", "WrAddr", "TriggerAddr",
+                                    "Enabled", "Mode", "Init",
+                                    "Done", "Full", "Empty", "Error" };
+
+static const char* tpgRegName[] = { "BsaEventSel", "BsaStatSel", "NArraysBsa" };
+
+RegisterCache::RegisterCache() : _lookups(0), _hits(0)
+{
+}
+
+void RegisterCache::resolve(Path        root,
+                            const char* ram[NRAMBLOCKS],
+                            const char* tpg)
+{
+  for(unsigned b=0; b<NRAMBLOCKS; b++) {
+    if (!ram[b]) continue;
+    for(unsigned r=0; r<NRAMREGS; r++)
+      _resolve(root, regId(RamBlock(b),RamReg(r)),
+               (std::string(ram[b])+"/"+ramRegName[r]).c_str());
+  }
+  if (tpg) {
+    for(unsigned r=TpgBsaEventSel; r<NREGISTERS; r++)
+      _resolve(root, r,
+               (std::string(tpg)+"/"+tpgRegName[r-TpgBsaEventSel]).c_str());
+  }
+}
+
+void RegisterCache::_resolve(Path root, unsigned id, const char* path)
+{
+  _name[id] = path;
+  _lookups++;
+  try {
+    Path p = root->findByName(path);
+    _ro[id] = IScalVal_RO::create(p);
+    try {
+      _rw[id] = IScalVal::create(p);
+    }
+    catch(CPSWError&) {  // read-only register
+    }
+  }
+  catch(CPSWError& e) {
+    syslog(LOG_DEBUG,"<D> RegisterCache: %s not resolved [%s]",
+           path, e.getInfo().c_str());
+  }
+}
+
+ScalVal RegisterCache::rw(RegId id) const
+{
+  if (!_rw[id])
+    throw NotFoundError(_name[id].empty() ? "unmapped register" : _name[id].c_str());
+  __atomic_fetch_add(&_hits, 1, __ATOMIC_RELAXED);
+  return _rw[id];
+}
+
+ScalVal_RO RegisterCache::ro(RegId id) const
+{
+  if (!_ro[id])
+    throw NotFoundError(_name[id].empty() ? "unmapped register" : _name[id].c_str());
+  __atomic_fetch_add(&_hits, 1, __ATOMIC_RELAXED);
+  return _ro[id];
+}
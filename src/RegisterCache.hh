@@ -0,0 +1,75 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Register handles resolved once from their paths and handed out by ID
+//
+#ifndef Bsa_RegisterCache_hh
+#define Bsa_RegisterCache_hh
+
+#include <cpsw_api_builder.h>
+
+#include <stdint.h>
+#include <string>
+
+namespace Bsa {
+  //
+  //  Registers of one RamControl block
+  //
+  enum RamReg   { StartAddr, EndAddr, WrAddr, TriggerAddr, 
+                  Enabled, Mode, Init, 
+                  Done, Full, Empty, Error, NRAMREGS };
+  //
+  //  RamControl blocks: BSA buffers and the raw diagnostic waveform engines
+  //
+  enum RamBlock { BsaBuffers, Waveform0, Waveform1, NRAMBLOCKS };
+  //
+  //  Register IDs
+  //
+  enum RegId    { TpgBsaEventSel = NRAMBLOCKS*NRAMREGS,
+                  TpgBsaStatSel,
+                  TpgNArraysBsa,
+                  NREGISTERS };
+
+  inline RegId    regId   (RamBlock b, RamReg r) { return RegId(b*NRAMREGS+r); }
+  //  Raw diagnostic buffers 0-3 are in waveform0, 4-7 in waveform1
+  inline RamBlock waveform(unsigned index) { return index<4 ? Waveform0 : Waveform1; }
+
+  class RegisterCache {
+  public:
+    RegisterCache();
+  public:
+    //
+    //  Resolve all registers below root.  ram[] holds the path of each 
+    //  RamControl block and tpg the path of the TPG (may be null)
+    //
+    void       resolve (Path        root,
+                        const char* ram[NRAMBLOCKS],
+                        const char* tpg);
+    ScalVal    rw      (RegId id) const;
+    ScalVal_RO ro      (RegId id) const;
+    ScalVal    rw      (RamBlock b, RamReg r) const { return rw(regId(b,r)); }
+    ScalVal_RO ro      (RamBlock b, RamReg r) const { return ro(regId(b,r)); }
+  public:
+    //  Path lookups performed and handles served from the cache
+    //  (handles are served to any thread, so hits is counted atomically)
+    uint64_t   lookups () const { return _lookups; }
+    uint64_t   hits    () const { return __atomic_load_n(&_hits, __ATOMIC_RELAXED); }
+  private:
+    void       _resolve(Path root, unsigned id, const char* path);
+  private:
+    ScalVal          _rw  [NREGISTERS];
+    ScalVal_RO       _ro  [NREGISTERS];
+    std::string      _name[NREGISTERS];
+    uint64_t         _lookups;
+    mutable uint64_t _hits;
+  };
+};
+
+#endif
@@ -0,0 +1,247 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "ShmExport.hh"
+
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <syslog.h>
+
+using namespace Bsa;
+
+static const size_t PAGE = 4096;
+
+static size_t round_up(size_t v, size_t a) { return (v+a-1)/a*a; }
+
+//
+//  Column offsets from the array header
+//
+static size_t pid_offset () { return sizeof(ShmArrayHeader); }
+static size_t n_offset   (unsigned cap, unsigned ch)
+{ return pid_offset() + cap*sizeof(uint64_t) + ch*cap*sizeof(uint32_t); }
+static size_t mean_offset(unsigned cap, unsigned ch)
+{ return n_offset(cap,SHM_NCHANNELS) + ch*cap*sizeof(double); }
+static size_t rms2_offset(unsigned cap, unsigned ch)
+{ return mean_offset(cap,SHM_NCHANNELS) + ch*cap*sizeof(double); }
+
+//
+//  Writer side of the sequence lock
+//
+static void seq_begin(ShmArrayHeader* h)
+{
+  __atomic_store_n(&h->seq, h->seq+1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void seq_end(ShmArrayHeader* h)
+{
+  __atomic_store_n(&h->seq, h->seq+1, __ATOMIC_RELEASE);
+}
+
+ShmExport::ShmExport(const char* name,
+                     unsigned    capacity,
+                     uint64_t    arrays) :
+  _name    (name),
+  _capacity(round_up(capacity ? capacity : 1, 8)),
+  _size    (0),
+  _base    (0)
+{
+  size_t stride = round_up(rms2_offset(_capacity,SHM_NCHANNELS), PAGE);
+  size_t hsize  = round_up(sizeof(ShmExportHeader), PAGE);
+
+  _size = hsize;
+  for(unsigned i=0; i<HSTARRAYN; i++)
+    if (arrays & (1ULL<<i))
+      _size += stride;
+
+  //  Start from an empty region so readers never see stale data
+  shm_unlink(name);
+  int fd = shm_open(name, O_CREAT|O_RDWR, 0644);
+  if (fd < 0) {
+    syslog(LOG_ERR,"<E> ShmExport: shm_open %s failed: %s", name, strerror(errno));
+    throw(std::string("ShmExport: shm_open failed"));
+  }
+  if (ftruncate(fd, _size) < 0) {
+    syslog(LOG_ERR,"<E> ShmExport: ftruncate %s to %zu failed: %s", name, _size, strerror(errno));
+    close(fd);
+    throw(std::string("ShmExport: ftruncate failed"));
+  }
+  void* p = mmap(0, _size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    syslog(LOG_ERR,"<E> ShmExport: mmap %s failed: %s", name, strerror(errno));
+    throw(std::string("ShmExport: mmap failed"));
+  }
+  _base = reinterpret_cast<char*>(p);
+
+  ShmExportHeader* hdr = reinterpret_cast<ShmExportHeader*>(_base);
+  hdr->version   = SHM_EXPORT_VERSION;
+  hdr->nchannels = SHM_NCHANNELS;
+  hdr->capacity  = _capacity;
+  hdr->size      = _size;
+  size_t offset  = hsize;
+  for(unsigned i=0; i<HSTARRAYN; i++) {
+    if (arrays & (1ULL<<i)) {
+      hdr->offset[i] = offset;
+      offset += stride;
+    }
+    else
+      hdr->offset[i] = 0;
+  }
+  //  The magic word is written last; readers check it
+  __atomic_store_n(&hdr->magic, SHM_EXPORT_MAGIC, __ATOMIC_RELEASE);
+}
+
+ShmExport::~ShmExport()
+{
+  munmap(_base, _size);
+  shm_unlink(_name.c_str());
+}
+
+void ShmExport::publish(unsigned                  array,
+                        uint64_t                  timestamp,
+                        bool                      reset,
+                        const std::vector<Entry>& entries)
+{
+  const ShmExportHeader* hdr = reinterpret_cast<const ShmExportHeader*>(_base);
+  if (array >= HSTARRAYN || hdr->offset[array]==0)
+    return;
+
+  char*           base = _base + hdr->offset[array];
+  ShmArrayHeader* h    = reinterpret_cast<ShmArrayHeader*>(base);
+
+  if (reset) {
+    seq_begin(h);
+    h->generation++;
+    h->first = 0;
+    h->rows  = 0;
+    seq_end(h);
+  }
+
+  uint64_t rows0  = h->rows;
+  uint64_t rows   = rows0 + entries.size();
+  uint64_t first  = rows > _capacity ? rows - _capacity : 0;
+
+  //  Retire the slots about to be overwritten
+  seq_begin(h);
+  h->timestamp = timestamp;
+  if (first > h->first)
+    h->first = first;
+  seq_end(h);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  uint64_t* pid = reinterpret_cast<uint64_t*>(base + pid_offset());
+  uint32_t* n   = reinterpret_cast<uint32_t*>(base + n_offset   (_capacity,0));
+  double*   m   = reinterpret_cast<double*  >(base + mean_offset(_capacity,0));
+  double*   r   = reinterpret_cast<double*  >(base + rms2_offset(_capacity,0));
+
+  //  Entries older than a full ring are never visible
+  uint64_t row = rows0 > first ? rows0 : first;
+  for(unsigned i=row-rows0; row<rows; i++, row++) {
+    const Entry& e = entries[i];
+    unsigned s = row % _capacity;
+    pid[s] = e.pulseId();
+    for(unsigned j=0, k=s; j<SHM_NCHANNELS; j++, k+=_capacity) {
+      const ChannelData& d = e.channel_data[j];
+      n[k] = d.n();
+      m[k] = d.mean();
+      r[k] = d.rms2();
+    }
+  }
+
+  //  Make the new rows visible
+  seq_begin(h);
+  h->rows = rows;
+  h->updates++;
+  seq_end(h);
+}
+
+ShmExportReader::ShmExportReader(const char* name) :
+  _base(0), _hdr(0), _size(0)
+{
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0)
+    throw(std::string("ShmExportReader: shm_open failed"));
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(ShmExportHeader)) {
+    close(fd);
+    throw(std::string("ShmExportReader: region too small"));
+  }
+  _size = st.st_size;
+  void* p = mmap(0, _size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    throw(std::string("ShmExportReader: mmap failed"));
+  _base = reinterpret_cast<const char*>(p);
+  _hdr  = reinterpret_cast<const ShmExportHeader*>(_base);
+
+  if (__atomic_load_n(&_hdr->magic, __ATOMIC_ACQUIRE) != SHM_EXPORT_MAGIC ||
+      _hdr->version   != SHM_EXPORT_VERSION ||
+      _hdr->nchannels != SHM_NCHANNELS ||
+      _hdr->size      >  _size) {
+    munmap(const_cast<char*>(_base), _size);
+    throw(std::string("ShmExportReader: incompatible region"));
+  }
+}
+
+ShmExportReader::~ShmExportReader()
+{
+  munmap(const_cast<char*>(_base), _size);
+}
+
+void ShmExportReader::snapshot(unsigned array, ShmSnapshot& s) const
+{
+  const ShmArrayHeader* h = _array(array);
+  while(1) {
+    uint64_t seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+      continue;
+    s.generation = __atomic_load_n(&h->generation, __ATOMIC_RELAXED);
+    s.timestamp  = __atomic_load_n(&h->timestamp , __ATOMIC_RELAXED);
+    s.first      = __atomic_load_n(&h->first     , __ATOMIC_RELAXED);
+    s.rows       = __atomic_load_n(&h->rows      , __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&h->seq, __ATOMIC_RELAXED) == seq)
+      break;
+  }
+}
+
+bool ShmExportReader::valid(unsigned array, const ShmSnapshot& s, uint64_t from) const
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  ShmSnapshot t;
+  snapshot(array, t);
+  return t.generation == s.generation && t.first <= from;
+}
+
+const uint64_t* ShmExportReader::pulseId(unsigned array) const
+{
+  return reinterpret_cast<const uint64_t*>(reinterpret_cast<const char*>(_array(array)) + pid_offset());
+}
+
+const uint32_t* ShmExportReader::n(unsigned array, unsigned channel) const
+{
+  return reinterpret_cast<const uint32_t*>(reinterpret_cast<const char*>(_array(array)) + n_offset(_hdr->capacity,channel));
+}
+
+const double* ShmExportReader::mean(unsigned array, unsigned channel) const
+{
+  return reinterpret_cast<const double*>(reinterpret_cast<const char*>(_array(array)) + mean_offset(_hdr->capacity,channel));
+}
+
+const double* ShmExportReader::rms2(unsigned array, unsigned channel) const
+{
+  return reinterpret_cast<const double*>(reinterpret_cast<const char*>(_array(array)) + rms2_offset(_hdr->capacity,channel));
+}
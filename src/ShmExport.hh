@@ -0,0 +1,143 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef Bsa_ShmExport_hh
+#define Bsa_ShmExport_hh
+
+#include "BsaDefs.hh"
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+//
+//  Shared memory export of the BSA arrays
+//
+//  The region starts with a ShmExportHeader, followed by one ShmArray
+//  for each exported array.  Each ShmArray is a header followed by the
+//  columns of a ring of "capacity" rows:
+//
+//    uint64_t pulseId [capacity]
+//    uint32_t n       [NCHANNELS][capacity]
+//    double   mean    [NCHANNELS][capacity]
+//    double   rms2    [NCHANNELS][capacity]
+//
+//  Row r of an acquisition is at slot r%capacity.  The writer updates
+//  the array header under a sequence lock (odd while writing); it
+//  raises "first" before overwriting old slots and raises "rows" after
+//  the new slots are written.  Readers take a consistent snapshot of
+//  the header, read rows [from,rows) in place, and then check with
+//  ShmExportReader::valid() that the rows were not overwritten or
+//  cleared by a new acquisition while they were read.
+//
+#define SHM_EXPORT_MAGIC    0x58415342  // "BSAX"
+#define SHM_EXPORT_VERSION  1
+
+namespace Bsa {
+  enum { SHM_NCHANNELS = 31 };
+
+  struct ShmExportHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nchannels;
+    uint32_t capacity;              // rows per array
+    uint64_t size;                  // bytes in the region
+    uint64_t offset[HSTARRAYN];     // of each array from the start; 0 if not exported
+  };
+
+  struct ShmArrayHeader {
+    uint64_t seq;                   // sequence lock
+    uint64_t generation;            // acquisitions started
+    uint64_t timestamp;             // of the acquisition (sec<<32 | nsec)
+    uint64_t first;                 // oldest row not overwritten
+    uint64_t rows;                  // rows written in this acquisition
+    uint64_t updates;
+    uint64_t reserved[2];
+  };
+
+  //
+  //  Consistent view of an array header
+  //
+  class ShmSnapshot {
+  public:
+    uint64_t generation;
+    uint64_t timestamp;
+    uint64_t first;
+    uint64_t rows;
+  };
+
+  //
+  //  Writes the arrays updated by the Processor into a POSIX shared memory region
+  //
+  class ShmExport {
+  public:
+    //
+    //  Create (or recreate) region "name" (e.g. "/bsa") with "capacity" rows
+    //  for each array in "arrays"; throws on failure
+    //
+    ShmExport(const char* name,
+              unsigned    capacity=1<<14,
+              uint64_t    arrays=(1ULL<<HSTARRAYN)-1);
+    ~ShmExport();
+  public:
+    //
+    //  Add the entries of an update of "array";  "reset" starts a new acquisition
+    //
+    void publish(unsigned                  array,
+                 uint64_t                  timestamp,
+                 bool                      reset,
+                 const std::vector<Entry>& entries);
+  public:
+    const char* name    () const { return _name.c_str(); }
+    size_t      size    () const { return _size; }
+    unsigned    capacity() const { return _capacity; }
+  private:
+    std::string _name;
+    unsigned    _capacity;
+    size_t      _size;
+    char*       _base;
+  };
+
+  //
+  //  Maps an export region read-only
+  //
+  class ShmExportReader {
+  public:
+    ShmExportReader(const char* name);  // throws if the region is absent or of another version
+    ~ShmExportReader();
+  public:
+    bool     exported (unsigned array) const { return _hdr->offset[array]!=0; }
+    unsigned capacity () const { return _hdr->capacity; }
+    unsigned slot     (uint64_t row) const { return row%_hdr->capacity; }
+    //
+    //  Take a consistent snapshot of the array header
+    //
+    void     snapshot (unsigned array, ShmSnapshot&) const;
+    //
+    //  Rows [from, s.rows) read after snapshot "s" are still intact
+    //
+    bool     valid    (unsigned array, const ShmSnapshot& s, uint64_t from) const;
+    //
+    //  Columns, indexed by slot()
+    //
+    const uint64_t* pulseId(unsigned array) const;
+    const uint32_t* n      (unsigned array, unsigned channel) const;
+    const double*   mean   (unsigned array, unsigned channel) const;
+    const double*   rms2   (unsigned array, unsigned channel) const;
+  private:
+    const ShmArrayHeader* _array(unsigned array) const
+    { return reinterpret_cast<const ShmArrayHeader*>(_base+_hdr->offset[array]); }
+  private:
+    const char*            _base;
+    const ShmExportHeader* _hdr;
+    size_t                 _size;
+  };
+};
+
+#endif
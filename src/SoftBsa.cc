@@ -0,0 +1,192 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "SoftBsa.hh"
+
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace Bsa;
+
+//  Channels accumulated four at a time; the rest one at a time
+static const unsigned NVEC = (NUM_DIAG_CHANNELS/4)*4;
+
+//
+//  Sums of one EDEF.  The squares of channels 4i..4i+3 are kept in the
+//  order 4i, 4i+2, 4i+1, 4i+3 which is how the SSE2 multiply yields them.
+//
+class SoftBsa::Accumulator {
+public:
+  void init()
+  {
+    memset(sum, 0, sizeof(sum));
+    memset(sq , 0, sizeof(sq ));
+    memset(ovf, 0, sizeof(ovf));
+    n = 0;
+  }
+
+  void acquire(const uint32_t* ch)
+  {
+    n++;
+#ifdef __SSE2__
+    __m128i* s = reinterpret_cast<__m128i*>(sum);
+    __m128i* q = reinterpret_cast<__m128i*>(sq);
+    __m128i* o = reinterpret_cast<__m128i*>(ovf);
+    for(unsigned i=0; i<NVEC/4; i++) {
+      __m128i v   = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ch)+i);
+      __m128i sgn = _mm_srai_epi32(v, 31);
+      //  sign extended sums
+      s[2*i  ] = _mm_add_epi64(s[2*i  ], _mm_unpacklo_epi32(v, sgn));
+      s[2*i+1] = _mm_add_epi64(s[2*i+1], _mm_unpackhi_epi32(v, sgn));
+      //  squares of the magnitudes
+      __m128i a   = _mm_sub_epi32(_mm_xor_si128(v, sgn), sgn);
+      __m128i a13 = _mm_srli_epi64(a, 32);
+      q[2*i  ] = _mm_add_epi64(q[2*i  ], _mm_mul_epu32(a  , a  ));
+      q[2*i+1] = _mm_add_epi64(q[2*i+1], _mm_mul_epu32(a13, a13));
+      //  a sum of squares reaching 48 bits is remembered even if it wraps
+      o[2*i  ] = _mm_or_si128(o[2*i  ], q[2*i  ]);
+      o[2*i+1] = _mm_or_si128(o[2*i+1], q[2*i+1]);
+    }
+#else
+    for(unsigned i=0; i<NVEC; i++) {
+      int64_t  v = int32_t(ch[i]);
+      uint64_t a = v < 0 ? -v : v;
+      sum[i] += v;
+      unsigned k = (i&~3) | ((i&1)<<1) | ((i&2)>>1);
+      sq [k] += a*a;
+      ovf[k] |= sq[k];
+    }
+#endif
+    for(unsigned i=NVEC; i<NUM_DIAG_CHANNELS; i++) {
+      int64_t  v = int32_t(ch[i]);
+      uint64_t a = v < 0 ? -v : v;
+      sum[i] += v;
+      sq [i] += a*a;
+      ovf[i] |= sq[i];
+    }
+  }
+
+  //
+  //  Pack the sums into the firmware entry format
+  //
+  void avgdone(ChannelData* cd)
+  {
+    uint32_t hdr = (n&0x1fff) | (n > 0x1fff ? (1<<13) : 0);
+    for(unsigned i=0; i<NUM_DIAG_CHANNELS; i++) {
+      unsigned k  = (i < NVEC) ? ((i&~3) | ((i&1)<<1) | ((i&2)>>1)) : i;
+      int64_t  s  = sum[i];
+      uint64_t q  = sq [k];
+      uint32_t us = uint32_t(s);
+      //  sum outside the signed 32-bit range
+      uint32_t so = (uint64_t(s - INT32_MIN) >> 32) ? (1<<13) : 0;
+      //  sum of squares beyond 48 bits
+      uint32_t qo = (ovf[k] >> 48) ? (1<<14) : 0;
+      cd[i].data[0] = hdr | so | qo | (us<<16);
+      cd[i].data[1] = (us>>16) | uint32_t(q<<16);
+      cd[i].data[2] = uint32_t(q>>16);
+    }
+    init();
+  }
+public:
+  int64_t  sum[NUM_DIAG_CHANNELS+1] __attribute__((aligned(16)));
+  uint64_t sq [NUM_DIAG_CHANNELS+1] __attribute__((aligned(16)));
+  uint64_t ovf[NUM_DIAG_CHANNELS+1] __attribute__((aligned(16)));
+  unsigned n;
+};
+
+SoftBsa::SoftBsa(SoftBsaHandler& handler,
+                 unsigned        maxRows) :
+  _handler     (handler),
+  _maxRows     (maxRows ? maxRows : 1),
+  _timestamp   (0),
+  _records     (0),
+  _acquisitions(0),
+  _entries     (0)
+{
+  void* p = 0;
+  if (posix_memalign(&p, 64, NUM_SOFT_EDEFS*sizeof(Accumulator)))
+    throw(std::string("SoftBsa: allocation failed"));
+  _accum = reinterpret_cast<Accumulator*>(p);
+  for(unsigned i=0; i<NUM_SOFT_EDEFS; i++) {
+    _accum[i].init();
+    _record[i].buffer = i;
+    _record[i].entries.reserve(_maxRows);
+  }
+}
+
+SoftBsa::~SoftBsa()
+{
+  free(_accum);
+}
+
+void SoftBsa::process(const NetRecord& r)
+{
+  _records++;
+  _timestamp = r.timestamp;
+
+  uint64_t m = r.init | r.acquire | r.avgdone | r.update;
+  while(m) {
+    unsigned j   = __builtin_ctzll(m);
+    uint64_t bit = 1ULL<<j;
+    m &= m-1;
+
+    Accumulator& a = _accum[j];
+    if (r.init & bit)
+      a.init();
+    else if (r.acquire & bit) {
+      a.acquire(r.channel);
+      _acquisitions++;
+    }
+
+    if (r.avgdone & bit) {
+      std::vector<Entry>& entries = _record[j].entries;
+      entries.resize(entries.size()+1);
+      Entry& e = entries.back();
+      e.data[0] = NUM_DIAG_CHANNELS<<16;
+      e.data[1] = r.pulseId&0xffffffff;
+      e.data[2] = r.pulseId>>32;
+      a.avgdone(e.channel_data);
+      _entries++;
+      if (entries.size() >= _maxRows) {
+        _update(j);
+        continue;
+      }
+    }
+
+    if ((r.update & bit) && _record[j].entries.size())
+      _update(j);
+  }
+}
+
+void SoftBsa::process(const NetRecord* r, unsigned nrecords)
+{
+  for(unsigned i=0; i<nrecords; i++)
+    process(r[i]);
+}
+
+void SoftBsa::flush()
+{
+  for(unsigned i=0; i<NUM_SOFT_EDEFS; i++)
+    if (_record[i].entries.size())
+      _update(i);
+}
+
+void SoftBsa::_update(unsigned edef)
+{
+  Record& record = _record[edef];
+  record.time_secs  = _timestamp>>32;
+  record.time_nsecs = _timestamp&0xffffffff;
+  _handler.process(record);
+  record.entries.clear();
+}
@@ -0,0 +1,88 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef Bsa_SoftBsa_hh
+#define Bsa_SoftBsa_hh
+
+#include "BsaDefs.hh"
+
+#include <vector>
+#include <stdint.h>
+
+namespace Bsa {
+  enum { NUM_SOFT_EDEFS = 64 };
+  enum { NUM_DIAG_CHANNELS = 31 };
+
+  //
+  //  One diagnostic bus record with the EDEF masks of the event
+  //
+  class NetRecord {
+  public:
+    uint64_t pulseId;
+    uint64_t timestamp;   // sec<<32 | nsec
+    uint64_t init;        // EDEFs starting a new acquisition
+    uint64_t acquire;     // EDEFs accumulating this record
+    uint64_t avgdone;     // EDEFs completing an entry
+    uint64_t update;      // EDEFs handing their entries to the host
+    uint32_t channel[NUM_DIAG_CHANNELS];
+  };
+
+  class SoftBsaHandler {
+  public:
+    virtual ~SoftBsaHandler() {}
+    //
+    //  Entries completed by EDEF record.buffer since its last update
+    //
+    virtual void process(const Record&) = 0;
+  };
+
+  //
+  //  Host implementation of the BSA accumulation.
+  //
+  //  Each record is applied to the EDEFs set in its masks only.  The
+  //  channels are accumulated as 32-bit signed values into 64-bit sums
+  //  and sums of squares, four channels per SSE2 step (two 64-bit lanes
+  //  for the sums and two for the squares of each pair).  A completed
+  //  entry is packed like the firmware's: a 13-bit count, 32-bit sum and
+  //  48-bit sum of squares, with ChannelData exception bit 13 set when the
+  //  count or sum overflows and bit 14 when the sum of squares does.
+  //  Entries are handed over on update, or when maxRows are pending.
+  //
+  class SoftBsa {
+  public:
+    SoftBsa(SoftBsaHandler& handler,
+            unsigned        maxRows=1024);
+    ~SoftBsa();
+  public:
+    void     process(const NetRecord&);
+    void     process(const NetRecord*, unsigned nrecords);
+    //
+    //  Hand over the pending entries of every EDEF
+    //
+    void     flush  ();
+  public:
+    uint64_t records     () const { return _records; }
+    uint64_t acquisitions() const { return _acquisitions; }  // records x EDEFs
+    uint64_t entries     () const { return _entries; }
+  private:
+    class Accumulator;
+    void     _update(unsigned edef);
+  private:
+    SoftBsaHandler& _handler;
+    unsigned        _maxRows;
+    Accumulator*    _accum;
+    Record          _record[NUM_SOFT_EDEFS];
+    uint64_t        _timestamp;
+    uint64_t        _records;
+    uint64_t        _acquisitions;
+    uint64_t        _entries;
+  };
+};
+
+#endif
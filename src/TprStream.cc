@@ -0,0 +1,84 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#include "TprStream.hh"
+
+#include <syslog.h>
+
+using namespace Tpr;
+
+TprStreamDecoder::TprStreamDecoder(uint32_t pidMax, unsigned window, unsigned reserve) :
+    _pidMax     (pidMax),
+    _window     (window),
+    _first      (true),
+    _lastPulseId(0),
+    _packets    (0),
+    _nevents    (0),
+    _gaps       (0),
+    _missed     (0),
+    _outOfOrder (0),
+    _resyncs    (0),
+    _errors     (0)
+{
+    _events.reserve(reserve);
+    for(unsigned i = 0; i < NUM_EVENT_CODES; i++)
+        _pulseIds[i].reserve(reserve);
+}
+
+void TprStreamDecoder::clear()
+{
+    _events.clear();
+    for(unsigned i = 0; i < NUM_EVENT_CODES; i++)
+        _pulseIds[i].clear();
+}
+
+int TprStreamDecoder::process(const char* buff, size_t sz)
+{
+    _packets++;
+
+    if(sz % sizeof(TprEvent)) {
+        syslog(LOG_ERR, "<E> TprStreamDecoder: datagram of %u bytes is not a multiple of %u",
+               unsigned(sz), unsigned(sizeof(TprEvent)));
+        _errors++;
+    }
+
+    const TprEvent* ev  = reinterpret_cast<const TprEvent*>(buff);
+    unsigned        nev = sz / sizeof(TprEvent);
+    uint64_t        period = uint64_t(_pidMax)+1;
+
+    for(unsigned i = 0; i < nev; i++, ev++) {
+        uint32_t pid = ev->pulseId;
+
+        if(_first)
+            _first = false;
+        else {
+            //  Forward distance from the last pulse ID, modulo the wrap
+            uint64_t d = (uint64_t(pid) + period - _lastPulseId) % period;
+            if(d == 0 || (d > period/2 && period-d <= _window)) {
+                _outOfOrder++;
+                continue;
+            }
+            if(d > period/2)
+                _resyncs++;
+            else if(d > 1) {
+                _gaps++;
+                _missed += d-1;
+            }
+        }
+        _lastPulseId = pid;
+        _events.push_back(pid);
+
+        for(unsigned w = 0; w < 8; w++)
+            for(uint32_t m = ev->eventCodes[w]; m != 0; m &= (m-1))
+                _pulseIds[(w<<5) + __builtin_ctz(m)].push_back(pid);
+    }
+
+    _nevents += nev;
+    return nev;
+}
@@ -0,0 +1,88 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef TprStream_hh
+#define TprStream_hh
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+//
+//  Timing stream datagrams carry one or more TprEvent records back to back
+//
+namespace Tpr {
+    class TprEvent {
+        public:
+            uint32_t  pulseId;
+            uint32_t  eventCodes[8];
+            uint16_t  dtype;
+            uint16_t  version;
+            uint32_t  dmod[6];
+            uint64_t  epicsTime;
+            uint32_t  edefAvgDn;
+            uint32_t  edefMinor;
+            uint32_t  edefMajor;
+            uint32_t  edefInit;
+    };
+
+    enum { NUM_EVENT_CODES = 256 };
+    enum { LCLS1_PID_MAX   = 0x1ffdf };
+
+    //
+    //  Decodes timing stream datagrams into per event code lists of
+    //  pulse IDs and checks pulse ID continuity.  The lists accumulate
+    //  until clear() so that a batch of datagrams can be consumed at once.
+    //
+    class TprStreamDecoder {
+        public:
+            // pulse IDs count from 0 to pidMax and wrap; a step back of more
+            // than window pulse IDs is taken as a restart of the sequence
+            TprStreamDecoder(uint32_t pidMax=LCLS1_PID_MAX, unsigned window=1024,
+                             unsigned reserve=1024);
+            virtual ~TprStreamDecoder() {}
+
+            // decode one datagram; returns the number of events
+            int      process(const char* buff, size_t sz);
+            // start a new batch
+            void     clear  ();
+
+            // pulse IDs of the events in the batch with this event code
+            const std::vector<uint32_t>& pulseIds(unsigned code) const { return _pulseIds[code]; }
+            // pulse IDs of all events in the batch
+            const std::vector<uint32_t>& events  () const { return _events; }
+
+            uint32_t lastPulseId() const { return _lastPulseId; }
+            uint64_t packets    () const { return _packets; }
+            uint64_t nevents    () const { return _nevents; }
+            uint64_t gaps       () const { return _gaps; }        // forward jumps in pulse ID
+            uint64_t missed     () const { return _missed; }      // pulse IDs skipped by the jumps
+            uint64_t outOfOrder () const { return _outOfOrder; }  // events not after the last pulse ID (left out of the lists)
+            uint64_t resyncs    () const { return _resyncs; }     // restarts of the pulse ID sequence
+            uint64_t errors     () const { return _errors; }      // datagrams not a multiple of TprEvent
+
+        private:
+            uint32_t                 _pidMax;
+            unsigned                 _window;
+            bool                     _first;
+            uint32_t                 _lastPulseId;
+            std::vector<uint32_t>    _pulseIds[NUM_EVENT_CODES];
+            std::vector<uint32_t>    _events;
+            uint64_t                 _packets;
+            uint64_t                 _nevents;
+            uint64_t                 _gaps;
+            uint64_t                 _missed;
+            uint64_t                 _outOfOrder;
+            uint64_t                 _resyncs;
+            uint64_t                 _errors;
+    }; /* class TprStreamDecoder */
+
+} /* namespace Tpr */
+
+#endif /* TprStream_hh */
@@ -23,6 +23,8 @@
 #include <cpsw_yaml_keydefs.h>
 #include <cpsw_yaml.h>
 
+#include <BldStream.hh>
+
 void usage(const char* p) {
   printf("Usage: %s [options]\n",p);
   printf("Options: -a <ip address, dotted notation>\n");
@@ -44,73 +46,6 @@ namespace Bld {
   private:
     const char* _ip;
   };
-
-  class BldEvent {
-  public:
-    uint64_t  timeStamp;
-    uint64_t  pulseId;
-    uint32_t  mask;
-    uint32_t  beam;
-    std::vector<uint32_t> channels;
-    uint32_t  valid;
-  };
-
-  class BldEventIterator {
-  public:
-    BldEventIterator(const char* b, size_t sz) : 
-      _buff(reinterpret_cast<const uint32_t*>(b)),
-      _end (reinterpret_cast<const uint32_t*>(b+sz)),
-      _next(_buff)
-    { first(sz); }
-  public:
-    void first(size_t sz)
-    {
-      v.timeStamp = _buff[1]; v.timeStamp <<= 32; v.timeStamp += _buff[0];
-      v.pulseId   = _buff[3]; v.pulseId   <<= 32; v.pulseId   += _buff[2];
-      v.mask      = _buff[4];
-      v.beam      = _buff[5];
-      unsigned i=6;
-      for(unsigned m=v.mask; m!=0; m&=(m-1))
-        v.channels.push_back(_buff[i++]);
-      v.valid     = _buff[i++];
-      _next    = _buff+i;
-
-      //
-      //  Validate size of packet (sz = sizeof_first + n*sizeof_next)
-      //
-      unsigned sizeof_first = 4*i;
-      unsigned sizeof_next  = 4*(i-4);
-      if ( ((sz - sizeof_first)%sizeof_next) != 0 ) {
-        printf("BldEventIterator:first() size of packet error : sz %u, first %u, next %u\n",
-               sz, sizeof_first, sizeof_next);
-        abort();
-      }
-    }
-    bool next()
-    {
-      if (_next >= _end)
-        return false;
-
-      v.timeStamp = _buff[1]; v.timeStamp <<= 32; v.timeStamp += _buff[0];
-      v.pulseId   = _buff[3]; v.pulseId   <<= 32; v.pulseId   += _buff[2];
-      v.timeStamp+= ((_next[0]>> 0)&0xfffff);
-      v.pulseId  += ((_next[0]>>20)&0xfff);
-      v.mask      = _buff[4];
-      v.beam      = _next[1];
-      unsigned i=2;
-      for(unsigned m=v.mask; m!=0; m&=(m-1))
-        v.channels[i-2] = _next[i++];
-      v.valid     = _next[i++];
-      _next   += i;
-      return true;
-    }
-    BldEvent        operator*() { return v; }
-  private:
-    const uint32_t* _buff;
-    const uint32_t* _end;
-    const uint32_t* _next;
-    BldEvent v;
-  };
 };
 
 using namespace Bld;
@@ -365,8 +300,12 @@ int main(int argc, char* argv[])
       count++;
       bytes += ret;
       BldEventIterator it(buff,ret);
+      if (!it.valid()) {
+        printf("BldEventIterator:first() size of packet error : sz %zd\n", ret);
+        abort();
+      }
       do {
-        BldEvent ev = *it;
+        const BldEvent& ev = *it;
         lanes |= ev.valid;
         event++;
 
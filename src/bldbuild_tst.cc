@@ -0,0 +1,300 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Event builder test with BLD packets generated on loopback sockets
+//
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <vector>
+
+#include <BldStream.hh>
+
+using namespace Bld;
+
+static void show_usage(const char* p)
+{
+  printf("Usage: %s [options]\n",p);
+  printf("Options: -n <sources>    : number of BLD sources (default 4)\n");
+  printf("         -p <partitions> : builder threads (default 2)\n");
+  printf("         -e <events>     : events per source (default 1000000)\n");
+  printf("         -w <pulse IDs>  : reorder window (default 10000)\n");
+  printf("         -d <per mille>  : events dropped by each generator (default 1)\n");
+  printf("         -r <Hz>         : event rate of each source (default 100000)\n");
+  printf("         -P <port>       : first loopback port (default 11000)\n");
+}
+
+class CountHandler : public BldCombinedHandler {
+public:
+  CountHandler() : complete(0), partial(0), events(0) {}
+  void process(const BldCombined& ev, bool lcomplete) {
+    if (lcomplete)
+      __sync_fetch_and_add(&complete,1);
+    else
+      __sync_fetch_and_add(&partial,1);
+    __sync_fetch_and_add(&events,__builtin_popcount(ev.contributors));
+  }
+public:
+  uint64_t complete;
+  uint64_t partial;
+  uint64_t events;
+};
+
+class Source {
+public:
+  unsigned             id;
+  unsigned short       port;
+  unsigned             nevents;
+  unsigned             drop;
+  unsigned             rate;
+  timespec             begin;
+  uint64_t             dropped;
+  uint64_t             packets;
+  int                  fd;
+  BldEventBuilderPool* pool;
+};
+
+static const unsigned NCHAN  = 4;
+static const unsigned NPKT   = 16;   // events per packet
+static const uint64_t PID0   = 0x100000000ULL;
+
+static void* generator(void* arg)
+{
+  Source& s = *reinterpret_cast<Source*>(arg);
+
+  int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in saddr;
+  memset(&saddr, 0, sizeof(saddr));
+  saddr.sin_family      = AF_INET;
+  saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  saddr.sin_port        = htons(s.port);
+  if (connect(fd, (sockaddr*)&saddr, sizeof(saddr)) < 0) {
+    perror("Error connecting generator socket");
+    return 0;
+  }
+
+  unsigned seed = s.id+1;
+  uint32_t buff[7+NCHAN+NPKT*(3+NCHAN)];
+  unsigned nw = 0;
+  uint64_t pid0 = 0;
+  for(unsigned i=0; i<s.nevents; i++) {
+    uint64_t pid = PID0 + i;
+    if (unsigned(rand_r(&seed)%1000) < s.drop) {
+      s.dropped++;
+      continue;
+    }
+    if (nw && pid - pid0 > 0xfff) {
+      ::send(fd, buff, nw*sizeof(uint32_t), 0);
+      s.packets++;
+      nw = 0;
+    }
+    if (nw == 0) {
+      pid0 = pid;
+      buff[0] = uint32_t(pid*1000);
+      buff[1] = 0;
+      buff[2] = uint32_t(pid);
+      buff[3] = uint32_t(pid>>32);
+      buff[4] = (1<<NCHAN)-1;
+      buff[5] = 0;
+      nw = 6;
+    }
+    else {
+      buff[nw++] = (uint32_t(pid-pid0)<<20);
+      buff[nw++] = 0;
+    }
+    for(unsigned j=0; j<NCHAN; j++)
+      buff[nw++] = s.id*NCHAN+j;
+    buff[nw++] = (1<<NCHAN)-1;
+    if (nw + 3+NCHAN > sizeof(buff)/sizeof(uint32_t)) {
+      ::send(fd, buff, nw*sizeof(uint32_t), 0);
+      s.packets++;
+      nw = 0;
+    }
+    //  Pace each source at its event rate, as a carrier would
+    if ((i%1024)==0) {
+      timespec now;
+      clock_gettime(CLOCK_MONOTONIC,&now);
+      double dt = double(now.tv_sec-s.begin.tv_sec) +
+        1.e-9*(double(now.tv_nsec)-double(s.begin.tv_nsec));
+      double ahead = double(i)/double(s.rate) - dt;
+      if (ahead > 0)
+        usleep(unsigned(ahead*1.e6));
+    }
+  }
+  if (nw) {
+    ::send(fd, buff, nw*sizeof(uint32_t), 0);
+    s.packets++;
+  }
+  //  An empty datagram marks the end of the stream
+  ::send(fd, buff, 0, 0);
+  ::close(fd);
+  return 0;
+}
+
+static void* receiver(void* arg)
+{
+  Source& s = *reinterpret_cast<Source*>(arg);
+  char buff[8*1024];
+  while(1) {
+    ssize_t ret = ::read(s.fd, buff, sizeof(buff));
+    if (ret <= 0)
+      break;
+    s.pool->process(s.id, buff, ret);
+  }
+  return 0;
+}
+
+//
+//  A short packet with a wide channel mask, ending at a page that faults,
+//  must be rejected without reading past it
+//
+static bool checkShortPacket()
+{
+  long  page = sysconf(_SC_PAGESIZE);
+  char* p    = reinterpret_cast<char*>(mmap(0, 2*page, PROT_READ|PROT_WRITE,
+                                            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0));
+  if (p == MAP_FAILED || mprotect(p+page, page, PROT_NONE)) {
+    perror("Mapping guard page");
+    return false;
+  }
+  uint32_t* pkt = reinterpret_cast<uint32_t*>(p+page)-7;
+  memset(pkt, 0, 7*sizeof(uint32_t));
+  pkt[4] = 0xffffffff;
+  BldEventIterator it(reinterpret_cast<const char*>(pkt), 7*sizeof(uint32_t));
+  bool ok = !it.valid() && !it.next();
+  munmap(p, 2*page);
+  printf("short packet: %s\n", ok ? "rejected" : "FAILED");
+  return ok;
+}
+
+int main(int argc, char* argv[])
+{
+  unsigned nsources    = 4;
+  unsigned npartitions = 2;
+  unsigned nevents     = 1000000;
+  unsigned window      = 10000;
+  unsigned drop        = 1;
+  unsigned rate        = 100000;
+  unsigned short port  = 11000;
+
+  if (!checkShortPacket())
+    return -1;
+
+  int c;
+  while( (c=getopt(argc,argv,"n:p:e:w:d:r:P:h"))!=-1 ) {
+    switch(c) {
+    case 'n': nsources    = strtoul(optarg,NULL,0); break;
+    case 'p': npartitions = strtoul(optarg,NULL,0); break;
+    case 'e': nevents     = strtoul(optarg,NULL,0); break;
+    case 'w': window      = strtoul(optarg,NULL,0); break;
+    case 'd': drop        = strtoul(optarg,NULL,0); break;
+    case 'r': rate        = strtoul(optarg,NULL,0); break;
+    case 'P': port        = strtoul(optarg,NULL,0); break;
+    default:
+      show_usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  CountHandler        handler;
+  BldEventBuilderPool pool(handler, nsources, window, npartitions);
+
+  std::vector<Source>    sources(nsources);
+  std::vector<pthread_t> rthr(nsources), gthr(nsources);
+
+  for(unsigned i=0; i<nsources; i++) {
+    Source& s = sources[i];
+    s.id      = i;
+    s.port    = port+i;
+    s.nevents = nevents;
+    s.drop    = drop;
+    s.rate    = rate;
+    s.dropped = 0;
+    s.packets = 0;
+    s.pool    = &pool;
+    s.fd      = ::socket(AF_INET, SOCK_DGRAM, 0);
+
+    int rcvbuf = 16*1024*1024;
+    setsockopt(s.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    //  Stop on timeout as well, in case the end marker is lost
+    timeval tmo;
+    tmo.tv_sec  = 1;
+    tmo.tv_usec = 0;
+    setsockopt(s.fd, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+
+    sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family      = AF_INET;
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    saddr.sin_port        = htons(s.port);
+    if (bind(s.fd, (sockaddr*)&saddr, sizeof(saddr)) < 0) {
+      perror("Error binding receive socket");
+      return -1;
+    }
+  }
+
+  timespec begin;
+  clock_gettime(CLOCK_MONOTONIC,&begin);
+
+  for(unsigned i=0; i<nsources; i++)
+    pthread_create(&rthr[i], NULL, &receiver, &sources[i]);
+  for(unsigned i=0; i<nsources; i++) {
+    sources[i].begin = begin;
+    pthread_create(&gthr[i], NULL, &generator, &sources[i]);
+  }
+  for(unsigned i=0; i<nsources; i++) {
+    pthread_join(gthr[i], NULL);
+    pthread_join(rthr[i], NULL);
+  }
+  pool.flush();
+
+  timespec end;
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  double dt = double(end.tv_sec-begin.tv_sec) +
+    1.e-9*(double(end.tv_nsec)-double(begin.tv_nsec));
+
+  uint64_t dropped = 0, packets = 0;
+  for(unsigned i=0; i<nsources; i++) {
+    dropped += sources[i].dropped;
+    packets += sources[i].packets;
+  }
+
+  uint64_t late = 0, missing = 0, duplicate = 0, errors = 0;
+  for(unsigned i=0; i<pool.partitions(); i++) {
+    const BldEventBuilder& b = pool.builder(i);
+    late      += b.late();
+    missing   += b.missing();
+    duplicate += b.duplicate();
+    errors    += b.errors();
+  }
+
+  printf("%u sources x %u events in %u partitions: %f sec, %f Mevents/s\n",
+         nsources, nevents, npartitions, dt, 1.e-6*double(handler.events)/dt);
+  printf("packets %llu  complete %llu  partial %llu  contributions %llu\n",
+         (unsigned long long)packets,
+         (unsigned long long)handler.complete,
+         (unsigned long long)handler.partial,
+         (unsigned long long)handler.events);
+  printf("missing %llu (generators dropped %llu)  late %llu  duplicate %llu  errors %llu\n",
+         (unsigned long long)missing, (unsigned long long)dropped,
+         (unsigned long long)late, (unsigned long long)duplicate,
+         (unsigned long long)errors);
+
+  return 0;
+}
@@ -0,0 +1,618 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Benchmarks of the readout path that need no hardware.  The results are
+//  written as JSON so that releases can be compared.
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <Processor.hh>
+#include <EntryScanner.hh>
+#include <BldStream.hh>
+#include <socketAPI.h>
+
+using namespace Bsa;
+
+static void show_usage(const char* p)
+{
+  printf("Usage: %s [options]\n",p);
+  printf("Options: -t <ms>           : time per measurement (default 200)\n");
+  printf("         -r <repeats>      : measurements per benchmark (default 5)\n");
+  printf("         -b <name>         : run the benchmarks whose names contain <name>\n");
+  printf("         -o <file>         : write the JSON to <file> (default stdout)\n");
+  printf("         -P <port>         : loopback port for the socket benchmarks (default 12100)\n");
+  printf("         -l                : list the benchmarks\n");
+}
+
+static uint64_t _now()
+{
+  timespec tv;
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return uint64_t(tv.tv_sec)*1000000000ULL + tv.tv_nsec;
+}
+
+//  Results are summed here so that the work is not optimized away
+static volatile double _sink;
+
+//
+//  A benchmark repeats an operation; items and bytes are per operation
+//
+class Benchmark {
+public:
+  Benchmark(const char* name, double items, double bytes) :
+    _name(name), _items(items), _bytes(bytes) {}
+  virtual ~Benchmark() {}
+public:
+  const char* name () const { return _name; }
+  double      items() const { return _items; }
+  double      bytes() const { return _bytes; }
+  virtual void run(unsigned iterations) = 0;
+  //  Operations that were dropped rather than done, since created
+  virtual uint64_t drops() const { return 0; }
+protected:
+  const char* _name;
+  double      _items;
+  double      _bytes;
+};
+
+static unsigned nChannels = 16;
+
+//
+//  Entries with increasing pulse IDs and accumulated channel data
+//
+static void fillEntries(Entry* entries, unsigned n, uint64_t pulseId)
+{
+  memset(entries, 0, n*sizeof(Entry));
+  for(unsigned i=0; i<n; i++) {
+    uint32_t* p = reinterpret_cast<uint32_t*>(&entries[i]);
+    uint64_t pid = pulseId+i;
+    p[0] = nChannels<<16;
+    p[1] = pid&0xffffffff;
+    p[2] = pid>>32;
+    for(unsigned j=0; j<nChannels; j++) {
+      uint32_t* d = entries[i].channel_data[j].data;
+      unsigned  nv  = 1 + (i+j)%8;
+      int32_t   sum = int32_t(nv*(1000+i+j));
+      uint64_t  sq  = uint64_t(nv)*(1000+i+j)*(1000+i+j);
+      d[0] = nv | (uint32_t(sum)<<16);
+      d[1] = (uint32_t(sum)>>16) | uint32_t(sq<<16);
+      d[2] = uint32_t(sq>>16);
+    }
+  }
+}
+
+//=======================================================
+//  Decode of the channel data of an entry
+//
+class ChannelDecode : public Benchmark {
+public:
+  ChannelDecode(unsigned n) :
+    Benchmark("channel_decode", double(n)*nChannels, double(n)*sizeof(Entry)),
+    _entries(n)
+  { fillEntries(_entries.data(), n, 1); }
+  void run(unsigned iterations)
+  {
+    double s = 0;
+    for(unsigned k=0; k<iterations; k++)
+      for(unsigned i=0; i<_entries.size(); i++)
+        for(unsigned j=0; j<nChannels; j++) {
+          const ChannelData& d = _entries[i].channel_data[j];
+          s += d.n() + d.mean() + d.rms2();
+        }
+    _sink = s;
+  }
+private:
+  std::vector<Entry> _entries;
+};
+
+//=======================================================
+//  Validation of fetched entries, aligned or with corrupt entries
+//
+class EntryScan : public Benchmark {
+public:
+  EntryScan(const char* name, unsigned n, unsigned corruptEvery) :
+    Benchmark(name, n, double(n)*sizeof(Entry)),
+    _entries(n)
+  {
+    fillEntries(_entries.data(), n, 1);
+    if (corruptEvery)
+      for(unsigned i=corruptEvery/2; i<n; i+=corruptEvery)
+        reinterpret_cast<uint32_t*>(&_entries[i])[0] = 0xdeadbeef;
+    _record.entries = _entries;
+  }
+  void run(unsigned iterations)
+  {
+    unsigned dropped = 0;
+    for(unsigned k=0; k<iterations; k++) {
+      //  A resync compacts the record, so restore it (the copy is timed)
+      if (_record.entries.size() != _entries.size())
+        _record.entries = _entries;
+      _scanner.reset();
+      dropped += _scanner.scan(_record);
+    }
+    _sink = dropped;
+  }
+private:
+  std::vector<Entry> _entries;
+  Record             _record;
+  EntryScanner       _scanner;
+};
+
+//=======================================================
+//  AmcCarrierBase served from memory.  write() plays the firmware,
+//  appending entries to an array's circular buffer.
+//
+class SimCarrier : public AmcCarrierBase {
+public:
+  SimCarrier(unsigned narrays, unsigned nentries) :
+    _narrays(narrays),
+    _mem    (size_t(narrays)*nentries*sizeof(Entry)),
+    _ts     (HSTARRAYN,0),
+    _wr     (HSTARRAYN,0),
+    _clear  (HSTARRAYN,0),
+    _full   (HSTARRAYN,0),
+    _pulseId(HSTARRAYN,1)
+  {
+    _begin.resize(HSTARRAYN);
+    _end  .resize(HSTARRAYN);
+    for(unsigned i=0; i<HSTARRAYN; i++) {
+      _begin[i] = _end[i] = 0;
+      if (i < narrays) {
+        _begin[i] = uint64_t(i)*nentries*sizeof(Entry);
+        _end  [i] = _begin[i] + nentries*sizeof(Entry);
+        _wr   [i] = _begin[i];
+        _clear[i] = 1;
+        _ts   [i] = 1ULL<<32;
+        fillEntries(reinterpret_cast<Entry*>(&_mem[_begin[i]]), nentries, 0);
+      }
+    }
+    _memEnd = _mem.size();
+  }
+public:
+  void write(unsigned array, unsigned n)
+  {
+    for(unsigned i=0; i<n; i++) {
+      uint32_t* p = reinterpret_cast<uint32_t*>(&_mem[_wr[array]]);
+      uint64_t pid = _pulseId[array]++;
+      p[1] = pid&0xffffffff;
+      p[2] = pid>>32;
+      _wr[array] += sizeof(Entry);
+      if (_wr[array] == _end[array]) {
+        _wr  [array] = _begin[array];
+        _full[array] = 1;
+      }
+    }
+  }
+  uint64_t begin(unsigned array) const { return _begin[array]; }
+  //  Place the write pointer, as after a fill
+  void position(unsigned array, unsigned entry, bool wrapped)
+  {
+    _wr  [array] = _begin[array] + uint64_t(entry)*sizeof(Entry);
+    _full[array] = wrapped;
+  }
+public:
+  BsaStatus fetch(unsigned  array,
+                  uint64_t  begin,
+                  uint64_t* next,
+                  Record**  record) const
+  { return _fetch(array, begin, _ts[array], _wr[array], _full[array], next, record); }
+  void       initialize() {}
+  void       layout    () {}
+  void       reset     (unsigned) {}
+  void       ackClear  (unsigned array) { _clear[array] = 0; }
+  uint64_t   inprogress() const { return 0; }
+  uint64_t   done      () const { return 0; }
+  bool       done      (unsigned) const { return false; }
+  uint32_t   status    (unsigned) const { return 0; }
+  ArrayState state     (unsigned array) const
+  {
+    ArrayState s;
+    s.timestamp = _ts   [array];
+    s.wrAddr    = _wr   [array];
+    s.clear     = _clear[array];
+    s.wrap      = _full [array];
+    return s;
+  }
+  const std::vector<ArrayState>& state()
+  {
+    for(unsigned i=0; i<HSTARRAYN; i++) {
+      _state[i].timestamp = _ts   [i];
+      _state[i].wrAddr    = _wr   [i];
+      _state[i].clear     = _clear[i];
+    }
+    return _state;
+  }
+  RingState  ring      (unsigned) const
+  { RingState s; memset(&s,0,sizeof(s)); return s; }
+protected:
+  void       _fill     (void* dst, uint64_t begin, uint64_t end) const
+  { memcpy(dst, &_mem[begin], end-begin); }
+private:
+  unsigned              _narrays;
+  std::vector<uint8_t>  _mem;
+  std::vector<uint64_t> _ts;
+  std::vector<uint64_t> _wr;
+  std::vector<unsigned> _clear;
+  std::vector<unsigned> _full;
+  std::vector<uint64_t> _pulseId;
+};
+
+//=======================================================
+//  AmcCarrierBase::get of a contiguous or a wrapped range
+//
+class CarrierGet : public Benchmark {
+public:
+  CarrierGet(const char* name, unsigned n, bool wrap) :
+    Benchmark(name, n, double(n)*sizeof(Entry)),
+    _hw(1, 4*n)
+  {
+    //  Read n entries; the wrapped read crosses the end of the buffer
+    if (wrap) {
+      _hw.position(0, n/2, true);
+      _begin = _hw.begin(0) + uint64_t(n/2+3*n)*sizeof(Entry);
+    }
+    else {
+      _hw.position(0, n/2+n, false);
+      _begin = _hw.begin(0) + uint64_t(n/2)*sizeof(Entry);
+    }
+  }
+  void run(unsigned iterations)
+  {
+    uint64_t next, s = 0;
+    for(unsigned k=0; k<iterations; k++)
+      s += _hw.get(0, _begin, &next)->entries.size();
+    _sink = s;
+  }
+private:
+  SimCarrier _hw;
+  uint64_t   _begin;
+};
+
+//=======================================================
+//  ProcessorImpl::update of arrays that fill at a steady rate
+//
+class CountPv : public Pv {
+public:
+  CountPv() : sum(0) {}
+  void setTimestamp(unsigned, unsigned) {}
+  void clear() {}
+  void append(unsigned, double mean, double) { sum += mean; }
+  void flush() {}
+public:
+  double sum;
+};
+
+class CountPvArray : public PvArray {
+public:
+  CountPvArray(unsigned array) : entries(0), _array(array), _pvs(nChannels), _ppvs(nChannels)
+  {
+    for(unsigned i=0; i<nChannels; i++)
+      _ppvs[i] = &_pvs[i];
+  }
+public:
+  unsigned array() const { return _array; }
+  void     reset(uint32_t, uint32_t) {}
+  void     set  (uint32_t, uint32_t) {}
+  void     append(uint64_t) { entries++; }
+  std::vector<Pv*> pvs() { return _ppvs; }
+public:
+  uint64_t entries;
+private:
+  unsigned             _array;
+  std::vector<CountPv> _pvs;
+  std::vector<Pv*>     _ppvs;
+};
+
+class ProcessorUpdate : public Benchmark {
+public:
+  ProcessorUpdate(unsigned narrays, unsigned n) :
+    Benchmark("processor_update", double(narrays)*n, double(narrays)*n*sizeof(Entry)),
+    _hw  (narrays, 4096),
+    _n   (n)
+  {
+    _p = Processor::create(&_hw);
+    for(unsigned i=0; i<narrays; i++)
+      _arrays.push_back(new CountPvArray(i));
+  }
+  ~ProcessorUpdate()
+  {
+    delete _p;
+    for(unsigned i=0; i<_arrays.size(); i++)
+      delete _arrays[i];
+  }
+  void run(unsigned iterations)
+  {
+    for(unsigned k=0; k<iterations; k++) {
+      for(unsigned i=0; i<_arrays.size(); i++)
+        _hw.write(i, _n);
+      uint64_t pending = _p->pending();
+      for(unsigned i=0; i<_arrays.size(); i++)
+        if (pending & (1ULL<<i))
+          _p->update(*_arrays[i]);
+    }
+    _sink = _arrays[0]->entries;
+  }
+private:
+  SimCarrier                 _hw;
+  unsigned                   _n;
+  Processor*                 _p;
+  std::vector<CountPvArray*> _arrays;
+};
+
+//=======================================================
+//  Iteration over the events of a BLD packet
+//
+class BldIterate : public Benchmark {
+public:
+  BldIterate(unsigned nevents, unsigned nchannels) :
+    Benchmark("bld_iterate", nevents, 0)
+  {
+    uint32_t mask = nchannels < 32 ? (1U<<nchannels)-1 : ~0U;
+    _buff.push_back(0);           // timestamp
+    _buff.push_back(1000);
+    _buff.push_back(0x10000);     // pulse ID
+    _buff.push_back(0);
+    _buff.push_back(mask);
+    _buff.push_back(1);           // beam
+    for(unsigned j=0; j<nchannels; j++)
+      _buff.push_back(j);
+    _buff.push_back(mask);        // valid
+    for(unsigned i=1; i<nevents; i++) {
+      _buff.push_back((i<<20) | (i*1000));
+      _buff.push_back(1);
+      for(unsigned j=0; j<nchannels; j++)
+        _buff.push_back(i+j);
+      _buff.push_back(mask);
+    }
+    _bytes = _buff.size()*sizeof(uint32_t);
+  }
+  void run(unsigned iterations)
+  {
+    uint64_t s = 0;
+    for(unsigned k=0; k<iterations; k++) {
+      Bld::BldEventIterator it(reinterpret_cast<const char*>(_buff.data()),
+                               _buff.size()*sizeof(uint32_t));
+      if (it.valid())
+        do { s += (*it).pulseId + (*it).channels[0]; } while(it.next());
+    }
+    _sink = s;
+  }
+private:
+  std::vector<uint32_t> _buff;
+};
+
+//=======================================================
+//  socketAPI sends to a loopback port (the receiver does not read;
+//  the kernel drops what does not fit).  The publisher is given at most
+//  a queue of packets at a time and waits for its send thread to empty
+//  the queue, so that it measures sends rather than drops on a full queue.
+//
+class SocketSend : public Benchmark {
+public:
+  enum { QueueDepth = 1024 };
+  SocketSend(const char* name, unsigned short port, unsigned size, bool publisher) :
+    Benchmark(name, 1, size),
+    _buff(size, 0),
+    _api (0),
+    _pub (0),
+    _drops(0)
+  {
+    _fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family      = AF_INET;
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    saddr.sin_port        = htons(port);
+    if (bind(_fd, (sockaddr*)&saddr, sizeof(saddr)) < 0)
+      perror("SocketSend bind");
+
+    if (publisher) {
+      SocketAPISpace::socketAPIPublisherInterface* p =
+        SocketAPISpace::socketAPIFactory::createsocketAPIPublisher(size, 1, 0, QueueDepth);
+      p->addDestination(INADDR_LOOPBACK, port);
+      _api = _pub = p;
+    }
+    else
+      _api = SocketAPISpace::socketAPIFactory::createsocketAPI(INADDR_LOOPBACK, port, size, 1, 0U);
+  }
+  ~SocketSend()
+  {
+    delete _api;
+    ::close(_fd);
+  }
+  void run(unsigned iterations)
+  {
+    unsigned errors = 0;
+    for(unsigned k=0; k<iterations; ) {
+      unsigned n = _pub && iterations-k > QueueDepth ? unsigned(QueueDepth) : iterations-k;
+      for(unsigned j=0; j<n; j++)
+        if (_api->sendRawData(_buff.size(), _buff.data()))
+          errors++;
+      k += n;
+      if (_pub)
+        _drain();
+    }
+    _drops += errors;
+    _sink = errors;
+  }
+  uint64_t drops() const { return _drops; }
+private:
+  void _drain()
+  {
+    socketAPIDestCounters c;
+    while(_pub->getCounters(0, &c) == 0 && c.uQueueDepth)
+      sched_yield();
+  }
+private:
+  std::vector<char>                   _buff;
+  int                                 _fd;
+  SocketAPISpace::socketAPIInterface* _api;
+  SocketAPISpace::socketAPIPublisherInterface* _pub;
+  uint64_t                            _drops;
+};
+
+//=======================================================
+
+class Result {
+public:
+  std::string name;
+  unsigned    iterations;
+  double      items;
+  double      bytes;
+  uint64_t    drops;        // in the measurements
+  std::vector<double> ns;   // per operation, each measurement
+};
+
+static double measure(Benchmark& b, unsigned iterations)
+{
+  uint64_t t = _now();
+  b.run(iterations);
+  return double(_now()-t);
+}
+
+static Result runBenchmark(Benchmark& b, double targetNs, unsigned repeats)
+{
+  //  Scale the iterations to the target time
+  unsigned n = 1;
+  double   t;
+  while((t = measure(b, n)) < 0.1*targetNs && n < (1U<<30))
+    n *= 2;
+  double scaled = double(n)*targetNs/(t > 0 ? t : 1);
+  n = scaled < 1 ? 1 : scaled > double(1U<<31) ? (1U<<31) : unsigned(scaled);
+
+  Result r;
+  r.name       = b.name();
+  r.iterations = n;
+  r.items      = b.items();
+  r.bytes      = b.bytes();
+  uint64_t drops = b.drops();
+  for(unsigned i=0; i<repeats; i++)
+    r.ns.push_back(measure(b, n)/double(n));
+  r.drops      = b.drops()-drops;
+  return r;
+}
+
+static void writeJson(FILE* f, const std::vector<Result>& results,
+                      double targetNs, unsigned repeats)
+{
+  utsname u;
+  uname(&u);
+  timespec tv;
+  clock_gettime(CLOCK_REALTIME,&tv);
+
+  fprintf(f, "{\n");
+  fprintf(f, "  \"host\": \"%s\",\n", u.nodename);
+  fprintf(f, "  \"machine\": \"%s\",\n", u.machine);
+  fprintf(f, "  \"kernel\": \"%s\",\n", u.release);
+  fprintf(f, "  \"time\": %ld,\n", long(tv.tv_sec));
+  fprintf(f, "  \"time_per_measurement_ms\": %g,\n", targetNs*1.e-6);
+  fprintf(f, "  \"repeats\": %u,\n", repeats);
+  fprintf(f, "  \"benchmarks\": [");
+  for(unsigned i=0; i<results.size(); i++) {
+    const Result& r = results[i];
+    std::vector<double> ns(r.ns);
+    std::sort(ns.begin(), ns.end());
+    double median = ns[ns.size()/2];
+    fprintf(f, "%s\n    { \"name\": \"%s\", \"iterations\": %u,"
+            " \"ns_per_op\": %.1f, \"ns_per_op_min\": %.1f, \"ns_per_op_max\": %.1f,"
+            " \"items_per_op\": %g, \"items_per_sec\": %.4g, \"bytes_per_sec\": %.4g,"
+            " \"drops\": %llu }",
+            i ? "," : "", r.name.c_str(), r.iterations,
+            median, ns.front(), ns.back(),
+            r.items, r.items*1.e9/median, r.bytes*1.e9/median,
+            (unsigned long long)r.drops);
+  }
+  fprintf(f, "\n  ]\n}\n");
+}
+
+int main(int argc, char* argv[])
+{
+  extern char* optarg;
+  int c;
+  unsigned    ms      = 200;
+  unsigned    repeats = 5;
+  const char* filter  = 0;
+  const char* output  = 0;
+  bool        list    = false;
+  unsigned short port = 12100;
+
+  while ( (c=getopt( argc, argv, "t:r:b:o:P:lh")) != EOF ) {
+    switch(c) {
+    case 't': ms      = strtoul(optarg,NULL,0); break;
+    case 'r': repeats = strtoul(optarg,NULL,0); break;
+    case 'b': filter  = optarg; break;
+    case 'o': output  = optarg; break;
+    case 'P': port    = strtoul(optarg,NULL,0); break;
+    case 'l': list    = true; break;
+    default:
+      show_usage(argv[0]);
+      return 0;
+    }
+  }
+  if (repeats == 0)
+    repeats = 1;
+
+  std::vector<Benchmark*> benchmarks;
+  benchmarks.push_back(new ChannelDecode(1024));
+  benchmarks.push_back(new EntryScan ("entry_scan"        , 1024, 0));
+  benchmarks.push_back(new EntryScan ("entry_scan_resync" , 1024, 100));
+  benchmarks.push_back(new CarrierGet("carrier_get"       , 2048, false));
+  benchmarks.push_back(new CarrierGet("carrier_get_wrap"  , 2048, true));
+  benchmarks.push_back(new ProcessorUpdate(8, 32));
+  benchmarks.push_back(new BldIterate(32, 16));
+  benchmarks.push_back(new SocketSend("socketapi_send"    , port  , 1024, false));
+  benchmarks.push_back(new SocketSend("socketapi_publish" , port+1, 1024, true));
+
+  if (list) {
+    for(unsigned i=0; i<benchmarks.size(); i++)
+      printf("%s\n", benchmarks[i]->name());
+    return 0;
+  }
+
+  std::vector<Result> results;
+  for(unsigned i=0; i<benchmarks.size(); i++) {
+    if (filter && !strstr(benchmarks[i]->name(), filter))
+      continue;
+    results.push_back(runBenchmark(*benchmarks[i], double(ms)*1.e6, repeats));
+    const Result& r = results.back();
+    std::vector<double> ns(r.ns);
+    std::sort(ns.begin(), ns.end());
+    fprintf(stderr, "%-20s %12.1f ns/op  %10.4g items/s  drops %llu\n",
+            r.name.c_str(), ns[ns.size()/2], r.items*1.e9/ns[ns.size()/2],
+            (unsigned long long)r.drops);
+  }
+
+  FILE* f = output ? fopen(output, "w") : stdout;
+  if (!f) {
+    perror("Opening output");
+    return -1;
+  }
+  writeJson(f, results, double(ms)*1.e6, repeats);
+  if (output)
+    fclose(f);
+
+  for(unsigned i=0; i<benchmarks.size(); i++)
+    delete benchmarks[i];
+
+  return 0;
+}
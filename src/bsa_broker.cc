@@ -0,0 +1,159 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Owns the carrier connection and serves it to local clients
+//  (Processor::create(new AmcCarrierClient(<socket>,<owner>)) connects through it)
+//
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <AmcCarrier.hh>
+#include <AmcCarrierYaml.hh>
+#include <AmcCarrierBroker.hh>
+#include <cpsw_yaml_keydefs.h>
+#include <cpsw_yaml.h>
+
+class IpAddrFixup : public IYamlFixup {
+public:
+  IpAddrFixup(const char* ip) : _ip(ip) {}
+  ~IpAddrFixup() {}
+  void operator()(YAML::Node& node, YAML::Node&) {
+    writeNode(node, YAML_KEY_ipAddr, _ip);
+  }
+private:
+  const char* _ip;
+};
+
+static Bsa::AmcCarrierBroker* broker = 0;
+
+static void sigHandler(int signal)
+{
+  psignal(signal, "bsa_broker received signal");
+  if (broker)
+    broker->stop();
+}
+
+static void* statThread(void* arg)
+{
+  unsigned interval = *reinterpret_cast<unsigned*>(arg);
+  uint64_t oreq = 0, oacc = 0;
+  while(1) {
+    sleep(interval);
+    uint64_t nreq = broker->requests();
+    uint64_t nacc = broker->accesses();
+    printf("clients %u  requests %llu (%7.1f/s)  carrier accesses %llu (%7.1f/s)  shared %llu  errors %llu\n",
+           broker->clients(),
+           (unsigned long long)nreq, double(nreq-oreq)/double(interval),
+           (unsigned long long)nacc, double(nacc-oacc)/double(interval),
+           (unsigned long long)broker->cacheHits(),
+           (unsigned long long)broker->errors());
+    oreq = nreq;
+    oacc = nacc;
+  }
+  return 0;
+}
+
+static void show_usage(const char* p)
+{
+  printf("Usage: %s [options]\n",p);
+  printf("Options: -a <IP address dotted notation> : set carrier IP\n");
+  printf("         -y <yaml file, regpath, rampath>: use yaml file\n");
+  printf("         -s <socket path>                : (default %s)\n", BSA_BROKER_PATH);
+  printf("         -m <MB>                         : shared buffer per client (default 64)\n");
+  printf("         -c <us>                         : share array states for <us> (default 0)\n");
+  printf("         -i                              : initialize BSA buffers\n");
+  printf("         -S <sec>                        : print statistics every <sec>\n");
+}
+
+int main(int argc, char* argv[])
+{
+  const char* ip       = "192.168.2.10";
+  const char* yaml     = 0;
+  const char* reg_path = "mmio/AmcCarrierCore/AmcCarrierBsa";
+  const char* ram_path = "strm/AmcCarrierDRAM/dram";
+  const char* sock     = BSA_BROKER_PATH;
+  unsigned    shmMB    = 64;
+  unsigned    cacheUs  = 0;
+  unsigned    stats    = 0;
+  bool        lInit    = false;
+
+  int c;
+  while( (c=getopt(argc,argv,"a:y:s:m:c:iS:h"))!=-1 ) {
+    switch(c) {
+    case 'a':
+      ip = optarg; break;
+    case 'y':
+      yaml = strtok(optarg,",");
+      { const char* reg_p = strtok(NULL,",");
+        const char* ram_p = strtok(NULL,",");
+        if (reg_p) reg_path = reg_p;
+        if (ram_p) ram_path = ram_p;
+      }
+      break;
+    case 's':
+      sock = optarg; break;
+    case 'm':
+      shmMB = strtoul(optarg,NULL,0); break;
+    case 'c':
+      cacheUs = strtoul(optarg,NULL,0); break;
+    case 'i':
+      lInit = true; break;
+    case 'S':
+      stats = strtoul(optarg,NULL,0); break;
+    default:
+      show_usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  Bsa::AmcCarrierBase* hw;
+  if (yaml) {
+    IYamlFixup* fixup = new IpAddrFixup(ip);
+    Path path = IPath::loadYamlFile(yaml,"NetIODev",0,fixup);
+    delete fixup;
+    hw = new Bsa::AmcCarrierYaml(path->findByName(reg_path),
+                                 path->findByName(ram_path));
+  }
+  else
+    hw = new Bsa::AmcCarrier(ip);
+
+  //  Clients take the buffer layout from the broker
+  if (lInit)
+    hw->initialize();
+  else
+    hw->layout();
+
+  try {
+    broker = new Bsa::AmcCarrierBroker(*hw, sock, size_t(shmMB)<<20, cacheUs);
+  }
+  catch(std::string& e) {
+    printf("%s\n", e.c_str());
+    return -1;
+  }
+
+  ::signal( SIGINT , sigHandler );
+  ::signal( SIGTERM, sigHandler );
+
+  if (stats) {
+    pthread_t thr;
+    pthread_create(&thr, 0, statThread, &stats);
+  }
+
+  printf("Serving carrier on %s\n", sock);
+  broker->run();
+
+  delete broker;
+  return 0;
+}
@@ -28,6 +28,8 @@
 
 #include <AmcCarrier.hh>
 #include <AmcCarrierYaml.hh>
+#include <RawCapture.hh>
+#include <BsaCapture.hh>
 #include <cpsw_yaml_keydefs.h>
 #include <cpsw_yaml.h>
 
@@ -114,6 +116,9 @@ static void show_usage(const char* p)
   printf("         -d <buffer>                     : write diagnostics to file and re-arm\n");
   printf("         -c <channel mask>               : bit mask of channels to dump\n");
   printf("         -S <max segment size>           : set maximum segment size (bytes)\n");
+  printf("         -R <file>,<rings>,<bytes>,<secs>: stream the raw diagnostic rings in mask <rings>\n"
+         "                                           to <file> for <secs> with <bytes> per buffer\n");
+  printf("         -C <file>                       : capture the values read for bsareplay_tst\n");
 }
 
 int main(int argc, char* argv[])
@@ -138,10 +143,14 @@ int main(int argc, char* argv[])
   bool lTPG =false;
   bool lDiag=false;
   bool lNoFetch=false;
+  const char* rawFile=0;
+  const char* captureFile=0;
+  unsigned rawMask=0, rawSecs=10;
+  uint64_t rawSize=1ULL<<24;
 
   char* endPtr;
   int c;
-  while( (c=getopt(argc,argv,"a:c:d:i:g:f:y:D:F:GNS:"))!=-1 ) {
+  while( (c=getopt(argc,argv,"a:c:d:i:g:f:y:C:D:F:GNR:S:"))!=-1 ) {
     switch(c) {
     case 'a':
       ip = optarg; break;
@@ -193,6 +202,16 @@ int main(int argc, char* argv[])
     case 'S':
       segmentSize = strtoul(optarg,NULL,0);
       break;
+    case 'C':
+      captureFile = optarg;
+      break;
+    case 'R':
+      rawFile = strtok(optarg,",");
+      { const char* v;
+        if ((v = strtok(NULL,","))) rawMask = strtoul (v,NULL,0);
+        if ((v = strtok(NULL,","))) rawSize = strtoull(v,NULL,0);
+        if ((v = strtok(NULL,","))) rawSecs = strtoul (v,NULL,0); }
+      break;
     default:
       show_usage(argv[0]);
       exit(1);
@@ -218,6 +237,12 @@ int main(int argc, char* argv[])
       printf("Segment Size 0x%x -> 0x%x (0x%x)\n", curSize, newSize, segSize);
     }
 
+    //  Before the carrier, so the capture holds every value it reads
+    if (captureFile && !Bsa::BsaCapture::open(captureFile)) {
+      perror("Opening capture file");
+      return -1;
+    }
+
     Bsa::AmcCarrierYaml hw(path->findByName(reg_path),
                            path->findByName(ram_path));
 
@@ -254,6 +279,45 @@ int main(int argc, char* argv[])
       hw.rearm(ndiag);
     }
 
+    if (rawFile) {
+      if (!lInit)
+        hw.layout();  // the raw buffers go above the BSA arrays
+      Bsa::RawCapture* pcapture;
+      try {
+        pcapture = new Bsa::RawCapture(hw, rawFile, rawMask, rawSize);
+      }
+      catch(std::string& e) {
+        printf("%s\n", e.c_str());
+        return -1;
+      }
+      Bsa::RawCapture& capture = *pcapture;
+      if (!capture.start()) {
+        perror("Opening raw capture file");
+        delete pcapture;
+        return -1;
+      }
+      printf("Streaming rings 0x%x to %s (%s)\n", rawMask, rawFile,
+             capture.direct() ? "direct" : "buffered");
+      uint64_t owritten = 0;
+      for(unsigned s=0; s<rawSecs; s++) {
+        sleep(1);
+        uint64_t written = capture.written();
+        printf("%4u s  %8.2f MB/s  errors %llu\n", s+1,
+               1.e-6*double(written-owritten), (unsigned long long)capture.writeErrors());
+        owritten = written;
+      }
+      capture.stop();
+      for(unsigned r=0; r<Bsa::RAW_RINGS; r++) {
+        if (!(rawMask & (1<<r))) continue;
+        const Bsa::RawCapture::RingStats& st = capture.stats(r);
+        printf("ring %u  buffers %llu  %.1f MB  dead %.1f ms (max %.3f ms)\n", r,
+               (unsigned long long)st.buffers, 1.e-6*double(st.bytes),
+               1.e-6*double(st.deadNs), 1.e-6*double(st.deadMaxNs));
+      }
+      delete pcapture;
+      return 0;
+    }
+
     if (nacq) {
       BeamSelect beam;
       RateSelect rsel;
@@ -29,6 +29,8 @@
 
 #include <BsaField.hh>
 #include <Processor.hh>
+#include <PulseIdJoin.hh>
+#include <ShmExport.hh>
 #include <AmcCarrier.hh>
 
 #include <cpsw_api_user.h>
@@ -207,6 +209,15 @@ private:
   std::vector<Bsa::Pv*> _pvs;
 };
 
+class TextJoinHandler : public Bsa::JoinHandler {
+public:
+  void process(const Bsa::JoinedColumns& c) {
+    printf("-- joined %u rows [%016llx - %016llx] --\n",
+           c.rows(), (unsigned long long)c.pulseId()[0],
+           (unsigned long long)c.pulseId()[c.rows()-1]);
+  }
+};
+
 class IpAddrFixup : public IYamlFixup {
 public:
   IpAddrFixup(const char* ip) : _ip(ip) {}
@@ -228,6 +239,8 @@ static void show_usage(const char* p)
   printf("         -y <yaml file, regpath, rampath>: use yaml file\n");
   printf("         -F <array>                      : force fetch of BSA array\n");
   printf("         -I <update interval>            : retries updates\n");
+  printf("         -j <arrays>                     : join fetched arrays on pulse ID\n");
+  printf("         -x <name>[,<rows>]              : export arrays to shared memory\n");
   printf("         -D                              : debug\n");
 }
 
@@ -242,8 +255,11 @@ int main(int argc, char* argv[])
   bool     lInit=false;
   bool     lDebug=false;
   unsigned fields=(1<<1);
+  uint64_t join=0;
+  const char* shm=0;
+  unsigned shmRows=1<<14;
   int c;
-  while( (c=getopt(argc,argv,"a:f:y:iF:I:D"))!=-1 ) {
+  while( (c=getopt(argc,argv,"a:f:y:iF:I:j:x:D"))!=-1 ) {
     switch(c) {
     case 'a':
       ip = optarg; break;
@@ -267,6 +283,14 @@ int main(int argc, char* argv[])
     case 'I':
       uinterval = unsigned(1.e6*strtod(optarg,NULL));
       break;
+    case 'j':
+      join = strtoull(optarg,NULL,0);
+      break;
+    case 'x':
+      shm = strtok(optarg,",");
+      { const char* rows = strtok(NULL,",");
+        if (rows) shmRows = strtoul(rows,NULL,0); }
+      break;
     case 'D':
       lDebug = true;
       break;
@@ -290,6 +314,21 @@ int main(int argc, char* argv[])
     pva.push_back(new TextPvArray(a, pvs));
   }
 
+  //  Arrays in the join are updated through the join taps
+  TextJoinHandler joinHandler;
+  Bsa::PulseIdJoin pidJoin(joinHandler);
+  std::vector<Bsa::PvArray*> upd;
+  std::vector<unsigned> channels;
+  for(unsigned i=0; i<31; i++)
+    if ((1<<i)&fields)
+      channels.push_back(channels.size());
+  for(unsigned a=0; a<pva.size(); a++) {
+    if ((1ULL<<pva[a]->array())&join)
+      upd.push_back(&pidJoin.add(pva[a]->array(), channels, pva[a]));
+    else
+      upd.push_back(pva[a]);
+  }
+
   Bsa::Processor* p;
   if (yaml) {
     IYamlFixup* fixup = new IpAddrFixup(ip);
@@ -305,6 +344,9 @@ int main(int argc, char* argv[])
     p = Bsa::Processor::create(ip,lInit,lDebug);
   }
 
+  if (shm)
+    p->setExport(new Bsa::ShmExport(shm, shmRows, array));
+
   //  ::signal( SIGINT, sigHandler );
 
   //
@@ -322,7 +364,7 @@ int main(int argc, char* argv[])
       if (!(pending&(1ULL<<pva[a]->array())))
         continue;
 
-      if (p->update(*pva[a])) {
+      if (p->update(*upd[a])) {
         const std::vector<Bsa::Pv*>& pvs = pva[a]->pvs();
         __pidGlobal = &pva[a]->pid();
         for(unsigned i=0; i<pvs.size(); i++)
@@ -331,6 +373,8 @@ int main(int argc, char* argv[])
       else {
       }
     }
+    if (join)
+      pidJoin.process();
 #ifdef DBUG
     clock_gettime(CLOCK_REALTIME,&ts_end);
     printf("\rpending [%016llx] array update = %f sec",
@@ -0,0 +1,346 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Broker test: two clients of a simulated carrier over a local socket
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <string>
+#include <vector>
+
+#include <AmcCarrierBroker.hh>
+
+using namespace Bsa;
+
+static const unsigned NARRAYS  = 4;
+static const unsigned NENTRIES = 1024;
+
+//
+//  Arrays in host memory; counts the accesses that change their state
+//
+class SimCarrier : public AmcCarrierBase {
+public:
+  SimCarrier() :
+    resets(0), acks(0), inits(0), stateReads(0), hold(false),
+    _mem(size_t(NARRAYS)*NENTRIES*sizeof(Entry)),
+    _wr (HSTARRAYN,0)
+  {
+    _begin.resize(HSTARRAYN);
+    _end  .resize(HSTARRAYN);
+    for(unsigned i=0; i<HSTARRAYN; i++) {
+      _begin[i] = _end[i] = 0;
+      if (i < NARRAYS) {
+        _begin[i] = uint64_t(i)*NENTRIES*sizeof(Entry);
+        _end  [i] = _begin[i] + NENTRIES*sizeof(Entry);
+        _wr   [i] = _begin[i];
+      }
+    }
+    _memEnd = _mem.size();
+    sem_init(&entered, 0, 0);
+    sem_init(&release, 0, 0);
+  }
+  ~SimCarrier()
+  {
+    sem_destroy(&release);
+    sem_destroy(&entered);
+  }
+public:
+  //  Append n entries to an array (the broker thread is idle meanwhile)
+  void write(unsigned array, unsigned n)
+  {
+    for(unsigned i=0; i<n && _wr[array] < _end[array]; i++) {
+      uint32_t* p = reinterpret_cast<uint32_t*>(&_mem[_wr[array]]);
+      uint64_t pid = 1 + (_wr[array]-_begin[array])/sizeof(Entry);
+      p[0] = 1<<16;
+      p[1] = pid&0xffffffff;
+      p[2] = pid>>32;
+      p[3] = 0;
+      p[4] = 0;
+      p[5] = uint32_t(array*NENTRIES + pid);
+      _wr[array] += sizeof(Entry);
+    }
+  }
+public:
+  BsaStatus fetch(unsigned  array,
+                  uint64_t  begin,
+                  uint64_t* next,
+                  Record**  record) const
+  { return _fetch(array, begin, 1ULL<<32, _wr[array], 0, next, record); }
+  void       initialize() { inits++; }
+  void       layout    () {}
+  void       reset     (unsigned) { resets++; }
+  void       ackClear  (unsigned) { acks++; }
+  uint64_t   inprogress() const { return 0; }
+  uint64_t   done      () const { return 0; }
+  bool       done      (unsigned) const { return false; }
+  uint32_t   status    (unsigned) const { return 0; }
+  ArrayState state     (unsigned array) const
+  {
+    ArrayState s;
+    s.wrAddr = _wr[array];
+    return s;
+  }
+  //  Reads of all states; with hold, waits for release so that more
+  //  requests queue at the broker meanwhile
+  const std::vector<ArrayState>& state()
+  {
+    stateReads++;
+    if (hold) {
+      sem_post(&entered);
+      sem_wait(&release);
+    }
+    for(unsigned i=0; i<HSTARRAYN; i++)
+      _state[i].wrAddr = _wr[i];
+    return _state;
+  }
+  RingState  ring      (unsigned) const
+  { RingState s; memset(&s,0,sizeof(s)); return s; }
+protected:
+  void       _fill     (void* dst, uint64_t begin, uint64_t end) const
+  { memcpy(dst, &_mem[begin], end-begin); }
+public:
+  unsigned resets;
+  unsigned acks;
+  unsigned inits;
+  unsigned stateReads;
+  volatile bool hold;
+  sem_t    entered;
+  sem_t    release;
+private:
+  std::vector<uint8_t>  _mem;
+  std::vector<uint64_t> _wr;
+};
+
+static unsigned failures = 0;
+
+static void check(bool ok, const char* what)
+{
+  printf("%-52s %s\n", what, ok ? "passed" : "FAILED");
+  if (!ok)
+    failures++;
+}
+
+static void* serve(void* arg)
+{
+  reinterpret_cast<AmcCarrierBroker*>(arg)->run();
+  return 0;
+}
+
+//
+//  Requests sent without the client class
+//
+static bool rawSend(int fd, unsigned op, unsigned array=0)
+{
+  BrokerRequest req;
+  memset(&req, 0, sizeof(req));
+  req.op    = op;
+  req.array = array;
+  return ::send(fd, &req, sizeof(req), 0) == sizeof(req);
+}
+
+//  Returns the reply status
+static int rawReply(int fd)
+{
+  BrokerReply rep;
+  char        cbuf[CMSG_SPACE(sizeof(int))];
+  msghdr      msg;
+  iovec       iov;
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base       = &rep;
+  iov.iov_len        = sizeof(rep);
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+
+  if (::recvmsg(fd, &msg, 0) != sizeof(rep))
+    return -EIO;
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_type == SCM_RIGHTS) {
+    int shmFd;
+    memcpy(&shmFd, CMSG_DATA(cmsg), sizeof(int));
+    ::close(shmFd);
+  }
+  return rep.status;
+}
+
+//  A connected client past the handshake, or -1
+static int rawConnect(const char* path)
+{
+  int fd = ::socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+  if (fd < 0 || ::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("Connecting to broker");
+    if (fd >= 0)
+      ::close(fd);
+    return -1;
+  }
+  if (!rawSend(fd, BrokerHello) || rawReply(fd) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int rawRequest(const char* path, unsigned op, unsigned array)
+{
+  int fd = rawConnect(path);
+  if (fd < 0)
+    return 0;
+  int status = rawSend(fd, op, array) ? rawReply(fd) : -EIO;
+  ::close(fd);
+  return status;
+}
+
+static void* readStates(void* arg)
+{
+  reinterpret_cast<AmcCarrierClient*>(arg)->state();
+  return 0;
+}
+
+static bool sameRecord(const Record* a, const Record* b)
+{
+  return a->entries.size() == b->entries.size() &&
+    memcmp(a->entries.data(), b->entries.data(), a->entries.size()*sizeof(Entry)) == 0;
+}
+
+static void show_usage(const char* p)
+{
+  printf("Usage: %s [options]\n",p);
+  printf("Options: -s <socket path> : (default /tmp/bsabroker_tst.<pid>)\n");
+}
+
+int main(int argc, char* argv[])
+{
+  char defpath[64];
+  snprintf(defpath, sizeof(defpath), "/tmp/bsabroker_tst.%d", getpid());
+  const char* path = defpath;
+
+  int c;
+  while( (c=getopt(argc,argv,"s:h"))!=-1 ) {
+    switch(c) {
+    case 's': path = optarg; break;
+    default:
+      show_usage(argv[0]);
+      return 0;
+    }
+  }
+
+  SimCarrier       hw;
+  AmcCarrierBroker broker(hw, path, 1<<20);
+  pthread_t        thr;
+  if (pthread_create(&thr, 0, serve, &broker)) {
+    perror("Creating broker thread");
+    return -1;
+  }
+
+  try {
+    AmcCarrierClient* owner    = new AmcCarrierClient(path, true);
+    AmcCarrierClient* observer = new AmcCarrierClient(path);
+    check(broker.owned() && owner->owner() && !observer->owner(),
+          "one owner and one observer");
+
+    bool refused = false;
+    try {
+      AmcCarrierClient second(path, true);
+    }
+    catch(std::string&) {
+      refused = true;
+    }
+    check(refused, "a second owner is refused");
+
+    //  Both read the same entries (array 0 starts at 0), in two steps
+    hw.write(0, 100);
+    uint64_t nexto, nextb;
+    Record*  ro = owner   ->get(0, 0, &nexto);
+    Record*  rb = observer->get(0, 0, &nextb);
+    check(sameRecord(ro, rb) && ro->entries.size()==100 && nexto==nextb,
+          "both clients read the same 100 entries");
+    hw.write(0, 28);
+    ro = owner   ->get(0, nexto, &nexto);
+    rb = observer->get(0, nextb, &nextb);
+    check(sameRecord(ro, rb) && ro->entries.size()==28 && nexto==nextb,
+          "both clients read the next 28 entries");
+
+    std::vector<ArrayState> so = owner   ->state();
+    std::vector<ArrayState> sb = observer->state();
+    check(so[0].wrAddr == sb[0].wrAddr && sb[0].wrAddr == hw.state(0).wrAddr,
+          "both clients see the same array states");
+
+    //  Only the owner's changes reach the carrier
+    owner   ->ackClear(0);
+    owner   ->reset   (1);
+    observer->ackClear(0);
+    observer->reset   (1);
+    observer->initialize();
+    check(hw.acks==1 && hw.resets==1 && hw.inits==0,
+          "only the owner acknowledges and resets");
+    check(rawRequest(path, BrokerAckClear, 0) == -EPERM &&
+          rawRequest(path, BrokerReset, 1) == -EPERM &&
+          rawRequest(path, BrokerInitialize, 0) == -EPERM && hw.acks==1,
+          "the broker refuses them from other clients");
+
+    //  Two clients whose state reads wait while the carrier is busy
+    //  are served in one round, with one carrier read
+    int b = rawConnect(path), c = rawConnect(path);
+    unsigned reads = hw.stateReads;
+    uint64_t hits  = broker.cacheHits();
+    hw.hold = true;
+    pthread_t athr;
+    pthread_create(&athr, 0, readStates, observer);
+    sem_wait(&hw.entered);
+    hw.hold = false;
+    bool sent = rawSend(b, BrokerStateAll) && rawSend(c, BrokerStateAll);
+    sem_post(&hw.release);
+    pthread_join(athr, 0);
+    bool replied = rawReply(b) == 0 && rawReply(c) == 0;
+    check(b >= 0 && c >= 0 && sent && replied &&
+          hw.stateReads == reads+2 && broker.cacheHits() == hits+1,
+          "state reads of one round share one carrier read");
+    ::close(b);
+    ::close(c);
+
+    //  Ownership is released when the owner disconnects
+    delete owner;
+    usleep(300000);
+    AmcCarrierClient* next = new AmcCarrierClient(path, true);
+    next->ackClear(2);
+    check(next->owner() && hw.acks==2, "a new owner takes over after a disconnect");
+
+    delete next;
+    delete observer;
+  }
+  catch(std::string& e) {
+    printf("%s\n", e.c_str());
+    failures++;
+  }
+
+  broker.stop();
+  pthread_join(thr, 0);
+
+  printf("requests %llu  carrier accesses %llu  shared %llu  errors %llu\n",
+         (unsigned long long)broker.requests(),
+         (unsigned long long)broker.accesses(),
+         (unsigned long long)broker.cacheHits(),
+         (unsigned long long)broker.errors());
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,292 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Replay a carrier capture written by BsaCapture (bsa_tst -C <file>)
+//  through an unmodified Processor, and report its throughput
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <Processor.hh>
+#include <AmcCarrierReplay.hh>
+#include <BsaCapture.hh>
+#include <BsaRealTime.hh>
+
+using namespace Bsa;
+
+static void show_usage(const char* p)
+{
+  printf("Usage: %s -f <file> [options]\n",p);
+  printf("Options: -f <file>       : capture file\n");
+  printf("         -r              : replay at the recorded speed\n");
+  printf("         -S <rounds>     : first write a synthetic capture to <file>\n");
+  printf("         -a <arrays>     : synthetic BSA arrays (default 8)\n");
+  printf("         -e <entries>    : synthetic entries per array per round (default 16)\n");
+  printf("         -c <channels>   : synthetic channels per entry (default 8)\n");
+}
+
+static double _seconds()
+{
+  timespec tv;
+  clock_gettime(CLOCK_MONOTONIC,&tv);
+  return double(tv.tv_sec)+1.e-9*double(tv.tv_nsec);
+}
+
+//
+//  Counts what the Processor delivers
+//
+class CountPv : public Pv {
+public:
+  CountPv() : appends(0) {}
+  void setTimestamp(unsigned, unsigned) {}
+  void clear() {}
+  void append(unsigned, double, double) { appends++; }
+  void flush() {}
+public:
+  uint64_t appends;
+};
+
+class CountPvArray : public PvArray {
+public:
+  CountPvArray(unsigned array, unsigned npvs) :
+    entries(0), resets(0), _array(array), _pvs(npvs) {}
+public:
+  unsigned array() const { return _array; }
+  void     reset(uint32_t, uint32_t) { resets++; }
+  void     set  (uint32_t, uint32_t) {}
+  void     append(uint64_t) { entries++; }
+  std::vector<Pv*> pvs()
+  {
+    std::vector<Pv*> v(_pvs.size());
+    for(unsigned i=0; i<_pvs.size(); i++)
+      v[i] = &_pvs[i];
+    return v;
+  }
+  uint64_t appends() const
+  {
+    uint64_t n=0;
+    for(unsigned i=0; i<_pvs.size(); i++)
+      n += _pvs[i].appends;
+    return n;
+  }
+public:
+  uint64_t entries;
+  uint64_t resets;
+private:
+  unsigned _array;
+  std::vector<CountPv> _pvs;
+};
+
+//
+//  The standard DRAM layout
+//
+class Layout : public AmcCarrierBase {
+public:
+  Layout() { _defaultLayout(); }
+  RingState ring(unsigned) const { RingState s; memset(&s,0,sizeof(s)); return s; }
+  const std::vector<uint64_t>& begin() const { return _begin; }
+  const std::vector<uint64_t>& end  () const { return _end; }
+};
+
+//
+//  The reads AmcCarrierBase makes while a Processor polls arrays that
+//  fill at a steady rate; an array that would wrap starts a new acquisition
+//
+static void synthesize(const char* file, unsigned nrounds, unsigned narrays,
+                       unsigned nentries, unsigned nchannels)
+{
+  if (!BsaCapture::open(file)) {
+    perror("Opening capture");
+    exit(1);
+  }
+
+  Layout layout;
+  BsaCapture::layout(layout.begin(), layout.end());
+
+  uint64_t tstamp[HSTARRAYN], wrAddr[HSTARRAYN], clear[HSTARRAYN], status[HSTARRAYN];
+  uint64_t pulseId[HSTARRAYN];
+  for(unsigned i=0; i<HSTARRAYN; i++) {
+    tstamp [i] = 0;
+    wrAddr [i] = i<narrays ? layout.begin()[i] : 0;  // idle arrays read as zero
+    clear  [i] = 0;
+    status [i] = 0;
+    pulseId[i] = 0;
+  }
+
+  std::vector<Entry> entries(nentries);
+  memset(entries.data(), 0, nentries*sizeof(Entry));
+
+  uint64_t secs = 1000000000ULL;
+  for(unsigned r=0; r<nrounds; r++) {
+    uint64_t begin[HSTARRAYN];
+    for(unsigned i=0; i<narrays && i<NBSAARRAYS; i++) {
+      begin[i] = wrAddr[i];
+      clear[i] = 0;
+      if (r==0 || wrAddr[i] + nentries*sizeof(Entry) > layout.end()[i]) {
+        begin [i] = layout.begin()[i];
+        clear [i] = 1;
+        tstamp[i] = (secs+r)<<32;
+      }
+      wrAddr[i] = begin[i] + nentries*sizeof(Entry);
+      tstamp[i]++;
+    }
+
+    BsaCapture::poll();
+    BsaCapture::regs(TraceTimestamp, 0, HSTARRAYN, tstamp);
+    BsaCapture::regs(TraceClear    , 0, HSTARRAYN, clear);
+    BsaCapture::regs(TraceWrAddr   , 0, HSTARRAYN, wrAddr);
+    BsaCapture::regs(TraceStatus   , 0, HSTARRAYN, status);
+
+    for(unsigned i=0; i<narrays && i<NBSAARRAYS; i++) {
+      uint64_t full = 0;
+      BsaCapture::regs(TraceTimestamp, i, 1, &tstamp[i]);
+      BsaCapture::regs(TraceWrAddr   , i, 1, &wrAddr[i]);
+      BsaCapture::regs(TraceClear    , i, 1, &clear [i]);
+      BsaCapture::regs(TraceFull     , i, 1, &full);
+
+      for(unsigned j=0; j<nentries; j++) {
+        uint32_t* p = reinterpret_cast<uint32_t*>(&entries[j]);
+        uint64_t pid = ++pulseId[i];
+        p[0] = nchannels<<16;
+        p[1] = pid & 0xffffffff;
+        p[2] = pid >> 32;
+        for(unsigned k=0; k<nchannels; k++)
+          entries[j].channel_data[k].data[0] = 1;
+      }
+
+      BsaCapture::regs(TraceTimestamp, i, 1, &tstamp[i]);
+      BsaCapture::regs(TraceWrAddr   , i, 1, &wrAddr[i]);
+      BsaCapture::regs(TraceFull     , i, 1, &full);
+      BsaCapture::dram(begin[i], wrAddr[i], entries.data());
+    }
+  }
+
+  printf("Wrote %u rounds, %llu bytes to %s\n",
+         nrounds, (unsigned long long)BsaCapture::bytes(), file);
+  BsaCapture::close();
+}
+
+static void printLatency(const char* name, const LatencyStats& s)
+{
+  printf("  %s latency (us): n %llu  min %.1f  mean %.1f  p99 < %.1f  p99.99 < %.1f  max %.1f\n",
+         name, (unsigned long long)s.count(),
+         1.e-3*s.min(), 1.e-3*s.mean(),
+         1.e-3*s.percentile(0.99), 1.e-3*s.percentile(0.9999), 1.e-3*s.max());
+}
+
+int main(int argc, char* argv[])
+{
+  extern char* optarg;
+  int c;
+  const char* file = 0;
+  bool     realTime  = false;
+  unsigned nsynth    = 0;
+  unsigned narrays   = 8;
+  unsigned nentries  = 16;
+  unsigned nchannels = 8;
+
+  while ( (c=getopt( argc, argv, "f:rS:a:e:c:h")) != EOF ) {
+    switch(c) {
+    case 'f': file      = optarg; break;
+    case 'r': realTime  = true; break;
+    case 'S': nsynth    = strtoul(optarg,NULL,0); break;
+    case 'a': narrays   = strtoul(optarg,NULL,0); break;
+    case 'e': nentries  = strtoul(optarg,NULL,0); break;
+    case 'c': nchannels = strtoul(optarg,NULL,0); break;
+    default:
+      show_usage(argv[0]);
+      return 0;
+    }
+  }
+
+  if (!file || nchannels > 31) {
+    show_usage(argv[0]);
+    return 0;
+  }
+
+  if (nsynth)
+    synthesize(file, nsynth, narrays, nentries, nchannels);
+
+  AmcCarrierReplay* hw;
+  try {
+    hw = new AmcCarrierReplay(file, realTime);
+  }
+  catch(std::string& e) {
+    printf("%s\n", e.c_str());
+    return -1;
+  }
+  Processor* p = Processor::create(hw);
+
+  std::vector<CountPvArray*> arrays;
+  for(unsigned i=0; i<NBSAARRAYS; i++)
+    arrays.push_back(new CountPvArray(i, nchannels));
+
+  double t0 = _seconds();
+  do {
+    uint64_t pending = p->pending();
+    for(unsigned i=0; i<NBSAARRAYS; i++)
+      if (pending & (1ULL<<i))
+        p->update(*arrays[i]);
+    if (realTime)
+      usleep(1000);
+  } while(!hw->finished());
+  double dt = _seconds() - t0;
+
+  uint64_t entries=0, appends=0, resets=0;
+  for(unsigned i=0; i<NBSAARRAYS; i++) {
+    entries += arrays[i]->entries;
+    appends += arrays[i]->appends();
+    resets  += arrays[i]->resets;
+  }
+
+  const StatusCounts& errors = p->errors();
+  printf("Replayed %llu rounds in %.3f s: %.0f rounds/s\n",
+         (unsigned long long)hw->rounds(), dt, double(hw->rounds())/dt);
+  printf("  entries  %llu (%.3g /s, %.3g MB/s)  values %llu  acquisitions %llu\n",
+         (unsigned long long)entries, double(entries)/dt,
+         double(entries*sizeof(Entry))/dt*1.e-6,
+         (unsigned long long)appends, (unsigned long long)resets);
+  printf("  DRAM misses %llu  errors %llu\n",
+         (unsigned long long)hw->misses(), (unsigned long long)errors.errors());
+  for(unsigned i=1; i<NumBsaStatus; i++)
+    if (errors[BsaStatus(i)])
+      printf("    %-24s %llu\n", statusText(BsaStatus(i)),
+             (unsigned long long)errors[BsaStatus(i)]);
+
+  //  BSA_RT=<options> runs the replay in real-time mode
+  if (BsaRealTime::enabled()) {
+    printLatency("update", BsaRealTime::updates());
+    printLatency("wakeup", BsaRealTime::wakeup());
+    printf("  page faults during updates: minor %llu  major %llu\n",
+           (unsigned long long)BsaRealTime::minorFaults(),
+           (unsigned long long)BsaRealTime::majorFaults());
+    //  With cpus= or node=, the readout buffers must be on the readout node
+    if (BsaRealTime::readoutNode() >= 0) {
+      bool local = BsaRealTime::prefaultPages() &&
+        BsaRealTime::localPages() == BsaRealTime::prefaultPages();
+      printf("  prefaulted pages on readout node %d: %llu of %llu  %s\n",
+             BsaRealTime::readoutNode(),
+             (unsigned long long)BsaRealTime::localPages(),
+             (unsigned long long)BsaRealTime::prefaultPages(),
+             local ? "passed" : "FAILED");
+      if (!local)
+        return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,177 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Benchmark of the BSAS stream decoder with generated packets
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <vector>
+
+#include <BsasStream.hh>
+
+using namespace Bsas;
+
+class CheckHandler : public BsasTableHandler {
+public:
+  CheckHandler() : tables(0), rows(0), sum(0) {}
+  void process(const BsasTable& table) {
+    tables++;
+    rows += table.rows();
+    sum  += table.mean(0)[table.rows()-1];
+  }
+public:
+  unsigned tables;
+  uint64_t rows;
+  double   sum;
+};
+
+//
+//  One packet of row i; returns its length in words
+//
+static unsigned fillPacket(uint32_t* p, unsigned i, uint32_t mask)
+{
+  uint64_t pulseId   = 910ULL*i;
+  uint64_t timestamp = 1000000ULL*i;
+  p[0] = timestamp&0xffffffff;
+  p[1] = timestamp>>32;
+  p[2] = pulseId&0xffffffff;
+  p[3] = pulseId>>32;
+  p[4] = mask;
+  p[5] = (i&0xffff) | ((i==0) ? (1<<24) : 0);
+  uint32_t* q = p+BSAS_HEADER_WORDS;
+  for(unsigned j=0; j<unsigned(__builtin_popcount(mask)); j++, q+=BSAS_CHANNEL_WORDS) {
+    q[0] = 910 | (1<<14);
+    q[1] = 910*i;
+    q[2] = 910*i*i;
+    q[3] = 0;
+    q[4] = i;
+    q[5] = i;
+  }
+  return q-p;
+}
+
+class MaskHandler : public BsasTableHandler {
+public:
+  MaskHandler() : errors(0) {}
+  void process(const BsasTable& table) {
+    for(unsigned r=0; r<table.rows(); r++) {
+      for(unsigned chn=0; chn<NUM_BSAS_CHN; chn++) {
+        if (!(table.channelMask() & (1U<<chn)))
+          continue;
+        bool present = table.rowMask()[r] & (1U<<chn);
+        bool ok = present ?
+          (table.n(chn)[r]==910 && table.mean(chn)[r]==double(r) && !table.excpt(chn)[r]) :
+          (table.n(chn)[r]==0 && isnan(table.mean(chn)[r]) && table.excpt(chn)[r]);
+        if (!ok) {
+          printf("row %u channel %u: %s but n %u mean %f excpt %u\n",
+                 r, chn, present ? "present":"absent",
+                 table.n(chn)[r], table.mean(chn)[r], table.excpt(chn)[r]);
+          errors++;
+        }
+      }
+    }
+  }
+public:
+  unsigned errors;
+};
+
+//
+//  The channel mask changes within a table; channels a row lacks must
+//  not show the values of other rows
+//
+static bool checkMaskChange()
+{
+  static const uint32_t masks[] = { 0x3, 0x5, 0x1, 0x6 };
+  std::vector<uint32_t> packet(BSAS_HEADER_WORDS+NUM_BSAS_CHN*BSAS_CHANNEL_WORDS);
+  MaskHandler handler;
+  BsasStreamReceiver receiver(handler, 16);
+  for(unsigned t=0; t<2; t++)   // the second table reuses the columns
+    for(unsigned i=0; i<16; i++) {
+      unsigned n = fillPacket(&packet[0], i, masks[(i/4+t)%4]);
+      receiver.process(reinterpret_cast<const char*>(&packet[0]), n*sizeof(uint32_t));
+    }
+  receiver.flush();
+  printf("mask change: %s\n", handler.errors ? "FAILED" : "passed");
+  return handler.errors==0;
+}
+
+static void show_usage(const char* p)
+{
+  printf("Usage: %s [options]\n",p);
+  printf("Options: -r <rows>   : rows per table (default 20000)\n");
+  printf("         -t <tables> : tables to decode (default 50)\n");
+  printf("         -m <mask>   : channel mask (default 0x7fffffff)\n");
+}
+
+int main(int argc, char* argv[])
+{
+  unsigned nrows   = 20000;
+  unsigned ntables = 50;
+  uint32_t mask    = 0x7fffffff;
+
+  int c;
+  while( (c=getopt(argc,argv,"r:t:m:h"))!=-1 ) {
+    switch(c) {
+    case 'r': nrows   = strtoul(optarg,NULL,0); break;
+    case 't': ntables = strtoul(optarg,NULL,0); break;
+    case 'm': mask    = strtoul(optarg,NULL,0); break;
+    default:
+      show_usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  if (!checkMaskChange())
+    return 1;
+
+  //  Prepare one table of packets
+  unsigned nchn = __builtin_popcount(mask);
+  unsigned pwords = BSAS_HEADER_WORDS + nchn*BSAS_CHANNEL_WORDS;
+  std::vector<uint32_t> packets(nrows*pwords);
+  for(unsigned i=0; i<nrows; i++)
+    fillPacket(&packets[i*pwords], i, mask);
+
+  CheckHandler handler;
+  BsasStreamReceiver receiver(handler, nrows);
+
+  timespec begin;
+  clock_gettime(CLOCK_MONOTONIC,&begin);
+
+  for(unsigned t=0; t<ntables; t++) {
+    for(unsigned i=0; i<nrows; i++) {
+      uint32_t* p = &packets[i*pwords];
+      p[5] = (p[5]&~(0xff<<16)) | ((t&0xff)<<16);
+      receiver.process(reinterpret_cast<const char*>(p), pwords*sizeof(uint32_t));
+    }
+  }
+  receiver.flush();
+
+  timespec end;
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  double dt = double(end.tv_sec-begin.tv_sec) +
+    1.e-9*(double(end.tv_nsec)-double(begin.tv_nsec));
+
+  printf("%u tables of %u rows x %u channels in %f sec\n", ntables, nrows, nchn, dt);
+  printf("%f Mrows/s  %f MB/s\n",
+         1.e-6*double(receiver.rows())/dt,
+         1.e-6*double(receiver.rows())*double(pwords*sizeof(uint32_t))/dt);
+  printf("tables %u  rows %llu  errors %llu  overflows %llu  missed %llu  [%f]\n",
+         handler.tables, (unsigned long long)handler.rows,
+         (unsigned long long)receiver.errors(),
+         (unsigned long long)receiver.overflows(),
+         (unsigned long long)receiver.missedRows(), handler.sum);
+
+  return 0;
+}
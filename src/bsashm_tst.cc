@@ -0,0 +1,180 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Exercise the shared memory export with a writer and a reader thread,
+//  or follow one array of an existing export (-a)
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+
+#include <ShmExport.hh>
+
+using namespace Bsa;
+
+static const char* name     = "/bsashm_tst";
+static unsigned    nrows    = 1000;
+static unsigned    nupdates = 10000;
+static unsigned    nreset   = 0;
+static volatile bool done   = false;
+
+static void show_usage(const char* p)
+{
+  printf("Usage: %s [options]\n",p);
+  printf("Options: -s <name>     : region name (default /bsashm_tst)\n");
+  printf("         -c <rows>     : ring capacity (default 16384)\n");
+  printf("         -n <rows>     : rows per update (default 1000)\n");
+  printf("         -u <updates>  : updates to write (default 10000)\n");
+  printf("         -r <updates>  : new acquisition every <updates> (default never)\n");
+  printf("         -a <array>    : follow <array> of an existing region\n");
+}
+
+//
+//  Rows are generated with consecutive pulse IDs and the raw value of
+//  channel 0 set to the row number of the acquisition
+//
+static void* writeThread(void* arg)
+{
+  ShmExport& shm = *reinterpret_cast<ShmExport*>(arg);
+
+  std::vector<Entry> entries(nrows);
+  uint64_t pid = 0, row = 0;
+  for(unsigned u=0; u<nupdates; u++) {
+    bool reset = nreset && (u%nreset)==0;
+    if (reset)
+      row = 0;
+    for(unsigned i=0; i<nrows; i++, pid++, row++) {
+      uint32_t* p = reinterpret_cast<uint32_t*>(&entries[i]);
+      p[1] = pid&0xffffffff;
+      p[2] = pid>>32;
+      ChannelData& d = entries[i].channel_data[0];
+      d.data[0] = (1<<15) | ((row&0xffff)<<16);
+      d.data[1] = row>>16;
+    }
+    shm.publish(0, u, reset, entries);
+  }
+  done = true;
+  return 0;
+}
+
+//
+//  Consume new rows in place and check them
+//
+static void follow(const ShmExportReader& rdr, unsigned array, bool lcheck)
+{
+  uint64_t rows = 0, overrun = 0, errors = 0, generation = 0;
+  uint64_t next = 0;
+
+  timespec begin;
+  clock_gettime(CLOCK_MONOTONIC,&begin);
+
+  while(1) {
+    ShmSnapshot s;
+    rdr.snapshot(array, s);
+    if (s.generation != generation) {
+      generation = s.generation;
+      next = 0;
+    }
+    if (next < s.first) {
+      overrun += s.first-next;
+      next = s.first;
+    }
+    if (next == s.rows) {
+      if (lcheck && done)
+        break;
+      usleep(100);
+      continue;
+    }
+
+    const uint64_t* pid = rdr.pulseId(array);
+    const double*   v   = rdr.mean   (array,0);
+    uint64_t err = 0;
+    for(uint64_t r=next; r<s.rows; r++) {
+      unsigned k = rdr.slot(r);
+      if (lcheck && v[k] != double(r))
+        err++;
+      else if (!lcheck && (r%100000)==0)
+        printf("[%llu] pid 0x%llx  mean %f\n",
+               (unsigned long long)r, (unsigned long long)pid[k], v[k]);
+    }
+
+    if (rdr.valid(array, s, next)) {
+      rows   += s.rows-next;
+      errors += err;
+    }
+    else
+      overrun += s.rows-next;
+    next = s.rows;
+  }
+
+  timespec end;
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  double dt = double(end.tv_sec-begin.tv_sec) +
+    1.e-9*(double(end.tv_nsec)-double(begin.tv_nsec));
+
+  printf("rows %llu  overrun %llu  errors %llu  generation %llu  in %f sec (%f Mrows/s)\n",
+         (unsigned long long)rows, (unsigned long long)overrun,
+         (unsigned long long)errors, (unsigned long long)generation,
+         dt, 1.e-6*double(rows)/dt);
+}
+
+int main(int argc, char* argv[])
+{
+  unsigned capacity = 1<<14;
+  int      array    = -1;
+
+  int c;
+  while( (c=getopt(argc,argv,"s:c:n:u:r:a:h"))!=-1 ) {
+    switch(c) {
+    case 's': name     = optarg; break;
+    case 'c': capacity = strtoul(optarg,NULL,0); break;
+    case 'n': nrows    = strtoul(optarg,NULL,0); break;
+    case 'u': nupdates = strtoul(optarg,NULL,0); break;
+    case 'r': nreset   = strtoul(optarg,NULL,0); break;
+    case 'a': array    = strtoul(optarg,NULL,0); break;
+    default:
+      show_usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  try {
+    if (array >= 0) {
+      ShmExportReader rdr(name);
+      follow(rdr, array, false);
+      return 0;
+    }
+
+    ShmExport shm(name, capacity, 1);
+    ShmExportReader rdr(name);
+    printf("%s: %zu bytes, %u rows\n", shm.name(), shm.size(), shm.capacity());
+
+    pthread_t thr;
+    if (pthread_create(&thr, 0, writeThread, &shm)) {
+      perror("Error creating write thread");
+      return -1;
+    }
+    follow(rdr, 0, true);
+    pthread_join(thr, NULL);
+  }
+  catch(std::string& e) {
+    printf("%s\n", e.c_str());
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,269 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Analyze a transaction trace written by BsaTrace (BSA_TRACE=<file>):
+//  throughput, latency percentiles per target, and the idle gaps between
+//  transactions that indicate link stalls
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <BsaTrace.hh>
+
+using namespace Bsa;
+
+static void show_usage(const char* p)
+{
+  printf("Usage: %s -f <file> [options]\n",p);
+  printf("Options: -f <file>       : trace file\n");
+  printf("         -g <us>         : report gaps longer than <us> (default 1000)\n");
+  printf("         -n <gaps>       : number of longest gaps to list (default 10)\n");
+  printf("         -i <ms>         : print the throughput in intervals of <ms>\n");
+  printf("         -T <records>    : first write a synthetic trace to <file>\n");
+}
+
+static bool by_issue(const TraceRecord& a, const TraceRecord& b)
+{
+  return a.issue < b.issue;
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& v, double p)
+{
+  if (v.empty()) return 0;
+  size_t i = size_t(p*double(v.size()-1)+0.5);
+  return v[i];
+}
+
+//
+//  DRAM blocks of 4 kB with register polls in between, and an
+//  occasional stall
+//
+static void synthesize(const char* file, unsigned nrecords)
+{
+  if (!BsaTrace::open(file, nrecords)) {
+    perror("Opening trace");
+    exit(1);
+  }
+  srand(1);
+  uint64_t t = BsaTrace::now();
+  uint64_t addr = 0;
+  for(unsigned i=0; i<nrecords; i++) {
+    uint64_t lat, gap = 500 + rand()%1000;
+    if ((i%64)==0) {
+      lat = 20000 + rand()%10000;
+      BsaTrace::record(TraceWrAddr, 0, i%48, 8, t, t+lat);
+    }
+    else {
+      lat = 40000 + rand()%20000;
+      BsaTrace::record(TraceDram, (rand()%10000)==0 ? TraceFailed : 0, addr, 4096, t, t+lat);
+      addr += 4096;
+    }
+    if ((rand()%5000)==0)
+      gap += 5000000;
+    t += lat+gap;
+  }
+  BsaTrace::close();
+}
+
+int main(int argc, char* argv[])
+{
+  extern char* optarg;
+  int c;
+  const char* file = 0;
+  uint64_t gapMin   = 1000;
+  unsigned ngaps    = 10;
+  unsigned interval = 0;
+  unsigned nsynth   = 0;
+
+  while ( (c=getopt( argc, argv, "f:g:n:i:T:h")) != EOF ) {
+    switch(c) {
+    case 'f': file     = optarg; break;
+    case 'g': gapMin   = strtoull(optarg,NULL,0); break;
+    case 'n': ngaps    = strtoul (optarg,NULL,0); break;
+    case 'i': interval = strtoul (optarg,NULL,0); break;
+    case 'T': nsynth   = strtoul (optarg,NULL,0); break;
+    default:
+      show_usage(argv[0]);
+      return 0;
+    }
+  }
+
+  if (!file) {
+    show_usage(argv[0]);
+    return 0;
+  }
+
+  if (nsynth)
+    synthesize(file, nsynth);
+
+  int fd = open(file, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror("Opening trace");
+    return -1;
+  }
+  if (size_t(st.st_size) < sizeof(TraceHeader)) {
+    printf("%s is not a trace\n", file);
+    return -1;
+  }
+  void* p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    perror("Mapping trace");
+    return -1;
+  }
+
+  const TraceHeader* h = reinterpret_cast<const TraceHeader*>(p);
+  if (memcmp(h->magic, "BSAT", 4) || h->version != 2 ||
+      h->recordSize != sizeof(TraceRecord) ||
+      size_t(st.st_size) < sizeof(TraceHeader)+size_t(h->capacity)*sizeof(TraceRecord)) {
+    printf("%s is not a trace of this version\n", file);
+    return -1;
+  }
+
+  //
+  //  Copy out the records still in the ring, oldest first
+  //
+  const TraceRecord* ring = reinterpret_cast<const TraceRecord*>(h+1);
+  uint64_t head  = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+  uint64_t first = head > h->capacity ? head-h->capacity : 0;
+  uint64_t torn  = 0;
+  std::vector<TraceRecord> recs;
+  recs.reserve(head-first);
+  for(uint64_t i=first; i<head; i++) {
+    const TraceRecord& r = ring[i&(h->capacity-1)];
+    if (__atomic_load_n(&r.seq, __ATOMIC_ACQUIRE) != i+1) {
+      torn++;
+      continue;
+    }
+    TraceRecord c;
+    memcpy(&c, &r, sizeof(c));
+    //  Overwritten while copied
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&r.seq, __ATOMIC_RELAXED) != i+1) {
+      torn++;
+      continue;
+    }
+    recs.push_back(c);
+  }
+  std::sort(recs.begin(), recs.end(), by_issue);
+
+  printf("%s: %llu transactions recorded, %llu overwritten, %llu incomplete\n",
+         file, (unsigned long long)head, (unsigned long long)first, (unsigned long long)torn);
+  if (recs.empty())
+    return 0;
+
+  uint64_t t0 = recs.front().issue, t1 = 0;
+  for(unsigned i=0; i<recs.size(); i++)
+    if (recs[i].complete > t1)
+      t1 = recs[i].complete;
+  double span = 1.e-9*double(t1-t0);
+
+  time_t start = (h->realtime + (t0 - h->monotonic))/1000000000ULL;
+  char tbuf[64];
+  strftime(tbuf, sizeof(tbuf), "%F %T", localtime(&start));
+  printf("start %s  span %.3f s\n\n", tbuf, span);
+
+  //
+  //  Per target
+  //
+  printf("%-10s %10s %12s %9s %8s %9s %9s %9s %9s %9s %9s\n",
+         "target", "count", "bytes", "MB/s", "failed",
+         "mean us", "p50", "p90", "p99", "p99.9", "max");
+  for(unsigned t=0; t<=NumTraceTargets; t++) {
+    std::vector<uint64_t> lat;
+    uint64_t bytes = 0, failed = 0;
+    for(unsigned i=0; i<recs.size(); i++) {
+      const TraceRecord& r = recs[i];
+      if (t < NumTraceTargets && r.target != t)
+        continue;
+      lat.push_back(r.complete - r.issue);
+      bytes += r.size;
+      if (r.flags & TraceFailed)
+        failed++;
+    }
+    if (lat.empty())
+      continue;
+    std::sort(lat.begin(), lat.end());
+    uint64_t sum = 0;
+    for(unsigned i=0; i<lat.size(); i++)
+      sum += lat[i];
+    printf("%-10s %10zu %12llu %9.2f %8llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+           t < NumTraceTargets ? BsaTrace::name(t) : "all",
+           lat.size(), (unsigned long long)bytes,
+           1.e-6*double(bytes)/span, (unsigned long long)failed,
+           1.e-3*double(sum)/double(lat.size()),
+           1.e-3*double(percentile(lat,0.5)),
+           1.e-3*double(percentile(lat,0.9)),
+           1.e-3*double(percentile(lat,0.99)),
+           1.e-3*double(percentile(lat,0.999)),
+           1.e-3*double(lat.back()));
+  }
+
+  //
+  //  Idle gaps: no transaction outstanding between the completion of the
+  //  ones before and the issue of the next
+  //
+  std::vector<uint64_t> gaps;
+  std::vector< std::pair<uint64_t,uint64_t> > longest;  // (gap, start)
+  uint64_t busy = recs[0].complete, idle = 0;
+  for(unsigned i=1; i<recs.size(); i++) {
+    const TraceRecord& r = recs[i];
+    if (r.issue > busy) {
+      uint64_t g = r.issue - busy;
+      gaps.push_back(g);
+      idle += g;
+      if (g >= gapMin*1000)
+        longest.push_back(std::make_pair(g, busy));
+    }
+    if (r.complete > busy)
+      busy = r.complete;
+  }
+  std::sort(gaps.begin(), gaps.end());
+  printf("\nidle %.3f s (%.1f%%) in %zu gaps:  p50 %.1f us  p99 %.1f us  max %.1f us\n",
+         1.e-9*double(idle), 100.*1.e-9*double(idle)/span, gaps.size(),
+         1.e-3*double(percentile(gaps,0.5)),
+         1.e-3*double(percentile(gaps,0.99)),
+         gaps.empty() ? 0. : 1.e-3*double(gaps.back()));
+
+  std::sort(longest.begin(), longest.end());
+  std::reverse(longest.begin(), longest.end());
+  printf("%zu gaps over %llu us\n", longest.size(), (unsigned long long)gapMin);
+  for(unsigned i=0; i<longest.size() && i<ngaps; i++)
+    printf("  %10.1f us  at %.6f s\n",
+           1.e-3*double(longest[i].first),
+           1.e-9*double(longest[i].second - t0));
+
+  //
+  //  Throughput timeline
+  //
+  if (interval) {
+    uint64_t dt = uint64_t(interval)*1000000ULL;
+    std::vector<uint64_t> bytes((t1-t0)/dt+1, 0);
+    for(unsigned i=0; i<recs.size(); i++)
+      bytes[(recs[i].complete-t0)/dt] += recs[i].size;
+    printf("\n%10s %9s\n", "time s", "MB/s");
+    for(unsigned i=0; i<bytes.size(); i++)
+      printf("%10.3f %9.2f\n", 1.e-9*double(i*dt), 1.e-6*double(bytes[i])*1.e9/double(dt));
+  }
+
+  munmap(p, st.st_size);
+  return 0;
+}
@@ -7,35 +7,37 @@
 // may be copied, modified, propagated, or distributed except according to 
 // the terms contained in the LICENSE.txt file.
 //////////////////////////////////////////////////////////////////////////////
+//
+//  Benchmark of the host BSA engine against the scalar prototype
+//
 #include <unistd.h>
 #include <stdio.h>
 #include <time.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <math.h>
 
-class NetRecord {
-public:
-  uint64_t pulseId;
-  uint64_t timestamp;
-  uint64_t init;
-  uint64_t acquire;
-  uint64_t avgdone;
-  uint64_t update;
-  uint32_t channel[31];
-};
+#include <vector>
+
+#include <SoftBsa.hh>
 
+using namespace Bsa;
+
+//
+//  The scalar prototype, kept as the reference
+//
 class NetBsaChannel {
 public:
   unsigned n;
   double sum;
   double sqsum;
   unsigned m;
-  unsigned nacq[1<<15];
-  double mean[1<<15], rms2[1<<15];
+  unsigned nacq;
+  double mean, rms2;
 public:
   void init() { n=0; sum=0; sqsum=0; m=0; }
-  void acquire(unsigned v) { n++; sum+=double(v); sqsum+=(double(v)*double(v)); }
+  void acquire(int v) { n++; sum+=double(v); sqsum+=(double(v)*double(v)); }
   void avgdone() {
     double mn=0, r2=0;
     if (n) {
@@ -43,9 +45,9 @@ public:
       if (n>1) 
         r2 = (sqsum - sum*mn)/double(n-1);
     }
-    nacq[m] = n;
-    mean[m] = mn;
-    rms2[m] = r2;
+    nacq = n;
+    mean = mn;
+    rms2 = r2;
     m++;
     n=0; sum=0; sqsum=0;
   }
@@ -56,25 +58,100 @@ public:
   NetBsaChannel channel[31];
 public:
   void init() { for(unsigned i=0; i<31; i++) channel[i].init(); }
-  void acquire(const uint32_t* ch, bool avgdone) {
-    //    printf("ch[0] %u\n",ch[0]);
-    for(unsigned i=0; i<31; i++) {
-      channel[i].acquire(ch[i]);
-      if (avgdone) channel[i].avgdone();
+  void acquire(const uint32_t* ch) {
+    for(unsigned i=0; i<31; i++)
+      channel[i].acquire(int32_t(ch[i]));
+  }
+  void avgdone() {
+    for(unsigned i=0; i<31; i++)
+      channel[i].avgdone();
+  }
+};
+
+static void reference(NetBsa* bsa, const NetRecord& r)
+{
+  for(unsigned j=0; j<64; j++) {
+    if (r.init & (1ULL<<j))
+      bsa[j].init();
+    else if (r.acquire & (1ULL<<j)) 
+      bsa[j].acquire(r.channel);
+    if (r.avgdone & (1ULL<<j))
+      bsa[j].avgdone();
+  }
+}
+
+//
+//  Compares each entry with the reference as it completes
+//
+class CheckHandler : public SoftBsaHandler {
+public:
+  CheckHandler(const NetBsa* bsa) : _bsa(bsa), entries(0), errors(0) {}
+  void process(const Record& record) {
+    if (!_bsa)
+      return;
+    const NetBsa& ref = _bsa[record.buffer];
+    for(unsigned k=0; k<record.entries.size(); k++, entries++) {
+      const Entry& e = record.entries[k];
+      for(unsigned i=0; i<31; i++) {
+        const ChannelData&   d = e.channel_data[i];
+        const NetBsaChannel& c = ref.channel[i];
+        if (d.n() != c.nacq ||
+            (d.n()   && fabs(d.mean()-c.mean) > 1.e-9*fabs(c.mean)) ||
+            (d.n()>1 && fabs(d.rms2()-c.rms2) > 1.e-6*fabs(c.rms2)+1.e-9)) {
+          if (errors++ < 10)
+            printf("edef %u  pid %llu  ch %u: n %u/%u  mean %f/%f  rms2 %f/%f\n",
+                   record.buffer, (unsigned long long)e.pulseId(), i,
+                   d.n(), c.nacq, d.mean(), c.mean, d.rms2(), c.rms2);
+        }
+      }
     }
   }
+private:
+  const NetBsa* _bsa;
+public:
+  uint64_t entries;
+  uint64_t errors;
 };
 
+static void show_usage(const char* p)
+{
+  printf("Usage: %s [options]\n",p);
+  printf("Options: -n <records> : records to process (default 1M)\n");
+  printf("         -v <records> : records checked against the reference (default 64k)\n");
+  printf("         -e <mask>    : EDEFs acquiring (default all)\n");
+}
+
+static double seconds(const timespec& begin, const timespec& end)
+{
+  return double(end.tv_sec-begin.tv_sec) +
+    1.e-9*(double(end.tv_nsec)-double(begin.tv_nsec));
+}
+
 int main(int argc, char* argv[])
 {
-  NetBsa* bsa = new NetBsa[64];
+  unsigned nrecords = 1<<20;
+  unsigned nverify  = 1<<16;
+  uint64_t edefs    = -1ULL;
+
+  int c;
+  while( (c=getopt(argc,argv,"n:v:e:h"))!=-1 ) {
+    switch(c) {
+    case 'n': nrecords = strtoul (optarg,NULL,0); break;
+    case 'v': nverify  = strtoul (optarg,NULL,0); break;
+    case 'e': edefs    = strtoull(optarg,NULL,0); break;
+    default:
+      show_usage(argv[0]);
+      exit(1);
+    }
+  }
+  if (nverify > nrecords)
+    nverify = nrecords;
 
   //  Prepare inputs
-  unsigned nrecords = 1<<20;
   uint64_t pulseId   = 0;
   uint64_t timestamp = 0;
 
-  NetRecord* buff = new NetRecord[nrecords];
+  std::vector<NetRecord> buff(nrecords);
   buff[0].pulseId   = pulseId++;
   buff[0].timestamp = timestamp;
   buff[0].init      = -1ULL;
@@ -91,36 +168,50 @@ int main(int argc, char* argv[])
     uint64_t m = i^(i-1);
     if (m&0x10)
       m |= 0xFFFFFFFFFFFF0;
-    buff[i].acquire   = m;
-    buff[i].avgdone   = (i&0x1f)==0x1f ? -1ULL : 0;
-    buff[i].update    = 0;
+    buff[i].acquire   = m & edefs;
+    buff[i].avgdone   = (i&0x1f)==0x1f ? edefs : 0;
+    buff[i].update    = (i&0x3ff)==0x3ff ? edefs : 0;
     for(unsigned j=0; j<31; j++)
-      buff[i].channel[j] = i;
+      buff[i].channel[j] = uint32_t(int32_t(i%4001) - 2000) * (j+1);
   }
 
-  timespec begin;
-  clock_gettime(CLOCK_REALTIME,&begin);
-
-  for(unsigned i=0; i<nrecords; i++) {
-    for(unsigned j=0; j<64; j++) {
-      if (buff[i].init & (1ULL<<j))
-        bsa[j].init();
-      else if (buff[i].acquire & (1ULL<<j)) 
-        bsa[j].acquire(buff[i].channel, buff[i].avgdone & (1ULL<<j));
+  //  Check the engine entry by entry
+  NetBsa* bsa = new NetBsa[64];
+  {
+    CheckHandler handler(bsa);
+    SoftBsa      engine(handler, 1);
+    for(unsigned i=0; i<nverify; i++) {
+      reference(bsa, buff[i]);
+      engine.process(buff[i]);
     }
+    printf("verified %llu entries over %u records: %llu errors\n",
+           (unsigned long long)handler.entries, nverify,
+           (unsigned long long)handler.errors);
   }
 
-  timespec end;
-  clock_gettime(CLOCK_REALTIME,&end);
-  double dt = double(end.tv_sec-begin.tv_sec) +
-    1.e-9*(double(end.tv_nsec)-double(begin.tv_nsec));
-  printf("%f sec\n",dt);
+  timespec begin, end;
+
+  clock_gettime(CLOCK_MONOTONIC,&begin);
+  for(unsigned i=0; i<nrecords; i++)
+    reference(bsa, buff[i]);
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  double dtr = seconds(begin,end);
+
+  CheckHandler handler(0);
+  SoftBsa      engine(handler);
+  clock_gettime(CLOCK_MONOTONIC,&begin);
+  engine.process(buff.data(), nrecords);
+  engine.flush();
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  double dte = seconds(begin,end);
 
-  printf("idx %u  n %u  avg %f  rms2 %f\n", 
-         bsa[0].channel[0].m, 
-         bsa[0].channel[0].nacq[0], 
-         bsa[0].channel[0].mean[0], 
-         bsa[0].channel[0].rms2[0]);
+  printf("%u records  %llu acquisitions  %llu entries\n", nrecords,
+         (unsigned long long)engine.acquisitions(),
+         (unsigned long long)engine.entries());
+  printf("reference: %f sec  %7.3f Mrecords/s per core\n", dtr, 1.e-6*double(nrecords)/dtr);
+  printf("engine   : %f sec  %7.3f Mrecords/s per core  %7.3f Macquisitions/s\n", dte,
+         1.e-6*double(nrecords)/dte, 1.e-6*double(engine.acquisitions())/dte);
         
-  return 1;
+  delete[] bsa;
+  return 0;
 }
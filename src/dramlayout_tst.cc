@@ -0,0 +1,97 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+//
+//  DramLayout test: the standard layout, the alignment of planned arrays,
+//  array ranges and rates, and the specs that are rejected
+//
+#include <stdio.h>
+#include <stdint.h>
+
+#include <DramLayout.hh>
+
+using namespace Bsa;
+
+static unsigned failures = 0;
+
+static void check(bool ok, const char* what)
+{
+  printf("%-52s %s\n", what, ok ? "passed" : "FAILED");
+  if (!ok)
+    failures++;
+}
+
+//  Arrays placed back to back on 4 kB boundaries
+static bool placed(const DramLayout& l, uint64_t base)
+{
+  uint64_t p = base;
+  for(unsigned i=0; i<HSTARRAYN; i++) {
+    if (l.begin(i) != p || (l.begin(i) % DramLayout::Alignment) ||
+        (l.end(i) % DramLayout::Alignment) || l.end(i) <= l.begin(i))
+      return false;
+    p = l.end(i);
+  }
+  return l.memEnd() == p;
+}
+
+int main()
+{
+  {
+    //  The addresses AmcCarrierBase::initialize programmed before plans
+    const uint64_t entry = 3ULL<<7;
+    DramLayout l;
+    bool ok = sizeof(Entry) == entry;
+    for(unsigned i=0; i<NBSAARRAYS; i++)
+      ok &= l.begin(i) == i*(1ULL<<15)*entry && l.end(i) == (i+1)*(1ULL<<15)*entry;
+    uint64_t fault0 = NBSAARRAYS*(1ULL<<15)*entry;
+    for(unsigned i=HSTARRAY0; i<HSTARRAYN; i++)
+      ok &= l.begin(i) == fault0 + (i-HSTARRAY0)*(1ULL<<20)*entry &&
+        l.end(i) == fault0 + (i-HSTARRAY0+1)*(1ULL<<20)*entry;
+    check(ok && l.memEnd() == fault0 + (HSTARRAYN-HSTARRAY0)*(1ULL<<20)*entry,
+          "the standard layout has the old addresses");
+  }
+  {
+    DramLayout l;
+    bool ok = l.configure("0=1,1=33,2=100hz,hold=0.37") && l.plan(100);
+    check(ok && placed(l, DramLayout::Alignment) &&
+          l.entries(0) == 32 && l.entries(1) == 64 && l.entries(2) == 64,
+          "arrays are rounded up to 4 kB boundaries");
+  }
+  {
+    DramLayout l;
+    bool ok = l.configure("0-3=65536,4=120hz,44-47=2048,hold=2") && l.plan();
+    check(ok && placed(l, 0) &&
+          l.entries(0) == 65536 && l.entries(3) == 65536 &&
+          l.entries(4) == 256   && l.entries(5) == DramLayout::BsaEntries &&
+          l.entries(44) == 2048 && l.entries(47) == 2048,
+          "ranges and rates size their arrays");
+  }
+  {
+    DramLayout l;
+    l.configure("0=1000000000");
+    check(!l.plan(0, 1ULL<<33) && l.plan(0, 1ULL<<40) && l.plan(),
+          "a plan beyond the capacity fails");
+  }
+  {
+    const char* bad[] = { "hold=abc", "hold=-1", "hold=", "hold=1x",
+                          "0=abc", "0=-5", "0=", "0=10khz", "0=1e20",
+                          "48=10", "3-1=10", "x=1", "0", "0-=1" };
+    unsigned accepted = 0;
+    for(unsigned i=0; i<sizeof(bad)/sizeof(bad[0]); i++) {
+      DramLayout l;
+      if (l.configure(bad[i])) {
+        printf("  accepted %s\n", bad[i]);
+        accepted++;
+      }
+    }
+    check(accepted == 0, "malformed specs are rejected");
+  }
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,117 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+//
+//  EntryScanner test: entries after a pulse ID reset or a long gap are
+//  kept, corrupted entries are not
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include <EntryScanner.hh>
+
+using namespace Bsa;
+
+static const unsigned NCH = 4;
+
+static unsigned failures = 0;
+
+static void check(bool ok, const char* what)
+{
+  printf("%-52s %s\n", what, ok ? "passed" : "FAILED");
+  if (!ok)
+    failures++;
+}
+
+static void setEntry(Entry& e, uint64_t pid, unsigned nch=NCH)
+{
+  uint32_t* p = reinterpret_cast<uint32_t*>(&e);
+  memset(&e, 0, sizeof(e));
+  p[0] = nch<<16;
+  p[1] = uint32_t(pid);
+  p[2] = uint32_t(pid>>32);
+}
+
+//
+//  Scan one fetch of the given pulse IDs; returns the entries kept
+//
+static unsigned fetch(EntryScanner& s, const std::vector<uint64_t>& pids)
+{
+  Record record(pids.size());
+  record.entries.resize(pids.size());
+  for(unsigned i=0; i<pids.size(); i++)
+    setEntry(record.entries[i], pids[i]);
+  s.scan(record);
+  return record.entries.size();
+}
+
+static std::vector<uint64_t> range(uint64_t first, unsigned n)
+{
+  std::vector<uint64_t> v;
+  for(unsigned i=0; i<n; i++)
+    v.push_back(first+i);
+  return v;
+}
+
+int main()
+{
+  {
+    EntryScanner s;
+    fetch(s, range(1000, 10));
+    //  The timing system restarts its pulse IDs in the middle of a fetch
+    std::vector<uint64_t> v = range(1010, 5), w = range(5, 5);
+    v.insert(v.end(), w.begin(), w.end());
+    unsigned kept = fetch(s, v);
+    check(kept == 10 && s.dropped() == 0 && s.resyncs() == 1,
+          "pulse ID reset within a fetch is re-anchored");
+    check(fetch(s, range(10, 10)) == 10 && s.dropped() == 0,
+          "fetches after the reset are kept");
+  }
+  {
+    EntryScanner s;
+    fetch(s, range(1000, 10));
+    //  The array does not acquire for longer than the largest gap
+    uint64_t pid = 1009 + EntryScanner::MaxGap + 1000;
+    check(fetch(s, range(pid, 10)) == 10 && s.dropped() == 0 && s.resyncs() == 1,
+          "gap longer than MaxGap is re-anchored");
+    check(fetch(s, range(pid+10, 10)) == 10 && s.dropped() == 0,
+          "fetches after the gap are kept");
+  }
+  {
+    EntryScanner s;
+    fetch(s, range(1000, 10));
+    //  One entry per fetch after the reset: the first is dropped, the
+    //  second confirms it
+    unsigned k0 = fetch(s, range(5, 1));
+    unsigned k1 = fetch(s, range(6, 1));
+    unsigned k2 = fetch(s, range(7, 1));
+    check(k0 == 0 && k1 == 1 && k2 == 1 && s.dropped() == 1,
+          "reset across single-entry fetches is re-anchored");
+  }
+  {
+    EntryScanner s;
+    fetch(s, range(1000, 10));
+    //  A corrupted pulse ID is dropped without moving the anchor
+    std::vector<uint64_t> v = range(1010, 10);
+    v[4] = 1ULL<<40;
+    unsigned kept = fetch(s, v);
+    check(kept == 9 && s.dropped() == 1 && fetch(s, range(1020, 10)) == 10,
+          "a corrupted pulse ID is dropped");
+    v = range(1030, 10);
+    v[9] = 5;
+    kept = fetch(s, v);
+    check(kept == 9 && s.dropped() == 2 && fetch(s, range(1040, 10)) == 10,
+          "a corrupted pulse ID ending a fetch is dropped");
+  }
+
+  return failures ? 1 : 0;
+}
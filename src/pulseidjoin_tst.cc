@@ -0,0 +1,151 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Pulse ID join test: two arrays with interleaved pulse IDs, updated
+//  through the join taps as the Processor would
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include <PulseIdJoin.hh>
+
+using namespace Bsa;
+
+//
+//  The end of the join taps; counts what reaches it
+//
+class CountPv : public Pv {
+public:
+  CountPv() : n(0) {}
+  void setTimestamp(unsigned, unsigned) {}
+  void clear() {}
+  void append(unsigned, double, double) { n++; }
+  void flush() {}
+public:
+  unsigned n;
+};
+
+class CountPvArray : public PvArray {
+public:
+  CountPvArray(unsigned array, unsigned npvs) : _array(array), entries(0)
+  { for(unsigned i=0; i<npvs; i++) _pvs.push_back(&_cpvs[i]); }
+  unsigned array() const { return _array; }
+  void reset(uint32_t, uint32_t) {}
+  void set  (uint32_t, uint32_t) {}
+  void append(uint64_t) { entries++; }
+  std::vector<Pv*> pvs() { return _pvs; }
+public:
+  unsigned         _array;
+  CountPv          _cpvs[31];
+  std::vector<Pv*> _pvs;
+  unsigned         entries;
+};
+
+//
+//  Checks that each row has the means its pulse ID was given
+//
+class CheckHandler : public JoinHandler {
+public:
+  CheckHandler() : rows(0), errors(0), last(0) {}
+  void process(const JoinedColumns& c) {
+    for(unsigned r=0; r<c.rows(); r++) {
+      uint64_t pid = c.pulseId()[r];
+      bool ok = pid > last && (pid%6)==0 &&
+        c.mean(0,0)[r] == double(pid)   && c.mean(0,1)[r] == double(pid)+0.5 &&
+        c.mean(1,0)[r] == -double(pid);
+      if (!ok) {
+        if (errors < 10)
+          printf("row %u pulse ID %llu: means %f %f %f\n", r, (unsigned long long)pid,
+                 c.mean(0,0)[r], c.mean(0,1)[r], c.mean(1,0)[r]);
+        errors++;
+      }
+      last = pid;
+    }
+    rows += c.rows();
+  }
+public:
+  unsigned rows;
+  unsigned errors;
+  uint64_t last;
+};
+
+//
+//  Append the entries of one update, as ProcessorImpl::update does
+//
+static void update(PvArray& a, uint64_t first, uint64_t last, uint64_t step, double sign)
+{
+  std::vector<Pv*> pvs = a.pvs();
+  for(uint64_t pid=first; pid<last; pid+=step) {
+    a.append(pid);
+    for(unsigned j=0; j<pvs.size(); j++)
+      pvs[j]->append(1, sign*double(pid) + (j==2 ? 0.5 : 0), 0);
+  }
+}
+
+static unsigned failures = 0;
+
+static void check(bool ok, const char* what)
+{
+  printf("%-48s %s\n", what, ok ? "passed" : "FAILED");
+  if (!ok)
+    failures++;
+}
+
+int main()
+{
+  CheckHandler handler;
+  PulseIdJoin  join(handler);
+
+  //  Array 0 acquires every 2nd pulse, array 1 every 3rd;
+  //  rows are joined on every 6th
+  CountPvArray a0(0, 4), a1(1, 2);
+  std::vector<unsigned> c0, c1;
+  c0.push_back(0);
+  c0.push_back(2);
+  c1.push_back(1);
+  PvArray& t0 = join.add(0, c0, &a0);
+  PvArray& t1 = join.add(1, c1, &a1);
+
+  //  Updates of the two arrays interleave and cover different ranges;
+  //  rows are joined as both arrays reach them
+  const uint64_t span = 600;
+  unsigned joined = 0;
+  for(uint64_t base=0; base<10*span; base+=span) {
+    update(t0, base+2, base+span+2, 2, 1);
+    joined += join.process();
+    update(t1, base+3, base+span/2+3, 3, -1);
+    joined += join.process();
+    update(t1, base+span/2+3, base+span+3, 3, -1);
+    joined += join.process();
+  }
+  check(joined == 10*span/6 && handler.rows == joined, "every 6th pulse ID is joined once");
+  check(handler.errors == 0, "joined rows have the means of their pulse ID");
+  check(a0.entries == 10*span/2 && a0._cpvs[3].n == a0.entries &&
+        a1.entries == 10*span/3 && a1._cpvs[1].n == a1.entries,
+        "updates are forwarded to every PV");
+  check(join.unmatched(0) == 10*span/2 - joined && join.unmatched(1) == 10*span/3 - joined,
+        "entries of other pulse IDs are unmatched");
+
+  bool refused = false;
+  try {
+    std::vector<unsigned> bad(1, 31);
+    join.add(2, bad);
+  }
+  catch(std::string&) {
+    refused = true;
+  }
+  check(refused, "a channel beyond the entry is refused");
+
+  return failures ? 1 : 0;
+}
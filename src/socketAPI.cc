@@ -20,7 +20,11 @@
 #include <netdb.h>
 #include <sys/uio.h>
 #include <net/if.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <string>
+#include <vector>
 #include <sstream>
 
 #include "socketAPI.h"
@@ -101,7 +105,71 @@ int socketAPISendRawData(void* pVoidsocketAPI, int iSizeData, char* pData)
     return psocketAPI->sendRawData(iSizeData, pData);
 }
 
+/**
+ * Publisher functions
+ */
+int socketAPIPublisherInit(unsigned int uMaxDataSize, unsigned char ucTTL,
+    unsigned int uInterfaceIp, unsigned int uQueueDepth, void** ppVoidsocketAPI)
+{
+    if ( ppVoidsocketAPI == NULL )
+        return 1;
+
+    SocketAPISpace::socketAPIInterface* psocketAPI =
+      SocketAPISpace::socketAPIFactory::createsocketAPIPublisher(uMaxDataSize,
+      ucTTL, uInterfaceIp, uQueueDepth);
+
+    *ppVoidsocketAPI = reinterpret_cast<void*>(psocketAPI);
+
+    return 0;
+}
+
+static SocketAPISpace::socketAPIPublisherInterface* toPublisher(void* pVoidsocketAPI)
+{
+    if ( pVoidsocketAPI == NULL )
+        return NULL;
+
+    return dynamic_cast<SocketAPISpace::socketAPIPublisherInterface*>(
+      reinterpret_cast<SocketAPISpace::socketAPIInterface*>(pVoidsocketAPI));
+}
+
+int socketAPIPublisherAddDestination(void* pVoidsocketAPI, unsigned int uAddr,
+    unsigned short uPort)
+{
+    SocketAPISpace::socketAPIPublisherInterface* pPublisher = toPublisher(pVoidsocketAPI);
+    if ( pPublisher == NULL )
+        return -1;
+
+    return pPublisher->addDestination(uAddr, uPort);
+}
+
+int socketAPIPublisherRemoveDestination(void* pVoidsocketAPI, int iDestination)
+{
+    SocketAPISpace::socketAPIPublisherInterface* pPublisher = toPublisher(pVoidsocketAPI);
+    if ( pPublisher == NULL )
+        return -1;
+
+    return pPublisher->removeDestination(iDestination);
+}
+
+int socketAPIPublisherGetCounters(void* pVoidsocketAPI, int iDestination,
+    socketAPIDestCounters* pCounters)
+{
+    SocketAPISpace::socketAPIPublisherInterface* pPublisher = toPublisher(pVoidsocketAPI);
+    if ( pPublisher == NULL || pCounters == NULL )
+        return -1;
+
+    return pPublisher->getCounters(iDestination, pCounters);
+}
+
+int socketAPIPublisherSetPacing(void* pVoidsocketAPI, int iDestination,
+    unsigned int uBytesPerSec, unsigned int uBurstBytes)
+{
+    SocketAPISpace::socketAPIPublisherInterface* pPublisher = toPublisher(pVoidsocketAPI);
+    if ( pPublisher == NULL )
+        return -1;
 
+    return pPublisher->setPacing(iDestination, uBytesPerSec, uBurstBytes);
+}
 
 } // extern "C" 
 
@@ -129,21 +197,97 @@ public:
     virtual int setPort(unsigned short uPort);
     virtual int setAddr(unsigned int uAddr);
     virtual int sendRawData(int iSizeData, const char* pData);
+    /// send without logging; returns 0 or the errno code
+    int sendQuiet(int iSizeData, const char* pData);
+    /// 0 if the socket was set up, otherwise the _init() error code
+    int initError() const { return _iInitError; }
     
     // debug information control
     virtual void setDebugLevel(int iDebugLevel);
     virtual int getDebugLevel();
     
+    static std::string addressToStr( unsigned int uAddr );      
+
 private:
     unsigned int _uAddr;
     unsigned short _uPort;
     int _iSocket;
     int _iDebugLevel;
+    int _iInitError;
     
     int _init( unsigned int uMaxDataSize, unsigned char ucTTL, 
       unsigned int uInterfaceIp);   
-      
-    static std::string addressToStr( unsigned int uAddr );      
+};
+
+/**
+ * A publisher to several destinations
+ *
+ * Each destination has a single producer / single consumer ring of
+ * packet slots: sendRawData() is the producer and never blocks, the
+ * destination's send thread is the consumer.  The semaphore only wakes
+ * the send thread.
+ *
+ * A paced destination's send thread holds each packet until its token
+ * bucket (refilled at the configured rate, up to the burst size) covers
+ * the packet, waiting on a condition variable until an absolute
+ * CLOCK_MONOTONIC deadline, so that removing the destination does not
+ * wait out the pacing interval.
+ */
+class socketAPIPublisher : public socketAPIPublisherInterface
+{
+public:
+    socketAPIPublisher(unsigned int uMaxDataSize, unsigned char ucTTL,
+      unsigned int uInterfaceIp, unsigned int uQueueDepth);
+    virtual ~socketAPIPublisher();
+    virtual int sendRawData(int iSizeData, const char* pData);
+    virtual int addDestination(unsigned int uAddr, unsigned short uPort);
+    virtual int removeDestination(int iDestination);
+    virtual int getCounters(int iDestination, socketAPIDestCounters* pCounters);
+    virtual int setPacing(int iDestination, unsigned int uBytesPerSec,
+      unsigned int uBurstBytes);
+
+    // debug information control
+    virtual void setDebugLevel(int iDebugLevel);
+    virtual int getDebugLevel();
+
+private:
+    class Destination
+    {
+    public:
+        Destination(unsigned int uAddr, unsigned short uPort, unsigned int uMaxDataSize,
+          unsigned char ucTTL, unsigned int uInterfaceIp, unsigned int uQueueDepth);
+        ~Destination();
+        bool push(int iSizeData, const char* pData);
+        bool pace(int iSizeData);
+        static void* sendThread(void* pArg);
+
+        socketAPISlim      _socket;
+        unsigned int       _uMaxDataSize;
+        unsigned int       _uQueueDepth;
+        std::vector<char>  _vcSlots;
+        std::vector<int>   _viSizes;
+        std::vector<unsigned long long> _vuQueued;  /// enqueue time (ns)
+        unsigned int       _uHead;       /// written by the producer
+        unsigned int       _uTail;       /// written by the send thread
+        sem_t              _sem;
+        pthread_mutex_t    _mutex;       /// with _cond, the pacing wait
+        pthread_cond_t     _cond;
+        bool               _bStop;
+        pthread_t          _thread;
+        socketAPIDestCounters _counters;
+        unsigned int       _uBytesPerSec;  /// token bucket, 0 when not paced
+        unsigned int       _uBurstBytes;
+        double             _dTokens;
+        unsigned long long _uRefill;       /// time of the last refill (ns)
+    };
+
+    unsigned int  _uMaxDataSize;
+    unsigned char _ucTTL;
+    unsigned int  _uInterfaceIp;
+    unsigned int  _uQueueDepth;
+    int           _iDebugLevel;
+    pthread_mutex_t           _mutex;  /// guards the destination table against add/remove
+    std::vector<Destination*> _vDestinations;
 };
 
 } // namespace SocketAPISpace
@@ -170,25 +314,34 @@ socketAPIInterface* socketAPIFactory::createsocketAPI(unsigned int uAddr,
     return new socketAPISlim(uAddr, uPort, uMaxDataSize, ucTTL, uInterfaceIp );
 }
 
+socketAPIPublisherInterface* socketAPIFactory::createsocketAPIPublisher(
+  unsigned int uMaxDataSize, unsigned char ucTTL, unsigned int uInterfaceIp,
+  unsigned int uQueueDepth)
+{
+    return new socketAPIPublisher(uMaxDataSize, ucTTL, uInterfaceIp, uQueueDepth );
+}
+
 /**
  * class socketAPISlim
  */
 socketAPISlim::socketAPISlim(unsigned int uAddr, unsigned short uPort, 
   unsigned int uMaxDataSize, unsigned char ucTTL, const char* sInterfaceIp) : 
-  _uAddr(uAddr), _uPort(uPort), _iSocket(-1), _iDebugLevel(0)
+  _uAddr(uAddr), _uPort(uPort), _iSocket(-1), _iDebugLevel(0),
+  _iInitError(0)
 {
     unsigned int uInterfaceIp = ( 
       (sInterfaceIp == NULL || sInterfaceIp[0] == 0)?
       0 : ntohl(inet_addr(sInterfaceIp)) );
     
-    _init(uMaxDataSize, ucTTL, uInterfaceIp);   
+    _iInitError = _init(uMaxDataSize, ucTTL, uInterfaceIp);   
 }
 
 socketAPISlim::socketAPISlim(unsigned int uAddr, unsigned short uPort, 
   unsigned int uMaxDataSize, unsigned char ucTTL, unsigned int uInterfaceIp) : 
-  _uAddr(uAddr), _uPort(uPort), _iSocket(-1), _iDebugLevel(0)
+  _uAddr(uAddr), _uPort(uPort), _iSocket(-1), _iDebugLevel(0),
+  _iInitError(0)
 {   
-    _init(uMaxDataSize, ucTTL, uInterfaceIp);
+    _iInitError = _init(uMaxDataSize, ucTTL, uInterfaceIp);
 }
 
 int socketAPISlim::_init( unsigned int uMaxDataSize, unsigned char ucTTL, 
@@ -320,6 +473,20 @@ int socketAPISlim::setAddr(unsigned int uAddr)
 }
 
 
+int socketAPISlim::sendQuiet(int iSizeData, const char* pData)
+{
+    sockaddr_in sockaddrDst;
+    sockaddrDst.sin_family      = AF_INET;
+    sockaddrDst.sin_addr.s_addr = htonl(_uAddr);
+    sockaddrDst.sin_port        = htons(_uPort);
+
+    if ( sendto(_iSocket, pData, iSizeData, 0, (sockaddr*) &sockaddrDst,
+      sizeof(sockaddrDst)) == -1 )
+        return errno;
+
+    return 0;
+}
+
 int socketAPISlim::sendRawData(int iSizeData, const char* pData)
 {
     int iRetErrorCode = 0;
@@ -364,6 +531,322 @@ catch (string& sError)
     return iRetErrorCode;   
 }
 
+/**
+ * class socketAPIPublisher
+ */
+socketAPIPublisher::socketAPIPublisher(unsigned int uMaxDataSize, unsigned char ucTTL,
+  unsigned int uInterfaceIp, unsigned int uQueueDepth) :
+  _uMaxDataSize(uMaxDataSize), _ucTTL(ucTTL), _uInterfaceIp(uInterfaceIp),
+  _uQueueDepth(uQueueDepth), _iDebugLevel(0)
+{
+    pthread_mutex_init(&_mutex, NULL);
+}
+
+socketAPIPublisher::~socketAPIPublisher()
+{
+    for (unsigned int i = 0; i < _vDestinations.size(); i++)
+        delete _vDestinations[i];
+    pthread_mutex_destroy(&_mutex);
+}
+
+int socketAPIPublisher::addDestination(unsigned int uAddr, unsigned short uPort)
+{
+    Destination* pDest = new Destination(uAddr, uPort, _uMaxDataSize, _ucTTL,
+      _uInterfaceIp, _uQueueDepth);
+    pDest->_socket.setDebugLevel(_iDebugLevel);
+
+    if ( pDest->_socket.initError() )
+    {
+        printf( "[Error] socketAPIPublisher::addDestination() : socket setup failed\n" );
+        delete pDest;
+        return -1;
+    }
+
+    if ( pthread_create(&pDest->_thread, NULL, &Destination::sendThread, pDest) )
+    {
+        printf( "[Error] socketAPIPublisher::addDestination() : pthread_create failed\n" );
+        pDest->_thread = 0;
+        delete pDest;
+        return -1;
+    }
+
+    pthread_mutex_lock(&_mutex);
+    int iDestination = -1;
+    for (unsigned int i = 0; i < _vDestinations.size(); i++)
+        if (_vDestinations[i] == NULL)
+        {
+            iDestination = i;
+            break;
+        }
+    if (iDestination < 0)
+    {
+        iDestination = _vDestinations.size();
+        _vDestinations.push_back(NULL);
+    }
+    _vDestinations[iDestination] = pDest;
+    pthread_mutex_unlock(&_mutex);
+
+    if ( _iDebugLevel > 0 )
+        printf( "socketAPIPublisher: destination %d is %s:%u\n", iDestination,
+          socketAPISlim::addressToStr(uAddr).c_str(), uPort );
+
+    return iDestination;
+}
+
+int socketAPIPublisher::removeDestination(int iDestination)
+{
+    pthread_mutex_lock(&_mutex);
+    Destination* pDest = NULL;
+    if (iDestination >= 0 && iDestination < (int) _vDestinations.size())
+    {
+        pDest = _vDestinations[iDestination];
+        _vDestinations[iDestination] = NULL;
+    }
+    pthread_mutex_unlock(&_mutex);
+
+    if (pDest == NULL)
+        return -1;
+
+    delete pDest;
+    return 0;
+}
+
+int socketAPIPublisher::setPacing(int iDestination, unsigned int uBytesPerSec,
+  unsigned int uBurstBytes)
+{
+    int iRet = -1;
+    pthread_mutex_lock(&_mutex);
+    if (iDestination >= 0 && iDestination < (int) _vDestinations.size() &&
+        _vDestinations[iDestination] != NULL)
+    {
+        Destination* pDest = _vDestinations[iDestination];
+        if (uBytesPerSec && uBurstBytes < _uMaxDataSize)
+            uBurstBytes = _uMaxDataSize;  /// a packet must fit in the bucket
+        __atomic_store_n(&pDest->_uBurstBytes , uBurstBytes , __ATOMIC_RELEASE);
+        __atomic_store_n(&pDest->_uBytesPerSec, uBytesPerSec, __ATOMIC_RELEASE);
+        iRet = 0;
+    }
+    pthread_mutex_unlock(&_mutex);
+    return iRet;
+}
+
+int socketAPIPublisher::getCounters(int iDestination, socketAPIDestCounters* pCounters)
+{
+    int iRet = -1;
+    pthread_mutex_lock(&_mutex);
+    if (iDestination >= 0 && iDestination < (int) _vDestinations.size() &&
+        _vDestinations[iDestination] != NULL)
+    {
+        //  The send thread updates its counters without the mutex, so
+        //  every counter is read and written atomically
+        Destination* pDest = _vDestinations[iDestination];
+        const socketAPIDestCounters& c = pDest->_counters;
+        pCounters->uPackets       = __atomic_load_n(&c.uPackets      , __ATOMIC_RELAXED);
+        pCounters->uBytes         = __atomic_load_n(&c.uBytes        , __ATOMIC_RELAXED);
+        pCounters->uDropped       = __atomic_load_n(&c.uDropped      , __ATOMIC_RELAXED);
+        pCounters->uErrors        = __atomic_load_n(&c.uErrors       , __ATOMIC_RELAXED);
+        pCounters->uMaxQueueDepth = __atomic_load_n(&c.uMaxQueueDepth, __ATOMIC_RELAXED);
+        pCounters->uLatencySum    = __atomic_load_n(&c.uLatencySum   , __ATOMIC_RELAXED);
+        pCounters->uLatencyMax    = __atomic_load_n(&c.uLatencyMax   , __ATOMIC_RELAXED);
+        pCounters->uQueueDepth =
+          __atomic_load_n(&pDest->_uHead, __ATOMIC_ACQUIRE) -
+          __atomic_load_n(&pDest->_uTail, __ATOMIC_ACQUIRE);
+        iRet = 0;
+    }
+    pthread_mutex_unlock(&_mutex);
+    return iRet;
+}
+
+/**
+ * Queue the packet to every destination
+ *
+ * @return  0 if queued everywhere, otherwise the number of destinations that dropped it
+ */
+int socketAPIPublisher::sendRawData(int iSizeData, const char* pData)
+{
+    if (iSizeData < 0 || (unsigned int) iSizeData > _uMaxDataSize)
+    {
+        printf( "[Error] socketAPIPublisher::sendRawData() : size %d exceeds %u\n",
+          iSizeData, _uMaxDataSize );
+        return -1;
+    }
+
+    int iDropped = 0;
+    pthread_mutex_lock(&_mutex);
+    for (unsigned int i = 0; i < _vDestinations.size(); i++)
+        if (_vDestinations[i] != NULL && !_vDestinations[i]->push(iSizeData, pData))
+            iDropped++;
+    pthread_mutex_unlock(&_mutex);
+
+    return iDropped;
+}
+
+void socketAPIPublisher::setDebugLevel(int iDebugLevel)
+{
+    _iDebugLevel = iDebugLevel;
+}
+
+int socketAPIPublisher::getDebugLevel()
+{
+    return _iDebugLevel;
+}
+
+socketAPIPublisher::Destination::Destination(unsigned int uAddr, unsigned short uPort,
+  unsigned int uMaxDataSize, unsigned char ucTTL, unsigned int uInterfaceIp,
+  unsigned int uQueueDepth) :
+  _socket(uAddr, uPort, uMaxDataSize, ucTTL, uInterfaceIp),
+  _uMaxDataSize(uMaxDataSize), _uQueueDepth(uQueueDepth),
+  _vcSlots(uQueueDepth*uMaxDataSize), _viSizes(uQueueDepth), _vuQueued(uQueueDepth),
+  _uHead(0), _uTail(0), _bStop(false), _thread(0),
+  _uBytesPerSec(0), _uBurstBytes(0), _dTokens(0), _uRefill(0)
+{
+    sem_init(&_sem, 0, 0);
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    memset(&_counters, 0, sizeof(_counters));
+}
+
+socketAPIPublisher::Destination::~Destination()
+{
+    if (_thread)
+    {
+        pthread_mutex_lock(&_mutex);
+        __atomic_store_n(&_bStop, true, __ATOMIC_RELEASE);
+        pthread_cond_signal(&_cond);
+        pthread_mutex_unlock(&_mutex);
+        sem_post(&_sem);
+        pthread_join(_thread, NULL);
+    }
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_mutex);
+    sem_destroy(&_sem);
+}
+
+static unsigned long long monotonicNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool socketAPIPublisher::Destination::push(int iSizeData, const char* pData)
+{
+    unsigned int uHead = _uHead;
+    if (uHead - __atomic_load_n(&_uTail, __ATOMIC_ACQUIRE) >= _uQueueDepth)
+    {
+        __atomic_fetch_add(&_counters.uDropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    unsigned int uSlot = uHead % _uQueueDepth;
+    memcpy(&_vcSlots[uSlot*_uMaxDataSize], pData, iSizeData);
+    _viSizes[uSlot] = iSizeData;
+    _vuQueued[uSlot] = monotonicNs();
+    __atomic_store_n(&_uHead, uHead+1, __ATOMIC_RELEASE);
+    sem_post(&_sem);
+
+    unsigned int uDepth = uHead + 1 - __atomic_load_n(&_uTail, __ATOMIC_ACQUIRE);
+    if (uDepth > _counters.uMaxQueueDepth)
+        __atomic_store_n(&_counters.uMaxQueueDepth, uDepth, __ATOMIC_RELAXED);
+    return true;
+}
+
+/**
+ * Wait until the token bucket covers iSizeData bytes, and take them
+ *
+ * @return  false if the destination was stopped while waiting
+ */
+bool socketAPIPublisher::Destination::pace(int iSizeData)
+{
+    unsigned int uRate  = __atomic_load_n(&_uBytesPerSec, __ATOMIC_ACQUIRE);
+    unsigned int uBurst = __atomic_load_n(&_uBurstBytes , __ATOMIC_ACQUIRE);
+    unsigned long long uNow = monotonicNs();
+
+    if (uRate == 0)
+    {
+        _uRefill = 0;
+        return true;
+    }
+
+    if (_uRefill == 0)  /// pacing just enabled: start with a full bucket
+        _dTokens = uBurst;
+    else
+        _dTokens += double(uNow - _uRefill) * 1.e-9 * uRate;
+    if (_dTokens > uBurst)
+        _dTokens = uBurst;
+    _uRefill = uNow;
+
+    if (_dTokens < iSizeData)
+    {
+        unsigned long long uWake = uNow +
+          (unsigned long long) ((iSizeData - _dTokens) * 1.e9 / uRate);
+        timespec ts;
+        ts.tv_sec  = uWake / 1000000000ULL;
+        ts.tv_nsec = uWake % 1000000000ULL;
+        bool bStop;
+        pthread_mutex_lock(&_mutex);
+        while (!(bStop = __atomic_load_n(&_bStop, __ATOMIC_ACQUIRE)) &&
+               pthread_cond_timedwait(&_cond, &_mutex, &ts) != ETIMEDOUT)
+            ;
+        pthread_mutex_unlock(&_mutex);
+        if (bStop)
+            return false;
+        uNow = monotonicNs();
+        _dTokens += double(uNow - _uRefill) * 1.e-9 * uRate;
+        _uRefill = uNow;
+    }
+    _dTokens -= iSizeData;
+    return true;
+}
+
+void* socketAPIPublisher::Destination::sendThread(void* pArg)
+{
+    Destination& dest = *reinterpret_cast<Destination*>(pArg);
+
+    while (1)
+    {
+        sem_wait(&dest._sem);
+        if (__atomic_load_n(&dest._bStop, __ATOMIC_ACQUIRE))
+            break;
+
+        unsigned int uTail = dest._uTail;
+        if (uTail == __atomic_load_n(&dest._uHead, __ATOMIC_ACQUIRE))
+            continue;
+
+        unsigned int uSlot = uTail % dest._uQueueDepth;
+        int iSizeData = dest._viSizes[uSlot];
+        if (!dest.pace(iSizeData))
+            break;
+        int iError = dest._socket.sendQuiet(iSizeData, &dest._vcSlots[uSlot*dest._uMaxDataSize]);
+        unsigned long long uLatency = monotonicNs() - dest._vuQueued[uSlot];
+        __atomic_store_n(&dest._uTail, uTail+1, __ATOMIC_RELEASE);
+
+        socketAPIDestCounters& c = dest._counters;
+        __atomic_fetch_add(&c.uLatencySum, uLatency, __ATOMIC_RELAXED);
+        if (uLatency > c.uLatencyMax)
+            __atomic_store_n(&c.uLatencyMax, uLatency, __ATOMIC_RELAXED);
+
+        if (iError)
+        {
+            //  Report the first failure; the rest are only counted
+            if (__atomic_fetch_add(&c.uErrors, 1, __ATOMIC_RELAXED) == 0 ||
+                dest._socket.getDebugLevel() > 1)
+                printf( "[Error] socketAPIPublisher : send failed, errno = %d (%s)\n",
+                  iError, strerror(iError) );
+        }
+        else
+        {
+            __atomic_fetch_add(&c.uPackets, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&c.uBytes, (unsigned long long) iSizeData, __ATOMIC_RELAXED);
+        }
+    }
+    return 0;
+}
+
 /*
  * private static functions
  */
@@ -386,26 +869,30 @@ string socketAPISlim::addressToStr( unsigned int uAddr )
 extern "C"
 {
 
+static SocketAPISpace::socketAPISlim* toSlim(void* pVoidsocketAPI)
+{
+    if ( pVoidsocketAPI == NULL )
+        return NULL;
+
+    return dynamic_cast<SocketAPISpace::socketAPISlim*>(
+      reinterpret_cast<SocketAPISpace::socketAPIInterface*>(pVoidsocketAPI));
+}
 
 int socketAPISetPort(unsigned short uPort, void* pVoidsocketAPI)
 {
-    if ( pVoidsocketAPI == NULL )
+    SocketAPISpace::socketAPISlim* psocketAPI = toSlim(pVoidsocketAPI);
+    if ( psocketAPI == NULL )
         return -1;
 
-    SocketAPISpace::socketAPISlim* psocketAPI = 
-      reinterpret_cast<SocketAPISpace::socketAPISlim*>(pVoidsocketAPI);      
-
     return psocketAPI->setPort(uPort);  
 }
 
 int socketAPISetAddr(unsigned int uAddr, void* pVoidsocketAPI)
 {
-    if ( pVoidsocketAPI == NULL )
+    SocketAPISpace::socketAPISlim* psocketAPI = toSlim(pVoidsocketAPI);
+    if ( psocketAPI == NULL )
         return -1;
 
-    SocketAPISpace::socketAPISlim* psocketAPI = 
-      reinterpret_cast<SocketAPISpace::socketAPISlim*>(pVoidsocketAPI);      
-
     return psocketAPI->setAddr(uAddr);  
 }
 }
\ No newline at end of file
@@ -10,6 +10,21 @@
 #ifndef MULTICAST_BLD_LIB_H
 #define MULTICAST_BLD_LIB_H
 
+/**
+ * Per destination counters of a socketAPI publisher
+ */
+typedef struct
+{
+    unsigned long long uPackets;     /// packets sent
+    unsigned long long uBytes;       /// bytes sent
+    unsigned long long uDropped;     /// packets dropped on a full queue
+    unsigned long long uErrors;      /// failed sends
+    unsigned int       uQueueDepth;  /// packets waiting in the queue
+    unsigned int       uMaxQueueDepth;  /// largest queue depth seen
+    unsigned long long uLatencySum;  /// sum over sent packets of the time queued (ns)
+    unsigned long long uLatencyMax;  /// longest time queued (ns)
+} socketAPIDestCounters;
+
 namespace SocketAPISpace
 {   
 /**
@@ -45,6 +60,55 @@ private:
     socketAPIInterface& operator=(const socketAPIInterface&);
 };
 
+/**
+ * Abastract Interface of a Bld publisher to several destinations
+ *
+ * sendRawData() copies the packet into the queue of each destination and
+ * returns without waiting; each destination has its own send thread, so
+ * a slow or unreachable destination only fills (and drops from) its own
+ * queue.  sendRawData() is meant to be called from one thread.
+ */
+class socketAPIPublisherInterface : public socketAPIInterface
+{
+public:
+    /**
+     * Add a destination
+     *
+     * @param uAddr  IP address (multicast or unicast)
+     * @param uPort  UDP port
+     * @return  destination index, or -1 on failure
+     */
+    virtual int addDestination(unsigned int uAddr, unsigned short uPort) = 0;
+
+    /**
+     * Remove a destination; its queued packets are discarded
+     *
+     * @return  0 if successful
+     */
+    virtual int removeDestination(int iDestination) = 0;
+
+    /**
+     * Read the counters of a destination
+     *
+     * @return  0 if successful
+     */
+    virtual int getCounters(int iDestination, socketAPIDestCounters* pCounters) = 0;
+
+    /**
+     * Pace the sends to a destination with a token bucket
+     *
+     * @param uBytesPerSec  average rate; 0 disables pacing
+     * @param uBurstBytes   bytes that may be sent back-to-back
+     * @return  0 if successful
+     */
+    virtual int setPacing(int iDestination, unsigned int uBytesPerSec,
+      unsigned int uBurstBytes) = 0;
+
+    virtual ~socketAPIPublisherInterface() {}
+protected:
+    socketAPIPublisherInterface() {}
+};
+
 /**
  * Factory class of Bld Multicast Client 
  *
@@ -79,6 +143,19 @@ public:
     static socketAPIInterface* createsocketAPI(unsigned int uAddr, 
       unsigned short uPort, unsigned int uMaxDataSize, unsigned char ucTTL = 32, 
       unsigned int uInteraceIp = 0);
+
+    /**
+     * Create a Bld publisher with no destinations
+     *
+     * @param uMaxDataSize  Maximum Bld data size. Better to be less than MTU.
+     * @param ucTTL         TTL value in UDP packet. Ideal value is 1 + (# of middle routers)
+     * @param uInteraceIp   Specify the NIC by IP address (in unsigned int format)
+     * @param uQueueDepth   Packets queued per destination
+     * @return              The created Bld publisher object
+     */
+    static socketAPIPublisherInterface* createsocketAPIPublisher(
+      unsigned int uMaxDataSize, unsigned char ucTTL = 32,
+      unsigned int uInteraceIp = 0, unsigned int uQueueDepth = 1024);
 private:
     /// Disable object instantiation (No object semantics).
     socketAPIFactory();
@@ -132,6 +209,20 @@ int socketAPIRelease(void* pVoidsocketAPI);
  */
 int socketAPISendRawData(void* pVoidsocketAPI, int iSizeData, char* pData);
 
+/**
+ * Publisher functions: the publisher is released with socketAPIRelease()
+ * and sends with socketAPISendRawData()
+ */
+int socketAPIPublisherInit(unsigned int uMaxDataSize, unsigned char ucTTL,
+  unsigned int uInterfaceIp, unsigned int uQueueDepth, void** ppVoidsocketAPI);
+int socketAPIPublisherAddDestination(void* pVoidsocketAPI, unsigned int uAddr,
+  unsigned short uPort);
+int socketAPIPublisherRemoveDestination(void* pVoidsocketAPI, int iDestination);
+int socketAPIPublisherGetCounters(void* pVoidsocketAPI, int iDestination,
+  socketAPIDestCounters* pCounters);
+int socketAPIPublisherSetPacing(void* pVoidsocketAPI, int iDestination,
+  unsigned int uBytesPerSec, unsigned int uBurstBytes);
+
 } // extern "C"
 
 
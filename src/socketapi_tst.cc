@@ -0,0 +1,322 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Loopback test of the socketAPI publisher, pacer and BLD coalescer
+//
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <vector>
+
+#include <socketAPI.h>
+#include <BldStream.hh>
+
+using namespace SocketAPISpace;
+using namespace Bld;
+
+//  Records the size of each packet sent
+class CountOut : public socketAPIInterface {
+public:
+  int  sendRawData(int iSizeData, const char*) { sizes.push_back(iSizeData); return 0; }
+  void setDebugLevel(int) {}
+  int  getDebugLevel() { return 0; }
+  std::vector<int> sizes;
+};
+
+static void show_usage(const char* p)
+{
+  printf("Usage: %s [options]\n",p);
+  printf("Options: -n <packets>      : packets to publish (default 100000)\n");
+  printf("         -s <bytes>        : packet size (default 1024)\n");
+  printf("         -d <destinations> : loopback destinations (default 2)\n");
+  printf("         -S <usec>         : read delay of the last receiver (default 100)\n");
+  printf("         -q <packets>      : queue depth per destination (default 1024)\n");
+  printf("         -r <Hz>           : publishing rate (default 20000)\n");
+  printf("         -b <packets>      : publishing burst (default 64)\n");
+  printf("         -p <B/s>[,<bytes>]: pace each destination (rate, burst)\n");
+  printf("         -c <us>           : coalesce BLD events (-n events at -r Hz) with this deadline\n");
+  printf("         -P <port>         : first loopback port (default 12000)\n");
+}
+
+class Receiver {
+public:
+  int       fd;
+  unsigned  delay;
+  uint64_t  packets;
+  uint64_t  bytes;
+  timespec  first;
+  timespec  last;
+  uint64_t  window;      // start of the current 10 ms window (ns)
+  uint64_t  wbytes;      // bytes received in the window
+  uint64_t  peak;        // most bytes received in a window
+  bool      bld;         // decode BLD packets
+  uint64_t  events;
+};
+
+static void* receiver(void* arg)
+{
+  Receiver& r = *reinterpret_cast<Receiver*>(arg);
+  char buff[0x10000];
+  while(1) {
+    ssize_t ret = ::read(r.fd, buff, sizeof(buff));
+    if (ret <= 0)
+      break;
+    clock_gettime(CLOCK_MONOTONIC, r.packets ? &r.last : &r.first);
+    const timespec& ts = r.packets ? r.last : r.first;
+    uint64_t now = uint64_t(ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+    if (now - r.window > 10000000ULL) {
+      if (r.wbytes > r.peak)
+        r.peak = r.wbytes;
+      r.window = now;
+      r.wbytes = 0;
+    }
+    r.wbytes += ret;
+    r.packets++;
+    r.bytes += ret;
+    if (r.bld) {
+      BldEventIterator it(buff, ret);
+      if (it.valid())
+        do { r.events++; } while(it.next());
+    }
+    if (r.delay)
+      usleep(r.delay);
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  unsigned npackets = 100000;
+  unsigned size     = 1024;
+  unsigned ndest    = 2;
+  unsigned delay    = 100;
+  unsigned depth    = 1024;
+  unsigned rate     = 20000;
+  unsigned burst    = 64;
+  unsigned pace     = 0;
+  unsigned paceBurst = 0;
+  int      deadline  = -1;
+  unsigned short port = 12000;
+
+  int c;
+  while( (c=getopt(argc,argv,"n:s:d:S:q:r:b:p:c:P:h"))!=-1 ) {
+    switch(c) {
+    case 'n': npackets = strtoul(optarg,NULL,0); break;
+    case 's': size     = strtoul(optarg,NULL,0); break;
+    case 'd': ndest    = strtoul(optarg,NULL,0); break;
+    case 'S': delay    = strtoul(optarg,NULL,0); break;
+    case 'q': depth    = strtoul(optarg,NULL,0); break;
+    case 'r': rate     = strtoul(optarg,NULL,0); break;
+    case 'b': burst    = strtoul(optarg,NULL,0); break;
+    case 'p':
+      pace = strtoul(strtok(optarg,","),NULL,0);
+      { const char* b = strtok(NULL,",");
+        if (b) paceBurst = strtoul(b,NULL,0); }
+      break;
+    case 'c': deadline = strtoul(optarg,NULL,0); break;
+    case 'P': port     = strtoul(optarg,NULL,0); break;
+    default:
+      show_usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  std::vector<Receiver>  rcv(ndest);
+  std::vector<pthread_t> thr(ndest);
+  for(unsigned i=0; i<ndest; i++) {
+    Receiver& r = rcv[i];
+    memset(&r, 0, sizeof(r));
+    r.delay = (i==ndest-1) ? delay : 0;
+    r.bld   = deadline >= 0;
+    r.fd    = ::socket(AF_INET, SOCK_DGRAM, 0);
+
+    int rcvbuf = 4*1024*1024;
+    setsockopt(r.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    timeval tmo;
+    tmo.tv_sec  = 1;
+    tmo.tv_usec = 0;
+    setsockopt(r.fd, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+
+    sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family      = AF_INET;
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    saddr.sin_port        = htons(port+i);
+    if (bind(r.fd, (sockaddr*)&saddr, sizeof(saddr)) < 0) {
+      perror("Error binding receive socket");
+      return -1;
+    }
+    pthread_create(&thr[i], NULL, &receiver, &r);
+  }
+
+  socketAPIPublisherInterface* pub =
+    socketAPIFactory::createsocketAPIPublisher(size, 1, 0, depth);
+  for(unsigned i=0; i<ndest; i++) {
+    int d = pub->addDestination(INADDR_LOOPBACK, port+i);
+    if (pace)
+      pub->setPacing(d, pace, paceBurst);
+  }
+
+  std::vector<char> buff(size);
+  timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC,&begin);
+  unsigned dropped = 0;
+
+  bool coalesce = deadline >= 0;
+  if (coalesce) {
+    //  Events of 4 channels at about 1 MHz in pulse ID and timestamp
+    BldCoalescer* coalescer = new BldCoalescer(*pub, size, deadline);
+    coalescer->startTimer();
+    BldEvent ev;
+    ev.timeStamp = 1ULL<<32;
+    ev.pulseId   = 0x1000000;
+    ev.mask      = 0xf;
+    ev.beam      = 0;
+    ev.channels.resize(4);
+    ev.valid     = 0xf;
+    for(unsigned i=0; i<npackets; i++) {
+      ev.channels[0] = i;
+      coalescer->add(ev);
+      ev.pulseId   += 1;
+      ev.timeStamp += 1077;
+      if ((i%burst)==burst-1) {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC,&now);
+        double ahead = double(i+1)/double(rate) -
+          (double(now.tv_sec-begin.tv_sec) + 1.e-9*(double(now.tv_nsec)-double(begin.tv_nsec)));
+        if (ahead > 0)
+          usleep(unsigned(1.e6*ahead));
+      }
+    }
+    coalescer->flush();
+    printf("coalescer: events %llu  packets %llu  (full %llu  break %llu  deadline %llu)\n",
+           (unsigned long long)coalescer->events(),
+           (unsigned long long)coalescer->packets(),
+           (unsigned long long)coalescer->flushFull(),
+           (unsigned long long)coalescer->flushBreak(),
+           (unsigned long long)coalescer->flushDeadline());
+    delete coalescer;
+  }
+
+  for(unsigned i=0; !coalesce && i<npackets; i++) {
+    memcpy(&buff[0], &i, sizeof(i));
+    if (pub->sendRawData(size, &buff[0]))
+      dropped++;
+    //  Publish in bursts at the average rate
+    if ((i%burst)==burst-1) {
+      timespec now;
+      clock_gettime(CLOCK_MONOTONIC,&now);
+      double ahead = double(i+1)/double(rate) -
+        (double(now.tv_sec-begin.tv_sec) + 1.e-9*(double(now.tv_nsec)-double(begin.tv_nsec)));
+      if (ahead > 0)
+        usleep(unsigned(1.e6*ahead));
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  double dt = double(end.tv_sec-begin.tv_sec) +
+    1.e-9*(double(end.tv_nsec)-double(begin.tv_nsec));
+
+  if (coalesce)
+    printf("coalesced %u events in %f sec\n", npackets, dt);
+  else
+    printf("published %u packets of %u bytes in %f sec, %u dropped somewhere\n",
+           npackets, size, dt, dropped);
+
+  //  Let the queues drain before reading the counters
+  for(unsigned i=0; i<ndest; i++) {
+    socketAPIDestCounters cnt;
+    do {
+      usleep(10000);
+      pub->getCounters(i, &cnt);
+    } while(cnt.uQueueDepth);
+  }
+
+  for(unsigned i=0; i<ndest; i++) {
+    socketAPIDestCounters cnt;
+    pub->getCounters(i, &cnt);
+    unsigned long long nsent = cnt.uPackets+cnt.uErrors;
+    printf("destination %u: sent %llu  bytes %llu  dropped %llu  errors %llu  max depth %u  latency mean %f max %f ms\n",
+           i, cnt.uPackets, cnt.uBytes, cnt.uDropped, cnt.uErrors, cnt.uMaxQueueDepth,
+           nsent ? 1.e-6*double(cnt.uLatencySum)/double(nsent) : 0.,
+           1.e-6*double(cnt.uLatencyMax));
+  }
+
+  delete pub;
+
+  for(unsigned i=0; i<ndest; i++) {
+    pthread_join(thr[i], NULL);
+    Receiver& r = rcv[i];
+    double rdt = double(r.last.tv_sec-r.first.tv_sec) +
+      1.e-9*(double(r.last.tv_nsec)-double(r.first.tv_nsec));
+    printf("receiver %u: %llu packets  %llu bytes  %f kHz  %f MB/s  (peak %f MB/s over 10 ms)\n",
+           i, (unsigned long long)r.packets, (unsigned long long)r.bytes,
+           rdt > 0 ? 1.e-3*double(r.packets)/rdt : 0.,
+           rdt > 0 ? 1.e-6*double(r.bytes)/rdt : 0.,
+           1.e-4*double(r.peak));
+    if (r.bld)
+      printf("receiver %u: %llu events, %f events/packet\n",
+             i, (unsigned long long)r.events,
+             r.packets ? double(r.events)/double(r.packets) : 0.);
+  }
+
+  //  A destination waiting out its pacing must be removed promptly, and
+  //  the slim-socket setters must refuse a publisher handle
+  int failures = 0;
+  {
+    socketAPIPublisherInterface* p =
+      socketAPIFactory::createsocketAPIPublisher(size, 1, 0, depth);
+    int d = p->addDestination(INADDR_LOOPBACK, port+ndest);
+    p->setPacing(d, 1, size);  // the second packet waits ~size seconds
+    p->sendRawData(size, &buff[0]);
+    p->sendRawData(size, &buff[0]);
+    usleep(100000);
+    clock_gettime(CLOCK_MONOTONIC,&begin);
+    p->removeDestination(d);
+    clock_gettime(CLOCK_MONOTONIC,&end);
+    double rdt = double(end.tv_sec-begin.tv_sec)+1.e-9*(double(end.tv_nsec)-double(begin.tv_nsec));
+    printf("removed a paced destination in %f sec: %s\n", rdt, rdt < 1 ? "passed" : "FAILED");
+    if (rdt >= 1) failures++;
+
+    void* h = static_cast<socketAPIInterface*>(p);
+    bool refused = socketAPISetPort(port, h) < 0 && socketAPISetAddr(INADDR_LOOPBACK, h) < 0;
+    printf("setters refuse a publisher handle: %s\n", refused ? "passed" : "FAILED");
+    if (!refused) failures++;
+    delete p;
+  }
+
+  //  A packet just large enough for one event: 6 header words, the
+  //  channels and the valid mask
+  {
+    CountOut out;
+    BldCoalescer* coalescer = new BldCoalescer(out, (7+4)*sizeof(uint32_t), 1000000);
+    BldEvent ev;
+    ev.timeStamp = 1;
+    ev.pulseId   = 1;
+    ev.mask      = 0xf;
+    ev.beam      = 0;
+    ev.channels.resize(4);
+    ev.valid     = 0xf;
+    coalescer->add(ev);
+    delete coalescer;
+    bool fits = out.sizes.size()==1 && out.sizes[0]==int((7+4)*sizeof(uint32_t));
+    printf("coalescer sends an event that fills the packet: %s\n", fits ? "passed" : "FAILED");
+    if (!fits) failures++;
+  }
+
+  return failures ? 1 : 0;
+}
@@ -23,10 +23,16 @@
 #include <cpsw_yaml_keydefs.h>
 #include <cpsw_yaml.h>
 
+#include <TprStream.hh>
+#include <EventCodeRates.hh>
+
 void usage(const char* p) {
   printf("Usage: %s [options]\n",p);
   printf("Options: -a <ip address, dotted notation>\n");
   printf("         -y <yaml file>[,<path to timing>]\n");
+  printf("         -p <pulse ID max> (default 0x1ffdf)\n");
+  printf("         -r <file>[,<packets>] (record packets to file)\n");
+  printf("         -c (print event code rates)\n");
 }
 
 namespace Tpr {
@@ -40,21 +46,6 @@ namespace Tpr {
   private:
     const char* _ip;
   };
-
-  class TprEvent {
-  public:
-    uint32_t  pulseId;
-    uint32_t  eventCodes[8];
-    uint16_t  dtype;
-    uint16_t  version;
-    uint32_t  dmod[6];
-    uint64_t  epicsTime;
-    uint32_t  edefAvgDn;
-    uint32_t  edefMinor;
-    uint32_t  edefMajor;
-    uint32_t  edefInit;
-  };
-
 };
 
 using namespace Tpr;
@@ -62,6 +53,8 @@ using namespace Tpr;
 static int      count = 0;
 static int64_t  bytes = 0;
 static Path     core;
+static TprStreamDecoder* decoder = 0;
+static EventCodeRates*   rates   = 0;
 
 static void sigHandler( int signal ) 
 {
@@ -82,6 +75,7 @@ void* countThread(void* args)
   clock_gettime(CLOCK_REALTIME,&tv);
   unsigned ocount = count;
   int64_t  obytes = bytes;
+  std::vector<uint64_t> ocodes(NUM_EVENT_CODES,0);
   while(1) {
     send(fd, &fd, sizeof(fd), 0);
     usleep(1000000);
@@ -126,10 +120,40 @@ void* countThread(void* args)
       tbytes *= 1.e-3;
     }
     
-    printf("Packets %7.2f %cHz [%u]:  Size %7.2f %cBps [%lld B] (%7.2f %cB/evt)\n",
+    printf("Packets %7.2f %cHz [%u]:  Size %7.2f %cBps [%lld B] (%7.2f %cB/evt):  Events [%llu]  gaps %llu  missed %llu  order %llu  resync %llu\n",
            rate  , scchar[rsc ], ncount, 
            dbytes, scchar[dbsc], (long long)nbytes, 
-           tbytes, scchar[tbsc] );
+           tbytes, scchar[tbsc],
+           (unsigned long long)decoder->nevents(),
+           (unsigned long long)decoder->gaps(),
+           (unsigned long long)decoder->missed(),
+           (unsigned long long)decoder->outOfOrder(),
+           (unsigned long long)decoder->resyncs());
+
+    if (rates) {
+      //  Totals lag by up to 255 events
+      const uint64_t* ncodes = rates->counts();
+      unsigned n = 0;
+      for(unsigned i=0; i<NUM_EVENT_CODES; i++) {
+        uint64_t ncode = ncodes[i];
+        if (ncode != ocodes[i]) {
+          double crate = double(ncode-ocodes[i])/dt;
+          unsigned csc = 0;
+          if (crate > 1.e6) {
+            csc    = 2;
+            crate *= 1.e-6;
+          }
+          else if (crate > 1.e3) {
+            csc    = 1;
+            crate *= 1.e-3;
+          }
+          printf("  [%3u] %7.2f %cHz%c", i, crate, scchar[csc], (++n%6)==0 ? '\n':' ');
+          ocodes[i] = ncode;
+        }
+      }
+      if (n%6)
+        printf("\n");
+    }
 
     ocount = ncount;
     obytes = nbytes;
@@ -149,8 +173,11 @@ int main(int argc, char* argv[])
   unsigned mask = 1;
   unsigned psize(0x3c0);
   const char* endptr;
+  uint32_t pidMax = LCLS1_PID_MAX;
+  const char* record = 0;
+  unsigned nrecord = 100000;
 
-  while ( (c=getopt( argc, argv, "a:y:")) != EOF ) {
+  while ( (c=getopt( argc, argv, "a:y:p:r:c")) != EOF ) {
     switch(c) {
     case 'a':
       ip = optarg;
@@ -163,6 +190,17 @@ int main(int argc, char* argv[])
       else
         yaml_file = optarg;
       break;
+    case 'p':
+      pidMax = strtoul(optarg,NULL,0);
+      break;
+    case 'r':
+      record = strtok(optarg,",");
+      { const char* n = strtok(NULL,",");
+        if (n) nrecord = strtoul(n,NULL,0); }
+      break;
+    case 'c':
+      rates = new EventCodeRates;
+      break;
     default:
       usage(argv[0]);
       return 0;
@@ -185,6 +223,15 @@ int main(int argc, char* argv[])
   ::signal( SIGKILL , sigHandler );
   ::signal( SIGSEGV , sigHandler );
 
+  decoder = new TprStreamDecoder(pidMax);
+
+  //  Recorded packets are stored as a 32-bit length followed by the datagram
+  FILE* fout = 0;
+  if (record && !(fout = fopen(record,"w"))) {
+    perror("Opening record file");
+    return -1;
+  }
+
   int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
   if (fd < 0) {
     perror("Open socket");
@@ -231,18 +278,29 @@ int main(int argc, char* argv[])
   const unsigned buffsize=8*1024;
   char* buff = new char[buffsize];
 
-  uint32_t dpid = 0, opid=0;
   do {
     ssize_t ret = read(fd,buff,buffsize);
     if (ret < 0) break;
     count++;
     bytes += ret;
-    const TprEvent& ev = *reinterpret_cast<const TprEvent*>(buff);
-    const uint32_t PID_MAX = 0x1ffdf;
-    if ((opid < PID_MAX && ev.pulseId != (opid+1)) ||
-        (opid== PID_MAX && ev.pulseId != 0))
-      printf("Pulse ID jump: %x -> %x\n", opid, ev.pulseId);
-    opid = ev.pulseId;
+    if (fout) {
+      uint32_t len = ret;
+      fwrite(&len, sizeof(len), 1, fout);
+      fwrite(buff, ret, 1, fout);
+      if (--nrecord == 0) {
+        fclose(fout);
+        fout = 0;
+        printf("Recording complete\n");
+      }
+    }
+    uint32_t opid  = decoder->lastPulseId();
+    uint64_t njump = decoder->gaps()+decoder->outOfOrder()+decoder->resyncs();
+    decoder->process(buff,ret);
+    if (rates)
+      rates->process(buff,ret);
+    if (decoder->gaps()+decoder->outOfOrder()+decoder->resyncs() != njump)
+      printf("Pulse ID jump: %x -> %x\n", opid, reinterpret_cast<const TprEvent*>(buff)->pulseId);
+    decoder->clear();
   } while(1);
 
   pthread_join(thr,NULL);
@@ -0,0 +1,211 @@
+//////////////////////////////////////////////////////////////////////////////
+// This file is part of 'timing_bsa'.
+// It is subject to the license terms in the LICENSE.txt file found in the 
+// top-level directory of this distribution and at: 
+//    https://confluence.slac.stanford.edu/display/ppareg/LICENSE.html. 
+// No part of 'timing_bsa', including this file, 
+// may be copied, modified, propagated, or distributed except according to 
+// the terms contained in the LICENSE.txt file.
+//////////////////////////////////////////////////////////////////////////////
+//
+//  Benchmark of the timing stream decoder and event code rates over recorded packets
+//  (as written by tpr_stream -r: a 32-bit length followed by each datagram)
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include <TprStream.hh>
+#include <EventCodeRates.hh>
+
+using namespace Tpr;
+
+static const double TIMING_RATE = 929.e3;
+
+static void show_usage(const char* p)
+{
+  printf("Usage: %s [options]\n",p);
+  printf("Options: -f <file>    : recorded packets (default generates one second at 929 kHz)\n");
+  printf("         -w <file>    : write the generated packets as a recording\n");
+  printf("         -e <events>  : events per generated datagram (default 1)\n");
+  printf("         -n <passes>  : passes over the recording (default 10)\n");
+  printf("         -p <pid max> : pulse ID wrap (default 0x1ffdf)\n");
+}
+
+//
+//  One second of 929 kHz timing with fixed rate codes 1..6 at 929kHz/10^k
+//  and an occasional dropped pulse
+//
+static void generate(std::vector<char>& rec, unsigned nperdg, uint32_t pidMax)
+{
+  unsigned nevents = unsigned(TIMING_RATE);
+  std::vector<TprEvent> dg;
+  uint32_t pid = 0;
+  for(unsigned i=0; i<nevents; i++) {
+    TprEvent ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.pulseId = pid;
+    ev.eventCodes[0] = 1;
+    for(unsigned k=1, div=1; k<7; k++, div*=10)
+      if ((i%div)==0)
+        ev.eventCodes[0] |= (1<<k);
+    ev.eventCodes[i%8] |= (1<<(i%32));
+    dg.push_back(ev);
+    if (dg.size()==nperdg || i==nevents-1) {
+      uint32_t len = dg.size()*sizeof(TprEvent);
+      rec.insert(rec.end(), (char*)&len, (char*)&len+sizeof(len));
+      rec.insert(rec.end(), (char*)&dg[0], (char*)&dg[0]+len);
+      dg.clear();
+    }
+    pid = (pid==pidMax) ? 0 : pid+1;
+    if ((i%100000)==99999)
+      pid = (pid==pidMax) ? 0 : pid+1;
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  const char* fin    = 0;
+  const char* fout   = 0;
+  unsigned    nperdg = 1;
+  unsigned    passes = 10;
+  uint32_t    pidMax = LCLS1_PID_MAX;
+
+  int c;
+  while( (c=getopt(argc,argv,"f:w:e:n:p:h"))!=-1 ) {
+    switch(c) {
+    case 'f': fin    = optarg; break;
+    case 'w': fout   = optarg; break;
+    case 'e': nperdg = strtoul(optarg,NULL,0); break;
+    case 'n': passes = strtoul(optarg,NULL,0); break;
+    case 'p': pidMax = strtoul(optarg,NULL,0); break;
+    default:
+      show_usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  std::vector<char> rec;
+  if (fin) {
+    FILE* f = fopen(fin,"r");
+    if (!f) {
+      perror("Opening recording");
+      return -1;
+    }
+    char buff[8*1024];
+    size_t n;
+    while((n = fread(buff,1,sizeof(buff),f)) > 0)
+      rec.insert(rec.end(), buff, buff+n);
+    fclose(f);
+  }
+  else {
+    generate(rec, nperdg ? nperdg : 1, pidMax);
+    if (fout) {
+      FILE* f = fopen(fout,"w");
+      if (!f) {
+        perror("Opening output");
+        return -1;
+      }
+      fwrite(&rec[0], rec.size(), 1, f);
+      fclose(f);
+    }
+  }
+
+  //  Index the datagrams
+  std::vector<size_t> offset;
+  for(size_t o=0; o+sizeof(uint32_t)<=rec.size(); ) {
+    uint32_t len;
+    memcpy(&len, &rec[o], sizeof(len));
+    if (o+sizeof(len)+len > rec.size())
+      break;
+    offset.push_back(o);
+    o += sizeof(len)+len;
+  }
+
+  TprStreamDecoder decoder(pidMax);
+  uint64_t listed = 0;
+
+  timespec begin;
+  clock_gettime(CLOCK_MONOTONIC,&begin);
+
+  for(unsigned p=0; p<passes; p++) {
+    for(unsigned i=0; i<offset.size(); i++) {
+      uint32_t len;
+      memcpy(&len, &rec[offset[i]], sizeof(len));
+      decoder.process(&rec[offset[i]+sizeof(len)], len);
+      //  Consume the lists in batches as a client would
+      if ((i&0xff)==0xff) {
+        listed += decoder.pulseIds(1).size();
+        decoder.clear();
+      }
+    }
+  }
+
+  timespec end;
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  double dt = double(end.tv_sec-begin.tv_sec) +
+    1.e-9*(double(end.tv_nsec)-double(begin.tv_nsec));
+
+  double erate = double(decoder.nevents())/dt;
+  printf("%u datagrams x %u passes in %f sec\n", unsigned(offset.size()), passes, dt);
+  printf("%f Mevents/s  (%f x the 929 kHz timing rate)\n", 1.e-6*erate, erate/TIMING_RATE);
+  printf("events %llu  gaps %llu  missed %llu  order %llu  resyncs %llu  errors %llu  [%llu]\n",
+         (unsigned long long)decoder.nevents(),
+         (unsigned long long)decoder.gaps(),
+         (unsigned long long)decoder.missed(),
+         (unsigned long long)decoder.outOfOrder(),
+         (unsigned long long)decoder.resyncs(),
+         (unsigned long long)decoder.errors(),
+         (unsigned long long)listed);
+
+  //
+  //  Event code counts, bit-sliced against a loop over each event's codes
+  //
+  EventCodeRates rates;
+  std::vector<uint64_t> naive(NUM_EVENT_CODES,0);
+
+  clock_gettime(CLOCK_MONOTONIC,&begin);
+  for(unsigned p=0; p<passes; p++) {
+    for(unsigned i=0; i<offset.size(); i++) {
+      uint32_t len;
+      memcpy(&len, &rec[offset[i]], sizeof(len));
+      rates.process(&rec[offset[i]+sizeof(len)], len);
+    }
+  }
+  rates.flush();
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  double dtr = double(end.tv_sec-begin.tv_sec) +
+    1.e-9*(double(end.tv_nsec)-double(begin.tv_nsec));
+
+  clock_gettime(CLOCK_MONOTONIC,&begin);
+  for(unsigned p=0; p<passes; p++) {
+    for(unsigned i=0; i<offset.size(); i++) {
+      uint32_t len;
+      memcpy(&len, &rec[offset[i]], sizeof(len));
+      const TprEvent* ev = reinterpret_cast<const TprEvent*>(&rec[offset[i]+sizeof(len)]);
+      for(unsigned j=0; j<len/sizeof(TprEvent); j++)
+        for(unsigned c=0; c<NUM_EVENT_CODES; c++)
+          if (ev[j].eventCodes[c>>5] & (1<<(c&0x1f)))
+            naive[c]++;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC,&end);
+  double dtn = double(end.tv_sec-begin.tv_sec) +
+    1.e-9*(double(end.tv_nsec)-double(begin.tv_nsec));
+
+  unsigned nerr = 0;
+  for(unsigned c=0; c<NUM_EVENT_CODES; c++)
+    if (rates.counts()[c] != naive[c])
+      nerr++;
+
+  printf("event code rates: %f Mevents/s (%f x 929 kHz);  bit loop %f Mevents/s;  %u mismatched codes\n",
+         1.e-6*double(rates.events())/dtr, double(rates.events())/dtr/TIMING_RATE,
+         1.e-6*double(rates.events())/dtn, nerr);
+
+  return 0;
+}